@@ -0,0 +1,113 @@
+#pragma once
+
+#include <Arduino.h>
+#include <WiFi.h>
+#include <AudioFileSource.h>
+#include "StreamTls.h"
+
+// ----------------------------------------------------------------------------------------------------
+// ------------------------------------ HTTP/ICY stream source ----------------------------------------
+// ----------------------------------------------------------------------------------------------------
+//
+// Replaces AudioFileSourceICYStream for radio streams. Talks HTTP/1.1 over a plain socket, or over
+// TLS (StreamTls) for https:// URLs:
+//
+//  - follows 301/302/303/307/308 redirects, up to STREAM_MAX_REDIRECTS
+//  - decodes chunked transfer encoding
+//  - strips ICY metadata (icy-metaint) and reports StreamTitle through the metadata callback
+//  - reads straight from the socket into the caller's buffer (the AudioFileSourceBuffer ring), with
+//    no staging buffer in between - chunk headers and metadata are read around the audio, not
+//    copied out of it
+//  - connect and read timeouts can be set per stream
+//
+// lwIP ignores SO_RCVBUF on TCP sockets and the TCP window is fixed when the framework is built
+// (CONFIG_LWIP_TCP_WND_DEFAULT), so the receive side is tuned by draining the socket in large reads
+// rather than by socket options. The window in use is reported by the stream bench.
+//
+// ----------------------------------------------------------------------------------------------------
+
+#define STREAM_MAX_REDIRECTS 5
+#define STREAM_CONNECT_TIMEOUT_MS 5000
+#define STREAM_READ_TIMEOUT_MS 3000      // a blocking read gives up after this long without data
+#define STREAM_HEADER_LINE_MAX 512       // longer header lines are truncated
+#define STREAM_USER_AGENT "INR-ESP32"
+
+class AudioFileSourceRadioStream : public AudioFileSource {
+  public:
+    AudioFileSourceRadioStream();
+    virtual ~AudioFileSourceRadioStream() override;
+
+    // Call before open()
+    void setTimeouts(uint32_t connectMs, uint32_t readMs);
+    // Address for the URL's host, e.g. from the station resolver - skips the DNS lookup
+    void setAddress(const IPAddress &ip) { _address = ip; }
+
+    virtual bool open(const char *url) override;
+    virtual uint32_t read(void *data, uint32_t len) override;
+    virtual uint32_t readNonBlock(void *data, uint32_t len) override;
+    virtual bool seek(int32_t pos, int dir) override { (void)pos; (void)dir; return false; }
+    virtual bool close() override;
+    virtual bool isOpen() override { return _open; }
+    virtual uint32_t getSize() override { return _contentLength; }
+    virtual uint32_t getPos() override { return _pos; }
+
+    // What open() ended up talking to
+    const String &getFinalUrl() { return _finalUrl; }
+    uint8_t getRedirects() { return _redirects; }
+    bool isChunked() { return _chunked; }
+    uint32_t getMetaInt() { return _metaInt; }
+    uint32_t getConnectMs() { return _connectMs; }
+    int getStatus() { return _status; }           // of the last response, -1 if there wasn't one
+    const String &getContentType() { return _contentType; }
+    const String &getIcyName() { return _icyName; }
+    uint16_t getIcyBitrate() { return _icyBitrate; }   // icy-br, 0 if not sent
+    bool isSecure() { return _secure; }
+    StreamTls &getTls() { return _tls; }
+
+    // Compile-time TCP receive window of this build, in bytes
+    static uint32_t tcpWindow();
+
+    // A redirect's Location as a full URL, taken against the URL that sent it
+    static String resolveLocation(const String &current, const String &location);
+
+  private:
+    WiFiClient _client;
+    StreamTls _tls;
+    bool _secure = false;
+    IPAddress _address;
+    uint32_t _connectTimeoutMs = STREAM_CONNECT_TIMEOUT_MS;
+    uint32_t _readTimeoutMs = STREAM_READ_TIMEOUT_MS;
+
+    bool _open = false;
+    String _finalUrl;
+    uint8_t _redirects = 0;
+    uint32_t _connectMs = 0;
+    int _status = -1;
+    String _contentType;
+    String _icyName;
+    uint16_t _icyBitrate = 0;
+    uint32_t _contentLength = 0;          // 0 if not given - the usual case for a stream
+    uint32_t _pos = 0;                    // audio bytes delivered
+
+    bool _chunked = false;
+    uint32_t _chunkLeft = 0;              // body bytes left in the current chunk
+    bool _chunkCrlfPending = false;       // the CRLF after a chunk's data hasn't been read yet
+
+    uint32_t _metaInt = 0;                // audio bytes between metadata blocks, 0 for none
+    uint32_t _untilMeta = 0;
+
+    int connect(const String &url, String &location);
+    bool sendRequest(const String &host, uint16_t port, const String &path);
+    static String origin(bool secure, const String &host, uint16_t port);
+    int readHeaders(String &location);
+    bool readLine(String &line);
+
+    uint32_t readAudio(uint8_t *dst, uint32_t len, bool block);
+    uint32_t readBody(uint8_t *dst, uint32_t len, bool block);
+    bool readBodyFully(uint8_t *dst, uint32_t len);
+    bool readChunkHeader();
+    bool readMetadata();
+    int readSocket(uint8_t *dst, uint32_t len, bool block);
+    bool dataWaiting();
+    void fail(const char *why);
+};
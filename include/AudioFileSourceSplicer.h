@@ -0,0 +1,75 @@
+#pragma once
+
+#include <Arduino.h>
+#include <AudioFileSource.h>
+
+// ----------------------------------------------------------------------------------------------------
+// ------------------------------------- Seamless stream splicer --------------------------------------
+// ----------------------------------------------------------------------------------------------------
+//
+// Sits between the stream and the AudioFileSourceBuffer and lets the stream underneath be replaced
+// while playing, e.g. by another bitrate of the same station. It follows the MP3 frame headers going
+// through, so a replacement handed over with splice() takes over exactly at the end of a frame of the
+// old stream, and the new stream is read from its first frame header. The decoder sees one unbroken
+// run of whole frames; the switch is heard when playback reaches that point in the buffer.
+//
+// The first frame or two after the seam can refer to bit reservoir bytes from frames we never got,
+// which libmad reports as a recoverable error and plays as a frame of silence (26ms) at most.
+//
+// ----------------------------------------------------------------------------------------------------
+
+#define SPLICE_SYNC_LIMIT 8192            // bytes of the new stream to search for a frame header
+
+class AudioFileSourceSplicer : public AudioFileSource {
+  public:
+    // Takes ownership of source
+    explicit AudioFileSourceSplicer(AudioFileSource *source);
+    virtual ~AudioFileSourceSplicer() override;
+
+    virtual uint32_t read(void *data, uint32_t len) override;
+    virtual uint32_t readNonBlock(void *data, uint32_t len) override;
+    virtual bool seek(int32_t pos, int dir) override { (void)pos; (void)dir; return false; }
+    virtual bool close() override;
+    virtual bool isOpen() override;
+    virtual uint32_t getSize() override { return 0; }
+    virtual uint32_t getPos() override { return _pos; }
+    virtual bool loop() override;
+
+    // Hand over an opened source (taking ownership) to replace the current one at its next frame
+    // boundary. False if one is already waiting. Safe from any task.
+    bool splice(AudioFileSource *next);
+    bool isSplicePending() { return _next != nullptr; }
+    uint32_t getSplices() { return _splices; }
+    // Bitrate of the last frame header read, 0 until there is one
+    uint16_t getKbps() { return _kbps; }
+
+    // Length in bytes of the MPEG layer III frame with this header, 0 if it isn't one
+    static uint32_t frameLength(uint32_t header, uint16_t *kbps = nullptr);
+
+  private:
+    AudioFileSource *_current;
+    AudioFileSource *volatile _next = nullptr;
+    portMUX_TYPE _mux = portMUX_INITIALIZER_UNLOCKED;
+    uint32_t _pos = 0;
+    volatile uint32_t _splices = 0;
+    volatile uint16_t _kbps = 0;
+
+    // Frame tracking of the bytes going through
+    uint32_t _frameLeft = 0;              // bytes left in the current frame
+    uint32_t _header = 0;                 // last bytes seen while looking for a header
+    uint8_t _headerHave = 0;
+    bool _synced = false;
+
+    // Searching the start of a new stream for its first header
+    bool _seeking = false;
+    uint32_t _seekScanned = 0;
+    uint8_t _carry[3];
+    uint8_t _carryLen = 0;
+
+    uint32_t readFrom(void *data, uint32_t len, bool block);
+    uint32_t seekFrame(uint8_t *data, uint32_t len, bool block);
+    bool atFrameBoundary() { return _synced && _frameLeft == 0 && _headerHave == 0; }
+    uint32_t spliceLimit(uint32_t len);
+    void takeNext();
+    void track(const uint8_t *data, uint32_t len);
+};
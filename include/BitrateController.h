@@ -0,0 +1,124 @@
+#pragma once
+
+#include <Arduino.h>
+#include "StorageTypes.h"
+#include "JsonStreamWriter.h"
+
+// ----------------------------------------------------------------------------------------------------
+// ------------------------------------ Adaptive bitrate controller -----------------------------------
+// ----------------------------------------------------------------------------------------------------
+//
+// Picks which quality tier of a station to play. Once a second it is given the stream buffer's fill,
+// the bytes that came in and the decoder's consumption rate, and keeps:
+//
+//  - the buffer trend: how many ms of audio the buffer gains or loses per second, smoothed
+//  - a link capacity estimate: the intake rate while the buffer had room, which is the only time
+//    the intake isn't just following the decoder, smoothed and only taken once settled
+//
+// It steps down a tier when the buffer is falling and would run dry within ABR_HORIZON_S, or is
+// below ABR_LOW_WATER_MS and falling, for ABR_DOWN_SAMPLES seconds in a row - before the underrun,
+// not after it. An underrun or a failed stream steps down at once. It steps up when the buffer has
+// stayed above ABR_HIGH_WATER_PCT and the capacity estimate covers the next tier with 25% to spare,
+// or, for streams the server paces so the estimate can't show spare capacity, when the buffer has
+// stayed high for the hold time. A step up that is followed by a step down within ABR_PROBE_WINDOW_MS
+// doubles the hold, so a link that can't take the higher tier isn't tried every minute.
+//
+// The controller only decides; RadioOutputManager opens the new tier and splices it in. Every
+// decision, its reason and whether the new tier opened are kept for /api/abr.
+//
+// ----------------------------------------------------------------------------------------------------
+
+#define ABR_SETTLE_MS 10000               // no trend decisions this long after a start or switch
+#define ABR_LOW_WATER_MS 5000
+#define ABR_HORIZON_S 20                  // step down if the buffer would be empty sooner than this
+#define ABR_DOWN_SAMPLES 3
+#define ABR_HIGH_WATER_PCT 75
+#define ABR_UP_SAMPLES 10                 // seconds above high water before a capacity step up
+#define ABR_UP_HOLD_MS (60 * 1000UL)      // seconds above high water before a probing step up
+#define ABR_UP_HOLD_MAX_MS (16 * 60 * 1000UL)
+#define ABR_PROBE_WINDOW_MS (2 * 60 * 1000UL)
+#define ABR_HEADROOM_PCT 125              // capacity needed for a tier, as % of its bitrate
+#define ABR_CAPACITY_WEIGHT 8             // capacity estimate moves 1/8 of the way to each sample
+#define ABR_LOG_SIZE 8
+
+enum AbrReason {
+  ABR_REASON_START,
+  ABR_REASON_BUFFER,                // buffer falling
+  ABR_REASON_UNDERRUN,
+  ABR_REASON_FAILED,                // stream failed
+  ABR_REASON_CAPACITY,              // capacity estimate covers the next tier
+  ABR_REASON_HEADROOM               // buffer stayed high for the hold time
+};
+
+typedef struct {
+  uint32_t millis;
+  uint16_t fromKbps;
+  uint16_t toKbps;
+  AbrReason reason;
+  uint32_t bufferedMs;
+  int32_t trend;                    // ms of audio per second
+  uint16_t capacityKbps;
+  int8_t opened;                    // -1 still opening, 0 failed, 1 spliced in
+} abr_switch_t;
+
+class BitrateController_ {
+  private:
+    BitrateController_() {}
+
+  public:
+    static BitrateController_ &getInstance(); // Accessor for singleton instance
+
+    BitrateController_(const BitrateController_ &) = delete; // no copying
+    BitrateController_ &operator=(const BitrateController_ &) = delete;
+
+  public:
+    // A station is selected. Returns the tier to start on, or -1 if it has fewer than two tiers.
+    int begin(const station_t &station);
+    bool isActive() { return _tierCount >= 2; }
+    uint8_t getTier() { return _tier; }
+    const String &tierUrl(uint8_t tier) { return _tierUrls[tier]; }
+
+    // A stream (re)started on the current tier
+    void noteStreamStart();
+    // Once a second while playing. Returns the tier to switch to, or -1 to stay.
+    int sample(uint32_t fillBytes, uint32_t bufferBytes, uint32_t intakeBytes, uint32_t consumeRate);
+    // Any task
+    void noteUnderrun() { _underrun = true; }
+    // The stream failed: the tier to retry on, or -1 if already on the lowest
+    int stepDownOnFailure();
+    // The tier switch sample() asked for opened and was spliced in, or couldn't be opened
+    void noteSwitchResult(bool opened);
+
+    void writeJson(JsonStreamWriter &json);
+
+  private:
+    uint16_t _tierKbps[MAX_STATION_TIERS];
+    String _tierUrls[MAX_STATION_TIERS];
+    uint8_t _tierCount = 0;
+    uint8_t _tier = 0;
+    uint8_t _switchFrom = 0;
+    bool _switching = false;
+
+    uint32_t _settleUntil = 0;
+    uint32_t _lastBufferedMs = 0;
+    uint32_t _bufferedMs = 0;
+    int32_t _trend = 0;
+    uint16_t _capacityKbps = 0;       // kept across stations - it's the link, not the station
+    uint8_t _fallingSamples = 0;
+    uint8_t _highSamples = 0;
+    uint32_t _highSince = 0;
+    volatile bool _underrun = false;
+
+    uint32_t _lastUpAt = 0;
+    uint32_t _upHoldMs = ABR_UP_HOLD_MS;
+
+    abr_switch_t _log[ABR_LOG_SIZE];
+    uint8_t _logCount = 0;
+    uint8_t _logNext = 0;
+
+    int decide(uint8_t to, AbrReason reason);
+    void record(uint8_t from, uint8_t to, AbrReason reason, int8_t opened);
+    static const char *reasonName(AbrReason reason);
+};
+
+extern BitrateController_ &bitrateController;
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <Arduino.h>
+#include "Globals.h"
+#include "JsonStreamWriter.h"
+
+class SpiffsStorage_;
+
+// ----------------------------------------------------------------------------------------------------
+// ------------------------------------------- Config store -------------------------------------------
+// ----------------------------------------------------------------------------------------------------
+//
+// Config, stats and the preset station table, each as one binary record in NVS:
+//
+//   config_record_header_t { magic, kind, version, length, crc } + payload
+//
+// The payload is the fields in a fixed order, strings as a length and the bytes, so a record is
+// decoded straight into the globals with no parse buffer. The CRC is over the payload. A record
+// that fails its checks is treated as missing. NVS keeps the old value of a key until the new one
+// is completely written, so a reset during a save leaves the previous record, never a torn one.
+//
+// Stats are saved far more often than the rest, so they alternate between two keys, each record
+// carrying a sequence number; loading takes the newest that passes its checks. A damaged record, or
+// a save that never completed, falls back to the previous save instead of to zero.
+//
+// version is the schema of the payload. A new field is added at the end under a new version, and
+// older records still decode, with the new field at its default.
+//
+// Before this, the three were JSON files in /config/ on SPIFFS. On the first boot that finds a
+// record missing, the matching file is read once, saved as a record, and removed. JSON is now only
+// the web export and import form, see SpiffsStorage.
+//
+// ----------------------------------------------------------------------------------------------------
+
+#define CONFIG_NVS_NAMESPACE "cfgstore"
+#define CONFIG_NVS_KEY_CONFIG "config"
+#define CONFIG_NVS_KEY_STATS "stats"
+#define CONFIG_NVS_KEY_STATS_B "stats.b"
+#define CONFIG_NVS_KEY_STATIONS "stations"
+
+#define CONFIG_RECORD_MAGIC 0x5243          // "CR"
+#define CONFIG_RECORD_MAX 8192              // payload, far more than MAX_STATIONS presets need
+
+// Payload schema of each record - bump when the layout changes
+#define CONFIG_SCHEMA_CONFIG 1
+#define CONFIG_SCHEMA_STATS 2
+#define CONFIG_SCHEMA_STATIONS 1
+
+enum ConfigRecordKind {
+  CONFIG_RECORD_CONFIG = 1,
+  CONFIG_RECORD_STATS = 2,
+  CONFIG_RECORD_STATIONS = 3
+};
+
+typedef struct __attribute__((packed)) {
+  uint16_t magic;
+  uint8_t kind;
+  uint8_t version;
+  uint16_t length;                  // of the payload
+  uint16_t reserved;
+  uint32_t crc;                     // CRC-32 of the payload
+} config_record_header_t;
+
+class ConfigStore_ {
+  private:
+    ConfigStore_() {}
+
+  public:
+    static ConfigStore_ &getInstance(); // Accessor for singleton instance
+
+    ConfigStore_(const ConfigStore_ &) = delete; // no copying
+    ConfigStore_ &operator=(const ConfigStore_ &) = delete;
+
+  public:
+    // Into the globals, migrating the JSON file if there is no record yet. False if there was
+    // nothing to load, which leaves the globals as they were.
+    bool loadConfig();
+    bool loadStats();
+    bool loadStations();
+
+    // False if the record couldn't be written, which leaves the previous one
+    bool saveConfig();
+    bool saveStats();
+    bool saveStations();
+
+    // Record sizes, load results and how long loading took, as members of the object being written
+    void writeJson(JsonStreamWriter &json);
+
+  private:
+    uint32_t _loadUs = 0;             // all loads since boot, migrations included
+    uint16_t _bytes[3] = {0, 0, 0};   // last record size by kind
+    uint8_t _corrupt = 0;             // records that failed their checks
+    uint8_t _migrated = 0;            // JSON files migrated this boot
+    uint32_t _statsSeq = 0;           // of the newest stats record
+    uint8_t _statsSlot = 1;           // holding it - the first save goes to slot 0
+    uint32_t _statsSaves = 0;         // this boot
+
+    bool load(const char *key, ConfigRecordKind kind, bool (ConfigStore_::*decode)(const uint8_t *, uint16_t, uint8_t),
+              const char *legacyFile, bool (SpiffsStorage_::*legacyLoad)(), bool (ConfigStore_::*saveRecord)());
+    bool save(const char *key, ConfigRecordKind kind, uint8_t version, size_t (ConfigStore_::*encode)(uint8_t *, size_t));
+    bool migrate(const char *legacyFile, bool (SpiffsStorage_::*legacyLoad)(), bool (ConfigStore_::*saveRecord)());
+    bool readRecord(const char *key, ConfigRecordKind kind, uint8_t *&payload, uint16_t &length, uint8_t &version);
+    bool writeRecord(const char *key, ConfigRecordKind kind, uint8_t version, const uint8_t *payload, uint16_t length);
+    size_t encodeConfig(uint8_t *buf, size_t size);
+    bool decodeConfig(const uint8_t *payload, uint16_t length, uint8_t version);
+    size_t encodeStats(uint8_t *buf, size_t size);
+    bool decodeStats(const uint8_t *payload, uint16_t length, uint8_t version, spiffs_stats_t &stats, uint32_t &seq);
+    size_t encodeStations(uint8_t *buf, size_t size);
+    bool decodeStations(const uint8_t *payload, uint16_t length, uint8_t version);
+};
+
+extern ConfigStore_ &configStore;
@@ -22,6 +22,13 @@
 
 #define FEATURE_MENU
 
+// Event tracing for /utils/trace - uses ~0.5MB of PSRAM
+#define FEATURE_TRACE_OFF           // FEATURE_TRACE | FEATURE_TRACE_OFF
+
+// Reuse the last DHCP lease on a fast reconnect instead of asking again. Saves a second or so, but
+// the lease is never renewed - only turn it on with a DHCP reservation for the radio.
+#define WIFI_FAST_REUSE_IP_OFF      // WIFI_FAST_REUSE_IP | WIFI_FAST_REUSE_IP_OFF
+
 // Classic Bluetooth A2DP - only available on original ESP32 (not S3/C3)
 // Enable by adding -DFEATURE_BLUETOOTH to build_flags in platformio.ini
 
@@ -30,6 +37,9 @@
 #define CLOCK_MENU_TITLE "INet Radio"
 
 #define MAX_STATIONS 9                              // Max number of stations in station list
+#define MAX_STATION_URLS 3                          // Primary stream URL plus mirrors per station
+#define MAX_STATION_TIERS 4                         // Quality variants (bitrates) per station
+#define MAX_WIFI_CREDENTIALS 4                      // Max number of remembered WiFi networks
 
 #define MAX_GAIN 1.20                               // Max gain value before we clip
 #define VOLUME_STEPS 10                             // Number of volume steps
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <Arduino.h>
+#include <atomic>
 #include "Configuration.h"
 
 typedef void (*DebugCallback) (String);
@@ -16,20 +17,64 @@ typedef void (*DebugCallback) (String);
 #define MNM_EXTENDED_DEBUG_OFF
 #define AUD_EXTENDED_DEBUG
 
+// Log ring sizing. Slots live in internal RAM because the ESP32 can't do
+// atomic compare-and-set on PSRAM.
+#define LOG_RING_ENTRIES 32           // must be a power of two
+#define LOG_LINE_LENGTH 120
+#define LOG_HISTORY_SIZE 3072         // text kept for /api/logs
+#define LOG_DRAIN_INTERVAL_MS 20
+
+// Modules, each with its own runtime level
+enum LogModule {
+  LOG_MODULE_INR,
+  LOG_MODULE_OTM,
+  LOG_MODULE_SPF,
+  LOG_MODULE_WEB,
+  LOG_MODULE_UTL,
+  LOG_MODULE_WFM,
+  LOG_MODULE_CDM,
+  LOG_MODULE_CMG,
+  LOG_MODULE_MNM,
+  LOG_MODULE_AUD,
+  LOG_MODULE_DBG,
+  LOG_MODULE_CBK,
+  LOG_MODULE_COUNT
+};
+
+enum LogLevel {
+  LOG_LEVEL_OFF,
+  LOG_LEVEL_INFO,     // debugMsgXxx
+  LOG_LEVEL_TRACE     // debugMsgXxxX extended messages
+};
+
+// Only evaluate the message (and build any String temporaries) when the
+// module is actually logging
+#define debugLog(module, level, message) do { if (debugManager.isEnabled(module, level)) debugManager.debugMsg(module, level, message); } while (0)
+#define debugLogf(module, level, ...) do { if (debugManager.isEnabled(module, level)) debugManager.debugMsgf(module, level, __VA_ARGS__); } while (0)
+
 // Basic debug settings
 #ifdef DEBUG
-#define debugMsgInr(message) debugManager.debugMsg("[INR]", message);
-#define debugMsgOtm(message) debugManager.debugMsg("[OTM]", message);
-#define debugMsgSpf(message) debugManager.debugMsg("[SPF]", message);
-#define debugMsgWbm(message) debugManager.debugMsg("[WEB]", message);
-#define debugMsgUtl(message) debugManager.debugMsg("[UTL]", message);
-#define debugMsgWfm(message) debugManager.debugMsg("[WFM]", message);
-#define debugMsgCdm(message) debugManager.debugMsg("[CDM]", message);
-#define debugMsgCmg(message) debugManager.debugMsg("[GMC]", message);
-#define debugMsgMnm(message) debugManager.debugMsg("[MNM]", message);
-#define debugMsgAud(message) debugManager.debugMsg("[AUD]", message);
+#define debugMsgInr(message) debugLog(LOG_MODULE_INR, LOG_LEVEL_INFO, message)
+#define debugMsgOtm(message) debugLog(LOG_MODULE_OTM, LOG_LEVEL_INFO, message)
+#define debugMsgSpf(message) debugLog(LOG_MODULE_SPF, LOG_LEVEL_INFO, message)
+#define debugMsgWbm(message) debugLog(LOG_MODULE_WEB, LOG_LEVEL_INFO, message)
+#define debugMsgUtl(message) debugLog(LOG_MODULE_UTL, LOG_LEVEL_INFO, message)
+#define debugMsgWfm(message) debugLog(LOG_MODULE_WFM, LOG_LEVEL_INFO, message)
+#define debugMsgCdm(message) debugLog(LOG_MODULE_CDM, LOG_LEVEL_INFO, message)
+#define debugMsgCmg(message) debugLog(LOG_MODULE_CMG, LOG_LEVEL_INFO, message)
+#define debugMsgMnm(message) debugLog(LOG_MODULE_MNM, LOG_LEVEL_INFO, message)
+#define debugMsgAud(message) debugLog(LOG_MODULE_AUD, LOG_LEVEL_INFO, message)
+
+// printf style - nothing is formatted unless the module is logging
+#define debugMsgInrf(...) debugLogf(LOG_MODULE_INR, LOG_LEVEL_INFO, __VA_ARGS__)
+#define debugMsgSpff(...) debugLogf(LOG_MODULE_SPF, LOG_LEVEL_INFO, __VA_ARGS__)
+#define debugMsgWbmf(...) debugLogf(LOG_MODULE_WEB, LOG_LEVEL_INFO, __VA_ARGS__)
+#define debugMsgUtlf(...) debugLogf(LOG_MODULE_UTL, LOG_LEVEL_INFO, __VA_ARGS__)
+#define debugMsgWfmf(...) debugLogf(LOG_MODULE_WFM, LOG_LEVEL_INFO, __VA_ARGS__)
+#define debugMsgMnmf(...) debugLogf(LOG_MODULE_MNM, LOG_LEVEL_INFO, __VA_ARGS__)
+#define debugMsgAudf(...) debugLogf(LOG_MODULE_AUD, LOG_LEVEL_INFO, __VA_ARGS__)
 #else
-#define debugMsgMain(message)
+#define debugMsgInr(message)
 #define debugMsgOtm(message)
 #define debugMsgSpf(message)
 #define debugMsgWbm(message)
@@ -39,36 +84,46 @@ typedef void (*DebugCallback) (String);
 #define debugMsgCmg(message)
 #define debugMsgMnm(message)
 #define debugMsgAud(message)
+
+#define debugMsgInrf(...)
+#define debugMsgSpff(...)
+#define debugMsgWbmf(...)
+#define debugMsgUtlf(...)
+#define debugMsgWfmf(...)
+#define debugMsgMnmf(...)
+#define debugMsgAudf(...)
 #endif
 
 // Extended debug settings
 #ifdef INR_EXTENDED_DEBUG
-#define debugMsgInrX(message) debugManager.debugMsg("[INR]", message);
+#define debugMsgInrX(message) debugLog(LOG_MODULE_INR, LOG_LEVEL_TRACE, message)
 #else
 #define debugMsgInrX(message)
 #endif
 
 #ifdef SPF_EXTENDED_DEBUG
-#define debugMsgSpfX(message) debugManager.debugMsg("[UTL]", message);
+#define debugMsgSpfX(message) debugLog(LOG_MODULE_SPF, LOG_LEVEL_TRACE, message)
 #else
 #define debugMsgSpfX(message)
 #endif
 
 #ifdef MNM_EXTENDED_DEBUG
-#define debugMsgMnmX(message) debugManager.debugMsg("[MNM]", message);
+#define debugMsgMnmX(message) debugLog(LOG_MODULE_MNM, LOG_LEVEL_TRACE, message)
 #else
 #define debugMsgMnmX(message)
 #endif
 
 #ifdef AUD_EXTENDED_DEBUG
-#define debugMsgAudX(message) debugManager.debugMsg("[AUD]", message);
+#define debugMsgAudX(message) debugLog(LOG_MODULE_AUD, LOG_LEVEL_TRACE, message)
+#define debugMsgAudXf(...) debugLogf(LOG_MODULE_AUD, LOG_LEVEL_TRACE, __VA_ARGS__)
 #else
 #define debugMsgAudX(message)
+#define debugMsgAudXf(...)
 #endif
 
 class DebugManager_ {
   private:
-    DebugManager_() = default; // Make constructor private
+    DebugManager_();
 
   public:
     static DebugManager_ &getInstance(); // Accessor for singleton instance
@@ -77,22 +132,64 @@ class DebugManager_ {
     DebugManager_ &operator=(const DebugManager_ &) = delete;
 
   public:
+    // Start the task that drains the log ring to the serial port
+    void begin();
+
     void setDebuggingOutput(bool newState);
-    void debugMsg(String prefix, String message);
-    void debugMsgCont(String message);
+    void debugMsg(LogModule module, LogLevel level, const char* message);
+    void debugMsg(LogModule module, LogLevel level, const String &message) { debugMsg(module, level, message.c_str()); }
+    void debugMsgf(LogModule module, LogLevel level, const char* format, ...) __attribute__((format(printf, 4, 5)));
     void setDebugAutoOff(unsigned int seconds);
     void debugAutoOffCheck();
     bool isDebugOn();
 
+    bool isEnabled(LogModule module, LogLevel level) {
+      return _state && level <= _levels[module];
+    }
+    void setModuleLevel(LogModule module, LogLevel level);
+    LogLevel getModuleLevel(LogModule module);
+    static const char* getModuleName(LogModule module);
+    static bool moduleFromName(const char* name, LogModule &module);
+
+    // Copy out the most recent log text, oldest first
+    void writeHistory(Print &out);
+    uint32_t getDroppedCount() { return _dropped.load(std::memory_order_relaxed); }
+
     // Some components need to use a callback
     DebugCallback getDebugCallBack();
 
   private:
-    bool _state = true;
+    typedef struct {
+      std::atomic<uint32_t> seq;
+      uint32_t millis;
+      uint8_t module;
+      char text[LOG_LINE_LENGTH];
+    } log_slot_t;
+
+    volatile bool _state = true;
     unsigned int _debugForSecs = 0;
+    volatile uint8_t _levels[LOG_MODULE_COUNT];
+
+    log_slot_t _slots[LOG_RING_ENTRIES];
+    std::atomic<uint32_t> _writePos;
+    uint32_t _readPos = 0;                    // drain task only
+    std::atomic<uint32_t> _dropped;
+
+    char _history[LOG_HISTORY_SIZE];
+    size_t _historyHead = 0;
+    bool _historyWrapped = false;
+    portMUX_TYPE _historyMux = portMUX_INITIALIZER_UNLOCKED;
+
+    TaskHandle_t _drainTask = nullptr;
+
+    log_slot_t* reserveSlot(uint32_t &pos);
+    void commitSlot(log_slot_t* slot, uint32_t pos);
+    void drain();
+    void appendHistory(const char* text, size_t len);
+    static void drainTask(void *param);
 };
 
 // free function link to the class function
 extern void debugManagerLink(String message);
 
-extern DebugManager_ &debugManager;
\ No newline at end of file
+extern DebugManager_ &debugManager;
@@ -59,6 +59,9 @@
  typedef void (*StatusRenderCallback)(Adafruit_SH1106G* display, uint8_t width, uint8_t height);
  typedef bool (*StatusInputCallback)(ButtonEvent event);  // Return true to consume event
  typedef void (*StatusEncoderCallback)(int delta);  // Called on encoder rotation in status screen
+ typedef uint8_t (*SearchCallback)(const char* query);  // Returns the number of results for query
+ typedef const char* (*SearchLabelCallback)(uint8_t index);  // Label of a result of the last search
+ typedef void (*SearchPickCallback)(uint8_t index);  // Called when a result is chosen
  
  // Status screen data structure
  struct StatusData {
@@ -91,6 +94,9 @@
        uint8_t maxLength;
        const char* charset;
        ActionCallback onSave;  // Optional callback when value is saved
+       SearchCallback search;  // Search items only - run after every character
+       SearchLabelCallback resultLabel;
+       SearchPickCallback onPick;
      } stringData;
      struct {
        bool* valuePtr;
@@ -142,6 +148,11 @@
    uint8_t editingCursorPos;
    uint8_t editingCharIndex;
    const char* editingCharset;
+
+   // Search state - composing narrows the results, confirm browses them
+   bool editingBrowse = false;
+   uint8_t editingResultCount = 0;
+   uint8_t editingResultIndex = 0;
    
    // Either-Or state
    bool editingEitherOr;
@@ -194,10 +205,12 @@
    void renderMenuNavigation();
    void renderNumericValue();
    void renderStringComposition();
+   void renderSearchResults();
    void renderEitherOr();
    void renderFlashMessage();
    void enterMenuItem(MenuItem* item);
    void exitCurrentMode();
+   void runSearch();
    MenuItem* getItemAtIndex(uint8_t index);
    uint8_t getMenuItemCount(MenuItem* menu);
    
@@ -231,6 +244,10 @@
    MenuItem* addStringValue(MenuItem* parent, const char* label, char* buffer,
                            uint8_t maxLen, const char* charset = NULL,
                            ActionCallback onSave = NULL);
+   MenuItem* addSearch(MenuItem* parent, const char* label, char* buffer,
+                      uint8_t maxLen, SearchCallback search,
+                      SearchLabelCallback resultLabel, SearchPickCallback onPick,
+                      const char* charset = NULL);
    MenuItem* addEitherOr(MenuItem* parent, const char* label, bool* valuePtr,
                         const char* opt1 = "YES", const char* opt2 = "NO",
                         ActionCallback onSave = NULL);
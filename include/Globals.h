@@ -14,13 +14,7 @@
 extern esp_wps_config_t wps_config;
 
 extern unsigned long nowMillis;
-extern unsigned long lastSecondStartMillis;
 extern unsigned long previousMillisWiFi;
-extern int lastSecond;
-extern boolean triggeredThisSec;
-extern int secsDeltaAbs;
-extern int secsDelta;
-extern bool upOrDown;  
 
 extern bool blanked;  
 
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <Arduino.h>
+
+// ----------------------------------------------------------------------------------------------------
+// ------------------------------------- Streaming JSON writer ----------------------------------------
+// ----------------------------------------------------------------------------------------------------
+//
+// Writes JSON straight into a Print (normally an AsyncResponseStream) without building a document
+// in memory. Nothing is allocated on the heap; stack use is one small output buffer plus a bitmask
+// for comma tracking, so nesting is limited to JSON_WRITER_MAX_DEPTH levels.
+//
+//   JsonStreamWriter json(*response);
+//   json.beginObject();
+//   json.add("heap", ESP.getFreeHeap());
+//   json.key("stations").beginArray();
+//   ...
+//   json.endArray();
+//   json.endObject();
+//   json.flush();
+//
+// ----------------------------------------------------------------------------------------------------
+
+#define JSON_WRITER_MAX_DEPTH 16
+#define JSON_WRITER_BUFFER_SIZE 64
+
+class JsonStreamWriter {
+  public:
+    explicit JsonStreamWriter(Print &out);
+    ~JsonStreamWriter();
+
+    JsonStreamWriter(const JsonStreamWriter &) = delete; // no copying
+    JsonStreamWriter &operator=(const JsonStreamWriter &) = delete;
+
+    JsonStreamWriter &beginObject();
+    JsonStreamWriter &endObject();
+    JsonStreamWriter &beginArray();
+    JsonStreamWriter &endArray();
+    JsonStreamWriter &key(const char *name);
+
+    JsonStreamWriter &value(const char *str);
+    JsonStreamWriter &value(const String &str) { return value(str.c_str()); }
+    JsonStreamWriter &value(bool b);
+    JsonStreamWriter &value(int i) { return value((long)i); }
+    JsonStreamWriter &value(unsigned int u) { return value((unsigned long)u); }
+    JsonStreamWriter &value(long i);
+    JsonStreamWriter &value(unsigned long u);
+    JsonStreamWriter &value(long long i);
+    JsonStreamWriter &value(unsigned long long u);
+    JsonStreamWriter &value(double d, uint8_t decimals = 2);
+    JsonStreamWriter &nullValue();
+
+    // printf-style string value, formatted into a bounded stack buffer
+    JsonStreamWriter &valuef(const char *format, ...) __attribute__((format(printf, 2, 3)));
+
+    // A string value written in pieces, e.g. while iterating something
+    JsonStreamWriter &beginString();
+    JsonStreamWriter &stringPart(const char *str);
+    JsonStreamWriter &endString();
+
+    // key + value in one call
+    template <typename T>
+    JsonStreamWriter &add(const char *name, const T &val) {
+      key(name);
+      return value(val);
+    }
+
+    // Push anything still buffered to the output
+    void flush();
+
+  private:
+    Print &_out;
+    char _buf[JSON_WRITER_BUFFER_SIZE];
+    uint8_t _len = 0;
+    uint8_t _depth = 0;
+    uint32_t _hasItems = 0;   // bit per depth: something already written at this level
+    bool _afterKey = false;
+
+    void separator();
+    void open(char c);
+    void close(char c);
+    void put(char c);
+    void putStr(const char *s);
+    void putEscaped(const char *s);
+};
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <Arduino.h>
+#include "JsonStreamWriter.h"
+
+// ----------------------------------------------------------------------------------------------------
+// -------------------------------------- Link quality monitor ----------------------------------------
+// ----------------------------------------------------------------------------------------------------
+//
+// Once a second the main loop records RSSI, PHY mode, TCP retransmissions, stream bytes received and
+// buffered audio into a ring in PSRAM. Underruns, stream reconnects and WiFi disconnects are noted
+// from whichever task sees them; the next sample copies the preceding LINK_EVENT_WINDOW seconds into
+// the event, so /api/link can show what the link was doing when the stream got into trouble.
+//
+// The ESP-IDF doesn't report the station's PHY rate, so the PHY mode (b/g/n, HT40) is recorded
+// instead. Retransmissions need lwIP's MIB2 stats compiled in; without them they read as -1.
+//
+// ----------------------------------------------------------------------------------------------------
+
+#define LINK_HISTORY_SECONDS 300          // 64 without PSRAM
+#define LINK_EVENT_WINDOW 30              // seconds of history kept with each event
+#define LINK_EVENTS_KEPT 8                // most recent events, 2 without PSRAM
+#define LINK_EVENT_MIN_GAP_MS 5000        // repeats of the same event closer than this are dropped
+#define LINK_PENDING_EVENTS 4
+#define LINK_WEAK_RSSI -80                // dBm, below this the link itself is suspect
+
+// PHY mode bits
+#define LINK_PHY_11B  0x01
+#define LINK_PHY_11G  0x02
+#define LINK_PHY_11N  0x04
+#define LINK_PHY_LR   0x08
+#define LINK_PHY_HT40 0x10
+
+enum LinkEventType {
+  LINK_EVENT_UNDERRUN,
+  LINK_EVENT_RECONNECT,             // stream failed and is being restarted
+  LINK_EVENT_WIFI_DISCONNECT,
+  LINK_EVENT_COUNT
+};
+
+typedef struct {
+  uint32_t millis;
+  uint32_t bytesPerSec;             // stream bytes received over the last second
+  uint16_t bufferedMs;              // audio in the stream buffer
+  int16_t retransmits;              // TCP segments retransmitted over the last second, -1 if not counted
+  int8_t rssi;                      // dBm, 0 when not connected
+  uint8_t phy;                      // LINK_PHY_ bits
+  uint8_t reserved[2];
+} link_sample_t;
+
+typedef struct {
+  uint32_t millis;
+  uint32_t byteRate;                // decoder consumption rate at the time, bytes/s
+  uint8_t type;                     // LinkEventType
+  uint8_t sampleCount;
+  link_sample_t samples[LINK_EVENT_WINDOW];       // oldest first
+} link_event_t;
+
+class LinkMonitor_ {
+  private:
+    LinkMonitor_() {}
+
+  public:
+    static LinkMonitor_ &getInstance(); // Accessor for singleton instance
+
+    LinkMonitor_(const LinkMonitor_ &) = delete; // no copying
+    LinkMonitor_ &operator=(const LinkMonitor_ &) = delete;
+
+  public:
+    void begin();
+
+    // Main loop, once a second
+    void sample();
+
+    // Any task
+    void noteEvent(LinkEventType type);
+
+    // historySeconds of the ring, then every kept event
+    void writeJson(JsonStreamWriter &json, uint16_t historySeconds);
+
+  private:
+    link_sample_t* _history = nullptr;
+    uint16_t _historySize = 0;
+    uint32_t _sampleCount = 0;
+
+    link_event_t* _events = nullptr;
+    uint8_t _eventsSize = 0;
+    uint32_t _eventCount = 0;
+
+    uint8_t _pending[LINK_PENDING_EVENTS];
+    uint32_t _pendingMillis[LINK_PENDING_EVENTS];
+    uint8_t _pendingCount = 0;
+    uint32_t _lastEventMillis[LINK_EVENT_COUNT];
+
+    uint32_t _lastStreamBytes = 0;
+    int32_t _lastRetransmits = -1;
+
+    portMUX_TYPE _mux = portMUX_INITIALIZER_UNLOCKED;
+
+    void snapshot(uint8_t type, uint32_t when);
+    void writeSample(JsonStreamWriter &json, const link_sample_t &s);
+    const char* causeHint(const link_event_t &event);
+};
+
+extern LinkMonitor_ &linkMonitor;
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <Arduino.h>
+#include "JsonStreamWriter.h"
+
+// ----------------------------------------------------------------------------------------------------
+// -------------------------------------- Main loop profiler ------------------------------------------
+// ----------------------------------------------------------------------------------------------------
+//
+// Times each step of the main loop with the CPU cycle counter and keeps a fixed-bucket histogram per
+// step plus one for the whole iteration. An iteration longer than LOOP_SLOW_BUDGET_US is captured
+// with the time spent in every step, so the step that blew the budget can be identified. In audio
+// inline mode the decoder only runs once per iteration, so slow iterations there are counted apart.
+//
+// Only the main loop records; /api/loop reads under a short lock.
+//
+// ----------------------------------------------------------------------------------------------------
+
+#define LOOP_HISTOGRAM_BUCKETS 10
+#define LOOP_SLOW_BUDGET_US 20000       // an iteration longer than this is "slow"
+#define LOOP_SLOW_CAPTURES 8            // most recent slow iterations kept
+
+// Add new steps here and in the names in LoopProfiler.cpp, in the same order
+enum LoopStep {
+  LOOP_STEP_AUDIO,
+  LOOP_STEP_OTA,
+  LOOP_STEP_DNS,
+  LOOP_STEP_MENU,
+  LOOP_STEP_PERIODIC,                   // once per second/minute/hour/day processing
+  LOOP_STEP_COUNT
+};
+
+typedef struct {
+  uint32_t count;
+  uint32_t maxUs;
+  uint64_t totalUs;
+  uint32_t buckets[LOOP_HISTOGRAM_BUCKETS + 1];     // last is overflow
+} loop_histogram_t;
+
+typedef struct {
+  uint32_t millis;
+  uint32_t totalUs;
+  uint32_t stepUs[LOOP_STEP_COUNT];
+  uint8_t worstStep;
+  bool decoderInline;
+} loop_slow_capture_t;
+
+class LoopProfiler_ {
+  private:
+    LoopProfiler_() {}
+
+  public:
+    static LoopProfiler_ &getInstance(); // Accessor for singleton instance
+
+    LoopProfiler_(const LoopProfiler_ &) = delete; // no copying
+    LoopProfiler_ &operator=(const LoopProfiler_ &) = delete;
+
+  public:
+    void beginIteration();
+    void addStep(LoopStep step, uint32_t cycles);
+    void endIteration(bool decoderInline);
+
+    void writeJson(JsonStreamWriter &json);
+
+  private:
+    uint32_t _cyclesPerUs = 0;
+    uint32_t _iterationStart = 0;
+    uint32_t _stepCycles[LOOP_STEP_COUNT];
+    uint8_t _stepsRun = 0;                          // bit per step
+
+    loop_histogram_t _steps[LOOP_STEP_COUNT];
+    loop_histogram_t _iteration;
+    loop_slow_capture_t _slow[LOOP_SLOW_CAPTURES];
+    uint32_t _slowCount = 0;
+    uint32_t _slowInlineCount = 0;
+    uint32_t _iterationsInline = 0;
+
+    portMUX_TYPE _mux = portMUX_INITIALIZER_UNLOCKED;
+
+    void observe(loop_histogram_t &hist, uint32_t us);
+    void writeHistogram(JsonStreamWriter &json, const loop_histogram_t &hist);
+};
+
+// ************************************************************
+// Time one step of the loop, in CPU cycles
+// ************************************************************
+class LoopStepTimer {
+  public:
+    explicit LoopStepTimer(LoopStep step) : _step(step), _start(ESP.getCycleCount()) {}
+    ~LoopStepTimer();
+  private:
+    LoopStep _step;
+    uint32_t _start;
+};
+
+extern LoopProfiler_ &loopProfiler;
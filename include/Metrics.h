@@ -0,0 +1,131 @@
+#pragma once
+
+#include <Arduino.h>
+#include <atomic>
+
+// ----------------------------------------------------------------------------------------------------
+// ------------------------------------- Metrics registry ---------------------------------------------
+// ----------------------------------------------------------------------------------------------------
+//
+// Fixed table of counters, gauges and histograms, each backed by 32-bit atomics so they can be
+// updated from any task (audio, async_tcp, main loop) without locks. Scraped at /metrics in the
+// Prometheus text format.
+//
+// Counters are 32 bit and wrap; Prometheus treats the wrap as a counter reset.
+//
+// ----------------------------------------------------------------------------------------------------
+
+enum MetricType {
+  METRIC_TYPE_COUNTER,
+  METRIC_TYPE_GAUGE,
+  METRIC_TYPE_HISTOGRAM
+};
+
+// Add new metrics here and in the table in Metrics.cpp, in the same order
+enum MetricId {
+  METRIC_HTTP_REQUESTS,
+  METRIC_WIFI_CONNECTS,
+  METRIC_WIFI_DISCONNECTS,
+  METRIC_STREAM_BYTES,
+  METRIC_STREAM_STARTS,
+  METRIC_STREAM_FAILURES,
+  METRIC_STREAM_UNDERRUNS,
+  METRIC_SPIFFS_WRITE_US,
+  METRIC_MENU_RENDER_US,
+  METRIC_SCRAPE_US,
+  METRIC_AUDIO_STACK_WARNINGS,
+  METRIC_CORE1_IDLE_WARNINGS,
+  METRIC_CORE0_IDLE_PERCENT,
+  METRIC_CORE1_IDLE_PERCENT,
+  METRIC_WIFI_CONNECT_MS,
+  METRIC_WIFI_SCAN_MS,
+  METRIC_WIFI_CONNECT_FAILURES,
+  METRIC_WIFI_FAST_CONNECTS,
+  METRIC_WIFI_FAST_FALLBACKS,
+  METRIC_BOOT_WIFI_MS,
+  METRIC_BOOT_FIRST_AUDIO_MS,
+  METRIC_BOOT_STORAGE_MS,
+  METRIC_BOOT_READY_MS,
+  METRIC_STREAM_START_MS,
+  METRIC_WIFI_ROAM_SCANS,
+  METRIC_WIFI_ROAMS,
+  METRIC_WIFI_ROAMS_DEFERRED,
+  METRIC_RESOLVER_HITS,
+  METRIC_RESOLVER_MISSES,
+  METRIC_RESOLVER_SAVED_MS,
+  METRIC_RESOLVER_RESOLVE_MS,
+  METRIC_RESOLVER_FAILURES,
+  METRIC_STREAM_REDIRECTS,
+  METRIC_TLS_HANDSHAKES,
+  METRIC_TLS_RESUMED,
+  METRIC_TLS_HANDSHAKE_MS,
+  METRIC_TLS_DECRYPT_US,
+  METRIC_TLS_BYTES,
+  METRIC_STREAM_FAILOVERS,
+  METRIC_ABR_STEP_UPS,
+  METRIC_ABR_STEP_DOWNS,
+  METRIC_ABR_TIER_KBPS,
+  METRIC_DEAD_AIR_SILENCES,
+  METRIC_DEAD_AIR_STALLS,
+  METRIC_PROBES,
+  METRIC_PROBE_FAILURES,
+  METRIC_PROBE_FIRST_AUDIO_MS,
+  METRIC_COUNT
+};
+
+#define METRICS_MAX_BUCKETS 10
+#define METRICS_MAX_SLOTS 160             // atomics backing all metrics
+#define METRICS_MAX_TASKS 24              // tasks reported per scrape
+#define METRICS_MIN_SCRAPE_INTERVAL_MS 1000
+
+typedef struct {
+  const char* name;
+  const char* help;
+  MetricType type;
+  const uint32_t* buckets;                // histogram upper bounds, ascending
+  uint8_t bucketCount;
+} metric_def_t;
+
+class Metrics_ {
+  private:
+    Metrics_();
+
+  public:
+    static Metrics_ &getInstance(); // Accessor for singleton instance
+
+    Metrics_(const Metrics_ &) = delete; // no copying
+    Metrics_ &operator=(const Metrics_ &) = delete;
+
+  public:
+    void inc(MetricId id, uint32_t by = 1);
+    void set(MetricId id, int32_t value);
+    void observe(MetricId id, uint32_t value);
+    int32_t get(MetricId id);
+
+    // Returns false if called again within METRICS_MIN_SCRAPE_INTERVAL_MS
+    bool writePrometheus(Print &out);
+
+  private:
+    // Counter/gauge value, or the base slot of a histogram's buckets
+    uint16_t _slot[METRIC_COUNT];
+    // Histogram layout: one slot per bucket, then +Inf, count, sum
+    std::atomic<int32_t> _values[METRICS_MAX_SLOTS];
+    unsigned long _lastScrapeMillis = 0;
+
+    void writeHeader(Print &out, const char* name, const char* help, const char* type);
+    void writeTaskMetrics(Print &out);
+};
+
+// ************************************************************
+// Time a block of code into a histogram, in microseconds
+// ************************************************************
+class MetricTimer {
+  public:
+    explicit MetricTimer(MetricId id) : _id(id), _start(micros()) {}
+    ~MetricTimer();
+  private:
+    MetricId _id;
+    unsigned long _start;
+};
+
+extern Metrics_ &metrics;
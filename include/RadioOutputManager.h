@@ -4,15 +4,19 @@
 
 #include <AudioFileSource.h>
 #include <AudioFileSourceBuffer.h>
-#include <AudioFileSourceICYStream.h>
+#include "AudioFileSourceRadioStream.h"
+#include "AudioFileSourceSplicer.h"
 #include <AudioGeneratorTalkie.h>
 #include <AudioGeneratorMP3.h>
 #include <AudioOutputI2S.h>
 
 #include "Defs.h"
+#include "StorageTypes.h"
+#include "SilenceDetector.h"
 #include "DebugManager.h"
 
 const int bufferSize = 256 * 1024; // 64KB buffer in PSRAM (was 16KB in SRAM)
+const int TIER_SWITCH_TASK_STACK = 6144;  // opens the next quality tier, TLS included
 
 static void StatusCallback(void *cbData, int code, const char *string);
 static void MDCallback(void *cbData, const char *type, bool isUnicode, const char *string);
@@ -30,7 +34,7 @@ class RadioOutputManager_ {
     public:
       void initializeAudioOutput();
       void playStartupJingle();
-      void startRadioStream(String url, String stationName, float gain);
+      void startRadioStream(const station_t &station, float gain);
       void stopRadioStream();
       void StartPlaying();
       void StopPlaying();
@@ -39,6 +43,9 @@ class RadioOutputManager_ {
       void audioOncePerLoop();
       bool isPlaying() { return playing; }
       bool isReconnecting() { return reconnecting; }
+      bool isInlineMode() { return audioInlineMode; }
+      uint32_t getBufferedMs();
+      uint32_t getByteRate() { return _consumeRate; }
       bool isMuted() { return (_fgain == 0.0f); }
       bool togglePlay() {
         if (playing) {
@@ -59,8 +66,10 @@ class RadioOutputManager_ {
       bool isRadioMode();
       bool isBluetoothMode();
       bool isRadioBtMode();
-      String getStationName() { return _stationName; }
-      String getUrl() { return _url; }
+      const String &getStationName() { return _stationName; }
+      const String &getUrl() { return _url; }
+      uint8_t getUrlIndex() { return _urlCount ? _order[_orderPos] : 0; }   // which of the station's URLs
+      uint16_t getStreamKbps() { return _splicer ? _splicer->getKbps() : 0; }   // from the MP3 frame headers
       const char* getSongTitle() { return _songTitle; }
       void setSongTitle(const char* title) {
         strncpy(_songTitle, title, sizeof(_songTitle) - 1);
@@ -68,7 +77,8 @@ class RadioOutputManager_ {
       }
 
     private:
-      AudioFileSourceICYStream *file = nullptr;
+      AudioFileSource *file = nullptr;
+      AudioFileSourceSplicer *_splicer = nullptr;   // file, when it's a stream
       AudioFileSourceBuffer *buff = nullptr;
       AudioGeneratorMP3 *mp3 = nullptr;
       AudioOutput *out = nullptr;
@@ -77,6 +87,14 @@ class RadioOutputManager_ {
       float _fgain = DEFAULT_GAIN;
       String _url = "";
       String _stationName = "";
+
+      // The station's URLs, tried best health score first
+      String _urls[MAX_STATION_URLS];
+      uint8_t _urlCount = 0;
+      uint8_t _order[MAX_STATION_URLS] = {0};
+      uint8_t _orderPos = 0;               // where _url is in _order
+      uint8_t _failedThisRound = 0;        // URLs failed since one last played steadily
+      uint8_t _backoffAttempt = 0;
       char _songTitle[64] = "";
       volatile bool playing = false;
       volatile bool audioTaskRunning = false;
@@ -89,9 +107,43 @@ class RadioOutputManager_ {
       volatile bool streamFailed = false;  // set by audio task when mp3->loop() returns false unexpectedly
       bool reconnecting = false;           // true while waiting to retry after a stream failure
       unsigned long reconnectAt = 0;       // millis() timestamp to attempt reconnect
-      static const unsigned long RECONNECT_DELAY_MS = 5000;
+      bool _reconnectStart = false;        // the next start is a reconnect, not a new listen
+      // Once every URL has failed, back off from RECONNECT_BASE_MS doubling up to RECONNECT_MAX_MS, jittered
+      static const unsigned long RECONNECT_BASE_MS = 1000;
+      static const unsigned long RECONNECT_MAX_MS = 60000;
+      static const unsigned long FAILOVER_DELAY_MS = 250;      // before trying the next URL
+      static const unsigned long STABLE_PLAY_MS = 60000;       // playing this long starts a new round
       static const unsigned long RECONNECT_WIFI_WAIT_MS = 15000;
 
+      // Playlist URLs not yet in the resolver cache wait for it rather than play the playlist
+      bool _awaitingResolve = false;
+      unsigned long _awaitingResolveSince = 0;
+      bool _resolveWaited = false;         // the retry after waiting - play whatever we have
+      static const unsigned long RESOLVE_WAIT_MS = 8000;
+      static const unsigned long RESOLVE_SUSPECT_MS = 15000;   // failing sooner than this drops the cache entry
+
+      // Decoder consumption rate, worked out once a second from bytes in minus buffer growth
+      uint32_t _consumeRate = 0;           // bytes per second, smoothed
+      uint32_t _lastStreamBytes = 0;
+      uint32_t _lastFillLevel = 0;
+      static const uint32_t DEFAULT_BYTE_RATE = 16000;     // 128kbps until there's a frame header or a measurement
+
+      // Quality tier switch: a task opens the new tier, then the main loop hands it to the splicer
+      volatile bool _switchInFlight = false;
+      volatile bool _switchDone = false;
+      AudioFileSource *volatile _switchSource = nullptr;
+      String _switchUrl;                   // the tier's URL
+      String _switchStreamUrl;             // what to open - the resolved URL if there is one
+      IPAddress _switchAddress;
+      bool _switchResolved = false;
+      uint32_t _streamGeneration = 0;      // bumped by StopPlaying, so a switch that finishes late is dropped
+      uint32_t _switchGeneration = 0;
+
+      void setStation(const station_t &station);
+      void startTierSwitch(uint8_t tier);
+      void recoverDeadAir(DeadAirType type);
+      static void tierSwitchTask(void *param);
+      unsigned long nextBackoffMs();
       static void audioTask(void *param);
   };
   
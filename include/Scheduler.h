@@ -0,0 +1,81 @@
+#pragma once
+
+#include <Arduino.h>
+
+// ----------------------------------------------------------------------------------------------------
+// ----------------------------------- Cooperative scheduler ------------------------------------------
+// ----------------------------------------------------------------------------------------------------
+//
+// Periodic and one-shot jobs run from the main loop. runDue() runs whatever is due, highest priority
+// first, and returns how long until the next deadline so the loop task can sleep instead of spinning.
+//
+// Periodic jobs stay on their grid: the next deadline is the previous deadline plus the period, not
+// "now" plus the period, so they don't drift. A job that falls more than a period behind skips the
+// missed runs rather than running back to back.
+//
+// Jobs can be added or cancelled from any task; wake() cuts the main loop's sleep short.
+//
+// ----------------------------------------------------------------------------------------------------
+
+#define SCHEDULER_MAX_JOBS 16
+#define SCHEDULER_MAX_SLEEP_MS 1000
+
+typedef void (*SchedulerJob)();
+
+enum SchedulerPriority {
+  SCHEDULER_PRIORITY_LOW,
+  SCHEDULER_PRIORITY_NORMAL,
+  SCHEDULER_PRIORITY_HIGH
+};
+
+typedef struct {
+  const char* name;                 // string literal
+  SchedulerJob fn;
+  uint32_t due;                     // millis()
+  uint32_t period;                  // 0 for a one-shot
+  uint8_t priority;
+  bool active;
+  uint32_t runs;
+  uint32_t skipped;                 // periodic runs missed because the job fell behind
+  uint32_t maxLateMs;
+} scheduler_job_t;
+
+class Scheduler_ {
+  private:
+    Scheduler_() {}
+
+  public:
+    static Scheduler_ &getInstance(); // Accessor for singleton instance
+
+    Scheduler_(const Scheduler_ &) = delete; // no copying
+    Scheduler_ &operator=(const Scheduler_ &) = delete;
+
+  public:
+    // Call from the task that will run the jobs
+    void begin();
+
+    // Both return a job id, or -1 if the table is full. The first run of a periodic job is one
+    // period from now unless firstDelayMs says otherwise.
+    int8_t every(const char* name, uint32_t periodMs, SchedulerJob fn,
+                 SchedulerPriority priority = SCHEDULER_PRIORITY_NORMAL, int32_t firstDelayMs = -1);
+    int8_t after(const char* name, uint32_t delayMs, SchedulerJob fn,
+                 SchedulerPriority priority = SCHEDULER_PRIORITY_NORMAL);
+    void cancel(int8_t id);
+
+    // Run everything that is due at 'now', returns milliseconds until the next deadline
+    uint32_t runDue(uint32_t now);
+
+    // Block the calling (main) task for up to ms, or until wake()
+    void sleep(uint32_t ms);
+    void wake();
+
+  private:
+    scheduler_job_t _jobs[SCHEDULER_MAX_JOBS];
+    TaskHandle_t _mainTask = nullptr;
+    portMUX_TYPE _mux = portMUX_INITIALIZER_UNLOCKED;
+
+    int8_t add(const char* name, uint32_t delayMs, uint32_t periodMs, SchedulerJob fn, SchedulerPriority priority);
+    int8_t nextDue(uint32_t now, uint32_t ranMask);
+};
+
+extern Scheduler_ &scheduler;
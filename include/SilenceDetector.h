@@ -0,0 +1,126 @@
+#pragma once
+
+#include <Arduino.h>
+#include "JsonStreamWriter.h"
+
+// ----------------------------------------------------------------------------------------------------
+// --------------------------------------- Dead air detector ------------------------------------------
+// ----------------------------------------------------------------------------------------------------
+//
+// Catches a stream that stays connected, with the decoder happily running, but plays nothing useful:
+//
+//  - silence: decoded audio below the RMS threshold, with a peak-to-peak swing under ten times that,
+//    for the silence time. Using the swing rather than the peak means a stuck DC level counts too.
+//  - stall: no decoded samples at all for the stall time while playing
+//
+// The output calls feed() with each sample it accepts. That only adds to a running sum of squares
+// and a min/max - no buffering - and every SILENCE_BLOCK_SAMPLES samples the block is compared with
+// the thresholds in integer arithmetic. The main loop calls check() once a second, and
+// RadioOutputManager carries out the configured action on what it returns.
+//
+// ----------------------------------------------------------------------------------------------------
+
+#define SILENCE_BLOCK_SAMPLES 4096        // about 93ms at 44.1kHz
+#define SILENCE_EVENTS_KEPT 8
+
+#define SILENCE_DEFAULT_THRESHOLD_DB -60  // dBFS RMS
+#define SILENCE_DEFAULT_SECONDS 20
+#define STALL_DEFAULT_SECONDS 10
+
+enum SilenceAction {
+  SILENCE_ACTION_NONE,              // note it and carry on
+  SILENCE_ACTION_RECONNECT,         // the same URL again
+  SILENCE_ACTION_FAILOVER,          // the station's next URL
+  SILENCE_ACTION_NEXT_STATION
+};
+#define SILENCE_DEFAULT_ACTION SILENCE_ACTION_FAILOVER
+
+enum DeadAirType {
+  DEAD_AIR_NONE,
+  DEAD_AIR_SILENCE,
+  DEAD_AIR_STALL
+};
+
+typedef struct {
+  uint32_t millis;
+  DeadAirType type;
+  uint32_t durationMs;
+  float rmsDb;                      // last block before the event
+  SilenceAction action;
+  String url;
+} dead_air_event_t;
+
+class SilenceDetector_ {
+  private:
+    SilenceDetector_() {}
+
+  public:
+    static SilenceDetector_ &getInstance(); // Accessor for singleton instance
+
+    SilenceDetector_(const SilenceDetector_ &) = delete; // no copying
+    SilenceDetector_ &operator=(const SilenceDetector_ &) = delete;
+
+  public:
+    void configure(int thresholdDb, int silenceSeconds, int stallSeconds, int action);
+    SilenceAction getAction() { return _action; }
+
+    // Audio task, every sample the output takes
+    inline void feed(const int16_t sample[2]) {
+      int32_t mono = ((int32_t)sample[0] + sample[1]) >> 1;
+      _sumSquares += (uint32_t)(mono * mono);
+      if (mono < _min) {
+        _min = mono;
+      }
+      if (mono > _max) {
+        _max = mono;
+      }
+      if (++_count >= SILENCE_BLOCK_SAMPLES) {
+        endBlock();
+      }
+    }
+
+    // Main loop
+    void streamStarted();
+    void streamStopped() { _active = false; }
+    // Once a second: what has gone wrong, if anything
+    DeadAirType check();
+    // Record what was done about it
+    void noteEvent(DeadAirType type, SilenceAction action, const String &url);
+
+    void writeJson(JsonStreamWriter &json);
+
+  private:
+    // Thresholds
+    SilenceAction _action = SILENCE_DEFAULT_ACTION;
+    int _thresholdDb = SILENCE_DEFAULT_THRESHOLD_DB;
+    uint32_t _silenceMs = SILENCE_DEFAULT_SECONDS * 1000UL;
+    uint32_t _stallMs = STALL_DEFAULT_SECONDS * 1000UL;
+    uint32_t _meanSquareLimit = 0;
+    int32_t _swingLimit = 0;
+
+    // Current block, audio task only
+    uint64_t _sumSquares = 0;
+    int32_t _min = INT16_MAX;
+    int32_t _max = INT16_MIN;
+    uint32_t _count = 0;
+
+    // Block results, written by the audio task
+    volatile uint32_t _lastBlockMs = 0;
+    volatile uint32_t _silentSinceMs = 0; // 0 while there's sound
+    volatile uint32_t _lastMeanSquare = 0;
+    volatile int32_t _lastSwing = 0;
+
+    bool _active = false;
+    uint32_t _startedMs = 0;
+    uint32_t _eventMs = 0;              // duration of the run check() reported
+
+    dead_air_event_t _events[SILENCE_EVENTS_KEPT];
+    uint8_t _eventCount = 0;
+    uint8_t _eventNext = 0;
+
+    void endBlock();
+    static float toDb(uint32_t meanSquare);
+    static const char *actionName(SilenceAction action);
+};
+
+extern SilenceDetector_ &silenceDetector;
@@ -9,6 +9,15 @@
 // ----------------------------------------------------------------------------------------------------
 // ------------------------------------- SPIFFS Clock Component ---------------------------------------
 // ----------------------------------------------------------------------------------------------------
+//
+// Config, stats and the presets are kept in NVS by ConfigStore. What is left here is their JSON form:
+// the files they used to be kept in, read once to migrate them, and the web export and import.
+//
+// ----------------------------------------------------------------------------------------------------
+
+#define SPIFFS_CONFIG_FILE "/config/config.json"
+#define SPIFFS_STATS_FILE "/config/stats.json"
+#define SPIFFS_STATIONS_FILE "/config/stations.json"
 
 class SpiffsStorage_
 {
@@ -25,18 +34,24 @@ class SpiffsStorage_
     bool testMountSpiffs();
     bool getSpiffsMounted();
 
-    // These load/store the global objects, defined in globals.h
+    // Load the global objects, defined in globals.h, from the old JSON files
     bool getConfigFromSpiffs();
-    void saveConfigToSpiffs();
     bool getStatsFromSpiffs();
-    void saveStatsToSpiffs();
     bool getStationsFromSpiffs();
-    void saveStationsToSpiffs();
 
-    JsonObject& getConfigAsJsonObject();
+    // The JSON form of the globals. Exports leave out WiFi passwords; an import keeps the stored
+    // password of a network that comes without one.
+    void configToJson(JsonObject &json, bool withPasswords);
+    bool configFromJson(JsonObject &json);
+    void statsToJson(JsonObject &json);
+    bool statsFromJson(JsonObject &json);
+    void stationsToJson(JsonArray &arr);
+    bool stationsFromJson(JsonArray &arr);
+
   private:
     bool _spiffsMounted = false;
-    DynamicJsonBuffer _jsonBuffer;
+
+    char *readFile(const char *path);
 };
 
 extern SpiffsStorage_ &spiffsStorage;
\ No newline at end of file
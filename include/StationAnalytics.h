@@ -0,0 +1,139 @@
+#pragma once
+
+#include <Arduino.h>
+#include <FS.h>
+#include "StorageTypes.h"
+#include "JsonStreamWriter.h"
+
+// ----------------------------------------------------------------------------------------------------
+// ----------------------------------------- Station analytics ----------------------------------------
+// ----------------------------------------------------------------------------------------------------
+//
+// Per-station listening counters: minutes played, starts, reconnects, underruns and time to first
+// audio. A station is keyed by the hash of its primary URL (see StreamHealth_::hashUrl), so a preset
+// and the same station played from the directory count together.
+//
+// The counters live in a fixed table in RAM. Every ANALYTICS_FLUSH_MINUTES the change since the last
+// flush is appended to /analytics/log.bin, one 36-byte record per station that played, each with its
+// own CRC. A station's name is logged once, the first time it appears. At boot the log is replayed to
+// rebuild the table; a torn record at the end (a power cut during an append) is dropped.
+//
+// Appends only ever write new flash; SPIFFS spreads them over the partition. Once the log passes
+// ANALYTICS_LOG_MAX_BYTES it is compacted: the table's totals are written to log.tmp, renamed to
+// log.new when complete, and swapped in for log.bin. A log.new found at boot is finished the same way;
+// a log.tmp is dropped, and log.bin is still whole.
+//
+// Budgets:
+//  - RAM: ANALYTICS_MAX_STATIONS entries of ~88 bytes, ~2.8KB. When full, the station with the fewest
+//    minutes makes way, appending what it hadn't logged first; its records stay in the log until the
+//    next compaction drops them.
+//  - Flash: at most ANALYTICS_LOG_MAX_BYTES plus one flush, plus a compacted copy of at most
+//    2 * ANALYTICS_MAX_STATIONS records (2.3KB) while compacting - under 19KB.
+//  - Wear: one record per playing station per flush, ~3.5KB a day for one station playing all day,
+//    so a compaction every four or five days.
+//
+// ----------------------------------------------------------------------------------------------------
+
+#define ANALYTICS_LOG_FILE "/analytics/log.bin"
+#define ANALYTICS_LOG_TMP_FILE "/analytics/log.tmp"
+#define ANALYTICS_LOG_NEW_FILE "/analytics/log.new"
+
+#define ANALYTICS_MAX_STATIONS 32
+#define ANALYTICS_NAME_LEN 24             // stored, longer names are cut
+#define ANALYTICS_FLUSH_MINUTES 15
+#define ANALYTICS_LOG_MAX_BYTES 16384
+#define ANALYTICS_READ_CHUNK 8            // records read at a time while replaying
+
+enum AnalyticsRecordType {
+  ANALYTICS_RECORD_COUNTS = 1,
+  ANALYTICS_RECORD_NAME = 2
+};
+
+typedef struct {
+  uint32_t minutes;
+  uint32_t starts;
+  uint32_t reconnects;
+  uint32_t underruns;
+  uint32_t ttfaCount;               // starts that reached audio
+  uint32_t ttfaSumMs;               // and their total time to first audio
+} analytics_counts_t;
+
+typedef struct __attribute__((packed)) {
+  uint32_t key;
+  uint8_t type;                     // AnalyticsRecordType
+  uint8_t reserved[3];
+  union {
+    analytics_counts_t counts;      // added to the station's totals
+    char name[ANALYTICS_NAME_LEN];  // not NUL terminated when full
+  };
+  uint32_t crc;                     // CRC-32 of the bytes before it
+} analytics_record_t;
+
+typedef struct {
+  uint32_t key;                     // 0 for a free slot
+  char name[ANALYTICS_NAME_LEN + 1];
+  bool nameLogged;                  // the log has its name record
+  analytics_counts_t total;
+  analytics_counts_t pending;       // not in the log yet
+} station_analytics_t;
+
+class StationAnalytics_ {
+  private:
+    StationAnalytics_() {}
+
+  public:
+    static StationAnalytics_ &getInstance(); // Accessor for singleton instance
+
+    StationAnalytics_(const StationAnalytics_ &) = delete; // no copying
+    StationAnalytics_ &operator=(const StationAnalytics_ &) = delete;
+
+  public:
+    // After SPIFFS is mounted
+    void begin();
+
+    // Main loop. select() when a station is tuned, the rest count against it.
+    void select(const station_t &station);
+    void noteStart(bool reconnect);
+    void tick(bool playing);          // once a minute
+
+    // Safe from any task
+    void noteFirstAudio(uint32_t ms);
+    void noteUnderrun();
+
+    // Append what hasn't been logged yet, e.g. before a restart. Any task.
+    void flush();
+
+    // A copy of a station's entry by key or name (case-insensitive); false if it has none
+    bool find(const String &station, station_analytics_t &entry);
+    // Copies of the entries, most minutes first; returns how many
+    int list(station_analytics_t *entries, int max);
+
+    static uint32_t keyFor(const station_t &station);
+
+    // Log size and compaction counts, as members of the object being written
+    void writeJson(JsonStreamWriter &json);
+
+  private:
+    station_analytics_t _table[ANALYTICS_MAX_STATIONS];
+    int _current = -1;                // entry of the station tuned
+    uint16_t _sinceFlush = 0;
+    uint32_t _logBytes = 0;
+    uint32_t _replayed = 0;           // records read at boot
+    uint32_t _badRecords = 0;         // failed their CRC at boot
+    uint32_t _compactions = 0;
+    uint32_t _writeFailures = 0;
+    portMUX_TYPE _mux = portMUX_INITIALIZER_UNLOCKED;
+    SemaphoreHandle_t _fileLock = nullptr; // the log files, _logBytes and the compaction counts
+
+    int indexOf(uint32_t key);
+    int slotFor(uint32_t key, station_analytics_t *evicted = nullptr);
+    void logEvicted(const station_analytics_t &entry);
+    void replay();
+    void compact();
+    void finishCompaction();
+    bool append(File &file, uint32_t key, AnalyticsRecordType type, const void *data, size_t len);
+    void apply(const analytics_record_t &record);
+    static void add(analytics_counts_t &to, const analytics_counts_t &from);
+};
+
+extern StationAnalytics_ &stationAnalytics;
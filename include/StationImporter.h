@@ -0,0 +1,145 @@
+#pragma once
+
+#include <Arduino.h>
+#include <ESPAsyncWebServer.h>
+#include "JsonStreamWriter.h"
+
+// ----------------------------------------------------------------------------------------------------
+// ---------------------------------------- Station list import ---------------------------------------
+// ----------------------------------------------------------------------------------------------------
+//
+// Imports M3U, PLS and JSON station lists into the station store as they arrive, a body chunk at a
+// time, so a list of any size goes through a fixed ~1KB of parser state and is never held whole.
+// Each station is written to the store as soon as its last field has been parsed.
+//
+//  - M3U:  #EXTINF names the next URL line; bare URL lines are named after the URL
+//  - PLS:  FileN / TitleN pairs, in any order within an entry
+//  - JSON: any object with a "name" and a "url" or "url_resolved" string - a radio-browser.info
+//          dump, or an array in the stations.json format. Only the primary URL is imported.
+//
+// The format comes from the request's format argument, then the uploaded file's extension, then the
+// first characters of the data.
+//
+// Duplicates are found by primary URL hash. The hashes of the stations already in the store are read
+// into a sorted array when an import starts - 4 bytes per station - and each imported station is
+// added to it. The store's tail also grows, 20 bytes per station added, until the store folds it
+// into its index after the import. Only http:// and https:// URLs are taken.
+//
+// Only one import runs at a time. One that has seen no data for IMPORT_STALE_MS, e.g. because the
+// upload was abandoned, is given up when the next starts.
+//
+// ----------------------------------------------------------------------------------------------------
+
+#define IMPORT_LINE_MAX 512                 // M3U/PLS line or JSON string, longer ones are skipped
+#define IMPORT_NAME_MAX 96
+#define IMPORT_URL_MAX 256
+#define IMPORT_KEY_MAX 16                   // JSON keys, only short ones are of interest
+#define IMPORT_JSON_DEPTH 32
+#define IMPORT_HASH_STEP 512                // duplicate hashes the array grows by
+#define IMPORT_STALE_MS 15000
+
+enum ImportFormat {
+  IMPORT_FORMAT_UNKNOWN,
+  IMPORT_FORMAT_M3U,
+  IMPORT_FORMAT_PLS,
+  IMPORT_FORMAT_JSON
+};
+
+class StationImporter_ {
+  private:
+    StationImporter_() {}
+
+  public:
+    static StationImporter_ &getInstance(); // Accessor for singleton instance
+
+    StationImporter_(const StationImporter_ &) = delete; // no copying
+    StationImporter_ &operator=(const StationImporter_ &) = delete;
+
+  public:
+    // From the body or upload callback of request. start() is false if another import is running
+    // or there isn't the memory for the duplicate hashes.
+    bool start(AsyncWebServerRequest *request, ImportFormat format);
+    void feed(AsyncWebServerRequest *request, const uint8_t *data, size_t len);
+    void finish(AsyncWebServerRequest *request);
+
+    bool isRunning();
+    bool isOwner(AsyncWebServerRequest *request) { return _owner == request; }
+
+    // The running or last import, as members of the object being written
+    void writeJson(JsonStreamWriter &json);
+
+    // From a format argument ("m3u", "pls", "json") or a file name
+    static ImportFormat formatFor(const String &name);
+    static const char *formatName(ImportFormat format);
+
+  private:
+    AsyncWebServerRequest *_owner = nullptr;
+    bool _active = false;
+    const char *_status = "Idle";
+    ImportFormat _format = IMPORT_FORMAT_UNKNOWN;
+
+    // Results
+    uint32_t _bytes = 0;
+    uint32_t _parsed = 0;
+    uint32_t _added = 0;
+    uint32_t _duplicates = 0;
+    uint32_t _invalid = 0;            // no usable URL, or a line too long
+    uint32_t _failed = 0;             // the store couldn't take it
+    uint32_t _startedAt = 0;
+    uint32_t _lastFeedAt = 0;
+    uint32_t _elapsedMs = 0;
+    uint32_t _heapAtStart = 0;
+    uint32_t _peakHeapUsed = 0;
+    uint32_t _minFreeHeap = 0;
+    bool _full = false;
+
+    // Duplicate detection - sorted primary URL hashes
+    uint32_t *_hashes = nullptr;
+    uint32_t _hashCount = 0;
+    uint32_t _hashCapacity = 0;
+    uint32_t _hashBytes = 0;          // the most the array took
+
+    // Parser
+    bool _sniffed = false;
+    bool _sniffBracket = false;       // saw '[' first - PLS or a JSON array
+    char _buf[IMPORT_LINE_MAX];       // the line, or the JSON string being read
+    uint16_t _bufLen = 0;
+    bool _bufOverflow = false;
+    char _name[IMPORT_NAME_MAX];
+    char _url[IMPORT_URL_MAX];        // "-" if it was too long
+
+    // PLS
+    int _plsEntry = -1;
+
+    // JSON
+    uint8_t _depth = 0;
+    uint32_t _objectMask = 0;         // bit n set if depth n+1 is an object
+    bool _inString = false;
+    bool _escape = false;
+    uint8_t _unicodeLeft = 0;
+    uint16_t _unicode = 0;
+    bool _expectKey = false;
+    char _key[IMPORT_KEY_MAX];
+    uint8_t _recordDepth = 0;         // depth of the object the name and URL belong to, 0 if none
+    bool _urlResolved = false;
+
+    void reset();
+    void sampleHeap();
+    bool loadHashes();
+    bool findHash(uint32_t hash, uint32_t &pos);
+    void addHash(uint32_t hash, uint32_t pos);
+    void clearEntry();
+    void emit(const char *name, const char *url);
+
+    void sniff(char c);
+    void dispatch(char c);
+    void lineChar(char c);
+    void endLine();
+    void m3uLine(char *line);
+    void plsLine(char *line);
+    void jsonChar(char c);
+    void jsonAppend(char c);
+    void jsonString();
+};
+
+extern StationImporter_ &stationImporter;
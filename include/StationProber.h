@@ -0,0 +1,138 @@
+#pragma once
+
+#include <Arduino.h>
+#include <WiFi.h>
+#include "Configuration.h"
+#include "JsonStreamWriter.h"
+
+// ----------------------------------------------------------------------------------------------------
+// ------------------------------------ Background station prober -------------------------------------
+// ----------------------------------------------------------------------------------------------------
+//
+// A low priority task on core 0 checks the station list before anyone tunes to it. One URL at a
+// time, oldest result first, it opens the stream the way the player would (through the resolver's
+// cached address), reads the response headers and up to PROBER_READ_BYTES of audio until
+// PROBER_FRAMES MP3 frames in a row turn up, and closes again. What it keeps per URL:
+//
+//  - whether it answered, the HTTP status and the connect time
+//  - the codec, from the Content-Type and the frames themselves
+//  - the bitrate, from the frame headers or icy-br
+//  - time to first audio: request to the first confirmed frame, which is what a tune would cost
+//
+// A station is dead when every one of its URLs failed its last probe, and unsupported when the best
+// any of them did was serve audio we can't decode. The menu marks both, and /api/stations and
+// /api/probe report the results. Connects also go into StreamHealth, so failover ranks mirrors by
+// what the prober saw as well as what playback saw.
+//
+// Probing must never cost the stream anything. Only one probe runs at a time, at most one every
+// PROBER_GAP_MS. While a stream plays, a probe only starts with at least PROBER_MIN_BUFFER_MS of
+// audio in the buffer, never during a reconnect, resolve or tier switch, and within an hourly byte
+// budget. Results are kept in RAM only - a reboot probes again, starting PROBER_START_DELAY_MS in.
+//
+// ----------------------------------------------------------------------------------------------------
+
+#define PROBER_TABLE_SIZE (MAX_STATIONS * (MAX_STATION_URLS + MAX_STATION_TIERS))
+#define PROBER_START_DELAY_MS 30000         // leave boot and the first tune alone
+#define PROBER_GAP_MS 15000                 // between probes
+#define PROBER_INTERVAL_MS (30 * 60 * 1000UL)   // probe each URL again after this long
+#define PROBER_READ_BYTES 8192              // audio read per probe, at most
+#define PROBER_FRAMES 3                     // frames in a row that show the stream decodes
+#define PROBER_CONNECT_TIMEOUT_MS 4000
+#define PROBER_READ_TIMEOUT_MS 3000
+#define PROBER_MIN_BUFFER_MS 8000           // while playing, don't probe with less audio than this buffered
+#define PROBER_PLAYING_BYTES_PER_HOUR (512 * 1024UL)
+#define PROBER_TASK_STACK 6144
+
+enum ProbeCodec {
+  PROBE_CODEC_UNKNOWN,
+  PROBE_CODEC_MP3,
+  PROBE_CODEC_AAC,
+  PROBE_CODEC_OGG,
+  PROBE_CODEC_OTHER
+};
+
+enum ProbeState {
+  PROBE_STATE_UNKNOWN,              // not probed yet
+  PROBE_STATE_OK,
+  PROBE_STATE_UNSUPPORTED,          // answers, but not with anything we can play
+  PROBE_STATE_DEAD
+};
+
+typedef struct {
+  String url;
+  bool wanted;                      // still in the station list
+  ProbeState state;
+  ProbeCodec codec;
+  int16_t status;                   // HTTP status, -1 if there was no response
+  uint16_t kbps;                    // 0 if unknown
+  uint32_t connectMs;
+  uint32_t firstAudioMs;            // request to first confirmed frame, 0 if none
+  uint32_t bytes;                   // read by the probe
+  uint32_t probedAt;                // millis(), 0 if never probed
+} probe_result_t;
+
+class StationProber_ {
+  private:
+    StationProber_() {}
+
+  public:
+    static StationProber_ &getInstance(); // Accessor for singleton instance
+
+    StationProber_(const StationProber_ &) = delete; // no copying
+    StationProber_ &operator=(const StationProber_ &) = delete;
+
+  public:
+    void begin();
+
+    // Call after the station list changes
+    void refresh();
+
+    // Ask the task to look now
+    void wake();
+
+    // Once a second from the player: is a stream using the link, and how much audio is buffered
+    void notePlayback(bool playing, bool busy, uint32_t bufferedMs);
+
+    // Best state over a station's URLs and tiers
+    ProbeState stationState(int stationIdx);
+
+    // True once after any station's state has changed - e.g. to rebuild the menu
+    bool takeChanged();
+
+    // The result for the station's best URL, as a "probe" member (null if none yet)
+    void writeStationJson(JsonStreamWriter &json, int stationIdx);
+    void writeJson(JsonStreamWriter &json);
+
+    static const char *stateName(ProbeState state);
+
+  private:
+    probe_result_t _results[PROBER_TABLE_SIZE];
+    SemaphoreHandle_t _lock = nullptr;
+    TaskHandle_t _task = nullptr;
+    volatile bool _changed = false;
+
+    // Playback, from the main loop
+    volatile bool _playing = false;
+    volatile bool _busy = false;
+    volatile uint32_t _bufferedMs = 0;
+
+    // Task only
+    uint32_t _lastProbeAt = 0;
+    uint32_t _budgetSince = 0;
+    uint32_t _budgetUsed = 0;         // bytes read while playing, this hour
+
+    static void proberTask(void *param);
+    bool mayProbe();
+    int pickNext(String &url);
+    void probe(const String &url);
+    static ProbeCodec codecFor(const String &contentType);
+    static const char *codecName(ProbeCodec codec);
+    static uint8_t countFrames(const uint8_t *data, uint32_t len, uint16_t &kbps);
+    int findResult(const String &url);
+    int addResult(const String &url);
+    void want(const String &url);
+    int bestResult(int stationIdx);
+    void writeResult(JsonStreamWriter &json, const probe_result_t &result, uint32_t now);
+};
+
+extern StationProber_ &stationProber;
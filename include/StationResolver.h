@@ -0,0 +1,93 @@
+#pragma once
+
+#include <Arduino.h>
+#include <WiFi.h>
+#include <HTTPClient.h>
+#include "Configuration.h"
+#include "JsonStreamWriter.h"
+
+// ----------------------------------------------------------------------------------------------------
+// ----------------------------------- Station URL resolver cache -------------------------------------
+// ----------------------------------------------------------------------------------------------------
+//
+// A low priority task on core 0 works through the station list in the background. For each URL -
+// mirrors included, so a failover starts as quickly as the primary would - it follows HTTP
+// redirects and .pls/.m3u playlists to the URL that actually serves audio and resolves that host.
+// The result is cached for RESOLVER_TTL_MS, so a retune or reconnect can start on the final URL
+// without the redirect and playlist round trips, with the host already in lwIP's DNS cache.
+//
+// lwIP doesn't hand out DNS TTLs, so one fixed TTL covers both the address and the URL chain. An
+// entry is also dropped when a stream started from it fails, so a moved stream is picked up on the
+// reconnect.
+//
+// ----------------------------------------------------------------------------------------------------
+
+#define RESOLVER_CACHE_SIZE (MAX_STATIONS * (MAX_STATION_URLS + MAX_STATION_TIERS) + 2)
+#define RESOLVER_TTL_MS (30 * 60 * 1000UL)
+#define RESOLVER_CHECK_MS 60000             // how often the task looks for stale entries
+#define RESOLVER_MAX_HOPS 5                 // redirects + playlists followed per URL
+#define RESOLVER_HTTP_TIMEOUT_MS 5000
+#define RESOLVER_PLAYLIST_MAX_BYTES 4096
+#define RESOLVER_TASK_STACK 6144
+
+typedef struct {
+  String url;                       // as stored in the station list
+  String finalUrl;                  // where the audio actually comes from
+  IPAddress ip;                     // of the final host
+  uint32_t resolvedAt;              // millis(), 0 if never resolved
+  uint32_t resolveMs;               // what the last resolution cost - saved on every hit
+  uint8_t hops;                     // redirects and playlists followed
+  uint32_t attemptedAt;             // millis() of the last try, successful or not
+  bool valid;
+  bool wanted;                      // still in the station list or asked for directly
+  bool urgent;                      // a play is waiting on it
+} resolver_entry_t;
+
+class StationResolver_ {
+  private:
+    StationResolver_() {}
+
+  public:
+    static StationResolver_ &getInstance(); // Accessor for singleton instance
+
+    StationResolver_(const StationResolver_ &) = delete; // no copying
+    StationResolver_ &operator=(const StationResolver_ &) = delete;
+
+  public:
+    void begin();
+
+    // Call after the station list changes
+    void refresh();
+
+    // Ask the task to look now, e.g. when WiFi comes up
+    void wake();
+
+    // Fresh cache entry for url? Counts a hit or a miss.
+    bool lookup(const String &url, String &finalUrl, IPAddress &ip, bool count = true);
+
+    // Resolve url as soon as possible, for a play that is waiting on it
+    void resolveNow(const String &url);
+    bool isResolved(const String &url);
+
+    // A stream from this entry failed - resolve it again next time
+    void invalidate(const String &url);
+
+    static bool looksLikePlaylist(const String &url);
+
+    void writeJson(JsonStreamWriter &json);
+
+  private:
+    resolver_entry_t _entries[RESOLVER_CACHE_SIZE];
+    SemaphoreHandle_t _lock = nullptr;
+    TaskHandle_t _task = nullptr;
+
+    static void resolverTask(void *param);
+    void resolveStale();
+    bool resolveUrl(const String &url, String &finalUrl, IPAddress &ip, uint8_t &hops, uint32_t &savedMs);
+    bool readPlaylistEntry(HTTPClient &http, String &entry);
+    int findEntry(const String &url);
+    int addEntry(const String &url);
+    void want(const String &url);
+};
+
+extern StationResolver_ &stationResolver;
@@ -0,0 +1,175 @@
+#pragma once
+
+#include <Arduino.h>
+#include <FS.h>
+#include "Configuration.h"
+#include "StorageTypes.h"
+#include "JsonStreamWriter.h"
+
+// ----------------------------------------------------------------------------------------------------
+// ------------------------------------------ Station store -------------------------------------------
+// ----------------------------------------------------------------------------------------------------
+//
+// The station directory, on SPIFFS, for far more stations than the MAX_STATIONS presets in the menu.
+// Nothing is ever loaded whole and nothing is ever rewritten whole on an add:
+//
+//  - records.bin: one fixed-size store_record_t per station, so station id N is at N * 24
+//  - strings.bin: an append-only heap with each station's name, URLs and tier URLs, NUL separated
+//  - index.bin:   store_index_entry_t sorted by a folded name key - binary searched and paged
+//                 straight from flash
+//  - tail.bin:    stations added since the index was last rebuilt, each with its rank in index.bin
+//                 so paging can merge them in without searching
+//  - deleted.bin: ids deleted from index.bin since it was last rebuilt, up to STORE_DELETED_MAX
+//
+// An add appends one tail entry, then the strings and the record; the record is what commits it, and
+// a tail entry left without one by a reset is dropped at boot. Once the tail reaches STORE_TAIL_MAX,
+// maintain() on the main loop rebuilds index.bin by merging it with the tail in one sequential pass,
+// which also drops the deleted ids. It waits while an import is running, and the tail grows meanwhile
+// (in PSRAM where there is some), so the web server's task never stalls on a rebuild mid-import; only
+// a tail that reaches STORE_TAIL_GROW_MAX is rebuilt there and then. A full deleted list is rebuilt
+// straight away. The rebuilt index is written to index.tmp and renamed to index.new once it is
+// complete; begin() finishes a rebuild that a reset interrupted after that point and throws away one
+// interrupted before it.
+//
+// Because index.bin is sorted by name key, it is also the search index: the stations whose name
+// starts with a query are one range of it, found by two binary searches, plus any tail entries that
+// match. search() takes the range of the previous query back, so each character typed only searches
+// within what the last one found.
+//
+// RAM use is the tail and the deleted list - about 1.5KB - however many stations there are, plus
+// 20 bytes for each station added since the last rebuild while an import is running. Ids are
+// record numbers and never reused, so they are safe to keep elsewhere. The name key is the first
+// STORE_KEY_LEN letters and digits of the name, lower case; names that share a key are listed in
+// the order they were added.
+//
+// ----------------------------------------------------------------------------------------------------
+
+#define STORE_RECORDS_FILE "/stations/records.bin"
+#define STORE_STRINGS_FILE "/stations/strings.bin"
+#define STORE_INDEX_FILE "/stations/index.bin"
+#define STORE_INDEX_TMP_FILE "/stations/index.tmp"
+#define STORE_INDEX_NEW_FILE "/stations/index.new"
+#define STORE_TAIL_FILE "/stations/tail.bin"
+#define STORE_DELETED_FILE "/stations/deleted.bin"
+
+#define STORE_KEY_LEN 12
+#define STORE_TAIL_MAX 64                 // adds between index rebuilds
+#define STORE_TAIL_GROW_MAX 8192          // the most the tail grows to while maintain() can't run
+#define STORE_TAIL_GROW_MAX_SRAM 1024     // the same without PSRAM
+#define STORE_TAIL_STEP 256               // tail entries the array grows by
+#define STORE_REBUILD_RETRY_MS 60000UL    // after maintain() failed to rebuild
+#define STORE_DELETED_MAX 64              // deletes between index rebuilds
+#define STORE_STRINGS_MAX 1024            // name and URLs of one station
+#define STORE_PAGE_MAX 50
+#define STORE_READ_CHUNK 16               // index entries read at a time while paging
+#define STORE_NAME_READ 64                // bytes read for a name on its own - longer ones are cut
+
+#define STATION_ID_NONE 0xFFFFFFFFUL
+#define STORE_CURSOR_END 0xFFFFFFFFUL
+
+#define STORE_FLAG_DELETED 0x01
+
+typedef struct __attribute__((packed)) {
+  uint32_t stringsOffset;
+  uint16_t stringsLength;
+  uint8_t flags;
+  uint8_t urlCount;
+  uint8_t tierCount;
+  uint8_t reserved[3];
+  uint16_t tierKbps[MAX_STATION_TIERS];
+  uint32_t urlHash;                 // of the primary URL, for finding duplicates
+} store_record_t;
+
+typedef struct __attribute__((packed)) {
+  char key[STORE_KEY_LEN];          // folded name, zero padded
+  uint32_t id;
+} store_index_entry_t;
+
+// Where the last search() ended up, so the next one can start from there
+typedef struct {
+  char key[STORE_KEY_LEN];
+  uint8_t keyLen = 0;
+  uint32_t lo = 0;                  // index.bin range with that key prefix
+  uint32_t hi = 0;
+  uint32_t rebuild = UINT32_MAX;    // index rebuild the range belongs to
+} store_search_t;
+
+typedef struct __attribute__((packed)) {
+  store_index_entry_t entry;
+  uint32_t rank;                    // entries of index.bin that sort before it
+} store_tail_entry_t;
+
+class StationStore_ {
+  private:
+    StationStore_() {}
+
+  public:
+    static StationStore_ &getInstance(); // Accessor for singleton instance
+
+    StationStore_(const StationStore_ &) = delete; // no copying
+    StationStore_ &operator=(const StationStore_ &) = delete;
+
+  public:
+    // After SPIFFS is mounted and the presets are loaded. An empty store starts with the presets.
+    bool begin();
+    bool isReady() { return _lock != nullptr; }
+
+    // Id of the new station, STATION_ID_NONE if it couldn't be stored
+    uint32_t add(const station_t &station);
+    bool get(uint32_t id, station_t &station);
+    bool remove(uint32_t id);
+    uint32_t count();
+
+    // Up to max primary URL hashes of the stations, e.g. to find duplicates. Returns how many.
+    uint32_t urlHashes(uint32_t *hashes, uint32_t max);
+
+    // Up to max ids in name order from cursor (0 for the start). Returns the cursor for the next
+    // page, STORE_CURSOR_END after the last.
+    uint32_t page(uint32_t cursor, uint32_t *ids, uint8_t max, uint8_t &got);
+
+    // Up to max ids, in name order, of stations whose name starts with query. Case, spaces and
+    // punctuation are ignored. Pass the same state along while a query is typed. more is set if
+    // there were more matches than max.
+    uint8_t search(const String &query, uint32_t *ids, uint8_t max, store_search_t &state, bool &more);
+
+    // Just the names of some stations, reading each file once. Deleted ones come back empty.
+    void getNames(const uint32_t *ids, uint8_t count, String *names);
+
+    // Main loop, when no import is running: rebuild the index once the tail reaches STORE_TAIL_MAX
+    void maintain();
+
+    // Counts and sizes, as members of the object being written
+    void writeJson(JsonStreamWriter &json);
+
+    static void makeKey(const String &name, char *key);
+    // Letters and digits of a name, lower case - the whole of it, where a key stops at STORE_KEY_LEN
+    static String fold(const String &name);
+
+  private:
+    SemaphoreHandle_t _lock = nullptr;
+    uint32_t _recordCount = 0;
+    uint32_t _indexCount = 0;
+    store_tail_entry_t *_tail = nullptr;        // sorted
+    uint32_t _tailCount = 0;
+    uint32_t _tailCapacity = 0;
+    uint32_t _deleted[STORE_DELETED_MAX];
+    uint8_t _deletedCount = 0;
+    uint32_t _rebuilds = 0;
+    uint32_t _maintainAfter = 0;
+
+    void recover();
+    void loadTail();
+    void loadDeleted();
+    bool growTail();
+    void shrinkTail();
+    bool rebuildIndex();
+    void finishRebuild();
+    bool saveTail();
+    uint32_t rankInIndex(File &index, const store_index_entry_t &entry, bool &found);
+    uint32_t prefixBound(File &index, uint32_t lo, uint32_t hi, const char *prefix, uint8_t len, bool upper);
+    bool readRecord(uint32_t id, store_record_t &record);
+    bool isDeleted(uint32_t id);
+    static int compare(const store_index_entry_t &a, const store_index_entry_t &b);
+};
+
+extern StationStore_ &stationStore;
@@ -5,15 +5,34 @@
 #pragma once
 
 #include <Arduino.h>
+#include "Configuration.h"
 
 // ------------------------ Types ------------------------
 
+#define WIFI_DEFAULT_PRIORITY 1
+
+// A remembered WiFi network. Higher priority is preferred when several are in range.
+typedef struct {
+  String ssid;
+  String password;
+  uint8_t priority;
+} wifi_credential_t;
+
 // Used for holding the config set
 typedef struct {
-  String WiFiSSID;
+  String WiFiSSID;                  // last network connected to
   String WiFiPassword;
   bool WifiOnAtStart;
 
+  // Dead air detection, see SilenceDetector.h
+  int silenceAction;
+  int silenceThresholdDb;
+  int silenceSeconds;
+  int stallSeconds;
+
+  wifi_credential_t wifiCredentials[MAX_WIFI_CREDENTIALS];
+  uint8_t wifiCredentialCount = 0;
+
   String counterValuesZIN70;
   String counterValuesZIN18;
   int tubeType;
@@ -24,7 +43,13 @@ typedef struct {
 // Station entry for the station list
 typedef struct {
   String name;
-  String url;
+  String urls[MAX_STATION_URLS];    // primary first, then mirrors
+  uint8_t urlCount = 0;
+  // Optional bitrate variants of the same channel, lowest first. With two or more the station plays
+  // these, picked by the bitrate controller, instead of urls.
+  uint16_t tierKbps[MAX_STATION_TIERS];
+  String tierUrls[MAX_STATION_TIERS];
+  uint8_t tierCount = 0;
 } station_t;
 
 typedef struct {
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <Arduino.h>
+#include "JsonStreamWriter.h"
+
+// ----------------------------------------------------------------------------------------------------
+// ------------------------------------- Stream throughput bench --------------------------------------
+// ----------------------------------------------------------------------------------------------------
+//
+// Pulls a stream as fast as it will come for a few seconds, without decoding it, and records what
+// arrived. Runs either our AudioFileSourceRadioStream or the library's AudioFileSourceICYStream so
+// the two can be compared against the same server - normally scripts/stream_server.py on the LAN.
+// Runs in its own task on core 0; stop the radio first or the two streams share the link.
+//
+// ----------------------------------------------------------------------------------------------------
+
+#define BENCH_MAX_SECONDS 60
+#define BENCH_READ_BYTES 4096             // per read, about what the stream buffer asks for
+#define BENCH_TASK_STACK 6144
+
+enum BenchClient {
+  BENCH_CLIENT_NATIVE,              // AudioFileSourceRadioStream
+  BENCH_CLIENT_ICY                  // ESP8266Audio's AudioFileSourceICYStream
+};
+
+typedef struct {
+  BenchClient client;
+  String url;
+  uint16_t seconds;
+  bool opened;
+  uint32_t connectMs;               // open() including redirects
+  uint32_t bytes;                   // audio bytes, metadata stripped
+  uint32_t elapsedMs;
+  uint32_t stalls;                  // reads that came back empty
+  uint32_t maxGapMs;                // longest wait between reads that returned data
+  uint8_t redirects;
+  bool chunked;
+  uint32_t metaInt;
+  bool tls;
+  uint32_t handshakeMs;
+  bool resumed;
+  uint32_t cpuUsPerMbit;            // TLS decrypt cost
+} bench_result_t;
+
+class StreamBench_ {
+  private:
+    StreamBench_() {}
+
+  public:
+    static StreamBench_ &getInstance(); // Accessor for singleton instance
+
+    StreamBench_(const StreamBench_ &) = delete; // no copying
+    StreamBench_ &operator=(const StreamBench_ &) = delete;
+
+  public:
+    // False if a run is already going or the task can't start
+    bool start(const String &url, uint16_t seconds, BenchClient client);
+    bool isRunning() { return _running; }
+
+    // The current or last run
+    void writeJson(JsonStreamWriter &json);
+
+  private:
+    bench_result_t _result;
+    volatile bool _running = false;
+
+    static void benchTask(void *param);
+    void run();
+};
+
+extern StreamBench_ &streamBench;
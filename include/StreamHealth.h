@@ -0,0 +1,76 @@
+#pragma once
+
+#include <Arduino.h>
+#include "Configuration.h"
+#include "JsonStreamWriter.h"
+
+// ----------------------------------------------------------------------------------------------------
+// ------------------------------------- Stream URL health table --------------------------------------
+// ----------------------------------------------------------------------------------------------------
+//
+// Every station URL (primary and mirrors) gets a small record, keyed by a hash of the URL: smoothed
+// connect time, time to first audio, connect failure rate and early drop rate. The records make a
+// score from 0 (useless) to 100, which orders a station's URLs when it starts playing and when it
+// fails over. The table is a single NVS blob, written at most once a minute and only after it has
+// changed, so what we learn about a bad mirror survives a restart.
+//
+// ----------------------------------------------------------------------------------------------------
+
+#define HEALTH_TABLE_SIZE (MAX_STATIONS * (MAX_STATION_URLS + MAX_STATION_TIERS) + 4)
+#define HEALTH_UNKNOWN_SCORE 50           // URLs we have never tried
+#define HEALTH_DROP_WINDOW_MS (10 * 60 * 1000UL)   // a stream that dies sooner than this counts as a drop
+#define HEALTH_TABLE_VERSION 1
+
+typedef struct {
+  uint32_t urlHash;                 // 0 for a free slot
+  uint16_t connectMs;               // smoothed, open() including redirects and TLS
+  uint16_t firstAudioMs;            // smoothed, stream start to first decoded sample
+  uint8_t failRate;                 // smoothed, 255 = every connect failed
+  uint8_t dropRate;                 // smoothed, 255 = every stream dropped within HEALTH_DROP_WINDOW_MS
+  uint8_t samples;                  // connects seen, saturates
+  uint8_t reserved;
+  uint32_t lastUsed;                // use sequence number, for eviction
+} stream_health_t;
+
+class StreamHealth_ {
+  private:
+    StreamHealth_() {}
+
+  public:
+    static StreamHealth_ &getInstance(); // Accessor for singleton instance
+
+    StreamHealth_(const StreamHealth_ &) = delete; // no copying
+    StreamHealth_ &operator=(const StreamHealth_ &) = delete;
+
+  public:
+    void begin();
+    static uint32_t hashUrl(const String &url);
+
+    // Safe from any task
+    void noteConnect(uint32_t hash, bool ok, uint32_t connectMs);
+    void noteFirstAudio(uint32_t hash, uint32_t ms);
+    void noteEnd(uint32_t hash, uint32_t playedMs, bool failed);
+
+    uint8_t score(uint32_t hash);
+    // Indexes of urls, best score first; equal scores keep the configured order
+    void rank(const String *urls, uint8_t count, uint8_t *order);
+
+    // Main loop, once a minute
+    void saveIfDirty();
+
+    // Every station URL with its record
+    void writeJson(JsonStreamWriter &json);
+
+  private:
+    stream_health_t _table[HEALTH_TABLE_SIZE];
+    uint32_t _useCounter = 0;
+    bool _dirty = false;
+    portMUX_TYPE _mux = portMUX_INITIALIZER_UNLOCKED;
+
+    int find(uint32_t hash);
+    int findOrAdd(uint32_t hash);
+    static uint8_t scoreOf(const stream_health_t &entry);
+    void writeUrl(JsonStreamWriter &json, const String &url);
+};
+
+extern StreamHealth_ &streamHealth;
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <Arduino.h>
+#include "mbedtls/ssl.h"
+#include "mbedtls/entropy.h"
+#include "mbedtls/ctr_drbg.h"
+
+// ----------------------------------------------------------------------------------------------------
+// ------------------------------------------ Stream TLS ----------------------------------------------
+// ----------------------------------------------------------------------------------------------------
+//
+// mbedTLS over an already connected socket, for https:// streams. AES, SHA and bignum run on the
+// ESP32's crypto accelerators when the framework is built with them (the Arduino core is), so
+// there's nothing to switch on here.
+//
+// The session from each handshake is kept per host:port (TLS_SESSION_CACHE_SIZE of them), and the
+// next connection offers it back - as a session ticket where the server issues them, otherwise by
+// session ID. A resumed handshake skips the certificate exchange and key agreement.
+//
+// Records are decrypted straight into the caller's buffer. The time spent in mbedtls_ssl_read(),
+// less the time waiting on the socket, is counted as decrypt cost so /metrics can show CPU per Mbit.
+//
+// Certificates are not verified: stream audio is public and carries no credentials, and the device
+// has no CA store. TLS here keeps streams working as broadcasters drop plain HTTP.
+//
+// ----------------------------------------------------------------------------------------------------
+
+#define TLS_SESSION_CACHE_SIZE 4
+
+class StreamTls {
+  public:
+    StreamTls() {}
+    ~StreamTls() { end(); }
+
+    StreamTls(const StreamTls &) = delete; // no copying
+    StreamTls &operator=(const StreamTls &) = delete;
+
+    // Handshake on fd, offering any saved session for host:port
+    bool begin(int fd, const String &host, uint16_t port, uint32_t timeoutMs);
+    void end();
+    bool isActive() { return _active; }
+
+    // Same contract as a socket read: bytes read, 0 for none yet, -1 once closed
+    int read(uint8_t *dst, uint32_t len, bool block);
+    bool write(const uint8_t *data, uint32_t len);
+    // Plaintext buffered, or record bytes on the socket
+    bool dataWaiting();
+
+    uint32_t getHandshakeMs() { return _handshakeMs; }
+    bool wasResumed() { return _resumed; }
+    // Decrypt CPU per Mbit of plaintext on this connection, 0 until there's data
+    uint32_t getCpuUsPerMbit();
+
+    // Which crypto accelerators this build uses, e.g. "aes,sha,mpi"
+    static String hardwareCrypto();
+
+  private:
+    mbedtls_ssl_context _ssl;
+    mbedtls_ssl_config _conf;
+    mbedtls_entropy_context _entropy;
+    mbedtls_ctr_drbg_context _drbg;
+    bool _active = false;
+
+    int _fd = -1;
+    bool _block = true;
+    int64_t _recvUs = 0;                  // time in recv() during the current mbedtls call
+
+    uint32_t _handshakeMs = 0;
+    bool _resumed = false;
+    uint64_t _cpuUs = 0;
+    uint64_t _bytes = 0;
+
+    static int bioSend(void *ctx, const unsigned char *buf, size_t len);
+    static int bioRecv(void *ctx, unsigned char *buf, size_t len);
+};
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <Arduino.h>
+#include "JsonStreamWriter.h"
+
+// ----------------------------------------------------------------------------------------------------
+// ------------------------------------- FreeRTOS task profiler ---------------------------------------
+// ----------------------------------------------------------------------------------------------------
+//
+// Sampled once a second from the main loop. Each sample takes a uxTaskGetSystemState() snapshot and
+// turns the run time counter deltas into per-task CPU % (of one core) and per-core idle %, alongside
+// the stack high-water mark of every task. Served at /api/tasks.
+//
+// The audio task and core 1 are watched: each sample where the audio task's stack margin or core 1's
+// idle time is under its threshold bumps a warning counter in the metrics registry.
+//
+// ----------------------------------------------------------------------------------------------------
+
+#define PROFILER_MAX_TASKS 24
+#define PROFILER_AUDIO_TASK_NAME "audio"
+#define PROFILER_AUDIO_STACK_MIN_BYTES 512          // warn when less than this is left
+#define PROFILER_CORE1_IDLE_MIN_PERMILLE 100        // warn when core 1 is idle less than 10%
+
+typedef struct {
+  TaskHandle_t handle;
+  char name[configMAX_TASK_NAME_LEN];
+  int8_t core;                                      // -1 if not pinned
+  uint8_t priority;
+  uint8_t state;                                    // eTaskState
+  uint32_t stackFree;                               // bytes, lowest seen
+  uint32_t runTime;                                 // counter at the last sample
+  uint16_t cpuPermille;                             // over the last sample period
+} task_profile_t;
+
+class TaskProfiler_ {
+  private:
+    TaskProfiler_() {}
+
+  public:
+    static TaskProfiler_ &getInstance(); // Accessor for singleton instance
+
+    TaskProfiler_(const TaskProfiler_ &) = delete; // no copying
+    TaskProfiler_ &operator=(const TaskProfiler_ &) = delete;
+
+  public:
+    // Called once per second from the main loop
+    void sample();
+    void writeJson(JsonStreamWriter &json);
+
+    // Per mille, -1 until two samples have been taken
+    int getCoreIdlePermille(int core) { return _idlePermille[core]; }
+
+  private:
+    task_profile_t _tasks[PROFILER_MAX_TASKS];
+    uint8_t _taskCount = 0;
+    uint32_t _lastTotalRunTime = 0;
+    uint32_t _samplePeriod = 0;                      // run time counter ticks
+    int16_t _idlePermille[portNUM_PROCESSORS] = {-1, -1};
+    uint32_t _samples = 0;
+
+    // The web handler reads the table from the async_tcp task
+    portMUX_TYPE _mux = portMUX_INITIALIZER_UNLOCKED;
+
+    const task_profile_t* findTask(TaskHandle_t handle);
+    void checkThresholds();
+};
+
+extern TaskProfiler_ &taskProfiler;
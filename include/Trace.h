@@ -0,0 +1,132 @@
+#pragma once
+
+#include <Arduino.h>
+#include <atomic>
+#include "Configuration.h"
+
+// ----------------------------------------------------------------------------------------------------
+// -------------------------------------- Event tracing -----------------------------------------------
+// ----------------------------------------------------------------------------------------------------
+//
+// Begin/end/instant events with 64-bit microsecond timestamps, recorded into one ring per core so
+// that a stutter can be lined up against whatever else was running at the time. The rings are
+// dumped at /utils/trace as Chrome Trace Event JSON - open the file in https://ui.perfetto.dev
+//
+// Event names must be string literals: only the pointer is stored.
+//
+// Compiled out unless FEATURE_TRACE is defined in Configuration.h.
+//
+// ----------------------------------------------------------------------------------------------------
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+
+#ifdef FEATURE_TRACE
+#define TRACE_BEGIN(name) trace.record('B', name)
+#define TRACE_END(name) trace.record('E', name)
+#define TRACE_INSTANT(name) trace.record('i', name)
+#define TRACE_SCOPE(name) TraceScope TRACE_CONCAT(_traceScope, __LINE__)(name)
+#else
+#define TRACE_BEGIN(name)
+#define TRACE_END(name)
+#define TRACE_INSTANT(name)
+#define TRACE_SCOPE(name)
+#endif
+
+#ifdef FEATURE_TRACE
+
+#define TRACE_RING_EVENTS 8192              // per core, in PSRAM - must be a power of two
+#define TRACE_RING_EVENTS_SRAM 256          // per core, when there is no PSRAM
+#define TRACE_TASK_NAME_LENGTH 12
+#define TRACE_MAX_THREADS 32                // distinct task/core pairs named in a dump
+#define TRACE_LINE_LENGTH 160
+
+typedef struct {
+  uint64_t ts;                              // esp_timer time, microseconds since boot
+  const char* name;
+  uint32_t tid;                             // task handle
+  volatile uint32_t seq;                    // ring position + 1 once the event is complete
+  char phase;                               // 'B', 'E' or 'i'
+  char task[TRACE_TASK_NAME_LENGTH - 1];    // copied, tasks can be deleted before the dump
+} trace_event_t;
+
+typedef struct {
+  trace_event_t* events;                    // PSRAM
+  std::atomic<uint32_t> head;               // internal RAM - no atomics on PSRAM
+} trace_ring_t;
+
+class Trace_ {
+  private:
+    Trace_();
+
+  public:
+    static Trace_ &getInstance(); // Accessor for singleton instance
+
+    Trace_(const Trace_ &) = delete; // no copying
+    Trace_ &operator=(const Trace_ &) = delete;
+
+  public:
+    // Allocate the rings, recording starts straight away
+    bool begin();
+    void record(char phase, const char* name);
+
+    // Dumping pauses recording so the rings aren't overwritten while they are read.
+    // Returns false if a dump is already running.
+    bool startDump();
+    // Fill callback for a chunked response, returns 0 when done
+    size_t fillDump(uint8_t* buffer, size_t maxLen);
+    // Resume recording, also called if the client goes away mid-dump
+    void endDump();
+
+  private:
+    enum DumpStage {
+      DUMP_STAGE_HEADER,
+      DUMP_STAGE_EVENTS,
+      DUMP_STAGE_THREADS,
+      DUMP_STAGE_FOOTER,
+      DUMP_STAGE_DONE
+    };
+
+    typedef struct {
+      uint32_t tid;
+      uint8_t core;
+      char name[TRACE_TASK_NAME_LENGTH];
+    } trace_thread_t;
+
+    trace_ring_t _rings[portNUM_PROCESSORS];
+    uint32_t _mask = 0;
+    volatile bool _recording = false;
+    volatile bool _dumping = false;
+
+    // Dump cursor, only touched by the async_tcp task
+    DumpStage _stage = DUMP_STAGE_DONE;
+    uint8_t _dumpCore = 0;
+    uint32_t _dumpPos = 0;
+    uint32_t _dumpEnd[portNUM_PROCESSORS];
+    bool _firstEvent = true;
+    trace_thread_t _threads[TRACE_MAX_THREADS];
+    uint8_t _threadCount = 0;
+    uint8_t _threadIndex = 0;
+    char _line[TRACE_LINE_LENGTH];
+    size_t _lineLength = 0;
+    size_t _lineOffset = 0;
+
+    bool nextLine();
+    bool nextEventLine();
+    void noteThread(uint8_t core, const trace_event_t &ev);
+};
+
+extern Trace_ &trace;
+
+// ************************************************************
+// Begin on construction, end when it goes out of scope
+// ************************************************************
+class TraceScope {
+  public:
+    explicit TraceScope(const char* name) : _name(name) { TRACE_BEGIN(_name); }
+    ~TraceScope() { TRACE_END(_name); }
+  private:
+    const char* _name;
+};
+
+#endif
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <Arduino.h>
+#include "Globals.h"
+#include "JsonStreamWriter.h"
+
+// ----------------------------------------------------------------------------------------------------
+// --------------------------------------------- Usage stats ------------------------------------------
+// ----------------------------------------------------------------------------------------------------
+//
+// Counts uptime and play time a minute at a time. Each minute the counters are copied to a small
+// CRC-checked block in RTC slow memory, which keeps its contents through a software, panic or
+// watchdog reset, but not a power cut. They go to flash (the stats record, see ConfigStore) every
+// STATS_COMMIT_MINUTES, and on a restart from the menu or the web.
+//
+// At boot a valid RTC block that is ahead of the stats record is taken over and committed, so after
+// a crash nothing is lost, and after a power cut at most STATS_COMMIT_MINUTES.
+//
+// Flash wear: a commit is one NVS blob write of ~3 entries of 32 bytes. At 96 commits a day that is
+// about 9KB a day, spread over the NVS pages by NVS's own wear levelling - a page erase every couple
+// of days each, where the flash is good for ~100,000.
+//
+// ----------------------------------------------------------------------------------------------------
+
+#define STATS_COMMIT_MINUTES 15
+#define STATS_RTC_MAGIC 0x53545431          // "STT1"
+
+typedef struct {
+  uint32_t magic;
+  uint32_t uptimeMins;
+  uint32_t playtimeMins;
+  uint32_t crc;                     // CRC-32 of the fields before it
+} stats_rtc_t;
+
+class UsageStats_ {
+  private:
+    UsageStats_() {}
+
+  public:
+    static UsageStats_ &getInstance(); // Accessor for singleton instance
+
+    UsageStats_(const UsageStats_ &) = delete; // no copying
+    UsageStats_ &operator=(const UsageStats_ &) = delete;
+
+  public:
+    // After the stats record is loaded
+    void begin();
+
+    // Main loop, once a minute
+    void tick(bool playing);
+
+    // To flash now, e.g. before a restart. False if the save failed. Any task.
+    bool commit();
+
+    // The counters were changed from outside, e.g. restored from a backup. Any task.
+    void sync();
+
+    // Commit and recovery counts, as members of the object being written
+    void writeJson(JsonStreamWriter &json);
+
+  private:
+    uint16_t _sinceCommit = 0;        // minutes counted since the last commit
+    uint32_t _commits = 0;
+    uint32_t _commitFailures = 0;
+    uint32_t _recoveredMins = 0;      // uptime taken over from RTC memory at boot
+    SemaphoreHandle_t _lock = nullptr; // the counters, RTC block and stats record
+
+    void toRtc();
+};
+
+extern UsageStats_ &usageStats;
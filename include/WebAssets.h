@@ -0,0 +1,23 @@
+#pragma once
+
+#include <Arduino.h>
+
+// ************************************************************
+// Gzipped web pages embedded in flash. The table itself is
+// generated at build time by scripts/web_assets.py from the
+// files in web/ (see src/WebAssetData.cpp).
+// ************************************************************
+
+// Browsers revalidate after this with If-None-Match, which costs a 304 only
+#define WEB_ASSET_CACHE_CONTROL "public, max-age=86400"
+
+typedef struct {
+  const char* path;         // URL path, e.g. "/index.html"
+  const char* mimeType;
+  const uint8_t* data;      // gzip stream, PROGMEM
+  size_t length;
+  const char* etag;         // strong ETag, quoted
+} WebAsset;
+
+extern const WebAsset webAssets[];
+extern const size_t webAssetCount;
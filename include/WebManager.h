@@ -25,6 +25,9 @@ class WebManager_ {
     void startOTA();
     void handleOTA();
   private:
+    bool _requestMetricsAdded = false;
+
+    void addRequestMetrics();
 };
 
 extern AsyncWebServer server;
@@ -9,10 +9,54 @@
 #include "WebManager.h"
 #include <DNSServer.h>
 #include "DebugManager.h"
+#include "Scheduler.h"
 
 
 const byte    DNS_PORT                = 53;
 
+#define WIFI_SETTLE_MS 500                  // after a disconnect/mode change before the next step
+#define WIFI_CONNECT_TIMEOUT_MS 20000
+#define WIFI_SCAN_TIMEOUT_MS 15000
+#define WIFI_WPS_SETTLE_MS 1000
+#define WIFI_DNS_POLL_MS 10                 // captive portal DNS, only scheduled while it runs
+#define WIFI_EVENT_QUEUE_LEN 8              // events waiting for the main loop
+#define WIFI_FAST_CONNECT_TIMEOUT_MS 3000   // give up on the cached BSSID/channel and do a full connect
+#define WIFI_FAST_CACHE_VERSION 1
+
+// Roaming between APs of the same network
+#define WIFI_ROAM_CHECK_MS 10000            // how often the link is checked
+#define WIFI_ROAM_RSSI_THRESHOLD -72        // only look for another AP when weaker than this (dBm)
+#define WIFI_ROAM_HYSTERESIS_DB 8           // and only move to one at least this much stronger
+#define WIFI_ROAM_HOLDOFF_MS 60000          // minimum time between roams
+#define WIFI_ROAM_CONNECT_TIMEOUT_MS 2500   // the new AP has this long to give us an IP
+#define WIFI_ROAM_RETURN_MS 3000            // settle, then a fast connect back to the old AP
+#define WIFI_ROAM_MIN_BUFFER_MS 6000        // buffered audio needed to ride out a scan, or a failed roam and the way back
+#define WIFI_ROAM_SCAN_MS_PER_CHAN 120      // passive dwell per channel
+
+// What we remember about the last good connection, kept in NVS so the next connect can skip the
+// scan (BSSID and channel) and, with WIFI_FAST_REUSE_IP, the DHCP exchange
+typedef struct {
+  uint8_t version;
+  uint8_t channel;
+  uint8_t bssid[6];
+  char ssid[33];
+  uint32_t ip;
+  uint32_t gateway;
+  uint32_t subnet;
+  uint32_t dns1;
+  uint32_t dns2;
+} wifi_fast_cache_t;
+
+// Connection state. Advanced by WiFi events, run on the main loop, and by short one-shot
+// scheduler jobs in place of the delay()s that used to sit between the steps.
+enum WiFiState {
+  WIFI_STATE_IDLE,
+  WIFI_STATE_SCANNING,
+  WIFI_STATE_CONNECTING,
+  WIFI_STATE_CONNECTED,
+  WIFI_STATE_PORTAL
+};
+
 class WiFiManager_ {
   private:
     WiFiManager_() = default; // Make constructor private
@@ -41,7 +85,9 @@ class WiFiManager_ {
     int getLastScanResultCount();
     String getLastScanResultSSID(int index);
     void wifiBeginWithCredentials();
-    void saveWiFiCredentials(String newWiFiSSID, String newWiFiPassword);
+    void saveWiFiCredentials(String newWiFiSSID, String newWiFiPassword, int priority = -1);
+    bool removeWiFiCredential(const String &ssid);
+    const wifi_credential_t* findCredential(const String &ssid);
     void processScanResults();
 
     // For captive portal
@@ -49,10 +95,64 @@ class WiFiManager_ {
     void stopDNSD();
     void manageDNSInOpenAP();
 
+    WiFiState getState() { return _state; }
+    const char* getStateName();
+
+    // WiFiEvent() hands events to the main loop, which runs them and the steps
+    void postEvent(WiFiEvent_t event);
+    void runEvents();
+    void onGotIP();
+    void onDisconnected();
+    bool onScanDone();
+    void beginStep();
+    void scanStep();
+    void portalStep();
+    void wpsStep();
+    void smartConfigStep();
+    void checkTimeouts();
+    void selectStep();
+    void roamCheck();
+    void roamStep();
+
+    bool hasFastCache() { return _fastCacheValid; }
+
   private:
     bool _isOpenAP = false;
     std::unique_ptr<DNSServer>        dnsServer;    
 
+    volatile WiFiState _state = WIFI_STATE_IDLE;
+    WiFiState _stateBeforeScan = WIFI_STATE_IDLE;
+    unsigned long _connectStartMillis = 0;
+    unsigned long _scanStartMillis = 0;
+    int8_t _stepJob = -1;                   // pending one-shot step, -1 if none
+    QueueHandle_t _events = nullptr;        // from WiFiEvent(), for runEvents()
+    int8_t _dnsJob = -1;                    // captive portal DNS, -1 when it isn't running
+    bool _waitingForUser = false;           // WPS/SmartConfig: no connect timeout
+
+    wifi_fast_cache_t _fastCache;
+    bool _fastCacheValid = false;
+    bool _fastAttempt = false;              // current connect is using the cache
+    bool _bootConnectRecorded = false;
+
+    bool _selectScan = false;               // scan to pick the best known network
+    bool _roamScan = false;                 // scan for a better AP on the same network
+    bool _roamAllChannels = false;          // last current channel scan found nothing
+    bool _roamInProgress = false;           // roam started, waiting for the old AP to let go
+    bool _roamConnecting = false;           // left the old AP, associating with the new one
+    unsigned long _lastRoamMillis = 0;
+
+    void setState(WiFiState state);
+    void scheduleStep(const char* name, uint32_t delayMs, SchedulerJob fn);
+
+    void loadFastCache();
+    void updateFastCache();
+    void clearFastCache();
+    void fallBackToFullConnect();
+    bool upsertCredential(const String &ssid, const String &password, int priority);
+    int findBestScanResult(const char* ssid, const uint8_t* excludeBssid);
+    bool roamBufferOk();
+    void roamFailed(const char* why);
+
     // For resolving names to esp32xxxxx.local
     void startMDNS();
 };
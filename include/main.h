@@ -14,7 +14,11 @@
 // void MDCallback(void *cbData, const char *type, bool isUnicode, const char *string);
 // void StatusCallback(void *cbData, int code, const char *string);
 
-void performOncePerLoopProcessing();
+void scheduleJobs();
+void audioJob();
+void menuJob();
+void otaJob();
+void ledJob();
 void performOncePerSecondProcessing();
 void performOncePerMinuteProcessing();
 void performOncePerHourProcessing();
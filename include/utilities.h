@@ -14,6 +14,7 @@
 
 #include <Wire.h>
 #include "SpiffsStorage.h"
+#include "ConfigStore.h"
 #include "TimerManager.h"
 #include "Globals.h"
 #include "DebugManager.h"
@@ -28,6 +29,7 @@ const uint32_t DECODE_DIGIT_ZIN18[] = { 0x0200, 0x0001, 0x0002, 0x0004, 0x0008,
 
 // Formatting routines
 String timeToReadableStringFromTm(tm timeToFormat);
+void formatDuration(char* buf, size_t size, long secsValue);
 uint32_t decodeBCD(byte valueToDecode);
 
 String getValueAtIndex(String data, char separator, int index);
@@ -42,10 +44,29 @@ void getSummaryDataHandler(AsyncWebServerRequest *request);
 
 void getConfigDataHandler(AsyncWebServerRequest *request);
 void postConfigDataHandler(AsyncWebServerRequest *request);
+void getSettingsHandler(AsyncWebServerRequest *request);
+void postSettingsHandler(AsyncWebServerRequest *request);
 
 void getDiagsDataHandler(AsyncWebServerRequest *request);
+void getMetricsHandler(AsyncWebServerRequest *request);
+void getTasksHandler(AsyncWebServerRequest *request);
+void getLoopHandler(AsyncWebServerRequest *request);
+void getLinkHandler(AsyncWebServerRequest *request);
+void getResolverHandler(AsyncWebServerRequest *request);
+void getStreamHealthHandler(AsyncWebServerRequest *request);
+void getAbrHandler(AsyncWebServerRequest *request);
+void getSilenceHandler(AsyncWebServerRequest *request);
+void getProbeHandler(AsyncWebServerRequest *request);
+void postStreamBenchHandler(AsyncWebServerRequest *request);
+void getStreamBenchHandler(AsyncWebServerRequest *request);
+void getLogsHandler(AsyncWebServerRequest *request);
+void postLogLevelHandler(AsyncWebServerRequest *request);
+#ifdef FEATURE_TRACE
+void getTraceHandler(AsyncWebServerRequest *request);
+#endif
 
 void postWiFiCredentialsHandler(AsyncWebServerRequest *request);
+void deleteWiFiCredentialHandler(AsyncWebServerRequest *request);
 void resetWifiHandler(AsyncWebServerRequest *request);
 
 void getI2CScanHandler(AsyncWebServerRequest *request);
@@ -68,6 +89,7 @@ bool gotCredentials();
 void resetWiFi();
 void resetOptions();
 void resetAll();
+void scheduleRestart(uint32_t delayMs);
 
 void enableWatchdog();
 void disableWatchdog();
@@ -76,11 +98,20 @@ void feedWatchdog();
 void playTune();
 
 // Radio web interface handlers
-void radioPageHandler(AsyncWebServerRequest *request);
 void getStationsHandler(AsyncWebServerRequest *request);
 void postStationHandler(AsyncWebServerRequest *request);
 void deleteStationHandler(AsyncWebServerRequest *request);
 void getStatusHandler(AsyncWebServerRequest *request);
 void postPlayHandler(AsyncWebServerRequest *request);
+void getStoreHandler(AsyncWebServerRequest *request);
+void getStationSearchHandler(AsyncWebServerRequest *request);
+void postStoreHandler(AsyncWebServerRequest *request);
+void postStoreDeleteHandler(AsyncWebServerRequest *request);
+void postStorePresetHandler(AsyncWebServerRequest *request);
+void postImportHandler(AsyncWebServerRequest *request);
+void postImportUploadHandler(AsyncWebServerRequest *request, String filename, size_t index, uint8_t *data, size_t len, bool final);
+void postImportBodyHandler(AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total);
+void getImportHandler(AsyncWebServerRequest *request);
+void getStationStatsHandler(AsyncWebServerRequest *request);
 void postStopHandler(AsyncWebServerRequest *request);
 void postVolumeHandler(AsyncWebServerRequest *request);
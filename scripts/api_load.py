@@ -0,0 +1,76 @@
+#!/usr/bin/env python3
+# ************************************************************
+# API load generator
+#
+# Hammers the /api/* GET endpoints in a loop and samples the
+# device heap from /api/getDiags, so allocation changes in the
+# web handlers can be compared before/after:
+#
+#   python scripts/api_load.py 192.168.1.50 --seconds 120
+#
+# Reports lowest free heap, lowest largest-free-block and the
+# worst fragmentation seen (1 - maxalloc/free).
+# ************************************************************
+
+import argparse
+import json
+import time
+import urllib.request
+
+ENDPOINTS = [
+    "/api/getSummary",
+    "/api/getDiags",
+    "/api/getConfig",
+    "/api/stations",
+    "/api/status",
+    "/api/credentials",
+]
+
+
+def fetch(host, path, timeout):
+    with urllib.request.urlopen("http://%s%s" % (host, path), timeout=timeout) as resp:
+        return resp.read()
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument("host")
+    parser.add_argument("--seconds", type=int, default=60)
+    parser.add_argument("--sample-every", type=int, default=10, help="requests between heap samples")
+    parser.add_argument("--timeout", type=float, default=5.0)
+    args = parser.parse_args()
+
+    requests = errors = 0
+    samples = []
+    deadline = time.time() + args.seconds
+    while time.time() < deadline:
+        for path in ENDPOINTS:
+            try:
+                fetch(args.host, path, args.timeout)
+                requests += 1
+            except Exception:
+                errors += 1
+            if requests % args.sample_every == 0:
+                try:
+                    d = json.loads(fetch(args.host, "/api/getDiags", args.timeout))
+                    samples.append((d["heap"], d.get("maxallocheap", 0), d["minfreeheap"]))
+                except Exception:
+                    errors += 1
+
+    if not samples:
+        print("no samples collected (%d errors)" % errors)
+        return
+
+    min_free = min(s[0] for s in samples)
+    min_block = min(s[1] for s in samples)
+    worst_frag = max(1.0 - float(s[1]) / s[0] for s in samples if s[0])
+    print("requests:          %d (%d errors, %.1f req/s)" % (requests, errors, requests / float(args.seconds)))
+    print("heap samples:      %d" % len(samples))
+    print("min free heap:     %d" % min_free)
+    print("min largest block: %d" % min_block)
+    print("device min ever:   %d" % samples[-1][2])
+    print("worst frag:        %.1f%%" % (worst_frag * 100))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,221 @@
+#!/usr/bin/env python3
+# ************************************************************
+# Stand-in radio stream server
+#
+# Serves an endless MP3 stream on the LAN so the stream client
+# can be tried and benchmarked without a real station:
+#
+#   python scripts/stream_server.py --port 8000 --metaint 16000
+#
+#   /stream.mp3     the stream (ICY metadata if asked for)
+#   /chunked.mp3    the same with chunked transfer encoding
+#   /redirect       302 to /stream.mp3
+#   /station.pls    playlist pointing at /stream.mp3
+#
+# --bitrate paces the stream (kbit/s); 0 sends as fast as the
+# client takes it. The audio is --file looped, or silent 128k
+# MP3 frames if no file is given.
+#
+# With --bench DEVICE the server also drives the device's
+# /api/bench/stream against itself, once per client, and
+# prints the throughput of each:
+#
+#   python scripts/stream_server.py --bench 192.168.1.50
+#
+# --tls serves https instead, with a throwaway self-signed
+# certificate (made with openssl) unless --cert/--key are
+# given. Benchmarking over TLS runs each URL twice, so the
+# second run shows the resumed handshake, and reports the
+# decrypt cost per Mbit.
+# ************************************************************
+
+import argparse
+import json
+import os
+import socket
+import ssl
+import subprocess
+import tempfile
+import threading
+import time
+import urllib.parse
+import urllib.request
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+
+# MPEG-1 layer III, 128 kbit/s, 44.1 kHz, no padding: 417 bytes. All-zero side info decodes as silence.
+SILENT_FRAME = b"\xff\xfb\x90\x64" + bytes(413)
+TITLES = ["Stand-in - Track %d" % n for n in range(1, 100)]
+
+
+class StreamHandler(BaseHTTPRequestHandler):
+    protocol_version = "HTTP/1.1"
+    audio = SILENT_FRAME * 64
+    bitrate = 128
+    metaint = 16000
+    scheme = "http"
+
+    def log_message(self, fmt, *args):
+        pass
+
+    def do_GET(self):
+        path = urllib.parse.urlparse(self.path).path
+        if path == "/redirect":
+            self.send_response(302)
+            self.send_header("Location", "/stream.mp3")
+            self.send_header("Content-Length", "0")
+            self.end_headers()
+        elif path == "/station.pls":
+            host = self.headers.get("Host", "localhost")
+            body = ("[playlist]\nNumberOfEntries=1\nFile1=%s://%s/stream.mp3\nTitle1=Stand-in\nVersion=2\n" % (self.scheme, host)).encode()
+            self.send_response(200)
+            self.send_header("Content-Type", "audio/x-scpls")
+            self.send_header("Content-Length", str(len(body)))
+            self.end_headers()
+            self.wfile.write(body)
+        elif path in ("/stream.mp3", "/chunked.mp3"):
+            self.stream(chunked=(path == "/chunked.mp3"))
+        else:
+            self.send_error(404)
+
+    def stream(self, chunked):
+        metaint = self.metaint if self.headers.get("Icy-MetaData") == "1" else 0
+        self.send_response(200)
+        self.send_header("Content-Type", "audio/mpeg")
+        self.send_header("icy-name", "Stand-in stream")
+        if metaint:
+            self.send_header("icy-metaint", str(metaint))
+        if chunked:
+            self.send_header("Transfer-Encoding", "chunked")
+        else:
+            self.send_header("Connection", "close")
+        self.end_headers()
+
+        sent = 0
+        pos = 0
+        untilmeta = metaint
+        track = 0
+        start = time.time()
+        try:
+            while True:
+                block = self.audio[pos:pos + 4096] or self.audio[:4096]
+                if metaint and len(block) > untilmeta:
+                    block = block[:untilmeta]
+                pos = (pos + len(block)) % len(self.audio)
+                out = block
+                sent += len(block)
+                if metaint:
+                    untilmeta -= len(block)
+                    if untilmeta == 0:
+                        out += self.metadata(TITLES[track % len(TITLES)])
+                        track += 1
+                        untilmeta = metaint
+                if chunked:
+                    out = b"%x\r\n" % len(out) + out + b"\r\n"
+                self.wfile.write(out)
+                if self.bitrate:
+                    ahead = sent * 8.0 / (self.bitrate * 1000) - (time.time() - start)
+                    if ahead > 0:
+                        time.sleep(ahead)
+        except (BrokenPipeError, ConnectionResetError, ssl.SSLError):
+            pass
+        elapsed = time.time() - start
+        print("%s %s: %d bytes in %.1fs (%.0f kbit/s)" % (self.client_address[0], self.path, sent, elapsed,
+                                                          sent * 8 / 1000.0 / elapsed if elapsed else 0))
+
+    @staticmethod
+    def metadata(title):
+        text = ("StreamTitle='%s';" % title).encode()
+        blocks = (len(text) + 15) // 16
+        return bytes([blocks]) + text.ljust(blocks * 16, b"\0")
+
+
+def local_address(towards):
+    s = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    try:
+        s.connect((towards, 80))
+        return s.getsockname()[0]
+    finally:
+        s.close()
+
+
+def bench(device, base, seconds, tls):
+    # The library client can't do TLS; over TLS run ours twice to see resumption
+    clients = ("native", "native") if tls else ("native", "icy")
+    results = []
+    for path in ("/stream.mp3", "/chunked.mp3"):
+        for client in clients:
+            data = urllib.parse.urlencode({"url": base + path, "seconds": seconds, "client": client}).encode()
+            urllib.request.urlopen("http://%s/api/bench/stream" % device, data=data, timeout=10).read()
+            time.sleep(seconds + 1)
+            while True:
+                r = json.loads(urllib.request.urlopen("http://%s/api/bench/stream" % device, timeout=10).read())
+                if not r["running"]:
+                    break
+                time.sleep(1)
+            results.append((path, client, r))
+
+    print()
+    print("%-14s %-7s %10s %10s %8s %10s %9s %s" % ("path", "client", "kbit/s", "bytes", "stalls", "maxgap ms", "open ms",
+                                                   "tls" if tls else ""))
+    for path, client, r in results:
+        kbps = r["kbps"] if r["opened"] and r["kbps"] is not None else 0
+        extra = ""
+        if r.get("tls"):
+            extra = "%s %dms, %d us/Mbit" % ("resumed" if r["resumed"] else "full", r["handshakems"], r["cpuuspermbit"])
+        print("%-14s %-7s %10.1f %10d %8d %10d %9d %s" % (path, client, kbps, r["bytes"], r["stalls"], r["maxgapms"],
+                                                          r["connectms"], extra))
+    print("TCP window on the device: %d bytes, crypto hardware: %s" % (results[-1][2]["tcpwnd"], results[-1][2]["tlshw"] or "none"))
+
+
+def tls_context(cert, key):
+    if not cert:
+        workdir = tempfile.mkdtemp()
+        cert = os.path.join(workdir, "cert.pem")
+        key = os.path.join(workdir, "key.pem")
+        subprocess.run(["openssl", "req", "-x509", "-newkey", "rsa:2048", "-nodes", "-days", "1", "-subj", "/CN=stream-stand-in",
+                        "-keyout", key, "-out", cert], check=True, stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+    context = ssl.SSLContext(ssl.PROTOCOL_TLS_SERVER)
+    context.load_cert_chain(cert, key)
+    return context
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument("--port", type=int, default=8000)
+    parser.add_argument("--bitrate", type=int, default=128, help="kbit/s, 0 for unpaced")
+    parser.add_argument("--metaint", type=int, default=16000)
+    parser.add_argument("--file", help="MP3 file to loop instead of silence")
+    parser.add_argument("--bench", metavar="DEVICE", help="run /api/bench/stream on this device and exit")
+    parser.add_argument("--seconds", type=int, default=10, help="length of each bench run")
+    parser.add_argument("--tls", action="store_true", help="serve https")
+    parser.add_argument("--cert", help="certificate for --tls (default: self-signed)")
+    parser.add_argument("--key", help="private key for --cert")
+    args = parser.parse_args()
+
+    if args.file:
+        with open(args.file, "rb") as f:
+            StreamHandler.audio = f.read()
+    StreamHandler.metaint = args.metaint
+    # Benchmarks measure the client, so don't hold it back
+    StreamHandler.bitrate = 0 if args.bench else args.bitrate
+
+    server = ThreadingHTTPServer(("", args.port), StreamHandler)
+    server.daemon_threads = True
+    if args.tls:
+        server.socket = tls_context(args.cert, args.key).wrap_socket(server.socket, server_side=True)
+    scheme = "https" if args.tls else "http"
+    StreamHandler.scheme = scheme
+    if not args.bench:
+        print("Serving %s on port %d" % (scheme, args.port))
+        server.serve_forever()
+        return
+
+    threading.Thread(target=server.serve_forever, daemon=True).start()
+    base = "%s://%s:%d" % (scheme, local_address(args.bench), args.port)
+    print("Benchmarking %s against %s" % (args.bench, base))
+    bench(args.bench, base, args.seconds, args.tls)
+    server.shutdown()
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,92 @@
+# ************************************************************
+# Web asset pipeline
+#
+# Gzips every file in web/ and embeds the result in the firmware
+# as src/WebAssetData.cpp, along with a strong ETag for each
+# asset. Runs as a PlatformIO pre-build script, and can also be
+# run by hand: python scripts/web_assets.py
+# ************************************************************
+
+import gzip
+import hashlib
+import os
+
+try:
+    Import("env")  # noqa: F821 - provided by PlatformIO/SCons
+    PROJECT_DIR = env.subst("$PROJECT_DIR")  # noqa: F821
+except NameError:
+    PROJECT_DIR = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+
+WEB_DIR = os.path.join(PROJECT_DIR, "web")
+OUT_FILE = os.path.join(PROJECT_DIR, "src", "WebAssetData.cpp")
+
+MIME_TYPES = {
+    ".html": "text/html",
+    ".css": "text/css",
+    ".js": "application/javascript",
+    ".json": "application/json",
+    ".svg": "image/svg+xml",
+    ".ico": "image/x-icon",
+    ".png": "image/png",
+}
+
+
+def symbol_for(name):
+    return "ASSET_" + "".join(c if c.isalnum() else "_" for c in name).upper()
+
+
+def build_assets():
+    assets = []
+    for name in sorted(os.listdir(WEB_DIR)):
+        path = os.path.join(WEB_DIR, name)
+        if not os.path.isfile(path) or name.startswith("."):
+            continue
+        with open(path, "rb") as f:
+            raw = f.read()
+        # mtime=0 keeps the output byte-identical between builds, so the
+        # ETag only changes when the content does
+        packed = gzip.compress(raw, compresslevel=9, mtime=0)
+        etag = '"' + hashlib.sha1(packed).hexdigest()[:16] + '"'
+        mime = MIME_TYPES.get(os.path.splitext(name)[1], "application/octet-stream")
+        assets.append((name, mime, packed, etag, len(raw)))
+    return assets
+
+
+def render(assets):
+    lines = [
+        "// Generated by scripts/web_assets.py from web/ - do not edit",
+        "",
+        '#include "WebAssets.h"',
+        "",
+    ]
+    for name, mime, packed, etag, raw_len in assets:
+        lines.append("// %s: %d bytes, %d gzipped" % (name, raw_len, len(packed)))
+        lines.append("static const uint8_t %s[] PROGMEM = {" % symbol_for(name))
+        for i in range(0, len(packed), 16):
+            lines.append("  " + ",".join("0x%02x" % b for b in packed[i:i + 16]) + ",")
+        lines.append("};")
+        lines.append("")
+
+    lines.append("const WebAsset webAssets[] = {")
+    for name, mime, packed, etag, raw_len in assets:
+        lines.append('  {"/%s", "%s", %s, sizeof(%s), "%s"},' % (
+            name, mime, symbol_for(name), symbol_for(name), etag.replace('"', '\\"')))
+    lines.append("};")
+    lines.append("")
+    lines.append("const size_t webAssetCount = sizeof(webAssets) / sizeof(webAssets[0]);")
+    lines.append("")
+    return "\n".join(lines)
+
+
+def generate():
+    content = render(build_assets())
+    if os.path.exists(OUT_FILE):
+        with open(OUT_FILE) as f:
+            if f.read() == content:
+                return
+    with open(OUT_FILE, "w") as f:
+        f.write(content)
+    print("web_assets: regenerated %s" % os.path.relpath(OUT_FILE, PROJECT_DIR))
+
+
+generate()
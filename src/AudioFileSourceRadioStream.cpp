@@ -0,0 +1,493 @@
+#include "AudioFileSourceRadioStream.h"
+#include <lwip/sockets.h>
+#include "DebugManager.h"
+#include "Metrics.h"
+
+// ************************************************************
+// Split an http:// or https:// URL. Fails for anything else.
+// ************************************************************
+static bool splitUrl(const String &url, bool &secure, String &host, uint16_t &port, String &path) {
+  secure = url.startsWith("https://");
+  if (!secure && !url.startsWith("http://")) {
+    return false;
+  }
+  int hostStart = secure ? 8 : 7;
+  int hostEnd = hostStart;
+  while (hostEnd < (int)url.length() && url[hostEnd] != '/' && url[hostEnd] != '?') {
+    hostEnd++;
+  }
+  host = url.substring(hostStart, hostEnd);
+  port = secure ? 443 : 80;
+  int colon = host.indexOf(':');
+  if (colon >= 0) {
+    port = host.substring(colon + 1).toInt();
+    host = host.substring(0, colon);
+  }
+  path = url.substring(hostEnd);
+  if (path.length() == 0 || path[0] != '/') {
+    path = "/" + path;
+  }
+  return host.length() > 0 && port > 0;
+}
+
+AudioFileSourceRadioStream::AudioFileSourceRadioStream() {
+}
+
+AudioFileSourceRadioStream::~AudioFileSourceRadioStream() {
+  close();
+}
+
+// ************************************************************
+// Timeouts for the next open()
+// ************************************************************
+void AudioFileSourceRadioStream::setTimeouts(uint32_t connectMs, uint32_t readMs) {
+  _connectTimeoutMs = connectMs;
+  _readTimeoutMs = readMs;
+}
+
+// ************************************************************
+// Connect, following redirects, and read up to the body
+// ************************************************************
+bool AudioFileSourceRadioStream::open(const char *url) {
+  close();
+  uint32_t start = millis();
+  String current = url;
+  _redirects = 0;
+
+  for (;;) {
+    String location;
+    int code = connect(current, location);
+    _status = code;
+    if (code == 301 || code == 302 || code == 303 || code == 307 || code == 308) {
+      close();
+      if (location.length() == 0 || _redirects >= STREAM_MAX_REDIRECTS) {
+        debugMsgAudf("Stream: redirect from %s not followed", current.c_str());
+        return false;
+      }
+      location = resolveLocation(current, location);
+      debugMsgAudf("Stream: %d -> %s", code, location.c_str());
+      metrics.inc(METRIC_STREAM_REDIRECTS);
+      current = location;
+      _redirects++;
+      continue;
+    }
+    if (code != 200) {
+      debugMsgAudf("Stream: %s failed (%d)", current.c_str(), code);
+      close();
+      return false;
+    }
+    break;
+  }
+
+  _finalUrl = current;
+  _connectMs = millis() - start;
+  _pos = 0;
+  _untilMeta = _metaInt;
+  _chunkLeft = 0;
+  _chunkCrlfPending = false;
+  _open = true;
+  debugMsgAudf("Stream open: %s (%u redirects, %s%s, metaint %u, %ums)", _finalUrl.c_str(), (unsigned)_redirects,
+               _secure ? "tls, " : "", _chunked ? "chunked" : "plain", (unsigned)_metaInt, (unsigned)_connectMs);
+  return true;
+}
+
+// ************************************************************
+// One request: connect, send, read the headers. Returns the
+// status code, or -1 if we didn't get that far.
+// ************************************************************
+int AudioFileSourceRadioStream::connect(const String &url, String &location) {
+  String host, path;
+  uint16_t port;
+  _tls.end();
+  if (!splitUrl(url, _secure, host, port, path)) {
+    debugMsgAudf("Stream: can't play %s", url.c_str());
+    return -1;
+  }
+
+  // The resolver's address is for the URL we were given, not wherever it redirects to
+  bool connected;
+  if (_redirects == 0 && (uint32_t)_address != 0) {
+    connected = _client.connect(_address, port, _connectTimeoutMs);
+  } else {
+    connected = _client.connect(host.c_str(), port, _connectTimeoutMs);
+  }
+  if (!connected) {
+    return -1;
+  }
+
+  struct timeval tv;
+  tv.tv_sec = _readTimeoutMs / 1000;
+  tv.tv_usec = (_readTimeoutMs % 1000) * 1000;
+  setsockopt(_client.fd(), SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+  if (_secure && !_tls.begin(_client.fd(), host, port, _connectTimeoutMs)) {
+    return -1;
+  }
+  if (!sendRequest(host, port, path)) {
+    return -1;
+  }
+  return readHeaders(location);
+}
+
+// ************************************************************
+// GET, asking for ICY metadata
+// ************************************************************
+bool AudioFileSourceRadioStream::sendRequest(const String &host, uint16_t port, const String &path) {
+  String request = "GET " + path + " HTTP/1.1\r\n";
+  request += "Host: " + host + (port != (_secure ? 443 : 80) ? ":" + String(port) : "") + "\r\n";
+  request += "User-Agent: " STREAM_USER_AGENT "\r\n";
+  request += "Accept: */*\r\n";
+  request += "Icy-MetaData: 1\r\n";
+  request += "Connection: close\r\n\r\n";
+  if (_secure) {
+    return _tls.write((const uint8_t *)request.c_str(), request.length());
+  }
+  return _client.write((const uint8_t *)request.c_str(), request.length()) == request.length();
+}
+
+// ************************************************************
+// scheme://host[:port], for relative redirects
+// ************************************************************
+String AudioFileSourceRadioStream::origin(bool secure, const String &host, uint16_t port) {
+  String result = (secure ? "https://" : "http://") + host;
+  if (port != (secure ? 443 : 80)) {
+    result += ":" + String(port);
+  }
+  return result;
+}
+
+// ************************************************************
+// Location may be a full URL, //host/path on the same scheme,
+// /path on the same host, or relative to the current path's
+// directory (or its query, for ?...)
+// ************************************************************
+String AudioFileSourceRadioStream::resolveLocation(const String &current, const String &location) {
+  // A scheme: letters, digits, + - . then a colon
+  unsigned int i = 0;
+  while (i < location.length() && (isalnum(location[i]) || location[i] == '+' || location[i] == '-' || location[i] == '.')) {
+    i++;
+  }
+  if (i > 0 && i < location.length() && location[i] == ':') {
+    return location;
+  }
+
+  bool secure;
+  String host, path;
+  uint16_t port;
+  if (!splitUrl(current, secure, host, port, path)) {
+    return location;
+  }
+  if (location.startsWith("//")) {
+    return String(secure ? "https:" : "http:") + location;
+  }
+  String base = origin(secure, host, port);
+  if (location.startsWith("/")) {
+    return base + location;
+  }
+  int query = path.indexOf('?');
+  if (query >= 0) {
+    path = path.substring(0, query);
+  }
+  if (location.startsWith("?")) {
+    return base + path + location;
+  }
+  return base + path.substring(0, path.lastIndexOf('/') + 1) + location;
+}
+
+// ************************************************************
+// Status line and the headers we care about. SHOUTcast answers
+// "ICY 200 OK" rather than HTTP/1.x.
+// ************************************************************
+int AudioFileSourceRadioStream::readHeaders(String &location) {
+  _chunked = false;
+  _metaInt = 0;
+  _contentLength = 0;
+  _contentType = "";
+  _icyName = "";
+  _icyBitrate = 0;
+
+  String line;
+  if (!readLine(line)) {
+    return -1;
+  }
+  int space = line.indexOf(' ');
+  if (space < 0 || !(line.startsWith("HTTP/1.") || line.startsWith("ICY"))) {
+    return -1;
+  }
+  int code = line.substring(space + 1).toInt();
+
+  for (;;) {
+    if (!readLine(line)) {
+      return -1;
+    }
+    if (line.length() == 0) {
+      return code;
+    }
+    int colon = line.indexOf(':');
+    if (colon <= 0) {
+      continue;
+    }
+    String name = line.substring(0, colon);
+    name.toLowerCase();
+    String value = line.substring(colon + 1);
+    value.trim();
+
+    if (name == "location") {
+      location = value;
+    } else if (name == "transfer-encoding") {
+      value.toLowerCase();
+      _chunked = value.indexOf("chunked") >= 0;
+    } else if (name == "icy-metaint") {
+      _metaInt = value.toInt();
+    } else if (name == "content-length") {
+      _contentLength = value.toInt();
+    } else if (name == "content-type") {
+      value.toLowerCase();
+      _contentType = value;
+    } else if (name == "icy-br") {
+      _icyBitrate = value.toInt();
+    } else if (name == "icy-name") {
+      debugMsgAudf("Stream: station '%s'", value.c_str());
+      _icyName = value;
+    }
+  }
+}
+
+// ************************************************************
+// A CRLF (or bare LF) terminated line, without the terminator
+// ************************************************************
+bool AudioFileSourceRadioStream::readLine(String &line) {
+  line = "";
+  uint32_t start = millis();
+  for (;;) {
+    uint8_t c;
+    int n = readSocket(&c, 1, true);
+    if (n < 0) {
+      return false;
+    }
+    if (n == 0) {
+      if (millis() - start >= _readTimeoutMs) {
+        return false;
+      }
+      continue;
+    }
+    if (c == '\n') {
+      if (line.endsWith("\r")) {
+        line.remove(line.length() - 1);
+      }
+      return true;
+    }
+    if (line.length() < STREAM_HEADER_LINE_MAX) {
+      line += (char)c;
+    }
+  }
+}
+
+// ************************************************************
+// AudioFileSource reads
+// ************************************************************
+uint32_t AudioFileSourceRadioStream::read(void *data, uint32_t len) {
+  return readAudio((uint8_t *)data, len, true);
+}
+
+uint32_t AudioFileSourceRadioStream::readNonBlock(void *data, uint32_t len) {
+  return readAudio((uint8_t *)data, len, false);
+}
+
+// ************************************************************
+// Audio only: stops short of each metadata block and reads it
+// out of the way before carrying on
+// ************************************************************
+uint32_t AudioFileSourceRadioStream::readAudio(uint8_t *dst, uint32_t len, bool block) {
+  if (!_open || len == 0) {
+    return 0;
+  }
+  if (_metaInt) {
+    if (_untilMeta == 0) {
+      if (!block && !dataWaiting()) {
+        return 0;
+      }
+      if (!readMetadata()) {
+        return 0;
+      }
+      _untilMeta = _metaInt;
+    }
+    if (len > _untilMeta) {
+      len = _untilMeta;
+    }
+  }
+  uint32_t got = readBody(dst, len, block);
+  if (_metaInt) {
+    _untilMeta -= got;
+  }
+  _pos += got;
+  return got;
+}
+
+// ************************************************************
+// Body bytes, never past the end of the current chunk
+// ************************************************************
+uint32_t AudioFileSourceRadioStream::readBody(uint8_t *dst, uint32_t len, bool block) {
+  if (_chunked) {
+    if (_chunkLeft == 0) {
+      if (!block && !dataWaiting()) {
+        return 0;
+      }
+      if (!readChunkHeader()) {
+        return 0;
+      }
+    }
+    if (len > _chunkLeft) {
+      len = _chunkLeft;
+    }
+  }
+  int got = readSocket(dst, len, block);
+  if (got < 0) {
+    fail("connection closed");
+    return 0;
+  }
+  if (_chunked) {
+    _chunkLeft -= got;
+    _chunkCrlfPending = (_chunkLeft == 0);
+  }
+  return got;
+}
+
+// ************************************************************
+// Exactly len body bytes, for metadata
+// ************************************************************
+bool AudioFileSourceRadioStream::readBodyFully(uint8_t *dst, uint32_t len) {
+  uint32_t start = millis();
+  while (len > 0) {
+    uint32_t got = readBody(dst, len, true);
+    if (!_open) {
+      return false;
+    }
+    if (got == 0 && millis() - start >= _readTimeoutMs) {
+      fail("read timed out");
+      return false;
+    }
+    dst += got;
+    len -= got;
+  }
+  return true;
+}
+
+// ************************************************************
+// Next chunk's size. A zero size chunk ends the stream.
+// ************************************************************
+bool AudioFileSourceRadioStream::readChunkHeader() {
+  String line;
+  if (_chunkCrlfPending) {
+    if (!readLine(line)) {
+      fail("chunk trailer");
+      return false;
+    }
+    _chunkCrlfPending = false;
+  }
+  if (!readLine(line)) {
+    fail("chunk header");
+    return false;
+  }
+  _chunkLeft = strtoul(line.c_str(), nullptr, 16);
+  if (_chunkLeft == 0) {
+    fail("last chunk");
+    return false;
+  }
+  return true;
+}
+
+// ************************************************************
+// ICY metadata: a length byte (x16), then text like
+// StreamTitle='Artist - Song';StreamUrl='';
+// ************************************************************
+bool AudioFileSourceRadioStream::readMetadata() {
+  uint8_t blocks;
+  if (!readBodyFully(&blocks, 1)) {
+    return false;
+  }
+  if (blocks == 0) {
+    return true;
+  }
+
+  uint16_t metaLen = blocks * 16;
+  char *meta = (char *)malloc(metaLen + 1);
+  if (!meta) {
+    fail("no memory for metadata");
+    return false;
+  }
+  bool ok = readBodyFully((uint8_t *)meta, metaLen);
+  if (ok) {
+    meta[metaLen] = '\0';
+    char *title = strstr(meta, "StreamTitle='");
+    if (title) {
+      title += 13;
+      char *end = strstr(title, "';");
+      if (end) {
+        *end = '\0';
+      }
+      cb.md("StreamTitle", false, title);
+    }
+  }
+  free(meta);
+  return ok;
+}
+
+// ************************************************************
+// recv() (or decrypt) straight into dst. Blocking reads wait
+// for the first bytes (up to the read timeout), then take
+// what's there. Returns the bytes read, 0 for none yet, -1
+// once closed.
+// ************************************************************
+int AudioFileSourceRadioStream::readSocket(uint8_t *dst, uint32_t len, bool block) {
+  if (_secure) {
+    return _tls.read(dst, len, block);
+  }
+  int n = recv(_client.fd(), dst, len, block ? 0 : MSG_DONTWAIT);
+  if (n > 0) {
+    return n;
+  }
+  if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+    return 0;
+  }
+  return -1;
+}
+
+// ************************************************************
+// Something to read now - or the connection has closed, which
+// the next read will find out
+// ************************************************************
+bool AudioFileSourceRadioStream::dataWaiting() {
+  if (_secure) {
+    return _tls.dataWaiting();
+  }
+  uint8_t c;
+  int n = recv(_client.fd(), &c, 1, MSG_PEEK | MSG_DONTWAIT);
+  return n >= 0 || (errno != EAGAIN && errno != EWOULDBLOCK);
+}
+
+// ************************************************************
+// Give up on the stream
+// ************************************************************
+void AudioFileSourceRadioStream::fail(const char *why) {
+  debugMsgAudf("Stream: %s after %u bytes", why, (unsigned)_pos);
+  close();
+}
+
+bool AudioFileSourceRadioStream::close() {
+  _tls.end();
+  _client.stop();
+  _open = false;
+  return true;
+}
+
+// ************************************************************
+// The TCP receive window this build was made with
+// ************************************************************
+uint32_t AudioFileSourceRadioStream::tcpWindow() {
+#ifdef CONFIG_LWIP_TCP_WND_DEFAULT
+  return CONFIG_LWIP_TCP_WND_DEFAULT;
+#else
+  return 0;
+#endif
+}
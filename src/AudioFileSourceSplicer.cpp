@@ -0,0 +1,221 @@
+#include "AudioFileSourceSplicer.h"
+
+AudioFileSourceSplicer::AudioFileSourceSplicer(AudioFileSource *source) : _current(source) {
+}
+
+AudioFileSourceSplicer::~AudioFileSourceSplicer() {
+  close();
+  delete _current;
+}
+
+// ************************************************************
+// MPEG-1/2/2.5 layer III frame length from its header
+// ************************************************************
+uint32_t AudioFileSourceSplicer::frameLength(uint32_t header, uint16_t *kbps) {
+  static const uint16_t KBPS_V1[16] = {0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 0};
+  static const uint16_t KBPS_V2[16] = {0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160, 0};
+  static const uint32_t RATES_V1[3] = {44100, 48000, 32000};
+
+  if ((header & 0xFFE00000) != 0xFFE00000) {
+    return 0;
+  }
+  uint8_t version = (header >> 19) & 3;   // 0 = 2.5, 1 = reserved, 2 = 2, 3 = 1
+  uint8_t layer = (header >> 17) & 3;     // 1 = layer III
+  uint8_t bitrateIndex = (header >> 12) & 15;
+  uint8_t rateIndex = (header >> 10) & 3;
+  uint8_t padding = (header >> 9) & 1;
+  // Free format (bitrate index 0) has no length in the header - treat it as no header
+  if (version == 1 || layer != 1 || bitrateIndex == 0 || bitrateIndex == 15 || rateIndex == 3) {
+    return 0;
+  }
+
+  uint32_t rate = RATES_V1[rateIndex] >> (version == 3 ? 0 : (version == 2 ? 1 : 2));
+  uint16_t bitrate = (version == 3) ? KBPS_V1[bitrateIndex] : KBPS_V2[bitrateIndex];
+  if (kbps) {
+    *kbps = bitrate;
+  }
+  return (version == 3 ? 144000UL : 72000UL) * bitrate / rate + padding;
+}
+
+// ************************************************************
+// Queue a replacement stream
+// ************************************************************
+bool AudioFileSourceSplicer::splice(AudioFileSource *next) {
+  bool taken = false;
+  portENTER_CRITICAL(&_mux);
+  if (!_next) {
+    _next = next;
+    taken = true;
+  }
+  portEXIT_CRITICAL(&_mux);
+  return taken;
+}
+
+// ************************************************************
+// Switch to the queued stream and look for its first frame
+// ************************************************************
+void AudioFileSourceSplicer::takeNext() {
+  portENTER_CRITICAL(&_mux);
+  AudioFileSource *next = _next;
+  _next = nullptr;
+  portEXIT_CRITICAL(&_mux);
+  if (!next) {
+    return;
+  }
+
+  _current->close();
+  delete _current;
+  _current = next;
+  _frameLeft = 0;
+  _headerHave = 0;
+  _synced = false;
+  _seeking = true;
+  _seekScanned = 0;
+  _carryLen = 0;
+  _splices++;
+}
+
+// ************************************************************
+// With a splice waiting, don't read past the end of the
+// current frame
+// ************************************************************
+uint32_t AudioFileSourceSplicer::spliceLimit(uint32_t len) {
+  if (_frameLeft > 0) {
+    return len < _frameLeft ? len : _frameLeft;
+  }
+  // Part way through a header
+  uint32_t headerLeft = 4 - _headerHave;
+  return len < headerLeft ? len : headerLeft;
+}
+
+// ************************************************************
+// Follow the frames in the bytes going through
+// ************************************************************
+void AudioFileSourceSplicer::track(const uint8_t *data, uint32_t len) {
+  while (len > 0) {
+    if (_frameLeft > 0) {
+      uint32_t step = len < _frameLeft ? len : _frameLeft;
+      _frameLeft -= step;
+      data += step;
+      len -= step;
+      continue;
+    }
+
+    _header = (_header << 8) | *data++;
+    len--;
+    if (++_headerHave < 4) {
+      continue;
+    }
+    uint16_t kbps = 0;
+    uint32_t length = frameLength(_header, &kbps);
+    if (length > 4) {
+      _frameLeft = length - 4;
+      _headerHave = 0;
+      _synced = true;
+      _kbps = kbps;
+    } else {
+      // Lost sync - slide along a byte at a time until a header turns up
+      _synced = false;
+      _headerHave = 3;
+    }
+  }
+}
+
+// ************************************************************
+// Drop the start of a new stream up to its first frame header.
+// Returns 0 until there is one.
+// ************************************************************
+uint32_t AudioFileSourceSplicer::seekFrame(uint8_t *data, uint32_t len, bool block) {
+  if (len <= sizeof(_carry)) {
+    return 0;
+  }
+  while (true) {
+    memcpy(data, _carry, _carryLen);
+    uint32_t got = block ? _current->read(data + _carryLen, len - _carryLen)
+                         : _current->readNonBlock(data + _carryLen, len - _carryLen);
+    if (got == 0) {
+      return 0;
+    }
+    uint32_t have = _carryLen + got;
+
+    for (uint32_t i = 0; i + 4 <= have; i++) {
+      uint32_t header = ((uint32_t)data[i] << 24) | ((uint32_t)data[i + 1] << 16) | ((uint32_t)data[i + 2] << 8) | data[i + 3];
+      if (frameLength(header) > 4) {
+        _seeking = false;
+        _carryLen = 0;
+        memmove(data, data + i, have - i);
+        return have - i;
+      }
+    }
+
+    _seekScanned += got;
+    if (_seekScanned >= SPLICE_SYNC_LIMIT) {
+      // Nothing that looks like MP3 - pass it on and let the decoder make what it can of it
+      _seeking = false;
+      _carryLen = 0;
+      return have;
+    }
+    // Keep the tail in case a header straddles the next read
+    _carryLen = have < sizeof(_carry) ? have : sizeof(_carry);
+    memcpy(_carry, data + have - _carryLen, _carryLen);
+  }
+}
+
+// ************************************************************
+// Read from whichever stream is current
+// ************************************************************
+uint32_t AudioFileSourceSplicer::readFrom(void *data, uint32_t len, bool block) {
+  if (!_current || len == 0) {
+    return 0;
+  }
+  if (_next) {
+    // Without sync, or with the old stream gone, there is no frame end worth waiting for
+    if (atFrameBoundary() || !_synced || !_current->isOpen()) {
+      takeNext();
+    } else {
+      len = spliceLimit(len);
+    }
+  }
+
+  uint8_t *dst = (uint8_t *)data;
+  uint32_t got;
+  if (_seeking) {
+    got = seekFrame(dst, len, block);
+  } else {
+    got = block ? _current->read(dst, len) : _current->readNonBlock(dst, len);
+  }
+  track(dst, got);
+  _pos += got;
+  return got;
+}
+
+uint32_t AudioFileSourceSplicer::read(void *data, uint32_t len) {
+  return readFrom(data, len, true);
+}
+
+uint32_t AudioFileSourceSplicer::readNonBlock(void *data, uint32_t len) {
+  return readFrom(data, len, false);
+}
+
+bool AudioFileSourceSplicer::loop() {
+  return _current ? _current->loop() : true;
+}
+
+bool AudioFileSourceSplicer::isOpen() {
+  return (_current && _current->isOpen()) || _next != nullptr;
+}
+
+// ************************************************************
+// Close the current stream and drop any waiting one
+// ************************************************************
+bool AudioFileSourceSplicer::close() {
+  portENTER_CRITICAL(&_mux);
+  AudioFileSource *next = _next;
+  _next = nullptr;
+  portEXIT_CRITICAL(&_mux);
+  if (next) {
+    next->close();
+    delete next;
+  }
+  return _current ? _current->close() : true;
+}
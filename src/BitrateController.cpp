@@ -0,0 +1,288 @@
+#include "BitrateController.h"
+#include "DebugManager.h"
+#include "Metrics.h"
+#include "Trace.h"
+
+// ************************************************************
+// Take a station's tiers and pick where to start: the best
+// one the link is known to carry, otherwise the lowest
+// ************************************************************
+int BitrateController_::begin(const station_t &station) {
+  _tierCount = station.tierCount;
+  for (uint8_t t = 0; t < _tierCount; t++) {
+    _tierKbps[t] = station.tierKbps[t];
+    _tierUrls[t] = station.tierUrls[t];
+  }
+  _switching = false;
+  _fallingSamples = 0;
+  _highSamples = 0;
+  _highSince = 0;
+  _trend = 0;
+  _underrun = false;
+  _lastUpAt = 0;
+  _upHoldMs = ABR_UP_HOLD_MS;
+
+  if (!isActive()) {
+    metrics.set(METRIC_ABR_TIER_KBPS, 0);
+    return -1;
+  }
+
+  _tier = 0;
+  for (uint8_t t = 1; t < _tierCount; t++) {
+    if ((uint32_t)_tierKbps[t] * ABR_HEADROOM_PCT / 100 <= _capacityKbps) {
+      _tier = t;
+    }
+  }
+  record(_tier, _tier, ABR_REASON_START, 1);
+  metrics.set(METRIC_ABR_TIER_KBPS, _tierKbps[_tier]);
+  debugMsgAudf("ABR: starting on %ukbps (capacity %ukbps)", (unsigned)_tierKbps[_tier], (unsigned)_capacityKbps);
+  return _tier;
+}
+
+// ************************************************************
+// A stream (re)started. A switch that was still opening went
+// with the old stream, so we are on the tier it came from.
+// ************************************************************
+void BitrateController_::noteStreamStart() {
+  if (_switching) {
+    noteSwitchResult(false);
+  }
+  _settleUntil = millis() + ABR_SETTLE_MS;
+  _fallingSamples = 0;
+  _highSamples = 0;
+  _highSince = 0;
+  _trend = 0;
+  _underrun = false;
+}
+
+// ************************************************************
+// Once a second: update the trend and capacity estimate, then
+// see whether to move
+// ************************************************************
+int BitrateController_::sample(uint32_t fillBytes, uint32_t bufferBytes, uint32_t intakeBytes, uint32_t consumeRate) {
+  if (!isActive() || _switching) {
+    return -1;
+  }
+  uint32_t now = millis();
+
+  // Until the decoder has been measured, assume it takes the tier's bitrate
+  uint32_t rate = consumeRate ? consumeRate : (uint32_t)_tierKbps[_tier] * 125;
+  _bufferedMs = (uint64_t)fillBytes * 1000 / rate;
+
+  bool underrun = _underrun;
+  _underrun = false;
+  if ((int32_t)(now - _settleUntil) < 0) {
+    _lastBufferedMs = _bufferedMs;
+    return -1;
+  }
+
+  // Intake only shows what the link can carry while the buffer has room for more. Servers burst
+  // the first seconds of a stream, so this waits for the settle time too, and is smoothed both
+  // ways so one fast second doesn't count as capacity.
+  uint32_t intakeKbps = intakeBytes * 8 / 1000;
+  bool full = fillBytes >= bufferBytes / 10 * 9;
+  if (!full && intakeKbps > 0) {
+    _capacityKbps = _capacityKbps ? (_capacityKbps * (ABR_CAPACITY_WEIGHT - 1) + intakeKbps) / ABR_CAPACITY_WEIGHT : intakeKbps;
+  }
+  _trend = (_trend * 3 + ((int32_t)_bufferedMs - (int32_t)_lastBufferedMs)) / 4;
+  _lastBufferedMs = _bufferedMs;
+
+  // A step up that has lasted the probe window worked, so the hold goes back to normal
+  if (_lastUpAt != 0 && now - _lastUpAt >= ABR_PROBE_WINDOW_MS) {
+    _lastUpAt = 0;
+    _upHoldMs = ABR_UP_HOLD_MS;
+  }
+
+  if (underrun && _tier > 0) {
+    return decide(_tier - 1, ABR_REASON_UNDERRUN);
+  }
+
+  bool falling = _trend < 0 && (_bufferedMs < ABR_LOW_WATER_MS || _bufferedMs / (uint32_t)(-_trend) < ABR_HORIZON_S);
+  if (falling) {
+    _highSamples = 0;
+    _highSince = 0;
+    if (_fallingSamples < UINT8_MAX) {
+      _fallingSamples++;
+    }
+    if (_tier > 0 && _fallingSamples >= ABR_DOWN_SAMPLES) {
+      return decide(_tier - 1, ABR_REASON_BUFFER);
+    }
+    return -1;
+  }
+  _fallingSamples = 0;
+
+  if (fillBytes < bufferBytes / 100 * ABR_HIGH_WATER_PCT) {
+    _highSamples = 0;
+    _highSince = 0;
+    return -1;
+  }
+  if (_highSince == 0) {
+    _highSince = now;
+  }
+  if (_highSamples < UINT8_MAX) {
+    _highSamples++;
+  }
+  if (_tier + 1 >= _tierCount) {
+    return -1;
+  }
+  if (_highSamples >= ABR_UP_SAMPLES && _capacityKbps >= (uint32_t)_tierKbps[_tier + 1] * ABR_HEADROOM_PCT / 100) {
+    return decide(_tier + 1, ABR_REASON_CAPACITY);
+  }
+  if (now - _highSince >= _upHoldMs) {
+    return decide(_tier + 1, ABR_REASON_HEADROOM);
+  }
+  return -1;
+}
+
+// ************************************************************
+// Step down straight away after a stream failure
+// ************************************************************
+int BitrateController_::stepDownOnFailure() {
+  if (!isActive()) {
+    return -1;
+  }
+  if (_switching) {
+    noteSwitchResult(false);
+  }
+  if (_tier == 0) {
+    return -1;
+  }
+  int to = decide(_tier - 1, ABR_REASON_FAILED);
+  // This one is a reconnect, not a splice, so there's nothing to wait for
+  _switching = false;
+  _log[(_logNext + ABR_LOG_SIZE - 1) % ABR_LOG_SIZE].opened = 1;
+  metrics.set(METRIC_ABR_TIER_KBPS, _tierKbps[_tier]);
+  return to;
+}
+
+// ************************************************************
+// Move to a tier and log why
+// ************************************************************
+int BitrateController_::decide(uint8_t to, AbrReason reason) {
+  uint32_t now = millis();
+  if (to < _tier) {
+    if (_lastUpAt != 0 && now - _lastUpAt < ABR_PROBE_WINDOW_MS) {
+      // The last step up didn't hold - wait longer before the next one
+      _upHoldMs = (_upHoldMs * 2 > ABR_UP_HOLD_MAX_MS) ? ABR_UP_HOLD_MAX_MS : _upHoldMs * 2;
+    }
+    _lastUpAt = 0;
+    metrics.inc(METRIC_ABR_STEP_DOWNS);
+  } else {
+    _lastUpAt = now;
+    metrics.inc(METRIC_ABR_STEP_UPS);
+  }
+  TRACE_INSTANT("abr.switch");
+  debugMsgAudf("ABR: %u -> %ukbps (%s, buffer %ums, trend %d, capacity %ukbps)", (unsigned)_tierKbps[_tier],
+               (unsigned)_tierKbps[to], reasonName(reason), (unsigned)_bufferedMs, (int)_trend, (unsigned)_capacityKbps);
+  record(_tier, to, reason, -1);
+
+  _switchFrom = _tier;
+  _tier = to;
+  _switching = true;
+  _fallingSamples = 0;
+  _highSamples = 0;
+  _highSince = 0;
+  return to;
+}
+
+// ************************************************************
+// The new tier was spliced in, or never opened
+// ************************************************************
+void BitrateController_::noteSwitchResult(bool opened) {
+  if (!_switching) {
+    return;
+  }
+  _switching = false;
+  _log[(_logNext + ABR_LOG_SIZE - 1) % ABR_LOG_SIZE].opened = opened ? 1 : 0;
+  if (opened) {
+    // The buffer empties at the old rate until playback reaches the seam - let that pass
+    _settleUntil = millis() + ABR_SETTLE_MS;
+  } else {
+    debugMsgAudf("ABR: %ukbps didn't open - staying on %ukbps", (unsigned)_tierKbps[_tier], (unsigned)_tierKbps[_switchFrom]);
+    if (_tier > _switchFrom) {
+      _upHoldMs = (_upHoldMs * 2 > ABR_UP_HOLD_MAX_MS) ? ABR_UP_HOLD_MAX_MS : _upHoldMs * 2;
+      _lastUpAt = 0;
+    }
+    _tier = _switchFrom;
+  }
+  metrics.set(METRIC_ABR_TIER_KBPS, _tierKbps[_tier]);
+}
+
+void BitrateController_::record(uint8_t from, uint8_t to, AbrReason reason, int8_t opened) {
+  abr_switch_t &entry = _log[_logNext];
+  entry.millis = millis();
+  entry.fromKbps = _tierKbps[from];
+  entry.toKbps = _tierKbps[to];
+  entry.reason = reason;
+  entry.bufferedMs = _bufferedMs;
+  entry.trend = _trend;
+  entry.capacityKbps = _capacityKbps;
+  entry.opened = opened;
+  _logNext = (_logNext + 1) % ABR_LOG_SIZE;
+  if (_logCount < ABR_LOG_SIZE) {
+    _logCount++;
+  }
+}
+
+const char *BitrateController_::reasonName(AbrReason reason) {
+  switch (reason) {
+    case ABR_REASON_START:    return "start";
+    case ABR_REASON_BUFFER:   return "buffer";
+    case ABR_REASON_UNDERRUN: return "underrun";
+    case ABR_REASON_FAILED:   return "failed";
+    case ABR_REASON_CAPACITY: return "capacity";
+    case ABR_REASON_HEADROOM: return "headroom";
+  }
+  return "?";
+}
+
+// ************************************************************
+// State and the recent switches, oldest first
+// ************************************************************
+void BitrateController_::writeJson(JsonStreamWriter &json) {
+  json.beginObject();
+  json.add("active", isActive());
+  json.key("tiers").beginArray();
+  for (uint8_t t = 0; t < _tierCount; t++) {
+    json.value((unsigned)_tierKbps[t]);
+  }
+  json.endArray();
+  json.add("tier", (int)_tier);
+  json.add("switching", _switching);
+  json.add("bufferedms", _bufferedMs);
+  json.add("trend", (long)_trend);
+  json.add("capacitykbps", (unsigned)_capacityKbps);
+  json.add("upholdms", _upHoldMs);
+
+  json.key("switches").beginArray();
+  for (uint8_t i = 0; i < _logCount; i++) {
+    const abr_switch_t &entry = _log[(_logNext + ABR_LOG_SIZE - _logCount + i) % ABR_LOG_SIZE];
+    json.beginObject();
+    json.add("millis", entry.millis);
+    json.add("from", (unsigned)entry.fromKbps);
+    json.add("to", (unsigned)entry.toKbps);
+    json.add("reason", reasonName(entry.reason));
+    json.add("bufferedms", entry.bufferedMs);
+    json.add("trend", (long)entry.trend);
+    json.add("capacitykbps", (unsigned)entry.capacityKbps);
+    json.key("opened");
+    if (entry.opened < 0) {
+      json.nullValue();
+    } else {
+      json.value(entry.opened == 1);
+    }
+    json.endObject();
+  }
+  json.endArray();
+  json.endObject();
+}
+
+// ************************************************************
+// Library internal singleton wiring
+// ************************************************************
+BitrateController_ &BitrateController_::getInstance() {
+  static BitrateController_ instance;
+  return instance;
+}
+
+BitrateController_ &bitrateController = bitrateController.getInstance();
@@ -0,0 +1,471 @@
+#include "ConfigStore.h"
+#include <Preferences.h>
+#include <SPIFFS.h>
+#include <esp_rom_crc.h>
+#include "DebugManager.h"
+#include "Metrics.h"
+#include "SpiffsStorage.h"
+#include "Trace.h"
+
+static_assert(sizeof(config_record_header_t) == 12, "config_record_header_t is part of the stored format");
+
+// ************************************************************
+// Payload encoding: fields in order, integers little endian,
+// strings as a 16 bit length and the bytes. The writer only
+// counts when it has no buffer, to size one.
+// ************************************************************
+class RecordWriter {
+  public:
+    RecordWriter(uint8_t *buf, size_t size) : _buf(buf), _size(size) {}
+
+    void bytes(const void *data, size_t len) {
+      if (_buf && _len + len <= _size) {
+        memcpy(_buf + _len, data, len);
+      }
+      _len += len;
+    }
+    void u8(uint8_t v) { bytes(&v, 1); }
+    void u16(uint16_t v) { bytes(&v, 2); }
+    void u32(uint32_t v) { bytes(&v, 4); }
+    void str(const String &s) {
+      u16(s.length());
+      bytes(s.c_str(), s.length());
+    }
+    size_t length() { return _len; }
+
+  private:
+    uint8_t *_buf;
+    size_t _size;
+    size_t _len = 0;
+};
+
+class RecordReader {
+  public:
+    RecordReader(const uint8_t *buf, size_t len) : _buf(buf), _len(len) {}
+
+    bool bytes(void *data, size_t len) {
+      if (!_ok || _pos + len > _len) {
+        _ok = false;
+        return false;
+      }
+      memcpy(data, _buf + _pos, len);
+      _pos += len;
+      return true;
+    }
+    uint8_t u8() { uint8_t v = 0; bytes(&v, 1); return v; }
+    uint16_t u16() { uint16_t v = 0; bytes(&v, 2); return v; }
+    uint32_t u32() { uint32_t v = 0; bytes(&v, 4); return v; }
+    String str() {
+      uint16_t len = u16();
+      if (!_ok || _pos + len > _len) {
+        _ok = false;
+        return String();
+      }
+      String s;
+      s.reserve(len);
+      for (uint16_t i = 0; i < len; i++) {
+        s += (char)_buf[_pos + i];
+      }
+      _pos += len;
+      return s;
+    }
+    bool ok() { return _ok; }
+
+  private:
+    const uint8_t *_buf;
+    size_t _len;
+    size_t _pos = 0;
+    bool _ok = true;
+};
+
+// ************************************************************
+// Load a record's payload, checked. Free it after.
+// ************************************************************
+bool ConfigStore_::readRecord(const char *key, ConfigRecordKind kind, uint8_t *&payload, uint16_t &length, uint8_t &version) {
+  payload = nullptr;
+  Preferences prefs;
+  if (!prefs.begin(CONFIG_NVS_NAMESPACE, true)) {
+    // No namespace yet - nothing has been saved
+    return false;
+  }
+  size_t size = prefs.getBytesLength(key);
+  if (size == 0) {
+    prefs.end();
+    return false;
+  }
+
+  uint8_t *record = (uint8_t *)malloc(size);
+  if (!record) {
+    prefs.end();
+    return false;
+  }
+  prefs.getBytes(key, record, size);
+  prefs.end();
+
+  config_record_header_t header;
+  memcpy(&header, record, size < sizeof(header) ? size : sizeof(header));
+  if (size < sizeof(header) || header.magic != CONFIG_RECORD_MAGIC || header.kind != kind ||
+      header.length != size - sizeof(header) ||
+      esp_rom_crc32_le(0, record + sizeof(header), header.length) != header.crc) {
+    debugMsgSpff("Config store: record %s is damaged", key);
+    _corrupt++;
+    free(record);
+    return false;
+  }
+
+  _bytes[kind - 1] = size;
+  length = header.length;
+  version = header.version;
+  // The payload is read in place - move it to the front so there's one pointer to free
+  memmove(record, record + sizeof(header), length);
+  payload = record;
+  return true;
+}
+
+bool ConfigStore_::writeRecord(const char *key, ConfigRecordKind kind, uint8_t version, const uint8_t *payload, uint16_t length) {
+  MetricTimer timer(METRIC_SPIFFS_WRITE_US);
+  TRACE_SCOPE("config.save");
+  size_t size = sizeof(config_record_header_t) + length;
+  uint8_t *record = (uint8_t *)malloc(size);
+  if (!record) {
+    return false;
+  }
+  config_record_header_t header;
+  header.magic = CONFIG_RECORD_MAGIC;
+  header.kind = kind;
+  header.version = version;
+  header.length = length;
+  header.reserved = 0;
+  header.crc = esp_rom_crc32_le(0, payload, length);
+  memcpy(record, &header, sizeof(header));
+  memcpy(record + sizeof(header), payload, length);
+
+  bool saved = false;
+  Preferences prefs;
+  if (prefs.begin(CONFIG_NVS_NAMESPACE, false)) {
+    saved = prefs.putBytes(key, record, size) == size;
+    prefs.end();
+  }
+  free(record);
+  if (saved) {
+    _bytes[kind - 1] = size;
+  } else {
+    debugMsgSpff("Config store: couldn't save %s", key);
+  }
+  return saved;
+}
+
+// ************************************************************
+// Encode a payload with one of the encoders and save it
+// ************************************************************
+bool ConfigStore_::save(const char *key, ConfigRecordKind kind, uint8_t version, size_t (ConfigStore_::*encode)(uint8_t *, size_t)) {
+  size_t length = (this->*encode)(nullptr, 0);
+  if (length > CONFIG_RECORD_MAX) {
+    debugMsgSpff("Config store: %s is too big at %u bytes", key, (unsigned)length);
+    return false;
+  }
+  uint8_t *payload = (uint8_t *)malloc(length ? length : 1);
+  if (!payload) {
+    return false;
+  }
+  (this->*encode)(payload, length);
+  bool saved = writeRecord(key, kind, version, payload, length);
+  free(payload);
+  return saved;
+}
+
+// ************************************************************
+// Load a record into the globals with one of the decoders. If
+// there is none yet, migrate the old JSON file.
+// ************************************************************
+bool ConfigStore_::load(const char *key, ConfigRecordKind kind, bool (ConfigStore_::*decode)(const uint8_t *, uint16_t, uint8_t),
+                        const char *legacyFile, bool (SpiffsStorage_::*legacyLoad)(), bool (ConfigStore_::*saveRecord)()) {
+  uint32_t start = micros();
+  bool loaded = false;
+  uint8_t *payload;
+  uint16_t length;
+  uint8_t version;
+  if (readRecord(key, kind, payload, length, version)) {
+    loaded = (this->*decode)(payload, length, version);
+    free(payload);
+    if (!loaded) {
+      debugMsgSpff("Config store: can't decode %s version %u", key, (unsigned)version);
+      _corrupt++;
+    }
+  }
+
+  _loadUs += micros() - start;
+  return loaded || migrate(legacyFile, legacyLoad, saveRecord);
+}
+
+// ************************************************************
+// Load the old JSON file, save it as a record, and remove it
+// ************************************************************
+bool ConfigStore_::migrate(const char *legacyFile, bool (SpiffsStorage_::*legacyLoad)(), bool (ConfigStore_::*saveRecord)()) {
+  uint32_t start = micros();
+  bool loaded = false;
+  if (SPIFFS.exists(legacyFile) && (spiffsStorage.*legacyLoad)()) {
+    loaded = true;
+    if ((this->*saveRecord)()) {
+      SPIFFS.remove(legacyFile);
+      _migrated++;
+      debugMsgSpff("Config store: migrated %s", legacyFile);
+    }
+  }
+  _loadUs += micros() - start;
+  return loaded;
+}
+
+bool ConfigStore_::loadConfig() {
+  return load(CONFIG_NVS_KEY_CONFIG, CONFIG_RECORD_CONFIG, &ConfigStore_::decodeConfig,
+              SPIFFS_CONFIG_FILE, &SpiffsStorage_::getConfigFromSpiffs, &ConfigStore_::saveConfig);
+}
+
+// ************************************************************
+// Stats alternate between two slots. The newest one that passes
+// its checks wins, so a damaged slot costs one save's worth.
+// ************************************************************
+static const char *STATS_SLOT_KEYS[2] = {CONFIG_NVS_KEY_STATS, CONFIG_NVS_KEY_STATS_B};
+
+bool ConfigStore_::loadStats() {
+  uint32_t start = micros();
+  bool loaded = false;
+  for (uint8_t slot = 0; slot < 2; slot++) {
+    uint8_t *payload;
+    uint16_t length;
+    uint8_t version;
+    if (!readRecord(STATS_SLOT_KEYS[slot], CONFIG_RECORD_STATS, payload, length, version)) {
+      continue;
+    }
+    spiffs_stats_t stats;
+    uint32_t seq;
+    bool decoded = decodeStats(payload, length, version, stats, seq);
+    free(payload);
+    if (!decoded) {
+      _corrupt++;
+      continue;
+    }
+    // Sequence numbers wrap, so compare the difference
+    if (!loaded || (int32_t)(seq - _statsSeq) > 0) {
+      *cs = stats;
+      _statsSeq = seq;
+      _statsSlot = slot;
+      loaded = true;
+    }
+  }
+  _loadUs += micros() - start;
+  return loaded || migrate(SPIFFS_STATS_FILE, &SpiffsStorage_::getStatsFromSpiffs, &ConfigStore_::saveStats);
+}
+
+bool ConfigStore_::loadStations() {
+  return load(CONFIG_NVS_KEY_STATIONS, CONFIG_RECORD_STATIONS, &ConfigStore_::decodeStations,
+              SPIFFS_STATIONS_FILE, &SpiffsStorage_::getStationsFromSpiffs, &ConfigStore_::saveStations);
+}
+
+bool ConfigStore_::saveConfig() {
+  debugMsgSpf("Saving config");
+  return save(CONFIG_NVS_KEY_CONFIG, CONFIG_RECORD_CONFIG, CONFIG_SCHEMA_CONFIG, &ConfigStore_::encodeConfig);
+}
+
+bool ConfigStore_::saveStats() {
+  debugMsgSpf("Saving stats");
+  // Over the older slot, so the newer one is still there if this doesn't complete
+  uint8_t slot = _statsSlot ^ 1;
+  _statsSeq++;
+  if (!save(STATS_SLOT_KEYS[slot], CONFIG_RECORD_STATS, CONFIG_SCHEMA_STATS, &ConfigStore_::encodeStats)) {
+    _statsSeq--;
+    return false;
+  }
+  _statsSlot = slot;
+  _statsSaves++;
+  return true;
+}
+
+bool ConfigStore_::saveStations() {
+  debugMsgSpf("Saving " + String(stationCount) + " stations");
+  return save(CONFIG_NVS_KEY_STATIONS, CONFIG_RECORD_STATIONS, CONFIG_SCHEMA_STATIONS, &ConfigStore_::encodeStations);
+}
+
+// ************************************************************
+// Config, schema 1
+// ************************************************************
+size_t ConfigStore_::encodeConfig(uint8_t *buf, size_t size) {
+  RecordWriter out(buf, size);
+  out.u8(cc->WifiOnAtStart ? 1 : 0);
+  out.u16((int16_t)cc->silenceAction);
+  out.u16((int16_t)cc->silenceThresholdDb);
+  out.u16((int16_t)cc->silenceSeconds);
+  out.u16((int16_t)cc->stallSeconds);
+  out.str(cc->WiFiSSID);
+  out.str(cc->WiFiPassword);
+  out.u8(cc->wifiCredentialCount);
+  for (uint8_t i = 0; i < cc->wifiCredentialCount; i++) {
+    out.str(cc->wifiCredentials[i].ssid);
+    out.str(cc->wifiCredentials[i].password);
+    out.u8(cc->wifiCredentials[i].priority);
+  }
+  return out.length();
+}
+
+bool ConfigStore_::decodeConfig(const uint8_t *payload, uint16_t length, uint8_t version) {
+  if (version != 1) {
+    return false;
+  }
+  RecordReader in(payload, length);
+  spiffs_config_t config;
+  config.WifiOnAtStart = in.u8() != 0;
+  config.silenceAction = (int16_t)in.u16();
+  config.silenceThresholdDb = (int16_t)in.u16();
+  config.silenceSeconds = (int16_t)in.u16();
+  config.stallSeconds = (int16_t)in.u16();
+  config.WiFiSSID = in.str();
+  config.WiFiPassword = in.str();
+  uint8_t count = in.u8();
+  if (count > MAX_WIFI_CREDENTIALS) {
+    return false;
+  }
+  for (uint8_t i = 0; i < count; i++) {
+    config.wifiCredentials[i].ssid = in.str();
+    config.wifiCredentials[i].password = in.str();
+    config.wifiCredentials[i].priority = in.u8();
+  }
+  if (!in.ok()) {
+    return false;
+  }
+
+  cc->WifiOnAtStart = config.WifiOnAtStart;
+  cc->silenceAction = config.silenceAction;
+  cc->silenceThresholdDb = config.silenceThresholdDb;
+  cc->silenceSeconds = config.silenceSeconds;
+  cc->stallSeconds = config.stallSeconds;
+  cc->WiFiSSID = config.WiFiSSID;
+  cc->WiFiPassword = config.WiFiPassword;
+  for (uint8_t i = 0; i < count; i++) {
+    cc->wifiCredentials[i] = config.wifiCredentials[i];
+  }
+  cc->wifiCredentialCount = count;
+  return true;
+}
+
+// ************************************************************
+// Stats, schema 2: the slot sequence number first. Schema 1
+// records, from before the two slots, read as sequence 0.
+// ************************************************************
+size_t ConfigStore_::encodeStats(uint8_t *buf, size_t size) {
+  RecordWriter out(buf, size);
+  out.u32(_statsSeq);
+  out.u32(cs->uptimeMins);
+  out.u32(cs->playtimeMins);
+  return out.length();
+}
+
+bool ConfigStore_::decodeStats(const uint8_t *payload, uint16_t length, uint8_t version, spiffs_stats_t &stats, uint32_t &seq) {
+  if (version != 1 && version != 2) {
+    return false;
+  }
+  RecordReader in(payload, length);
+  seq = version >= 2 ? in.u32() : 0;
+  stats.uptimeMins = in.u32();
+  stats.playtimeMins = in.u32();
+  return in.ok();
+}
+
+// ************************************************************
+// Preset stations, schema 1
+// ************************************************************
+size_t ConfigStore_::encodeStations(uint8_t *buf, size_t size) {
+  RecordWriter out(buf, size);
+  out.u8(stationCount);
+  for (int i = 0; i < stationCount; i++) {
+    const station_t &station = stations[i];
+    out.str(station.name);
+    out.u8(station.urlCount);
+    for (uint8_t u = 0; u < station.urlCount; u++) {
+      out.str(station.urls[u]);
+    }
+    out.u8(station.tierCount);
+    for (uint8_t t = 0; t < station.tierCount; t++) {
+      out.u16(station.tierKbps[t]);
+      out.str(station.tierUrls[t]);
+    }
+  }
+  return out.length();
+}
+
+bool ConfigStore_::decodeStations(const uint8_t *payload, uint16_t length, uint8_t version) {
+  if (version != 1) {
+    return false;
+  }
+  // Checked as a whole before anything is copied into the station table
+  RecordReader check(payload, length);
+  uint8_t count = check.u8();
+  if (count > MAX_STATIONS) {
+    return false;
+  }
+  for (uint8_t i = 0; i < count && check.ok(); i++) {
+    check.str();
+    uint8_t urlCount = check.u8();
+    for (uint8_t u = 0; u < urlCount && check.ok(); u++) {
+      check.str();
+    }
+    uint8_t tierCount = check.u8();
+    for (uint8_t t = 0; t < tierCount && check.ok(); t++) {
+      check.u16();
+      check.str();
+    }
+    if (urlCount > MAX_STATION_URLS || tierCount > MAX_STATION_TIERS) {
+      return false;
+    }
+  }
+  if (!check.ok()) {
+    return false;
+  }
+
+  RecordReader in(payload, length);
+  in.u8();
+  for (uint8_t i = 0; i < count; i++) {
+    station_t &station = stations[i];
+    station.name = in.str();
+    station.urlCount = in.u8();
+    for (uint8_t u = 0; u < MAX_STATION_URLS; u++) {
+      station.urls[u] = u < station.urlCount ? in.str() : String();
+    }
+    station.tierCount = in.u8();
+    for (uint8_t t = 0; t < MAX_STATION_TIERS; t++) {
+      if (t < station.tierCount) {
+        station.tierKbps[t] = in.u16();
+        station.tierUrls[t] = in.str();
+      } else {
+        station.tierKbps[t] = 0;
+        station.tierUrls[t] = String();
+      }
+    }
+  }
+  stationCount = count;
+  return count > 0;
+}
+
+// ************************************************************
+// For diagnostics
+// ************************************************************
+void ConfigStore_::writeJson(JsonStreamWriter &json) {
+  json.add("loadus", _loadUs);
+  json.add("configbytes", (unsigned)_bytes[CONFIG_RECORD_CONFIG - 1]);
+  json.add("statsbytes", (unsigned)_bytes[CONFIG_RECORD_STATS - 1]);
+  json.add("stationsbytes", (unsigned)_bytes[CONFIG_RECORD_STATIONS - 1]);
+  json.add("corrupt", (unsigned)_corrupt);
+  json.add("migrated", (unsigned)_migrated);
+  json.add("statsseq", _statsSeq);
+  json.add("statsslot", (unsigned)_statsSlot);
+  json.add("statssaves", _statsSaves);
+}
+
+// ************************************************************
+// Library internal singleton wiring
+// ************************************************************
+ConfigStore_ &ConfigStore_::getInstance() {
+  static ConfigStore_ instance;
+  return instance;
+}
+
+ConfigStore_ &configStore = configStore.getInstance();
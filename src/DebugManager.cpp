@@ -1,4 +1,34 @@
 #include "DebugManager.h"
+#include <stdarg.h>
+
+static const char* const MODULE_NAMES[LOG_MODULE_COUNT] = {
+  "INR", "OTM", "SPF", "WEB", "UTL", "WFM", "CDM", "GMC", "MNM", "AUD", "DBG", "CBK"
+};
+
+// ************************************************************
+// Empty ring: slot i is free for write position i
+// ************************************************************
+DebugManager_::DebugManager_() {
+  for (uint32_t i = 0; i < LOG_RING_ENTRIES; i++) {
+    _slots[i].seq.store(i, std::memory_order_relaxed);
+  }
+  for (int i = 0; i < LOG_MODULE_COUNT; i++) {
+    _levels[i] = LOG_LEVEL_INFO;
+  }
+  _writePos.store(0, std::memory_order_relaxed);
+  _dropped.store(0, std::memory_order_relaxed);
+}
+
+// ************************************************************
+// Start the low priority drain task. Until then messages are
+// held in the ring (and dropped once it is full).
+// ************************************************************
+void DebugManager_::begin() {
+  if (_drainTask) {
+    return;
+  }
+  xTaskCreatePinnedToCore(drainTask, "log", 3072, this, 1, &_drainTask, 0);
+}
 
 // ************************************************************
 // Set if we are to send messages to the serial port or not
@@ -8,25 +38,180 @@ void DebugManager_::setDebuggingOutput(bool newState) {
 }
 
 // ************************************************************
-// Output a logging message to the debug output, if set, 
-// adding prefix
+// Claim the next free slot without locking. Several tasks may
+// log at once: whoever wins the compare-and-set owns the slot.
+// Returns nullptr when the ring is full - we drop rather than
+// block the caller.
 // ************************************************************
-void DebugManager_::debugMsg(String prefix, String message) {
-  if (_state) {
-    Serial.println(prefix + ": " + message);
-    Serial.flush();
+DebugManager_::log_slot_t* DebugManager_::reserveSlot(uint32_t &pos) {
+  pos = _writePos.load(std::memory_order_relaxed);
+  for (;;) {
+    log_slot_t* slot = &_slots[pos & (LOG_RING_ENTRIES - 1)];
+    uint32_t seq = slot->seq.load(std::memory_order_acquire);
+    int32_t diff = (int32_t)(seq - pos);
+    if (diff == 0) {
+      if (_writePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+        return slot;
+      }
+    } else if (diff < 0) {
+      _dropped.fetch_add(1, std::memory_order_relaxed);
+      return nullptr;
+    } else {
+      pos = _writePos.load(std::memory_order_relaxed);
+    }
   }
 }
 
 // ************************************************************
-// Output a logging message to the debug output, if set, 
-// Continued messages don't need a prefix
+// Publish a filled slot to the drain task
 // ************************************************************
-void DebugManager_::debugMsgCont(String message) {
-  if (_state) {
-    Serial.print(message);
-    Serial.flush();
+void DebugManager_::commitSlot(log_slot_t* slot, uint32_t pos) {
+  slot->seq.store(pos + 1, std::memory_order_release);
+}
+
+// ************************************************************
+// Queue a logging message for the debug output, if set
+// ************************************************************
+void DebugManager_::debugMsg(LogModule module, LogLevel level, const char* message) {
+  if (!isEnabled(module, level)) {
+    return;
+  }
+  uint32_t pos;
+  log_slot_t* slot = reserveSlot(pos);
+  if (!slot) {
+    return;
+  }
+  slot->millis = millis();
+  slot->module = module;
+  strncpy(slot->text, message, LOG_LINE_LENGTH - 1);
+  slot->text[LOG_LINE_LENGTH - 1] = '\0';
+  commitSlot(slot, pos);
+}
+
+// ************************************************************
+// Queue a printf style message, formatted straight into the
+// ring slot
+// ************************************************************
+void DebugManager_::debugMsgf(LogModule module, LogLevel level, const char* format, ...) {
+  if (!isEnabled(module, level)) {
+    return;
+  }
+  uint32_t pos;
+  log_slot_t* slot = reserveSlot(pos);
+  if (!slot) {
+    return;
+  }
+  slot->millis = millis();
+  slot->module = module;
+  va_list args;
+  va_start(args, format);
+  vsnprintf(slot->text, LOG_LINE_LENGTH, format, args);
+  va_end(args);
+  commitSlot(slot, pos);
+}
+
+// ************************************************************
+// Keep a copy of what went to serial for /api/logs
+// ************************************************************
+void DebugManager_::appendHistory(const char* text, size_t len) {
+  portENTER_CRITICAL(&_historyMux);
+  for (size_t i = 0; i < len; i++) {
+    _history[_historyHead++] = text[i];
+    if (_historyHead >= LOG_HISTORY_SIZE) {
+      _historyHead = 0;
+      _historyWrapped = true;
+    }
+  }
+  portEXIT_CRITICAL(&_historyMux);
+}
+
+// ************************************************************
+// Write everything queued so far to the serial port. Runs only
+// on the drain task, so the UART never blocks a caller.
+// ************************************************************
+void DebugManager_::drain() {
+  char line[LOG_LINE_LENGTH + 24];
+  for (;;) {
+    log_slot_t* slot = &_slots[_readPos & (LOG_RING_ENTRIES - 1)];
+    if (slot->seq.load(std::memory_order_acquire) != _readPos + 1) {
+      break;
+    }
+    int len = snprintf(line, sizeof(line), "[%s]: %s\n", MODULE_NAMES[slot->module], slot->text);
+    if (len > (int)sizeof(line) - 1) {
+      len = sizeof(line) - 1;
+    }
+    // Release the slot before the slow UART write
+    slot->seq.store(_readPos + LOG_RING_ENTRIES, std::memory_order_release);
+    _readPos++;
+
+    Serial.write((const uint8_t*)line, len);
+    appendHistory(line, len);
+  }
+}
+
+// ************************************************************
+// Drain task body
+// ************************************************************
+void DebugManager_::drainTask(void *param) {
+  DebugManager_ *self = static_cast<DebugManager_ *>(param);
+  for (;;) {
+    self->drain();
+    vTaskDelay(pdMS_TO_TICKS(LOG_DRAIN_INTERVAL_MS));
+  }
+}
+
+// ************************************************************
+// Output the retained log text, oldest first. Copied in chunks
+// so the critical section stays short.
+// ************************************************************
+void DebugManager_::writeHistory(Print &out) {
+  char chunk[128];
+  size_t start;
+  size_t total;
+  portENTER_CRITICAL(&_historyMux);
+  start = _historyWrapped ? _historyHead : 0;
+  total = _historyWrapped ? LOG_HISTORY_SIZE : _historyHead;
+  portEXIT_CRITICAL(&_historyMux);
+
+  size_t done = 0;
+  while (done < total) {
+    size_t n = total - done;
+    if (n > sizeof(chunk)) {
+      n = sizeof(chunk);
+    }
+    portENTER_CRITICAL(&_historyMux);
+    for (size_t i = 0; i < n; i++) {
+      chunk[i] = _history[(start + done + i) % LOG_HISTORY_SIZE];
+    }
+    portEXIT_CRITICAL(&_historyMux);
+    out.write((const uint8_t*)chunk, n);
+    done += n;
+  }
+}
+
+// ************************************************************
+// Per module runtime level
+// ************************************************************
+void DebugManager_::setModuleLevel(LogModule module, LogLevel level) {
+  _levels[module] = level;
+}
+
+LogLevel DebugManager_::getModuleLevel(LogModule module) {
+  return (LogLevel)_levels[module];
+}
+
+const char* DebugManager_::getModuleName(LogModule module) {
+  return MODULE_NAMES[module];
+}
+
+bool DebugManager_::moduleFromName(const char* name, LogModule &module) {
+  for (int i = 0; i < LOG_MODULE_COUNT; i++) {
+    if (strcasecmp(name, MODULE_NAMES[i]) == 0) {
+      module = (LogModule)i;
+      return true;
+    }
   }
+  return false;
 }
 
 // ************************************************************
@@ -39,7 +224,7 @@ void DebugManager_::debugAutoOffCheck() {
       _debugForSecs--;
     }
     if (_debugForSecs == 0) {
-      debugMsg("[DBG]", "Auto off");
+      debugMsg(LOG_MODULE_DBG, LOG_LEVEL_INFO, "Auto off");
       _state = false;
     }
   }
@@ -59,7 +244,7 @@ bool DebugManager_::isDebugOn() {
 void DebugManager_::setDebugAutoOff(unsigned int seconds) {
   _debugForSecs = seconds;
   _state = true;
-  debugMsg("[DBG]", "Debug on for " + String(seconds) + " seconds");
+  debugMsgf(LOG_MODULE_DBG, LOG_LEVEL_INFO, "Debug on for %u seconds", seconds);
 }
 
 // ************************************************************
@@ -75,7 +260,7 @@ DebugManager_ &DebugManager_::getInstance() {
 // be called from a callback.
 // ************************************************************
 void debugManagerLink(String message) {
-  debugManager.debugMsg("[CBK]: ", message);
+  debugManager.debugMsg(LOG_MODULE_CBK, LOG_LEVEL_INFO, message);
 }
 
-DebugManager_ &debugManager = debugManager.getInstance();
\ No newline at end of file
+DebugManager_ &debugManager = debugManager.getInstance();
@@ -4,6 +4,7 @@
  */
 
 #include "ESP32MenuSystem.h"
+#include "Trace.h"
 
 // Static instance for ISR access
 MenuSystem *MenuSystem::instance = NULL;
@@ -289,6 +290,9 @@ MenuItem *MenuSystem::addStringValue(MenuItem *parent, const char *label, char *
   item->data.stringData.maxLength = maxLen;
   item->data.stringData.charset = charset ? charset : DEFAULT_CHARSET;
   item->data.stringData.onSave = onSave;
+  item->data.stringData.search = NULL;
+  item->data.stringData.resultLabel = NULL;
+  item->data.stringData.onPick = NULL;
 
   if (parent->child == NULL)
   {
@@ -305,6 +309,19 @@ MenuItem *MenuSystem::addStringValue(MenuItem *parent, const char *label, char *
   return item;
 }
 
+// Add search item - a string value that searches as it is composed
+MenuItem *MenuSystem::addSearch(MenuItem *parent, const char *label, char *buffer,
+                                uint8_t maxLen, SearchCallback search,
+                                SearchLabelCallback resultLabel, SearchPickCallback onPick,
+                                const char *charset)
+{
+  MenuItem *item = addStringValue(parent, label, buffer, maxLen, charset);
+  item->data.stringData.search = search;
+  item->data.stringData.resultLabel = resultLabel;
+  item->data.stringData.onPick = onPick;
+  return item;
+}
+
 // Add either-or item
 MenuItem *MenuSystem::addEitherOr(MenuItem *parent, const char *label, bool *valuePtr,
                                   const char *opt1, const char *opt2,
@@ -540,6 +557,8 @@ void MenuSystem::enterMenuItem(MenuItem *item)
     editingCharset = item->data.stringData.charset;
     editingCursorPos = strlen(editingBuffer);
     editingCharIndex = 0;
+    editingBrowse = false;
+    runSearch();
     encoderPosition = 0;
     lastEncoderPos = 0;
     break;
@@ -562,13 +581,28 @@ void MenuSystem::enterMenuItem(MenuItem *item)
 void MenuSystem::exitCurrentMode()
 {
   currentMode = MODE_MENU_NAVIGATION;
+  editingBrowse = false;
   encoderPosition = 0;
   lastEncoderPos = 0;
 }
 
+// Search with the string composed so far, if this is a search item
+void MenuSystem::runSearch()
+{
+  editingResultCount = 0;
+  editingResultIndex = 0;
+  if (selectedItem->data.stringData.search)
+  {
+    editingResultCount = selectedItem->data.stringData.search(editingBuffer);
+    debugMsgMnm("[SEARCH] '" + String(editingBuffer) + "': " + String(editingResultCount) + " results");
+  }
+}
+
 // Main update loop
 void MenuSystem::update()
 {
+  TRACE_SCOPE("menu.update");
+
   // lastEncoderPos is now a class member to allow syncing when entering edit modes
 
   // Check for screen saver timeout
@@ -579,7 +613,10 @@ void MenuSystem::update()
     {
       screenSaverActive = true;
       display->clearDisplay();
-      display->display();
+      {
+        TRACE_SCOPE("display.flush");
+        display->display();
+      }
       debugMsgMnm("[SCREEN] Screen saver activated");
       return; // Don't process anything while screen saver is active
     }
@@ -595,7 +632,10 @@ void MenuSystem::update()
     // Render flash message but skip input processing
     display->clearDisplay();
     renderFlashMessage();
-    display->display();
+    {
+      TRACE_SCOPE("display.flush");
+      display->display();
+    }
     return;
   }
 
@@ -688,6 +728,16 @@ void MenuSystem::update()
 
     case MODE_STRING_COMPOSITION:
     {
+      if (editingBrowse)
+      {
+        int index = editingResultIndex + delta;
+        if (index < 0)
+          index = 0;
+        if (index >= editingResultCount)
+          index = editingResultCount - 1;
+        editingResultIndex = index;
+        break;
+      }
       int charsetLen = strlen(editingCharset);
       editingCharIndex += delta;
       if (editingCharIndex < 0)
@@ -759,6 +809,23 @@ void MenuSystem::update()
       }
       exitCurrentMode();
     }
+    else if (currentMode == MODE_STRING_COMPOSITION && selectedItem->data.stringData.search)
+    {
+      // Confirm browses the results, then picks one
+      if (editingBrowse)
+      {
+        debugMsgMnm("[SEARCH] Picked result " + String(editingResultIndex));
+        exitCurrentMode();
+        selectedItem->data.stringData.onPick(editingResultIndex);
+      }
+      else if (editingResultCount > 0)
+      {
+        editingBrowse = true;
+        editingResultIndex = 0;
+        encoderPosition = 0;
+        lastEncoderPos = 0;
+      }
+    }
     else if (currentMode == MODE_STRING_COMPOSITION)
     {
       // Confirm button finishes string entry
@@ -800,6 +867,12 @@ void MenuSystem::update()
       }
       exitCurrentMode();
     }
+    else if (currentMode == MODE_STRING_COMPOSITION && editingBrowse)
+    {
+      debugMsgMnm("[SEARCH] Picked result " + String(editingResultIndex));
+      exitCurrentMode();
+      selectedItem->data.stringData.onPick(editingResultIndex);
+    }
     else if (currentMode == MODE_STRING_COMPOSITION)
     {
       // Encoder button adds the current character
@@ -810,6 +883,11 @@ void MenuSystem::update()
         editingCursorPos++;
         editingBuffer[editingCursorPos] = '\0';
         editingCharIndex = 0;
+        runSearch();
+      }
+      else if (selectedItem->data.stringData.search)
+      {
+        debugMsgMnm("[SEARCH] Max length reached");
       }
       else
       {
@@ -862,6 +940,13 @@ void MenuSystem::update()
         showStatusScreen();
       }
     }
+    else if (currentMode == MODE_STRING_COMPOSITION && editingBrowse)
+    {
+      // Back to narrowing the search
+      editingBrowse = false;
+      encoderPosition = 0;
+      lastEncoderPos = 0;
+    }
     else if (currentMode == MODE_STRING_COMPOSITION)
     {
       if (editingCursorPos > 0)
@@ -869,6 +954,7 @@ void MenuSystem::update()
         editingCursorPos--;
         editingBuffer[editingCursorPos] = '\0';
         debugMsgMnm("[STRING] Deleted character, now: " + String(editingBuffer));
+        runSearch();
       }
       else
       {
@@ -909,6 +995,7 @@ void MenuSystem::update()
     break;
   }
 
+  TRACE_SCOPE("display.flush");
   display->display();
 }
 
@@ -1013,6 +1100,12 @@ void MenuSystem::renderNumericValue()
 // Render string composition
 void MenuSystem::renderStringComposition()
 {
+  if (editingBrowse)
+  {
+    renderSearchResults();
+    return;
+  }
+
   display->setTextSize(1);
   display->setCursor(0, 0);
   display->print(selectedItem->label);
@@ -1048,9 +1141,65 @@ void MenuSystem::renderStringComposition()
   display->setCursor(screenWidth - 10, 42);
   display->print(nextChar);
 
+  // Search items show how many match and the first of them
+  if (selectedItem->data.stringData.search)
+  {
+    char resultLine[22];
+    if (editingResultCount > 0)
+    {
+      snprintf(resultLine, sizeof(resultLine), "%d:%s", editingResultCount,
+               selectedItem->data.stringData.resultLabel(0));
+    }
+    else
+    {
+      snprintf(resultLine, sizeof(resultLine), "No match");
+    }
+    display->setCursor(2, 26);
+    display->print(resultLine);
+  }
+
   // Instructions
   display->setCursor(0, screenHeight - 10);
-  display->print("Enc:Add OK:Done");
+  display->print(selectedItem->data.stringData.search ? "Enc:Add OK:List" : "Enc:Add OK:Done");
+}
+
+// Render the results of a search item as a list
+void MenuSystem::renderSearchResults()
+{
+  const uint8_t lineHeight = 12;
+  const uint8_t startY = 14;
+  const uint8_t maxVisibleItems = (screenHeight - startY - 2) / lineHeight;
+
+  display->setTextSize(1);
+  display->setCursor(0, 0);
+  display->print(selectedItem->label);
+  display->print(": ");
+  display->print(editingBuffer);
+  display->drawLine(0, 10, screenWidth, 10, SH110X_WHITE);
+
+  // Keep the selected result on screen
+  uint8_t first = editingResultIndex < maxVisibleItems ? 0 : editingResultIndex - maxVisibleItems + 1;
+  uint8_t yPos = startY;
+  for (uint8_t index = first; index < editingResultCount && index < first + maxVisibleItems; index++)
+  {
+    if (index == editingResultIndex)
+    {
+      display->fillRect(0, yPos, screenWidth, lineHeight, SH110X_WHITE);
+      display->setTextColor(SH110X_BLACK);
+    }
+    else
+    {
+      display->setTextColor(SH110X_WHITE);
+    }
+
+    char line[22];
+    snprintf(line, sizeof(line), "%s", selectedItem->data.stringData.resultLabel(index));
+    display->setCursor(4, yPos + 2);
+    display->print(line);
+
+    display->setTextColor(SH110X_WHITE); // Reset color
+    yPos += lineHeight;
+  }
 }
 
 // Render either-or selection
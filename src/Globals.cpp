@@ -36,12 +36,6 @@ unsigned long lastEncoderMillis = 0;
 // ************************************************************
 unsigned long nowMillis = 0;
 unsigned long previousMillisWiFi = 0;
-unsigned long lastSecondStartMillis = 0;
-int lastSecond = 0;
-boolean triggeredThisSec = false;
-int secsDeltaAbs;                   // Sawtooth 0..1000 every sec
-int secsDelta;                      // Triangle 0..1000..0 every 2 secs
-bool upOrDown;  
 
 bool blanked = false;
 
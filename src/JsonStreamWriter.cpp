@@ -0,0 +1,224 @@
+#include "JsonStreamWriter.h"
+#include <stdarg.h>
+
+// ************************************************************
+// Bind to the output
+// ************************************************************
+JsonStreamWriter::JsonStreamWriter(Print &out) : _out(out) {
+}
+
+// ************************************************************
+// Never lose buffered output
+// ************************************************************
+JsonStreamWriter::~JsonStreamWriter() {
+  flush();
+}
+
+// ************************************************************
+// Push the buffer to the output
+// ************************************************************
+void JsonStreamWriter::flush() {
+  if (_len > 0) {
+    _out.write((const uint8_t *)_buf, _len);
+    _len = 0;
+  }
+}
+
+// ************************************************************
+// Buffered single character output
+// ************************************************************
+void JsonStreamWriter::put(char c) {
+  if (_len >= JSON_WRITER_BUFFER_SIZE) {
+    flush();
+  }
+  _buf[_len++] = c;
+}
+
+// ************************************************************
+// Buffered raw string output
+// ************************************************************
+void JsonStreamWriter::putStr(const char *s) {
+  while (*s) {
+    put(*s++);
+  }
+}
+
+// ************************************************************
+// Output a string with JSON escaping applied
+// ************************************************************
+void JsonStreamWriter::putEscaped(const char *s) {
+  static const char hex[] = "0123456789abcdef";
+  for (; *s; s++) {
+    char c = *s;
+    switch (c) {
+      case '"':  putStr("\\\""); break;
+      case '\\': putStr("\\\\"); break;
+      case '\n': putStr("\\n"); break;
+      case '\r': putStr("\\r"); break;
+      case '\t': putStr("\\t"); break;
+      default:
+        if ((uint8_t)c < 0x20) {
+          putStr("\\u00");
+          put(hex[(c >> 4) & 0x0f]);
+          put(hex[c & 0x0f]);
+        } else {
+          put(c);
+        }
+    }
+  }
+}
+
+// ************************************************************
+// Write the comma between siblings, unless we are the value
+// half of a key/value pair
+// ************************************************************
+void JsonStreamWriter::separator() {
+  if (_afterKey) {
+    _afterKey = false;
+    return;
+  }
+  uint32_t bit = 1UL << _depth;
+  if (_hasItems & bit) {
+    put(',');
+  }
+  _hasItems |= bit;
+}
+
+// ************************************************************
+// Open a container
+// ************************************************************
+void JsonStreamWriter::open(char c) {
+  separator();
+  put(c);
+  if (_depth < JSON_WRITER_MAX_DEPTH) {
+    _depth++;
+  }
+  _hasItems &= ~(1UL << _depth);
+}
+
+// ************************************************************
+// Close a container
+// ************************************************************
+void JsonStreamWriter::close(char c) {
+  if (_depth > 0) {
+    _depth--;
+  }
+  put(c);
+}
+
+JsonStreamWriter &JsonStreamWriter::beginObject() { open('{'); return *this; }
+JsonStreamWriter &JsonStreamWriter::endObject()   { close('}'); return *this; }
+JsonStreamWriter &JsonStreamWriter::beginArray()  { open('['); return *this; }
+JsonStreamWriter &JsonStreamWriter::endArray()    { close(']'); return *this; }
+
+// ************************************************************
+// Object member name
+// ************************************************************
+JsonStreamWriter &JsonStreamWriter::key(const char *name) {
+  separator();
+  put('"');
+  putEscaped(name);
+  putStr("\":");
+  _afterKey = true;
+  return *this;
+}
+
+// ************************************************************
+// Scalar values
+// ************************************************************
+JsonStreamWriter &JsonStreamWriter::value(const char *str) {
+  if (!str) {
+    return nullValue();
+  }
+  separator();
+  put('"');
+  putEscaped(str);
+  put('"');
+  return *this;
+}
+
+JsonStreamWriter &JsonStreamWriter::value(bool b) {
+  separator();
+  putStr(b ? "true" : "false");
+  return *this;
+}
+
+JsonStreamWriter &JsonStreamWriter::value(long i) {
+  char num[24];
+  snprintf(num, sizeof(num), "%ld", i);
+  separator();
+  putStr(num);
+  return *this;
+}
+
+JsonStreamWriter &JsonStreamWriter::value(unsigned long u) {
+  char num[24];
+  snprintf(num, sizeof(num), "%lu", u);
+  separator();
+  putStr(num);
+  return *this;
+}
+
+JsonStreamWriter &JsonStreamWriter::value(long long i) {
+  char num[24];
+  snprintf(num, sizeof(num), "%lld", i);
+  separator();
+  putStr(num);
+  return *this;
+}
+
+JsonStreamWriter &JsonStreamWriter::value(unsigned long long u) {
+  char num[24];
+  snprintf(num, sizeof(num), "%llu", u);
+  separator();
+  putStr(num);
+  return *this;
+}
+
+JsonStreamWriter &JsonStreamWriter::value(double d, uint8_t decimals) {
+  if (isnan(d) || isinf(d)) {
+    return nullValue();
+  }
+  char num[32];
+  snprintf(num, sizeof(num), "%.*f", decimals, d);
+  separator();
+  putStr(num);
+  return *this;
+}
+
+JsonStreamWriter &JsonStreamWriter::nullValue() {
+  separator();
+  putStr("null");
+  return *this;
+}
+
+// ************************************************************
+// Formatted string value - truncated to the stack buffer
+// ************************************************************
+JsonStreamWriter &JsonStreamWriter::valuef(const char *format, ...) {
+  char text[96];
+  va_list args;
+  va_start(args, format);
+  vsnprintf(text, sizeof(text), format, args);
+  va_end(args);
+  return value(text);
+}
+
+// ************************************************************
+// Piecewise string value
+// ************************************************************
+JsonStreamWriter &JsonStreamWriter::beginString() {
+  separator();
+  put('"');
+  return *this;
+}
+
+JsonStreamWriter &JsonStreamWriter::stringPart(const char *str) {
+  putEscaped(str);
+  return *this;
+}
+
+JsonStreamWriter &JsonStreamWriter::endString() {
+  put('"');
+  return *this;
+}
@@ -0,0 +1,287 @@
+#include "LinkMonitor.h"
+#include <WiFi.h>
+#include <esp_wifi.h>
+#include "lwip/stats.h"
+#include "DebugManager.h"
+#include "Metrics.h"
+#include "RadioOutputManager.h"
+
+// Must match the LinkEventType order
+static const char* const LINK_EVENT_NAMES[LINK_EVENT_COUNT] = {
+  "underrun", "reconnect", "wifidisconnect"
+};
+
+// ************************************************************
+// TCP retransmissions so far, -1 if lwIP isn't counting them
+// ************************************************************
+static int32_t readRetransmits() {
+#if LWIP_STATS && MIB2_STATS
+  return (int32_t)lwip_stats.mib2.tcpretranssegs;
+#else
+  return -1;
+#endif
+}
+
+// ************************************************************
+// PHY mode of the current association as LINK_PHY_ bits
+// ************************************************************
+static uint8_t readPhy() {
+  wifi_ap_record_t apInfo;
+  if (esp_wifi_sta_get_ap_info(&apInfo) != ESP_OK) {
+    return 0;
+  }
+  uint8_t phy = 0;
+  if (apInfo.phy_11b) phy |= LINK_PHY_11B;
+  if (apInfo.phy_11g) phy |= LINK_PHY_11G;
+  if (apInfo.phy_11n) phy |= LINK_PHY_11N;
+  if (apInfo.phy_lr) phy |= LINK_PHY_LR;
+  if (apInfo.second != WIFI_SECOND_CHAN_NONE) phy |= LINK_PHY_HT40;
+  return phy;
+}
+
+// ************************************************************
+// Allocate the history and event rings, in PSRAM if we have it
+// ************************************************************
+void LinkMonitor_::begin() {
+  if (psramFound()) {
+    _historySize = LINK_HISTORY_SECONDS;
+    _eventsSize = LINK_EVENTS_KEPT;
+    _history = (link_sample_t*)ps_calloc(_historySize, sizeof(link_sample_t));
+    _events = (link_event_t*)ps_calloc(_eventsSize, sizeof(link_event_t));
+  } else {
+    _historySize = 64;
+    _eventsSize = 2;
+    _history = (link_sample_t*)calloc(_historySize, sizeof(link_sample_t));
+    _events = (link_event_t*)calloc(_eventsSize, sizeof(link_event_t));
+  }
+  if (!_history || !_events) {
+    debugMsgWfm("Link monitor: no memory for history");
+    free(_history);
+    free(_events);
+    _history = nullptr;
+    _events = nullptr;
+    return;
+  }
+  memset(_lastEventMillis, 0, sizeof(_lastEventMillis));
+  _lastRetransmits = readRetransmits();
+  debugMsgWfmf("Link monitor: %us history, %u events", (unsigned)_historySize, (unsigned)_eventsSize);
+}
+
+// ************************************************************
+// Note an event. The window is captured at the next sample.
+// Safe from any task.
+// ************************************************************
+void LinkMonitor_::noteEvent(LinkEventType type) {
+  uint32_t now = millis();
+  portENTER_CRITICAL(&_mux);
+  if (_lastEventMillis[type] == 0 || now - _lastEventMillis[type] >= LINK_EVENT_MIN_GAP_MS) {
+    _lastEventMillis[type] = now;
+    if (_pendingCount < LINK_PENDING_EVENTS) {
+      _pending[_pendingCount] = type;
+      _pendingMillis[_pendingCount] = now;
+      _pendingCount++;
+    }
+  }
+  portEXIT_CRITICAL(&_mux);
+}
+
+// ************************************************************
+// Record one second of link data, then capture the window for
+// any events noted since the last sample
+// ************************************************************
+void LinkMonitor_::sample() {
+  if (!_history) {
+    return;
+  }
+
+  link_sample_t s;
+  memset(&s, 0, sizeof(s));
+  s.millis = millis();
+
+  uint32_t streamBytes = metrics.get(METRIC_STREAM_BYTES);
+  s.bytesPerSec = streamBytes - _lastStreamBytes;
+  _lastStreamBytes = streamBytes;
+
+  s.bufferedMs = (uint16_t)min(radioOutputManager.getBufferedMs(), (uint32_t)UINT16_MAX);
+
+  int32_t retransmits = readRetransmits();
+  s.retransmits = (retransmits >= 0 && _lastRetransmits >= 0) ? (int16_t)min(retransmits - _lastRetransmits, (int32_t)INT16_MAX) : -1;
+  _lastRetransmits = retransmits;
+
+  if (WiFi.isConnected()) {
+    s.rssi = (int8_t)WiFi.RSSI();
+    s.phy = readPhy();
+  }
+
+  portENTER_CRITICAL(&_mux);
+  _history[_sampleCount % _historySize] = s;
+  _sampleCount++;
+  portEXIT_CRITICAL(&_mux);
+
+  for (;;) {
+    uint8_t type;
+    uint32_t when;
+    portENTER_CRITICAL(&_mux);
+    bool more = _pendingCount > 0;
+    if (more) {
+      type = _pending[0];
+      when = _pendingMillis[0];
+      _pendingCount--;
+      memmove(_pending, _pending + 1, _pendingCount);
+      memmove(_pendingMillis, _pendingMillis + 1, _pendingCount * sizeof(uint32_t));
+    }
+    portEXIT_CRITICAL(&_mux);
+    if (!more) {
+      break;
+    }
+    snapshot(type, when);
+  }
+}
+
+// ************************************************************
+// Copy the last LINK_EVENT_WINDOW samples into a new event
+// ************************************************************
+void LinkMonitor_::snapshot(uint8_t type, uint32_t when) {
+  link_event_t &event = _events[_eventCount % _eventsSize];
+
+  portENTER_CRITICAL(&_mux);
+  uint32_t count = min(_sampleCount, (uint32_t)min((int)LINK_EVENT_WINDOW, (int)_historySize));
+  event.millis = when;
+  event.type = type;
+  event.byteRate = radioOutputManager.getByteRate();
+  event.sampleCount = count;
+  for (uint32_t i = 0; i < count; i++) {
+    event.samples[i] = _history[(_sampleCount - count + i) % _historySize];
+  }
+  _eventCount++;
+  portEXIT_CRITICAL(&_mux);
+
+  debugMsgWfmf("Link event %s captured with %us of history", LINK_EVENT_NAMES[type], (unsigned)count);
+}
+
+// ************************************************************
+// Network or decoder? A weak or dropped link, retransmissions,
+// or less coming in than the decoder uses point at the network.
+// Data arriving fine while the buffer ran dry points elsewhere,
+// but only if we know what the decoder was using.
+// ************************************************************
+const char* LinkMonitor_::causeHint(const link_event_t &event) {
+  if (event.type == LINK_EVENT_WIFI_DISCONNECT) {
+    return "network";
+  }
+  uint8_t recent = min((int)event.sampleCount, 10);
+  if (recent == 0) {
+    return "unknown";
+  }
+  uint32_t inbound = 0;
+  int32_t retransmits = 0;
+  for (uint8_t i = event.sampleCount - recent; i < event.sampleCount; i++) {
+    const link_sample_t &s = event.samples[i];
+    if (s.rssi == 0 || s.rssi < LINK_WEAK_RSSI) {
+      return "network";
+    }
+    inbound += s.bytesPerSec;
+    if (s.retransmits > 0) {
+      retransmits += s.retransmits;
+    }
+  }
+  if (retransmits > (int32_t)recent * 2) {
+    return "network";
+  }
+  if (event.byteRate == 0) {
+    // Not measured yet, e.g. straight after a start - nothing to compare the intake with
+    return "unknown";
+  }
+  if (inbound / recent < event.byteRate * 9 / 10) {
+    return "network";
+  }
+  return "decoder";
+}
+
+// ************************************************************
+// One sample as a compact array, in the order of "fields"
+// ************************************************************
+void LinkMonitor_::writeSample(JsonStreamWriter &json, const link_sample_t &s) {
+  json.beginArray();
+  json.value(s.millis);
+  json.value((int)s.rssi);
+  json.value((int)s.phy);
+  json.value(s.bytesPerSec);
+  json.value((int)s.retransmits);
+  json.value((unsigned long)s.bufferedMs);
+  json.endArray();
+}
+
+// ************************************************************
+// The recent history and the kept events, newest event first
+// ************************************************************
+void LinkMonitor_::writeJson(JsonStreamWriter &json, uint16_t historySeconds) {
+  json.beginObject();
+  json.key("fields").beginArray();
+  json.value("millis").value("rssi").value("phy").value("bps").value("retransmits").value("bufferedms");
+  json.endArray();
+  json.add("retransmitscounted", readRetransmits() >= 0);
+  json.add("samples", _sampleCount);
+
+  json.key("history").beginArray();
+  if (_history) {
+    uint32_t sampleCount;
+    portENTER_CRITICAL(&_mux);
+    sampleCount = _sampleCount;
+    portEXIT_CRITICAL(&_mux);
+    uint32_t count = min(sampleCount, (uint32_t)min(historySeconds, _historySize));
+    for (uint32_t i = 0; i < count; i++) {
+      link_sample_t s;
+      portENTER_CRITICAL(&_mux);
+      s = _history[(sampleCount - count + i) % _historySize];
+      portEXIT_CRITICAL(&_mux);
+      writeSample(json, s);
+    }
+  }
+  json.endArray();
+
+  json.key("events").beginArray();
+  if (_events) {
+    uint32_t eventCount;
+    portENTER_CRITICAL(&_mux);
+    eventCount = _eventCount;
+    portEXIT_CRITICAL(&_mux);
+    uint32_t kept = min(eventCount, (uint32_t)_eventsSize);
+    for (uint32_t n = 1; n <= kept; n++) {
+      link_event_t event;
+      portENTER_CRITICAL(&_mux);
+      event = _events[(eventCount - n) % _eventsSize];
+      portEXIT_CRITICAL(&_mux);
+
+      json.beginObject();
+      json.add("millis", event.millis);
+      json.add("type", LINK_EVENT_NAMES[event.type]);
+      json.add("cause", causeHint(event));
+      json.key("byterate");
+      if (event.byteRate) {
+        json.value(event.byteRate);
+      } else {
+        json.nullValue();
+      }
+      json.key("samples").beginArray();
+      for (uint8_t i = 0; i < event.sampleCount; i++) {
+        writeSample(json, event.samples[i]);
+      }
+      json.endArray();
+      json.endObject();
+    }
+  }
+  json.endArray();
+
+  json.endObject();
+}
+
+// ************************************************************
+// Library internal singleton wiring
+// ************************************************************
+LinkMonitor_ &LinkMonitor_::getInstance() {
+  static LinkMonitor_ instance;
+  return instance;
+}
+
+LinkMonitor_ &linkMonitor = linkMonitor.getInstance();
@@ -0,0 +1,191 @@
+#include "LoopProfiler.h"
+
+// Upper bounds in microseconds
+static const uint32_t LOOP_BUCKETS_US[LOOP_HISTOGRAM_BUCKETS] = {50, 100, 250, 500, 1000, 2500, 5000, 10000, 20000, 50000};
+
+// Must match the LoopStep order
+static const char* const LOOP_STEP_NAMES[LOOP_STEP_COUNT] = {
+  "audio", "ota", "dns", "menu", "periodic"
+};
+
+// ************************************************************
+// Start timing a loop iteration
+// ************************************************************
+void LoopProfiler_::beginIteration() {
+  if (_cyclesPerUs == 0) {
+    _cyclesPerUs = getCpuFrequencyMhz();
+  }
+  _iterationStart = ESP.getCycleCount();
+  _stepsRun = 0;
+}
+
+// ************************************************************
+// Add the cycles spent in one step. A step can run more than
+// once in an iteration.
+// ************************************************************
+void LoopProfiler_::addStep(LoopStep step, uint32_t cycles) {
+  if (!(_stepsRun & (1 << step))) {
+    _stepCycles[step] = 0;
+    _stepsRun |= (1 << step);
+  }
+  _stepCycles[step] += cycles;
+}
+
+// ************************************************************
+// Count one observation into a histogram
+// ************************************************************
+void LoopProfiler_::observe(loop_histogram_t &hist, uint32_t us) {
+  uint8_t bucket = 0;
+  while (bucket < LOOP_HISTOGRAM_BUCKETS && us > LOOP_BUCKETS_US[bucket]) {
+    bucket++;
+  }
+  hist.buckets[bucket]++;
+  hist.count++;
+  hist.totalUs += us;
+  if (us > hist.maxUs) {
+    hist.maxUs = us;
+  }
+}
+
+// ************************************************************
+// Fold the iteration into the histograms, capturing it if it
+// went over budget
+// ************************************************************
+void LoopProfiler_::endIteration(bool decoderInline) {
+  uint32_t totalUs = (ESP.getCycleCount() - _iterationStart) / _cyclesPerUs;
+  uint32_t stepUs[LOOP_STEP_COUNT];
+  for (int i = 0; i < LOOP_STEP_COUNT; i++) {
+    stepUs[i] = (_stepsRun & (1 << i)) ? _stepCycles[i] / _cyclesPerUs : 0;
+  }
+
+  portENTER_CRITICAL(&_mux);
+  for (int i = 0; i < LOOP_STEP_COUNT; i++) {
+    if (_stepsRun & (1 << i)) {
+      observe(_steps[i], stepUs[i]);
+    }
+  }
+  observe(_iteration, totalUs);
+  if (decoderInline) {
+    _iterationsInline++;
+  }
+
+  if (totalUs > LOOP_SLOW_BUDGET_US) {
+    loop_slow_capture_t &capture = _slow[_slowCount % LOOP_SLOW_CAPTURES];
+    capture.millis = millis();
+    capture.totalUs = totalUs;
+    capture.worstStep = 0;
+    for (int i = 0; i < LOOP_STEP_COUNT; i++) {
+      capture.stepUs[i] = stepUs[i];
+      if (stepUs[i] > stepUs[capture.worstStep]) {
+        capture.worstStep = i;
+      }
+    }
+    capture.decoderInline = decoderInline;
+    _slowCount++;
+    if (decoderInline) {
+      _slowInlineCount++;
+    }
+  }
+  portEXIT_CRITICAL(&_mux);
+}
+
+// ************************************************************
+// One histogram as JSON
+// ************************************************************
+void LoopProfiler_::writeHistogram(JsonStreamWriter &json, const loop_histogram_t &hist) {
+  json.add("count", hist.count);
+  json.add("max", hist.maxUs);
+  json.add("mean", hist.count ? (unsigned long)(hist.totalUs / hist.count) : 0UL);
+  json.key("buckets").beginArray();
+  for (int b = 0; b <= LOOP_HISTOGRAM_BUCKETS; b++) {
+    json.beginObject();
+    if (b < LOOP_HISTOGRAM_BUCKETS) {
+      json.add("le", LOOP_BUCKETS_US[b]);
+    } else {
+      json.add("le", "+Inf");
+    }
+    json.add("count", hist.buckets[b]);
+    json.endObject();
+  }
+  json.endArray();
+}
+
+// ************************************************************
+// All histograms (microseconds) and the slow captures, newest
+// first. Each piece is copied out under the lock.
+// ************************************************************
+void LoopProfiler_::writeJson(JsonStreamWriter &json) {
+  loop_histogram_t hist;
+  uint32_t slowCount;
+  uint32_t slowInlineCount;
+  uint32_t iterationsInline;
+
+  json.beginObject();
+  json.add("budget", (unsigned long)LOOP_SLOW_BUDGET_US);
+
+  portENTER_CRITICAL(&_mux);
+  hist = _iteration;
+  slowCount = _slowCount;
+  slowInlineCount = _slowInlineCount;
+  iterationsInline = _iterationsInline;
+  portEXIT_CRITICAL(&_mux);
+
+  json.key("iteration").beginObject();
+  writeHistogram(json, hist);
+  json.endObject();
+  json.add("inline", iterationsInline);
+  json.add("slow", slowCount);
+  json.add("slowinline", slowInlineCount);
+
+  json.key("steps").beginObject();
+  for (int i = 0; i < LOOP_STEP_COUNT; i++) {
+    portENTER_CRITICAL(&_mux);
+    hist = _steps[i];
+    portEXIT_CRITICAL(&_mux);
+    json.key(LOOP_STEP_NAMES[i]).beginObject();
+    writeHistogram(json, hist);
+    json.endObject();
+  }
+  json.endObject();
+
+  json.key("slowcaptures").beginArray();
+  uint32_t kept = min(slowCount, (uint32_t)LOOP_SLOW_CAPTURES);
+  for (uint32_t n = 1; n <= kept; n++) {
+    loop_slow_capture_t capture;
+    portENTER_CRITICAL(&_mux);
+    capture = _slow[(slowCount - n) % LOOP_SLOW_CAPTURES];
+    portEXIT_CRITICAL(&_mux);
+
+    json.beginObject();
+    json.add("millis", capture.millis);
+    json.add("total", capture.totalUs);
+    json.add("worst", LOOP_STEP_NAMES[capture.worstStep]);
+    json.add("inline", capture.decoderInline);
+    json.key("steps").beginObject();
+    for (int i = 0; i < LOOP_STEP_COUNT; i++) {
+      json.add(LOOP_STEP_NAMES[i], capture.stepUs[i]);
+    }
+    json.endObject();
+    json.endObject();
+  }
+  json.endArray();
+
+  json.endObject();
+}
+
+// ************************************************************
+// Record elapsed cycles when the timer goes out of scope
+// ************************************************************
+LoopStepTimer::~LoopStepTimer() {
+  loopProfiler.addStep(_step, ESP.getCycleCount() - _start);
+}
+
+// ************************************************************
+// Library internal singleton wiring
+// ************************************************************
+LoopProfiler_ &LoopProfiler_::getInstance() {
+  static LoopProfiler_ instance;
+  return instance;
+}
+
+LoopProfiler_ &loopProfiler = loopProfiler.getInstance();
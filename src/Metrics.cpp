@@ -0,0 +1,227 @@
+#include "Metrics.h"
+#include <WiFi.h>
+
+// Microsecond buckets shared by the latency histograms
+static const uint32_t LATENCY_BUCKETS_US[] = {100, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000, 500000};
+
+// Millisecond buckets for WiFi connects, scans and stream starts
+static const uint32_t WIFI_BUCKETS_MS[] = {100, 250, 500, 1000, 2000, 3000, 5000, 8000, 12000, 20000};
+
+// ************************************************************
+// The metric table - must match the MetricId order
+// ************************************************************
+static const metric_def_t METRIC_DEFS[METRIC_COUNT] = {
+  {"inr_http_requests_total",      "HTTP requests received",                      METRIC_TYPE_COUNTER,   nullptr, 0},
+  {"inr_wifi_connects_total",      "WiFi station connections (got IP)",           METRIC_TYPE_COUNTER,   nullptr, 0},
+  {"inr_wifi_disconnects_total",   "WiFi station disconnections",                 METRIC_TYPE_COUNTER,   nullptr, 0},
+  {"inr_stream_bytes_total",       "Bytes read from the radio stream",            METRIC_TYPE_COUNTER,   nullptr, 0},
+  {"inr_stream_starts_total",      "Radio stream start attempts",                 METRIC_TYPE_COUNTER,   nullptr, 0},
+  {"inr_stream_failures_total",    "Radio streams that ended unexpectedly",       METRIC_TYPE_COUNTER,   nullptr, 0},
+  {"inr_stream_underruns_total",   "Stream buffer underruns",                     METRIC_TYPE_COUNTER,   nullptr, 0},
+  {"inr_spiffs_write_us",          "Config store save duration in microseconds",  METRIC_TYPE_HISTOGRAM, LATENCY_BUCKETS_US, 10},
+  {"inr_menu_render_us",           "Menu update and display flush in microseconds", METRIC_TYPE_HISTOGRAM, LATENCY_BUCKETS_US, 10},
+  {"inr_metrics_scrape_us",        "Duration of /metrics scrapes in microseconds", METRIC_TYPE_HISTOGRAM, LATENCY_BUCKETS_US, 10},
+  {"inr_audio_stack_warnings_total", "Profiler samples with the audio task stack margin below threshold", METRIC_TYPE_COUNTER, nullptr, 0},
+  {"inr_core1_idle_warnings_total",  "Profiler samples with core 1 idle time below threshold", METRIC_TYPE_COUNTER, nullptr, 0},
+  {"inr_core0_idle_percent",       "Core 0 idle time over the last profiler sample", METRIC_TYPE_GAUGE,     nullptr, 0},
+  {"inr_core1_idle_percent",       "Core 1 idle time over the last profiler sample", METRIC_TYPE_GAUGE,     nullptr, 0},
+  {"inr_wifi_connect_ms",          "WiFi connect start to got IP in milliseconds", METRIC_TYPE_HISTOGRAM, WIFI_BUCKETS_MS, 10},
+  {"inr_wifi_scan_ms",             "WiFi scan duration in milliseconds",          METRIC_TYPE_HISTOGRAM, WIFI_BUCKETS_MS, 10},
+  {"inr_wifi_connect_failures_total", "WiFi connects that timed out without an IP", METRIC_TYPE_COUNTER, nullptr, 0},
+  {"inr_wifi_fast_connects_total", "WiFi connects made with the cached BSSID and channel", METRIC_TYPE_COUNTER, nullptr, 0},
+  {"inr_wifi_fast_fallbacks_total", "Fast WiFi connects that fell back to a full scan", METRIC_TYPE_COUNTER, nullptr, 0},
+  {"inr_boot_wifi_ms",             "Boot to first WiFi connection in milliseconds", METRIC_TYPE_GAUGE,     nullptr, 0},
+  {"inr_boot_first_audio_ms",      "Boot to first radio audio in milliseconds",   METRIC_TYPE_GAUGE,     nullptr, 0},
+  {"inr_boot_storage_ms",          "Loading config, stats and stations at boot in milliseconds", METRIC_TYPE_GAUGE, nullptr, 0},
+  {"inr_boot_ready_ms",            "Boot to the end of setup in milliseconds",    METRIC_TYPE_GAUGE,     nullptr, 0},
+  {"inr_stream_start_ms",          "Stream start to first decoded sample in milliseconds", METRIC_TYPE_HISTOGRAM, WIFI_BUCKETS_MS, 10},
+  {"inr_wifi_roam_scans_total",    "Scans for a better AP while the link was weak", METRIC_TYPE_COUNTER, nullptr, 0},
+  {"inr_wifi_roams_total",         "Moves to a stronger AP of the same network",  METRIC_TYPE_COUNTER,   nullptr, 0},
+  {"inr_wifi_roams_deferred_total", "Roam scans or moves held back because the stream buffer was low", METRIC_TYPE_COUNTER, nullptr, 0},
+  {"inr_resolver_hits_total",      "Stream starts that used a cached resolved URL", METRIC_TYPE_COUNTER,  nullptr, 0},
+  {"inr_resolver_misses_total",    "Stream starts with no fresh resolver entry",  METRIC_TYPE_COUNTER,   nullptr, 0},
+  {"inr_resolver_saved_ms_total",  "Redirect, playlist and DNS time skipped by resolver hits", METRIC_TYPE_COUNTER, nullptr, 0},
+  {"inr_resolver_resolve_ms",      "Background station URL resolution in milliseconds", METRIC_TYPE_HISTOGRAM, WIFI_BUCKETS_MS, 10},
+  {"inr_resolver_failures_total",  "Station URLs that could not be resolved",     METRIC_TYPE_COUNTER,   nullptr, 0},
+  {"inr_stream_redirects_total",   "HTTP redirects followed when opening streams", METRIC_TYPE_COUNTER,  nullptr, 0},
+  {"inr_tls_handshakes_total",     "TLS handshakes completed for streams",        METRIC_TYPE_COUNTER,   nullptr, 0},
+  {"inr_tls_resumed_total",        "TLS handshakes that resumed a saved session", METRIC_TYPE_COUNTER,   nullptr, 0},
+  {"inr_tls_handshake_ms",         "TLS handshake duration in milliseconds",      METRIC_TYPE_HISTOGRAM, WIFI_BUCKETS_MS, 10},
+  {"inr_tls_decrypt_us_total",     "CPU time spent decrypting stream data in microseconds", METRIC_TYPE_COUNTER, nullptr, 0},
+  {"inr_tls_bytes_total",          "Stream bytes decrypted",                      METRIC_TYPE_COUNTER,   nullptr, 0},
+  {"inr_stream_failovers_total",   "Failed streams retried on another of the station's URLs", METRIC_TYPE_COUNTER, nullptr, 0},
+  {"inr_abr_step_ups_total",       "Adaptive bitrate switches to a higher tier",  METRIC_TYPE_COUNTER,   nullptr, 0},
+  {"inr_abr_step_downs_total",     "Adaptive bitrate switches to a lower tier",   METRIC_TYPE_COUNTER,   nullptr, 0},
+  {"inr_abr_tier_kbps",            "Bitrate of the quality tier playing, 0 for a station without tiers", METRIC_TYPE_GAUGE, nullptr, 0},
+  {"inr_dead_air_silences_total",  "Streams found playing silence for the silence time", METRIC_TYPE_COUNTER, nullptr, 0},
+  {"inr_dead_air_stalls_total",    "Streams that stopped producing audio for the stall time", METRIC_TYPE_COUNTER, nullptr, 0},
+  {"inr_probes_total",             "Background station probes",                   METRIC_TYPE_COUNTER,   nullptr, 0},
+  {"inr_probe_failures_total",     "Station probes that found no playable audio", METRIC_TYPE_COUNTER,   nullptr, 0},
+  {"inr_probe_first_audio_ms",     "Probe request to first MP3 frame in milliseconds", METRIC_TYPE_HISTOGRAM, WIFI_BUCKETS_MS, 10},
+};
+
+// ************************************************************
+// Lay out the atomic slots for the table
+// ************************************************************
+Metrics_::Metrics_() {
+  uint16_t next = 0;
+  for (int i = 0; i < METRIC_COUNT; i++) {
+    _slot[i] = next;
+    if (METRIC_DEFS[i].type == METRIC_TYPE_HISTOGRAM) {
+      next += METRIC_DEFS[i].bucketCount + 3;
+    } else {
+      next++;
+    }
+  }
+  for (int i = 0; i < METRICS_MAX_SLOTS; i++) {
+    _values[i].store(0, std::memory_order_relaxed);
+  }
+  if (next > METRICS_MAX_SLOTS) {
+    // Table is too big for the backing store - raise METRICS_MAX_SLOTS
+    abort();
+  }
+}
+
+// ************************************************************
+// Add to a counter
+// ************************************************************
+void Metrics_::inc(MetricId id, uint32_t by) {
+  _values[_slot[id]].fetch_add(by, std::memory_order_relaxed);
+}
+
+// ************************************************************
+// Set a gauge
+// ************************************************************
+void Metrics_::set(MetricId id, int32_t value) {
+  _values[_slot[id]].store(value, std::memory_order_relaxed);
+}
+
+// ************************************************************
+// Read a counter or gauge
+// ************************************************************
+int32_t Metrics_::get(MetricId id) {
+  return _values[_slot[id]].load(std::memory_order_relaxed);
+}
+
+// ************************************************************
+// Record one histogram observation
+// ************************************************************
+void Metrics_::observe(MetricId id, uint32_t value) {
+  const metric_def_t &def = METRIC_DEFS[id];
+  uint16_t base = _slot[id];
+  uint8_t bucket = 0;
+  while (bucket < def.bucketCount && value > def.buckets[bucket]) {
+    bucket++;
+  }
+  _values[base + bucket].fetch_add(1, std::memory_order_relaxed);
+  _values[base + def.bucketCount + 1].fetch_add(1, std::memory_order_relaxed);
+  _values[base + def.bucketCount + 2].fetch_add(value, std::memory_order_relaxed);
+}
+
+// ************************************************************
+// HELP and TYPE lines
+// ************************************************************
+void Metrics_::writeHeader(Print &out, const char* name, const char* help, const char* type) {
+  out.printf("# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+// ************************************************************
+// Per task stack headroom and CPU time
+// ************************************************************
+void Metrics_::writeTaskMetrics(Print &out) {
+#if configUSE_TRACE_FACILITY
+  // Static so a scrape doesn't put ~1KB on the async_tcp stack
+  static TaskStatus_t tasks[METRICS_MAX_TASKS];
+  UBaseType_t count = uxTaskGetSystemState(tasks, METRICS_MAX_TASKS, NULL);
+
+  writeHeader(out, "inr_task_stack_free_bytes", "Lowest free stack seen per task", "gauge");
+  for (UBaseType_t i = 0; i < count; i++) {
+    out.printf("inr_task_stack_free_bytes{task=\"%s\"} %u\n", tasks[i].pcTaskName, (unsigned)tasks[i].usStackHighWaterMark);
+  }
+
+#if configGENERATE_RUN_TIME_STATS
+  writeHeader(out, "inr_task_runtime_total", "Run time counter ticks per task", "counter");
+  for (UBaseType_t i = 0; i < count; i++) {
+    out.printf("inr_task_runtime_total{task=\"%s\"} %u\n", tasks[i].pcTaskName, (unsigned)tasks[i].ulRunTimeCounter);
+  }
+#endif
+#endif
+}
+
+// ************************************************************
+// Write everything in the Prometheus text format
+// ************************************************************
+bool Metrics_::writePrometheus(Print &out) {
+  unsigned long now = millis();
+  if (_lastScrapeMillis != 0 && (now - _lastScrapeMillis) < METRICS_MIN_SCRAPE_INTERVAL_MS) {
+    return false;
+  }
+  _lastScrapeMillis = now;
+
+  MetricTimer timer(METRIC_SCRAPE_US);
+
+  for (int i = 0; i < METRIC_COUNT; i++) {
+    const metric_def_t &def = METRIC_DEFS[i];
+    uint16_t base = _slot[i];
+    switch (def.type) {
+      case METRIC_TYPE_COUNTER:
+        writeHeader(out, def.name, def.help, "counter");
+        out.printf("%s %u\n", def.name, (unsigned)_values[base].load(std::memory_order_relaxed));
+        break;
+      case METRIC_TYPE_GAUGE:
+        writeHeader(out, def.name, def.help, "gauge");
+        out.printf("%s %d\n", def.name, (int)_values[base].load(std::memory_order_relaxed));
+        break;
+      case METRIC_TYPE_HISTOGRAM: {
+        writeHeader(out, def.name, def.help, "histogram");
+        uint32_t cumulative = 0;
+        for (uint8_t b = 0; b < def.bucketCount; b++) {
+          cumulative += _values[base + b].load(std::memory_order_relaxed);
+          out.printf("%s_bucket{le=\"%u\"} %u\n", def.name, (unsigned)def.buckets[b], (unsigned)cumulative);
+        }
+        cumulative += _values[base + def.bucketCount].load(std::memory_order_relaxed);
+        out.printf("%s_bucket{le=\"+Inf\"} %u\n", def.name, (unsigned)cumulative);
+        out.printf("%s_sum %u\n", def.name, (unsigned)_values[base + def.bucketCount + 2].load(std::memory_order_relaxed));
+        out.printf("%s_count %u\n", def.name, (unsigned)_values[base + def.bucketCount + 1].load(std::memory_order_relaxed));
+        break;
+      }
+    }
+  }
+
+  // Point-in-time gauges, read at scrape rather than kept in the table
+  writeHeader(out, "inr_heap_free_bytes", "Free internal heap", "gauge");
+  out.printf("inr_heap_free_bytes %u\n", (unsigned)ESP.getFreeHeap());
+  writeHeader(out, "inr_heap_min_free_bytes", "Lowest free internal heap since boot", "gauge");
+  out.printf("inr_heap_min_free_bytes %u\n", (unsigned)ESP.getMinFreeHeap());
+  writeHeader(out, "inr_heap_max_alloc_bytes", "Largest allocatable internal heap block", "gauge");
+  out.printf("inr_heap_max_alloc_bytes %u\n", (unsigned)ESP.getMaxAllocHeap());
+  if (psramFound()) {
+    writeHeader(out, "inr_psram_min_free_bytes", "Lowest free PSRAM since boot", "gauge");
+    out.printf("inr_psram_min_free_bytes %u\n", (unsigned)ESP.getMinFreePsram());
+  }
+  writeHeader(out, "inr_wifi_rssi_dbm", "WiFi signal strength, 0 when not connected", "gauge");
+  out.printf("inr_wifi_rssi_dbm %d\n", WiFi.isConnected() ? (int)WiFi.RSSI() : 0);
+  writeHeader(out, "inr_uptime_seconds", "Time since boot", "gauge");
+  out.printf("inr_uptime_seconds %lu\n", millis() / 1000);
+
+  writeTaskMetrics(out);
+
+  return true;
+}
+
+// ************************************************************
+// Record elapsed time when the timer goes out of scope
+// ************************************************************
+MetricTimer::~MetricTimer() {
+  metrics.observe(_id, micros() - _start);
+}
+
+// ************************************************************
+// Library internal singleton wiring
+// ************************************************************
+Metrics_ &Metrics_::getInstance() {
+  static Metrics_ instance;
+  return instance;
+}
+
+Metrics_ &metrics = metrics.getInstance();
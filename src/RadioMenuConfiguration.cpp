@@ -1,4 +1,9 @@
 #include "RadioMenuConfiguration.h"
+#include "Metrics.h"
+#include "StationProber.h"
+#include "StationStore.h"
+#include "UsageStats.h"
+#include "StationAnalytics.h"
 
 // ************************************************************
 // Menu system instance and state
@@ -21,7 +26,7 @@ static char wifiPasswordBuffer[64];
 static void playStation(int idx) {
   if (idx >= 0 && idx < stationCount) {
     float gain = (volume / 100.0f) * MAX_GAIN;
-    radioOutputManager.startRadioStream(stations[idx].url, stations[idx].name, gain);
+    radioOutputManager.startRadioStream(stations[idx], gain);
   }
   buildAudioMenuDynamic();
 }
@@ -41,6 +46,80 @@ static StationCallback stationCallbacks[] = {
   playStation5, playStation6, playStation7, playStation8
 };
 
+// ************************************************************
+// Station name for the menu, marked if the prober found
+// nothing we can play there
+// ************************************************************
+static String stationLabel(int idx) {
+  ProbeState state = stationProber.stationState(idx);
+  if (state == PROBE_STATE_DEAD || state == PROBE_STATE_UNSUPPORTED) {
+    return String("x ") + stations[idx].name;
+  }
+  return stations[idx].name;
+}
+
+// ************************************************************
+// Re-label the stations in place - rebuilding the menu would
+// take the user back to the top of it
+// ************************************************************
+static void updateStationLabels() {
+  if (!audioMenu) return;
+  for (MenuItem *item = audioMenu->child; item; item = item->next) {
+    if (item->type != MENU_ITEM_ACTION) continue;
+    for (int i = 0; i < stationCount && i < MAX_STATIONS; i++) {
+      if (item->data.actionCallback == stationCallbacks[i]) {
+        strncpy(item->label, stationLabel(i).c_str(), sizeof(item->label) - 1);
+        item->label[sizeof(item->label) - 1] = '\0';
+      }
+    }
+  }
+}
+
+// ************************************************************
+// Station search - each character typed narrows the directory
+// down. Names are only read for what is on screen: the first
+// result while typing, the rest once the list is opened.
+// ************************************************************
+#define MENU_SEARCH_RESULTS 20
+static const char SEARCH_CHARSET[] = "abcdefghijklmnopqrstuvwxyz0123456789";
+static char searchBuffer[16];
+static store_search_t searchState;
+static uint32_t searchIds[MENU_SEARCH_RESULTS];
+static String searchNames[MENU_SEARCH_RESULTS];
+static uint8_t searchCount = 0;
+static uint8_t searchNamesRead = 0;
+
+static uint8_t searchStations(const char *query) {
+  bool more;
+  searchCount = stationStore.search(query, searchIds, MENU_SEARCH_RESULTS, searchState, more);
+  searchNamesRead = 0;
+  return searchCount;
+}
+
+static const char *searchResultLabel(uint8_t index) {
+  if (index >= searchCount) return "";
+  if (index >= searchNamesRead) {
+    uint8_t upTo = index == 0 ? 1 : searchCount;
+    stationStore.getNames(searchIds + searchNamesRead, upTo - searchNamesRead, searchNames + searchNamesRead);
+    searchNamesRead = upTo;
+  }
+  return searchNames[index].c_str();
+}
+
+static void playSearchResult(uint8_t index) {
+  station_t station;
+  if (index < searchCount && stationStore.get(searchIds[index], station)) {
+    float gain = (volume / 100.0f) * MAX_GAIN;
+    radioOutputManager.startRadioStream(station, gain);
+  }
+  buildAudioMenuDynamic();
+}
+
+static void addStationSearch() {
+  menuSystem.addSearch(audioMenu, "Search", searchBuffer, sizeof(searchBuffer),
+                       searchStations, searchResultLabel, playSearchResult, SEARCH_CHARSET);
+}
+
 void startPlaying() {
   radioOutputManager.StartPlaying();
   buildAudioMenuDynamic();
@@ -147,13 +226,13 @@ void saveWiFiPasswordCb() {
 // System menu callbacks
 // ************************************************************
 void restartDeviceCb() {
-  spiffsStorage.saveStatsToSpiffs();
-  delay(1000);
-  ESP.restart();
+  usageStats.commit();
+  stationAnalytics.flush();
+  scheduleRestart(1000);
 }
 
 void saveConfigCb() {
-  spiffsStorage.saveConfigToSpiffs();
+  configStore.saveConfig();
 }
 
 void toggleWiFiAtStartCb() {
@@ -184,8 +263,9 @@ void buildAudioMenuDynamic() {
   if (radioOutputManager.isRadioMode()) {
     menuSystem.addInfo(audioMenu, "Mode: Radio");
     for (int i = 0; i < stationCount && i < MAX_STATIONS; i++) {
-      menuSystem.addAction(audioMenu, stations[i].name.c_str(), stationCallbacks[i]);
+      menuSystem.addAction(audioMenu, stationLabel(i).c_str(), stationCallbacks[i]);
     }
+    addStationSearch();
     menuSystem.addAction(audioMenu, "Stop", stopPlaying);
 #ifdef FEATURE_BLUETOOTH
     menuSystem.addAction(audioMenu, "Switch to BT Sink", switchToBluetoothMode);
@@ -201,8 +281,9 @@ void buildAudioMenuDynamic() {
       menuSystem.addInfo(audioMenu, "Status: Connecting");
     }
     for (int i = 0; i < stationCount && i < MAX_STATIONS; i++) {
-      menuSystem.addAction(audioMenu, stations[i].name.c_str(), stationCallbacks[i]);
+      menuSystem.addAction(audioMenu, stationLabel(i).c_str(), stationCallbacks[i]);
     }
+    addStationSearch();
     menuSystem.addAction(audioMenu, "Switch to Radio", switchToRadioMode);
   } else {
     menuSystem.addInfo(audioMenu, "Mode: BT Sink");
@@ -290,8 +371,9 @@ void buildRadioMenus() {
   if (radioOutputManager.isRadioMode()) {
     menuSystem.addInfo(audioMenu, "Mode: Radio");
     for (int i = 0; i < stationCount && i < MAX_STATIONS; i++) {
-      menuSystem.addAction(audioMenu, stations[i].name.c_str(), stationCallbacks[i]);
+      menuSystem.addAction(audioMenu, stationLabel(i).c_str(), stationCallbacks[i]);
     }
+    addStationSearch();
     menuSystem.addAction(audioMenu, "Stop", stopPlaying);
 #ifdef FEATURE_BLUETOOTH
     menuSystem.addAction(audioMenu, "Switch to BT", switchToBluetoothMode);
@@ -463,6 +545,7 @@ void handleStatusEncoder(int delta) {
 // Menu loop functions
 // ************************************************************
 void menuOncePerLoop() {
+  MetricTimer timer(METRIC_MENU_RENDER_US);
   menuSystem.update();
 }
 
@@ -473,4 +556,8 @@ void menuOncePerSecond() {
     strncpy(radioStatus.ipAddress, WiFi.localIP().toString().c_str(), 15);
     radioStatus.ipAddress[15] = '\0';
   }
+
+  if (stationProber.takeChanged()) {
+    updateStationLabels();
+  }
 }
@@ -6,6 +6,74 @@
 #include "Globals.h"
 #include <WiFi.h>
 #include <driver/i2s.h>
+#include "Metrics.h"
+#include "Trace.h"
+#include "LinkMonitor.h"
+#include "StationResolver.h"
+#include "StreamHealth.h"
+#include "BitrateController.h"
+#include "StationProber.h"
+#include "StationAnalytics.h"
+
+// AudioFileSourceBuffer reports an underflow with this status code
+static const int BUFFER_STATUS_UNDERFLOW = 3;
+
+// ************************************************************
+// Stream source that counts the bytes it delivers, for /metrics
+// ************************************************************
+class AudioFileSourceMeteredStream : public AudioFileSourceRadioStream {
+public:
+  uint32_t read(void *data, uint32_t len) override {
+    uint32_t got = AudioFileSourceRadioStream::read(data, len);
+    metrics.inc(METRIC_STREAM_BYTES, got);
+    return got;
+  }
+  uint32_t readNonBlock(void *data, uint32_t len) override {
+    uint32_t got = AudioFileSourceRadioStream::readNonBlock(data, len);
+    metrics.inc(METRIC_STREAM_BYTES, got);
+    return got;
+  }
+};
+
+// ************************************************************
+// Time to first audio: set when a stream starts, cleared by the
+// first sample the output sees
+// ************************************************************
+static volatile bool awaitingFirstSample = false;
+static unsigned long streamStartMillis = 0;
+
+// Health table key of the URL playing, and whether it connected
+static uint32_t streamUrlHash = 0;
+static bool streamConnected = false;
+
+static inline void noteFirstSample() {
+  if (awaitingFirstSample) {
+    awaitingFirstSample = false;
+    unsigned long now = millis();
+    metrics.observe(METRIC_STREAM_START_MS, now - streamStartMillis);
+    streamHealth.noteFirstAudio(streamUrlHash, now - streamStartMillis);
+    stationAnalytics.noteFirstAudio(now - streamStartMillis);
+    if (metrics.get(METRIC_BOOT_FIRST_AUDIO_MS) == 0) {
+      metrics.set(METRIC_BOOT_FIRST_AUDIO_MS, now);
+      debugMsgAudf("Boot to first audio: %lums", now);
+    }
+  }
+}
+
+// ************************************************************
+// I2S output that notes the first sample of each stream
+// ************************************************************
+class AudioOutputTimedI2S : public AudioOutputI2S {
+public:
+  bool ConsumeSample(int16_t sample[2]) override {
+    noteFirstSample();
+    if (!AudioOutputI2S::ConsumeSample(sample)) {
+      return false;
+    }
+    silenceDetector.feed(sample);
+    return true;
+  }
+};
 
 // ************************************************************
 // Custom AudioOutput that routes decoded PCM into the BT PCM ring buffer.
@@ -17,13 +85,18 @@ public:
   bool begin() override { return true; }
   bool stop() override { return true; }
   bool ConsumeSample(int16_t sample[2]) override {
+    noteFirstSample();
     // Apply gain (same fixed-point scheme as AudioOutputI2S)
     int16_t left  = (int32_t(sample[0]) * gainF2P6) >> 6;
     int16_t right = (int32_t(sample[1]) * gainF2P6) >> 6;
     // Return false when the ring buffer is full so the MP3 generator pauses.
     // This throttles the decoder to real-time speed and prevents the HTTP
     // download buffer from being drained faster than WiFi can refill it.
-    return BluetoothManager_::writePcmFrame(left, right);
+    if (!BluetoothManager_::writePcmFrame(left, right)) {
+      return false;
+    }
+    silenceDetector.feed(sample);
+    return true;
   }
 };
 #endif
@@ -63,11 +136,13 @@ void RadioOutputManager_::initializeAudioOutput() {
 
   // Set default station from stored station list
   if (stationCount > 0) {
-    _url = stations[0].url;
-    _stationName = stations[0].name;
+    setStation(stations[0]);
   } else {
-    _url = "http://mp3.ffh.de/radioffh/hqlivestream.mp3";
-    _stationName = "Radio FFH";
+    station_t fallback;
+    fallback.name = "Radio FFH";
+    fallback.urls[0] = "http://mp3.ffh.de/radioffh/hqlivestream.mp3";
+    fallback.urlCount = 1;
+    setStation(fallback);
   }
   _fgain = (volume / 100.0f) * MAX_GAIN;
 }
@@ -75,53 +150,125 @@ void RadioOutputManager_::initializeAudioOutput() {
 // ************************************************************
 // Initiate a radio stream
 // ************************************************************
-void RadioOutputManager_::startRadioStream(String url, String stationName, float gain) {
-  debugManagerLink("RadioOutputManager: Starting radio stream: " + url + " with gain: " + String(gain));
+void RadioOutputManager_::startRadioStream(const station_t &station, float gain) {
+  debugMsgAudf("Starting radio stream: %s with gain: %.2f", station.name.c_str(), gain);
 
   // Stop any existing playback first
   if (playing) {
     StopPlaying();
   }
 
-  _url = url;
-  _stationName = stationName;
+  setStation(station);
+  _reconnectStart = false;
   _fgain = gain;
   _songTitle[0] = '\0';
   StartPlaying();
 }
 
+// ************************************************************
+// Take a station's URLs, best health score first
+// ************************************************************
+void RadioOutputManager_::setStation(const station_t &station) {
+  _stationName = station.name;
+  stationAnalytics.select(station);
+  int tier = bitrateController.begin(station);
+  if (tier >= 0) {
+    // The bitrate controller picks between the tiers, so there is one URL at a time
+    _urls[0] = bitrateController.tierUrl(tier);
+    _urlCount = 1;
+  } else {
+    _urlCount = station.urlCount;
+    for (uint8_t i = 0; i < _urlCount; i++) {
+      _urls[i] = station.urls[i];
+    }
+  }
+  streamHealth.rank(_urls, _urlCount, _order);
+  _orderPos = 0;
+  _url = _urlCount ? _urls[_order[0]] : "";
+  _failedThisRound = 0;
+  _backoffAttempt = 0;
+}
+
+// ************************************************************
+// Delay before the next round after every URL has failed:
+// doubling, capped, with half of it random so radios behind
+// the same router don't all come back at once
+// ************************************************************
+unsigned long RadioOutputManager_::nextBackoffMs() {
+  unsigned long ceiling = RECONNECT_MAX_MS;
+  if (_backoffAttempt < 16 && (RECONNECT_BASE_MS << _backoffAttempt) < RECONNECT_MAX_MS) {
+    ceiling = RECONNECT_BASE_MS << _backoffAttempt;
+    _backoffAttempt++;
+  }
+  return ceiling / 2 + esp_random() % (ceiling / 2 + 1);
+}
+
 // ************************************************************
 // Start playing the stream
 // ************************************************************
 void RadioOutputManager_::StartPlaying() {
-  debugMsgAud("Start play: mode=" + String(currentAudioMode) +
-              " WiFi=" + String(WiFi.status()) +
-              " url=" + _url);
+  debugMsgAudf("Start play: mode=%d WiFi=%d url=%s", (int)currentAudioMode, (int)WiFi.status(), _url.c_str());
   if (_url.length() == 0) {
     debugMsgAud("No URL set - cannot play");
     menuSystem.showFlashMessage("No URL set");
+    _reconnectStart = false;
     return;
   }
   if (WiFi.status() != WL_CONNECTED) {
     debugMsgAud("No WiFi - cannot play");
     menuSystem.showFlashMessage("No WiFi connection");
+    _reconnectStart = false;
     return;
   }
 
   // Clean up any leftover objects
   StopPlaying();
 
-  file = new AudioFileSourceICYStream(_url.c_str());
-  file->RegisterMetadataCB(MDCallback, (void*)"ICY");
+  // Start on the resolved URL if the resolver has it, skipping redirects and playlists
+  String streamUrl = _url;
+  String finalUrl;
+  IPAddress ip;
+  bool resolved = stationResolver.lookup(_url, finalUrl, ip, !_resolveWaited);
+  if (resolved) {
+    streamUrl = finalUrl;
+    debugMsgAudf("Resolved to %s (%s)", streamUrl.c_str(), ip.toString().c_str());
+  } else if (!_resolveWaited && StationResolver_::looksLikePlaylist(_url)) {
+    // The ICY source can't read a playlist - give the resolver a moment to unpack it
+    stationResolver.resolveNow(_url);
+    _awaitingResolve = true;
+    _awaitingResolveSince = millis();
+    menuSystem.showFlashMessage("Resolving...");
+    return;
+  }
+
+  metrics.inc(METRIC_STREAM_STARTS);
+  stationAnalytics.noteStart(_reconnectStart);
+  _reconnectStart = false;
+  streamStartMillis = millis();
+  awaitingFirstSample = true;
+  AudioFileSourceMeteredStream *stream = new AudioFileSourceMeteredStream();
+  if (resolved) {
+    stream->setAddress(ip);
+  }
+  stream->RegisterMetadataCB(MDCallback, (void*)"ICY");
+  unsigned long openStart = millis();
+  streamConnected = stream->open(streamUrl.c_str());
+  streamUrlHash = StreamHealth_::hashUrl(_url);
+  streamHealth.noteConnect(streamUrlHash, streamConnected, millis() - openStart);
+  _splicer = new AudioFileSourceSplicer(stream);
+  file = _splicer;
+  bitrateController.noteStreamStart();
+  _lastFillLevel = 0;                    // a new, empty buffer
+  silenceDetector.streamStarted();
 
   // Allocate streaming buffer from PSRAM if available, otherwise fall back to SRAM
   if (psramFound()) {
     audioBuffer = (uint8_t *)ps_malloc(bufferSize);
-    debugMsgAud("Audio buffer: " + String(bufferSize / 1024) + "KB from PSRAM");
+    debugMsgAudf("Audio buffer: %uKB from PSRAM", (unsigned)(bufferSize / 1024));
   }
   if (!audioBuffer) {
     audioBuffer = (uint8_t *)malloc(bufferSize);
-    debugMsgAud("Audio buffer: " + String(bufferSize / 1024) + "KB from SRAM");
+    debugMsgAudf("Audio buffer: %uKB from SRAM", (unsigned)(bufferSize / 1024));
   }
   buff = new AudioFileSourceBuffer(file, audioBuffer, bufferSize);
   buff->RegisterStatusCB(StatusCallback, (void*)"buffer");
@@ -132,7 +279,7 @@ void RadioOutputManager_::StartPlaying() {
   } else
 #endif
   {
-    AudioOutputI2S *i2sOut = new AudioOutputI2S();
+    AudioOutputI2S *i2sOut = new AudioOutputTimedI2S();
     i2sOut->SetPinout(I2S_BCLK, I2S_LRC, I2S_DOUT);
     out = i2sOut;
   }
@@ -144,7 +291,7 @@ void RadioOutputManager_::StartPlaying() {
   playing = true;
   audioTaskRunning = true;
 
-  debugMsgAud("Free heap before task create: " + String(ESP.getFreeHeap()) + " bytes");
+  debugMsgAudf("Free heap before task create: %u bytes", (unsigned)ESP.getFreeHeap());
 
   // Try to run the decoder as a pinned task. When BT A2DP source is active it
   // consumes most of the internal DRAM heap, leaving too little for a task stack.
@@ -152,12 +299,12 @@ void RadioOutputManager_::StartPlaying() {
   audioInlineMode = false;
   BaseType_t taskResult = xTaskCreatePinnedToCore(audioTask, "audio", 4096, this, 3, &audioTaskHandle, 1);
   if (taskResult != pdPASS) {
-    debugMsgAud("Task creation failed (heap=" + String(ESP.getFreeHeap()) + ") - running inline");
+    debugMsgAudf("Task creation failed (heap=%u) - running inline", (unsigned)ESP.getFreeHeap());
     audioTaskHandle = nullptr;
     audioInlineMode = true;
   }
 
-  debugMsgAud("STATUS(URL) " + _url);
+  debugMsgAudf("STATUS(URL) %s", _url.c_str());
 }
 
 // ************************************************************
@@ -166,10 +313,18 @@ void RadioOutputManager_::StartPlaying() {
 void RadioOutputManager_::StopPlaying() {
   debugMsgAud("Stop play");
 
+  if (streamConnected) {
+    streamHealth.noteEnd(streamUrlHash, millis() - streamStartMillis, false);
+    streamConnected = false;
+  }
+
   // Cancel any pending reconnect - this is an intentional stop
   streamFailed = false;
   reconnecting = false;
   reconnectAt = 0;
+  _awaitingResolve = false;
+
+  silenceDetector.streamStopped();
 
   // Stop the audio task first
   audioTaskRunning = false;
@@ -197,7 +352,9 @@ void RadioOutputManager_::StopPlaying() {
     file->close();
     delete file;
     file = NULL;
+    _splicer = nullptr;
   }
+  _streamGeneration++;
   if (out) {
 #ifdef FEATURE_BLUETOOTH
     if (currentAudioMode != AUDIO_MODE_RADIO_BLUETOOTH) {
@@ -237,10 +394,139 @@ void RadioOutputManager_::setVolume(int vol) {
 }
 
 // ************************************************************
-//
+// Once a second, from the main loop: measure the decoder, look
+// for dead air, and move between quality tiers
 // ************************************************************
 void RadioOutputManager_::audioOncePerSecond() {
-  debugMsgAud("Buffer " + String(buff->getFillLevel()) + "/" + String(bufferSize));
+  uint32_t streamBytes = metrics.get(METRIC_STREAM_BYTES);
+  if (buff) {
+    uint32_t fill = buff->getFillLevel();
+    debugMsgAudf("Buffer %u/%u", (unsigned)fill, (unsigned)bufferSize);
+
+    // What came in, less what stayed in the buffer, is what the decoder used
+    int32_t used = (int32_t)(streamBytes - _lastStreamBytes) - (int32_t)(fill - _lastFillLevel);
+    if (playing && used > 0) {
+      _consumeRate = (_consumeRate == 0) ? used : (_consumeRate * 7 + used) / 8;
+    }
+    _lastFillLevel = fill;
+  } else {
+    _lastFillLevel = 0;
+  }
+
+  // Connected and decoding, but is anything coming out?
+  if (playing) {
+    DeadAirType deadAir = silenceDetector.check();
+    if (deadAir != DEAD_AIR_NONE) {
+      recoverDeadAir(deadAir);
+    }
+  }
+
+  // Quality tiers: see whether the buffer says to move
+  if (playing && buff && !_switchInFlight && bitrateController.isActive()) {
+    int tier = bitrateController.sample(buff->getFillLevel(), bufferSize, streamBytes - _lastStreamBytes, _consumeRate);
+    if (tier >= 0) {
+      startTierSwitch(tier);
+    }
+  }
+  _lastStreamBytes = streamBytes;
+
+  // The prober keeps out of the way of a stream that is starting, switching or short of audio
+  stationProber.notePlayback(playing, reconnecting || _awaitingResolve || _switchInFlight, getBufferedMs());
+}
+
+// ************************************************************
+// The stream has gone silent or stopped producing audio - do
+// what the config says
+// ************************************************************
+void RadioOutputManager_::recoverDeadAir(DeadAirType type) {
+  SilenceAction action = silenceDetector.getAction();
+  silenceDetector.noteEvent(type, action, _url);
+  if (action == SILENCE_ACTION_NONE) {
+    return;
+  }
+  menuSystem.showFlashMessage(type == DEAD_AIR_STALL ? "Stream stalled" : "Dead air");
+
+  // As far as the URL's health goes, this is a dropped stream
+  if (streamConnected) {
+    streamHealth.noteEnd(streamUrlHash, millis() - streamStartMillis, true);
+    streamConnected = false;
+  }
+
+  if (action == SILENCE_ACTION_NEXT_STATION && stationCount > 0) {
+    int next = 0;
+    for (int i = 0; i < stationCount; i++) {
+      if (stations[i].name == _stationName) {
+        next = (i + 1) % stationCount;
+        break;
+      }
+    }
+    startRadioStream(stations[next], _fgain);
+    return;
+  }
+
+  StopPlaying();
+  if (action == SILENCE_ACTION_FAILOVER && _urlCount > 1) {
+    _orderPos = (_orderPos + 1) % _urlCount;
+    _url = _urls[_order[_orderPos]];
+    metrics.inc(METRIC_STREAM_FAILOVERS);
+  }
+  reconnecting = true;
+  reconnectAt = millis() + FAILOVER_DELAY_MS;
+}
+
+// ************************************************************
+// Open another tier of the station in the background. The
+// current stream keeps playing until it's spliced in.
+// ************************************************************
+void RadioOutputManager_::startTierSwitch(uint8_t tier) {
+  _switchUrl = bitrateController.tierUrl(tier);
+  _switchStreamUrl = _switchUrl;
+  String finalUrl;
+  _switchResolved = stationResolver.lookup(_switchUrl, finalUrl, _switchAddress, false);
+  if (_switchResolved) {
+    _switchStreamUrl = finalUrl;
+  }
+  _switchGeneration = _streamGeneration;
+  _switchDone = false;
+  _switchInFlight = true;
+  if (xTaskCreatePinnedToCore(tierSwitchTask, "tier", TIER_SWITCH_TASK_STACK, this, 1, nullptr, 0) != pdPASS) {
+    _switchInFlight = false;
+    bitrateController.noteSwitchResult(false);
+  }
+}
+
+void RadioOutputManager_::tierSwitchTask(void *param) {
+  RadioOutputManager_ *self = static_cast<RadioOutputManager_ *>(param);
+  AudioFileSourceMeteredStream *stream = new AudioFileSourceMeteredStream();
+  if (self->_switchResolved) {
+    stream->setAddress(self->_switchAddress);
+  }
+  stream->RegisterMetadataCB(MDCallback, (void*)"ICY");
+  unsigned long openStart = millis();
+  bool opened = stream->open(self->_switchStreamUrl.c_str());
+  streamHealth.noteConnect(StreamHealth_::hashUrl(self->_switchUrl), opened, millis() - openStart);
+  if (!opened) {
+    delete stream;
+    stream = nullptr;
+  }
+  self->_switchSource = stream;
+  self->_switchDone = true;
+  vTaskDelete(nullptr);
+}
+
+// ************************************************************
+// Roughly how much playing time is in the stream buffer
+// ************************************************************
+uint32_t RadioOutputManager_::getBufferedMs() {
+  if (!buff || !playing) {
+    return 0;
+  }
+  uint32_t rate = _consumeRate;
+  if (rate == 0) {
+    // Not measured yet: go by the frame headers' bitrate, or a guess before the first frame
+    rate = getStreamKbps() ? (uint32_t)getStreamKbps() * 125 : DEFAULT_BYTE_RATE;
+  }
+  return (uint64_t)buff->getFillLevel() * 1000 / rate;
 }
 
 // ************************************************************
@@ -257,6 +543,7 @@ void RadioOutputManager_::audioOncePerLoop() {
   // Run the decoder inline when no task could be created (e.g. DRAM exhausted by BT).
   // Core 1 WDT is disabled so brief blocking on network I/O is safe.
   if (audioInlineMode && playing && mp3) {
+    TRACE_SCOPE("mp3.loop");
     if (!mp3->loop()) {
       debugMsgAud("Stream ended (inline)");
       streamFailed = true;
@@ -266,19 +553,95 @@ void RadioOutputManager_::audioOncePerLoop() {
     }
   }
 
+  // A tier switch has opened its stream - splice it in, unless the stream it was for has gone
+  if (_switchDone) {
+    _switchDone = false;
+    AudioFileSource *source = _switchSource;
+    _switchSource = nullptr;
+    _switchInFlight = false;
+    if (_switchGeneration != _streamGeneration || !_splicer) {
+      delete source;
+    } else if (source && _splicer->splice(source)) {
+      debugMsgAudf("Tier switch: %s queued at the next frame", _switchUrl.c_str());
+      if (streamConnected) {
+        streamHealth.noteEnd(streamUrlHash, millis() - streamStartMillis, false);
+      }
+      _url = _switchUrl;
+      _urls[0] = _url;
+      streamUrlHash = StreamHealth_::hashUrl(_url);
+      streamConnected = true;
+      streamStartMillis = millis();
+      // Measure the new tier's rate afresh; until then the controller assumes its bitrate
+      _consumeRate = 0;
+      bitrateController.noteSwitchResult(true);
+    } else {
+      delete source;
+      bitrateController.noteSwitchResult(false);
+    }
+  }
+
   // Check if the audio task flagged stream end - clean up from main loop context
   if (!audioTaskRunning && !playing && (mp3 || buff || file || out)) {
     debugMsgAud("Cleaning up after stream end");
     bool wasStreamFailed = streamFailed;  // save before StopPlaying() clears it
+    unsigned long playedMs = millis() - streamStartMillis;
+    if (wasStreamFailed && streamConnected) {
+      streamHealth.noteEnd(streamUrlHash, playedMs, true);
+      streamConnected = false;
+    }
     StopPlaying();
     if (wasStreamFailed) {
+      metrics.inc(METRIC_STREAM_FAILURES);
+      linkMonitor.noteEvent(LINK_EVENT_RECONNECT);
+      if (playedMs < RESOLVE_SUSPECT_MS) {
+        // Died straight away - the resolved URL may have moved on
+        stationResolver.invalidate(_url);
+      }
+      if (playedMs >= STABLE_PLAY_MS) {
+        // It was working - a fresh outage, not more of the last one
+        _failedThisRound = 0;
+        _backoffAttempt = 0;
+      }
       reconnecting = true;
-      reconnectAt = millis() + RECONNECT_DELAY_MS;
-      debugMsgAud("Stream failed - reconnect in " + String(RECONNECT_DELAY_MS / 1000) + "s");
-      menuSystem.showFlashMessage("Resyncing...");
+      int tier = bitrateController.stepDownOnFailure();
+      if (tier >= 0) {
+        // A tiered station tries the tier below before anything else
+        _url = bitrateController.tierUrl(tier);
+        _urls[0] = _url;
+        _consumeRate = 0;
+        reconnectAt = millis() + FAILOVER_DELAY_MS;
+        debugMsgAudf("Stream failed - dropping to %s", _url.c_str());
+        menuSystem.showFlashMessage("Lower quality...");
+      } else if (++_failedThisRound < _urlCount) {
+        // Straight on to the next URL
+        _orderPos = (_orderPos + 1) % _urlCount;
+        _url = _urls[_order[_orderPos]];
+        reconnectAt = millis() + FAILOVER_DELAY_MS;
+        metrics.inc(METRIC_STREAM_FAILOVERS);
+        debugMsgAudf("Stream failed - failing over to %s", _url.c_str());
+        menuSystem.showFlashMessage("Trying mirror...");
+      } else {
+        // All of them have failed - wait, then start again from the best
+        _failedThisRound = 0;
+        streamHealth.rank(_urls, _urlCount, _order);
+        _orderPos = 0;
+        _url = _urls[_order[0]];
+        unsigned long delayMs = nextBackoffMs();
+        reconnectAt = millis() + delayMs;
+        debugMsgAudf("Stream failed - reconnect in %lums", delayMs);
+        menuSystem.showFlashMessage("Resyncing...");
+      }
     }
   }
 
+  // Start once the resolver has dealt with a playlist, or give up waiting and play the URL as is
+  if (_awaitingResolve && (stationResolver.isResolved(_url) || millis() - _awaitingResolveSince >= RESOLVE_WAIT_MS)) {
+    _awaitingResolve = false;
+    _resolveWaited = true;
+    StartPlaying();
+    _resolveWaited = false;
+  }
+
   // Handle scheduled reconnect after a stream failure
   if (reconnecting && !playing) {
     if (WiFi.status() != WL_CONNECTED) {
@@ -286,6 +649,7 @@ void RadioOutputManager_::audioOncePerLoop() {
     } else if (millis() >= reconnectAt) {
       debugMsgAud("Attempting stream reconnect");
       reconnecting = false;
+      _reconnectStart = true;
       StartPlaying();
     }
   }
@@ -295,9 +659,8 @@ void RadioOutputManager_::audioOncePerLoop() {
     static unsigned long lastBtLog = 0;
     if (millis() - lastBtLog > 3000) {
       lastBtLog = millis();
-      debugMsgAud("BT wait: connected=" + String(bluetoothManager.isBluetoothSourceConnected()) +
-                  " cbFired=" + String(bluetoothManager.isBluetoothSourceAudioStarted()) +
-                  " WiFi=" + String(WiFi.status()));
+      debugMsgAudf("BT wait: connected=%d cbFired=%d WiFi=%d", (int)bluetoothManager.isBluetoothSourceConnected(),
+                   (int)bluetoothManager.isBluetoothSourceAudioStarted(), (int)WiFi.status());
     }
 
     if (bluetoothManager.isBluetoothSourceAudioStarted()) {
@@ -315,10 +678,11 @@ void RadioOutputManager_::audioOncePerLoop() {
 void RadioOutputManager_::audioTask(void *param) {
   RadioOutputManager_ *self = static_cast<RadioOutputManager_ *>(param);
 
-  debugMsgAud("Audio task started on core " + String(xPortGetCoreID()));
+  debugMsgAudf("Audio task started on core %d", (int)xPortGetCoreID());
 
   while (self->audioTaskRunning) {
     if (self->playing && self->mp3) {
+      TRACE_SCOPE("mp3.loop");
       if (!self->mp3->loop()) {
         debugMsgAud("Stream ended - stopping playback");
         self->streamFailed = true;
@@ -341,7 +705,7 @@ static void MDCallback(void *cbData, const char *type, bool isUnicode, const cha
   s1[sizeof(s1) - 1] = 0;
   strncpy_P(s2, string, sizeof(s2));
   s2[sizeof(s2) - 1] = 0;
-  debugMsgInr("METADATA(" + String(ptr) + ") '" + String(s1) + "' = '" + String(s2));
+  debugMsgInrf("METADATA(%s) '%s' = '%s'", ptr, s1, s2);
   if (strcmp(s1, "StreamTitle") == 0) {
     radioOutputManager.setSongTitle(s2);
   }
@@ -353,7 +717,14 @@ static void StatusCallback(void *cbData, int code, const char *string) {
   char s1[64];
   strncpy_P(s1, string, sizeof(s1));
   s1[sizeof(s1) - 1] = 0;
-  debugMsgInr("STATUS(" + String(ptr) + ") '" + String(code) + "' = '" + String(s1));
+  debugMsgInrf("STATUS(%s) '%d' = '%s'", ptr, code, s1);
+  if (code == BUFFER_STATUS_UNDERFLOW && strcmp(ptr, "buffer") == 0) {
+    metrics.inc(METRIC_STREAM_UNDERRUNS);
+    TRACE_INSTANT("stream.underrun");
+    linkMonitor.noteEvent(LINK_EVENT_UNDERRUN);
+    bitrateController.noteUnderrun();
+    stationAnalytics.noteUnderrun();
+  }
 }
 
 void RadioOutputManager_::stopRadioStream() {
@@ -0,0 +1,181 @@
+#include "Scheduler.h"
+#include "Trace.h"
+
+// ************************************************************
+// Remember the task that runs the jobs, so other tasks can
+// wake it
+// ************************************************************
+void Scheduler_::begin() {
+  _mainTask = xTaskGetCurrentTaskHandle();
+}
+
+// ************************************************************
+// Put a job in the first free slot
+// ************************************************************
+int8_t Scheduler_::add(const char* name, uint32_t delayMs, uint32_t periodMs, SchedulerJob fn, SchedulerPriority priority) {
+  int8_t id = -1;
+  portENTER_CRITICAL(&_mux);
+  for (int8_t i = 0; i < SCHEDULER_MAX_JOBS; i++) {
+    if (!_jobs[i].active) {
+      scheduler_job_t &job = _jobs[i];
+      job.name = name;
+      job.fn = fn;
+      job.due = millis() + delayMs;
+      job.period = periodMs;
+      job.priority = priority;
+      job.runs = 0;
+      job.skipped = 0;
+      job.maxLateMs = 0;
+      job.active = true;
+      id = i;
+      break;
+    }
+  }
+  portEXIT_CRITICAL(&_mux);
+
+  // The new deadline may be sooner than the one the main task is sleeping towards
+  if (id >= 0 && xTaskGetCurrentTaskHandle() != _mainTask) {
+    wake();
+  }
+  return id;
+}
+
+// ************************************************************
+// Run fn every periodMs
+// ************************************************************
+int8_t Scheduler_::every(const char* name, uint32_t periodMs, SchedulerJob fn, SchedulerPriority priority, int32_t firstDelayMs) {
+  return add(name, firstDelayMs >= 0 ? firstDelayMs : periodMs, periodMs, fn, priority);
+}
+
+// ************************************************************
+// Run fn once, delayMs from now
+// ************************************************************
+int8_t Scheduler_::after(const char* name, uint32_t delayMs, SchedulerJob fn, SchedulerPriority priority) {
+  return add(name, delayMs, 0, fn, priority);
+}
+
+// ************************************************************
+// Remove a job
+// ************************************************************
+void Scheduler_::cancel(int8_t id) {
+  if (id < 0 || id >= SCHEDULER_MAX_JOBS) {
+    return;
+  }
+  portENTER_CRITICAL(&_mux);
+  _jobs[id].active = false;
+  portEXIT_CRITICAL(&_mux);
+}
+
+// ************************************************************
+// The due job to run next: highest priority, then earliest
+// deadline. Each job runs at most once per runDue().
+// ************************************************************
+int8_t Scheduler_::nextDue(uint32_t now, uint32_t ranMask) {
+  int8_t best = -1;
+  for (int8_t i = 0; i < SCHEDULER_MAX_JOBS; i++) {
+    const scheduler_job_t &job = _jobs[i];
+    if (!job.active || (ranMask & (1UL << i)) || (int32_t)(now - job.due) < 0) {
+      continue;
+    }
+    if (best < 0 || job.priority > _jobs[best].priority ||
+        (job.priority == _jobs[best].priority && (int32_t)(job.due - _jobs[best].due) < 0)) {
+      best = i;
+    }
+  }
+  return best;
+}
+
+// ************************************************************
+// Run the due jobs and work out how long we can sleep
+// ************************************************************
+uint32_t Scheduler_::runDue(uint32_t now) {
+  uint32_t ranMask = 0;
+
+  for (;;) {
+    SchedulerJob fn = nullptr;
+    const char* name = nullptr;
+
+    portENTER_CRITICAL(&_mux);
+    int8_t id = nextDue(now, ranMask);
+    if (id >= 0) {
+      scheduler_job_t &job = _jobs[id];
+      uint32_t late = now - job.due;
+      if (late > job.maxLateMs) {
+        job.maxLateMs = late;
+      }
+      job.runs++;
+      fn = job.fn;
+      name = job.name;
+      if (job.period == 0) {
+        job.active = false;
+      } else {
+        // Stay on the grid; skip whole periods if we've fallen behind
+        job.due += job.period;
+        if ((int32_t)(now - job.due) >= 0) {
+          uint32_t missed = (now - job.due) / job.period + 1;
+          job.due += missed * job.period;
+          job.skipped += missed;
+        }
+      }
+      ranMask |= (1UL << id);
+    }
+    portEXIT_CRITICAL(&_mux);
+
+    if (!fn) {
+      break;
+    }
+    {
+      TRACE_SCOPE(name);
+      (void)name;                   // only used when tracing
+      fn();
+    }
+    now = millis();
+  }
+
+  // Time to the earliest deadline
+  uint32_t wait = SCHEDULER_MAX_SLEEP_MS;
+  portENTER_CRITICAL(&_mux);
+  for (int8_t i = 0; i < SCHEDULER_MAX_JOBS; i++) {
+    if (_jobs[i].active) {
+      int32_t until = (int32_t)(_jobs[i].due - now);
+      if (until <= 0) {
+        wait = 0;
+        break;
+      }
+      if ((uint32_t)until < wait) {
+        wait = until;
+      }
+    }
+  }
+  portEXIT_CRITICAL(&_mux);
+  return wait;
+}
+
+// ************************************************************
+// Sleep until the next deadline or a wake()
+// ************************************************************
+void Scheduler_::sleep(uint32_t ms) {
+  if (ms == 0) {
+    return;
+  }
+  ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(ms));
+}
+
+// ************************************************************
+// Cut the main task's sleep short
+// ************************************************************
+void Scheduler_::wake() {
+  if (_mainTask) {
+    xTaskNotifyGive(_mainTask);
+  }
+}
+
+// ************************************************************
+// Library internal singleton wiring
+// ************************************************************
+Scheduler_ &Scheduler_::getInstance() {
+  static Scheduler_ instance;
+  return instance;
+}
+
+Scheduler_ &scheduler = scheduler.getInstance();
@@ -0,0 +1,188 @@
+#include "SilenceDetector.h"
+#include "DebugManager.h"
+#include "Metrics.h"
+#include "Trace.h"
+
+// ************************************************************
+// Set the thresholds and action, clamped to sensible ranges
+// ************************************************************
+void SilenceDetector_::configure(int thresholdDb, int silenceSeconds, int stallSeconds, int action) {
+  _thresholdDb = constrain(thresholdDb, -96, -20);
+  _silenceMs = constrain(silenceSeconds, 2, 600) * 1000UL;
+  _stallMs = constrain(stallSeconds, 2, 600) * 1000UL;
+  _action = (SilenceAction)constrain(action, (int)SILENCE_ACTION_NONE, (int)SILENCE_ACTION_NEXT_STATION);
+
+  // Full scale is 32768; the swing allowed is twice a peak ten times the RMS limit
+  float amplitude = 32768.0f * powf(10.0f, _thresholdDb / 20.0f);
+  _meanSquareLimit = amplitude * amplitude;
+  _swingLimit = amplitude * 20;
+}
+
+// ************************************************************
+// A block is complete - is it silent? Audio task.
+// ************************************************************
+void SilenceDetector_::endBlock() {
+  uint32_t meanSquare = _sumSquares / _count;
+  int32_t swing = _max - _min;
+  uint32_t now = millis();
+  if (meanSquare < _meanSquareLimit && swing < _swingLimit) {
+    if (_silentSinceMs == 0) {
+      _silentSinceMs = now ? now : 1;
+    }
+  } else {
+    _silentSinceMs = 0;
+  }
+  _lastMeanSquare = meanSquare;
+  _lastSwing = swing;
+  _lastBlockMs = now;
+
+  _sumSquares = 0;
+  _min = INT16_MAX;
+  _max = INT16_MIN;
+  _count = 0;
+}
+
+// ************************************************************
+// A stream is starting - before the audio task is
+// ************************************************************
+void SilenceDetector_::streamStarted() {
+  _sumSquares = 0;
+  _min = INT16_MAX;
+  _max = INT16_MIN;
+  _count = 0;
+  _lastBlockMs = 0;
+  _silentSinceMs = 0;
+  _startedMs = millis();
+  _active = true;
+}
+
+// ************************************************************
+// Silence or a stall that has gone on long enough
+// ************************************************************
+DeadAirType SilenceDetector_::check() {
+  if (!_active) {
+    return DEAD_AIR_NONE;
+  }
+  uint32_t now = millis();
+  uint32_t lastBlock = _lastBlockMs;
+  uint32_t sinceSound = lastBlock ? lastBlock : _startedMs;
+  if (now - sinceSound >= _stallMs) {
+    _eventMs = now - sinceSound;
+    return DEAD_AIR_STALL;
+  }
+  uint32_t silentSince = _silentSinceMs;
+  if (silentSince && now - silentSince >= _silenceMs) {
+    _eventMs = now - silentSince;
+    return DEAD_AIR_SILENCE;
+  }
+  return DEAD_AIR_NONE;
+}
+
+// ************************************************************
+// Keep the event. With no action the stream carries on, so
+// start timing again rather than report it every second.
+// ************************************************************
+void SilenceDetector_::noteEvent(DeadAirType type, SilenceAction action, const String &url) {
+  dead_air_event_t &event = _events[_eventNext];
+  event.millis = millis();
+  event.type = type;
+  event.durationMs = _eventMs;
+  event.rmsDb = _lastBlockMs ? toDb(_lastMeanSquare) : NAN;
+  event.action = action;
+  event.url = url;
+  _eventNext = (_eventNext + 1) % SILENCE_EVENTS_KEPT;
+  if (_eventCount < SILENCE_EVENTS_KEPT) {
+    _eventCount++;
+  }
+
+  metrics.inc(type == DEAD_AIR_STALL ? METRIC_DEAD_AIR_STALLS : METRIC_DEAD_AIR_SILENCES);
+  TRACE_INSTANT("stream.deadair");
+  debugMsgAudf("Dead air: %s for %ums - %s", type == DEAD_AIR_STALL ? "stall" : "silence", (unsigned)_eventMs, actionName(action));
+
+  if (action == SILENCE_ACTION_NONE) {
+    uint32_t now = millis();
+    if (type == DEAD_AIR_STALL) {
+      _startedMs = now;
+      _lastBlockMs = 0;
+    } else {
+      _silentSinceMs = now;
+    }
+  }
+}
+
+float SilenceDetector_::toDb(uint32_t meanSquare) {
+  if (meanSquare == 0) {
+    return -120.0f;
+  }
+  return 10.0f * log10f(meanSquare / (32768.0f * 32768.0f));
+}
+
+const char *SilenceDetector_::actionName(SilenceAction action) {
+  switch (action) {
+    case SILENCE_ACTION_NONE:         return "none";
+    case SILENCE_ACTION_RECONNECT:    return "reconnect";
+    case SILENCE_ACTION_FAILOVER:     return "failover";
+    case SILENCE_ACTION_NEXT_STATION: return "nextstation";
+  }
+  return "?";
+}
+
+// ************************************************************
+// Thresholds, the current level and recent events
+// ************************************************************
+void SilenceDetector_::writeJson(JsonStreamWriter &json) {
+  uint32_t now = millis();
+  json.beginObject();
+  json.add("action", actionName(_action));
+  json.add("thresholddb", _thresholdDb);
+  json.add("silenceseconds", (unsigned long)(_silenceMs / 1000));
+  json.add("stallseconds", (unsigned long)(_stallMs / 1000));
+  json.add("active", _active);
+
+  uint32_t lastBlock = _lastBlockMs;
+  json.key("rmsdb");
+  if (_active && lastBlock) {
+    json.value(toDb(_lastMeanSquare), 1);
+  } else {
+    json.nullValue();
+  }
+  json.key("swing");
+  if (_active && lastBlock) {
+    json.value((long)_lastSwing);
+  } else {
+    json.nullValue();
+  }
+  uint32_t silentSince = _silentSinceMs;
+  json.add("silentms", (unsigned long)(_active && silentSince ? now - silentSince : 0));
+  json.add("sincesoundms", (unsigned long)(_active ? now - (lastBlock ? lastBlock : _startedMs) : 0));
+
+  json.key("events").beginArray();
+  for (uint8_t i = 0; i < _eventCount; i++) {
+    const dead_air_event_t &event = _events[(_eventNext + SILENCE_EVENTS_KEPT - _eventCount + i) % SILENCE_EVENTS_KEPT];
+    json.beginObject();
+    json.add("millis", event.millis);
+    json.add("type", event.type == DEAD_AIR_STALL ? "stall" : "silence");
+    json.add("durationms", event.durationMs);
+    json.key("rmsdb");
+    if (isnan(event.rmsDb)) {
+      json.nullValue();
+    } else {
+      json.value(event.rmsDb, 1);
+    }
+    json.add("action", actionName(event.action));
+    json.add("url", event.url);
+    json.endObject();
+  }
+  json.endArray();
+  json.endObject();
+}
+
+// ************************************************************
+// Library internal singleton wiring
+// ************************************************************
+SilenceDetector_ &SilenceDetector_::getInstance() {
+  static SilenceDetector_ instance;
+  return instance;
+}
+
+SilenceDetector_ &silenceDetector = silenceDetector.getInstance();
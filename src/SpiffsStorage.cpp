@@ -1,5 +1,6 @@
 #include "SpiffsStorage.h"
 #include <esp32-hal-psram.h>
+#include "SilenceDetector.h"
 
 //**********************************************************************************
 //**********************************************************************************
@@ -19,6 +20,33 @@ bool SpiffsStorage_::testMountSpiffs()
   return mounted;
 }
 
+// ************************************************************
+// A whole file, NUL terminated, or nullptr. Free it after.
+// ************************************************************
+char *SpiffsStorage_::readFile(const char *path)
+{
+  if (!SPIFFS.exists(path))
+  {
+    return nullptr;
+  }
+  File file = SPIFFS.open(path, "r");
+  if (!file)
+  {
+    return nullptr;
+  }
+  size_t size = file.size();
+  // Allocate a buffer from PSRAM if available
+  char *buf = psramFound() ? (char *)ps_malloc(size + 1) : nullptr;
+  if (!buf) buf = (char *)malloc(size + 1);
+  if (buf)
+  {
+    file.readBytes(buf, size);
+    buf[size] = '\0';
+  }
+  file.close();
+  return buf;
+}
+
 // ************************************************************
 // Retrieve the config from the SPIFFS
 // ************************************************************
@@ -26,78 +54,115 @@ bool SpiffsStorage_::getConfigFromSpiffs()
 {
   bool loaded = false;
   debugMsgSpfX("mounted file system config read");
-  if (SPIFFS.exists("/config/config.json"))
+  std::unique_ptr<char[], decltype(&free)> buf(readFile(SPIFFS_CONFIG_FILE), free);
+  if (buf)
   {
     // file exists, reading and loading
     debugMsgSpf("Reading config file");
-    File configFile = SPIFFS.open("/config/config.json", "r");
-    if (configFile)
+    DynamicJsonBuffer jsonBuffer;
+    JsonObject &json = jsonBuffer.parseObject(buf.get());
+    #ifdef SPF_EXTENDED_DEBUG
+    // Dump the raw JSON
+    json.printTo(Serial);
+    debugMsgSpfX("\n");
+    #endif
+    if (json.success())
     {
-      debugMsgSpfX("opened config file");
-      size_t size = configFile.size();
-      // Allocate a buffer from PSRAM if available
-      char *rawBuf = psramFound() ? (char *)ps_malloc(size) : nullptr;
-      if (!rawBuf) rawBuf = (char *)malloc(size);
-      std::unique_ptr<char[], decltype(&free)> buf(rawBuf, free);
-      configFile.readBytes(buf.get(), size);
-      DynamicJsonBuffer jsonBuffer;
-      JsonObject &json = jsonBuffer.parseObject(buf.get());
-      #ifdef SPF_EXTENDED_DEBUG
-      // Dump the raw JSON
-      json.printTo(Serial);
-      debugMsgSpfX("\n");
-      #endif
-      if (json.success())
-      {
-        debugMsgSpfX("parsed config json");
-
-        cc->WiFiSSID = json["WiFiSSID"].as<String>();
-        debugMsgSpfX("Loaded WiFiSSID: " + String(cc->WiFiSSID));
-
-        cc->WiFiPassword = json["WiFiPassword"].as<String>();
-        debugMsgSpfX("Loaded WiFiPassword: " + String(cc->WiFiPassword));
-
-        cc->WifiOnAtStart = json["WifiOnAtStart"].as<bool>();
-        debugMsgSpfX("Loaded WifiOnAtStart: " + String(cc->WifiOnAtStart));
-
-        loaded = true;
-      }
-      else
-      {
-        debugMsgSpf("failed to load json config");
-      }
-      debugMsgSpfX("Closing config file");
-
-      configFile.close();
+      debugMsgSpfX("parsed config json");
+      loaded = configFromJson(json);
+    }
+    else
+    {
+      debugMsgSpf("failed to load json config");
     }
   }
   return loaded;
 }
 
 // ************************************************************
-// Save config back to the SPIFFS
+// Config to JSON
 // ************************************************************
-void SpiffsStorage_::saveConfigToSpiffs()
+void SpiffsStorage_::configToJson(JsonObject &json, bool withPasswords)
 {
-  debugMsgSpf("Saving config");
-
-  DynamicJsonBuffer jsonBuffer;
-  JsonObject &json = jsonBuffer.createObject();
   json["WiFiSSID"] = cc->WiFiSSID;
-  json["WiFiPassword"] = cc->WiFiPassword;
+  if (withPasswords)
+  {
+    json["WiFiPassword"] = cc->WiFiPassword;
+  }
   json["WifiOnAtStart"] = cc->WifiOnAtStart;
-  
-  File configFile = SPIFFS.open("/config/config.json", "w");
-  if (!configFile)
+  json["SilenceAction"] = cc->silenceAction;
+  json["SilenceThresholdDb"] = cc->silenceThresholdDb;
+  json["SilenceSeconds"] = cc->silenceSeconds;
+  json["StallSeconds"] = cc->stallSeconds;
+  JsonArray &networks = json.createNestedArray("WiFiNetworks");
+  for (uint8_t i = 0; i < cc->wifiCredentialCount; i++) {
+    JsonObject &network = networks.createNestedObject();
+    network["ssid"] = cc->wifiCredentials[i].ssid;
+    if (withPasswords)
+    {
+      network["password"] = cc->wifiCredentials[i].password;
+    }
+    network["priority"] = cc->wifiCredentials[i].priority;
+  }
+}
+
+// ************************************************************
+// Config from JSON
+// ************************************************************
+bool SpiffsStorage_::configFromJson(JsonObject &json)
+{
+  String oldSSID = cc->WiFiSSID;
+  cc->WiFiSSID = json["WiFiSSID"].as<String>();
+  debugMsgSpfX("Loaded WiFiSSID: " + String(cc->WiFiSSID));
+
+  if (json.containsKey("WiFiPassword") || cc->WiFiSSID != oldSSID)
   {
-    debugMsgSpf("Failed to open config file for writing");
+    cc->WiFiPassword = json["WiFiPassword"].as<String>();
+  }
+  debugMsgSpfX("Loaded WiFiPassword: " + String(cc->WiFiPassword));
+
+  cc->WifiOnAtStart = json["WifiOnAtStart"].as<bool>();
+  debugMsgSpfX("Loaded WifiOnAtStart: " + String(cc->WifiOnAtStart));
+
+  // Configs from before dead air detection don't have these
+  cc->silenceAction = json.containsKey("SilenceAction") ? json["SilenceAction"].as<int>() : SILENCE_DEFAULT_ACTION;
+  cc->silenceThresholdDb = json.containsKey("SilenceThresholdDb") ? json["SilenceThresholdDb"].as<int>() : SILENCE_DEFAULT_THRESHOLD_DB;
+  cc->silenceSeconds = json.containsKey("SilenceSeconds") ? json["SilenceSeconds"].as<int>() : SILENCE_DEFAULT_SECONDS;
+  cc->stallSeconds = json.containsKey("StallSeconds") ? json["StallSeconds"].as<int>() : STALL_DEFAULT_SECONDS;
 
-    configFile.close();
-    return;
+  wifi_credential_t previous[MAX_WIFI_CREDENTIALS];
+  uint8_t previousCount = cc->wifiCredentialCount;
+  for (uint8_t i = 0; i < previousCount; i++) {
+    previous[i] = cc->wifiCredentials[i];
   }
-  json.printTo(configFile);
-  configFile.close();
-  debugMsgSpf("Saved config");
+  cc->wifiCredentialCount = 0;
+  JsonArray &networks = json["WiFiNetworks"];
+  if (networks.success()) {
+    for (size_t i = 0; i < networks.size() && cc->wifiCredentialCount < MAX_WIFI_CREDENTIALS; i++) {
+      JsonObject &network = networks[i];
+      wifi_credential_t &cred = cc->wifiCredentials[cc->wifiCredentialCount++];
+      cred.ssid = network["ssid"].as<String>();
+      cred.password = network["password"].as<String>();
+      cred.priority = network["priority"].as<int>();
+      // An export has no passwords - keep the one we know
+      if (!network.containsKey("password")) {
+        for (uint8_t p = 0; p < previousCount; p++) {
+          if (previous[p].ssid == cred.ssid) {
+            cred.password = previous[p].password;
+          }
+        }
+      }
+    }
+  }
+  // Configs from before the network list only have the single SSID
+  if (cc->wifiCredentialCount == 0 && cc->WiFiSSID.length() > 0) {
+    cc->wifiCredentials[0].ssid = cc->WiFiSSID;
+    cc->wifiCredentials[0].password = cc->WiFiPassword;
+    cc->wifiCredentials[0].priority = WIFI_DEFAULT_PRIORITY;
+    cc->wifiCredentialCount = 1;
+  }
+  debugMsgSpfX("Loaded WiFi networks: " + String(cc->wifiCredentialCount));
+  return true;
 }
 
 // ************************************************************
@@ -106,70 +171,41 @@ void SpiffsStorage_::saveConfigToSpiffs()
 bool SpiffsStorage_::getStatsFromSpiffs()
 {
   bool loaded = false;
-  if (SPIFFS.exists("/config/stats.json"))
+  std::unique_ptr<char[], decltype(&free)> buf(readFile(SPIFFS_STATS_FILE), free);
+  if (buf)
   {
     // file exists, reading and loading
     debugMsgSpf("Reading stats file");
-
-    File statsFile = SPIFFS.open("/config/stats.json", "r");
-    if (statsFile)
+    DynamicJsonBuffer jsonBuffer;
+    JsonObject &json = jsonBuffer.parseObject(buf.get());
+    if (json.success())
     {
-      debugMsgSpfX("opened stats file");
-
-      size_t size = statsFile.size();
-      // Allocate a buffer from PSRAM if available
-      char *rawBuf = psramFound() ? (char *)ps_malloc(size) : nullptr;
-      if (!rawBuf) rawBuf = (char *)malloc(size);
-      std::unique_ptr<char[], decltype(&free)> buf(rawBuf, free);
-      statsFile.readBytes(buf.get(), size);
-      DynamicJsonBuffer jsonBuffer;
-      JsonObject &json = jsonBuffer.parseObject(buf.get());
-      if (json.success())
-      {
-        debugMsgSpfX("parsed stats json");
-
-        cs->uptimeMins = json.get<unsigned long>("uptime");
-        debugMsgSpfX("Loaded uptime: " + String(cs->uptimeMins));
-
-        cs->playtimeMins = json.get<unsigned long>("playtime");
-        debugMsgSpfX("Loaded playtime: " + String(cs->playtimeMins));
-
-        loaded = true;
-      }
-      else
-      {
-        debugMsgSpf("Failed to load json config");
-      }
-      debugMsgSpfX("Closing stats file");
-
-      statsFile.close();
+      debugMsgSpfX("parsed stats json");
+      loaded = statsFromJson(json);
+    }
+    else
+    {
+      debugMsgSpf("Failed to load json config");
     }
   }
   return loaded;
 }
 
-// ************************************************************
-// Save the statistics back to the SPIFFS
-// ************************************************************
-void SpiffsStorage_::saveStatsToSpiffs()
+void SpiffsStorage_::statsToJson(JsonObject &json)
 {
-  debugMsgSpf("Saving stats");
-  DynamicJsonBuffer jsonBuffer;
-  JsonObject &json = jsonBuffer.createObject();
   json.set("uptime", cs->uptimeMins);
-
-  File statsFile = SPIFFS.open("/config/stats.json", "w");
-  if (!statsFile)
-  {
-    debugMsgSpf("Failed to open stats file for writing");
-    statsFile.close();
-    return;
-  }
-  json.printTo(statsFile);
-  statsFile.close();
-  debugMsgSpf("Saved stats");
+  json.set("playtime", cs->playtimeMins);
 }
 
+bool SpiffsStorage_::statsFromJson(JsonObject &json)
+{
+  cs->uptimeMins = json.get<unsigned long>("uptime");
+  debugMsgSpfX("Loaded uptime: " + String(cs->uptimeMins));
+
+  cs->playtimeMins = json.get<unsigned long>("playtime");
+  debugMsgSpfX("Loaded playtime: " + String(cs->playtimeMins));
+  return true;
+}
 
 // ************************************************************
 // Retrieve stations from SPIFFS
@@ -177,81 +213,79 @@ void SpiffsStorage_::saveStatsToSpiffs()
 bool SpiffsStorage_::getStationsFromSpiffs()
 {
   bool loaded = false;
-  if (SPIFFS.exists("/config/stations.json"))
+  std::unique_ptr<char[], decltype(&free)> buf(readFile(SPIFFS_STATIONS_FILE), free);
+  if (buf)
   {
     debugMsgSpf("Reading stations file");
-    File file = SPIFFS.open("/config/stations.json", "r");
-    if (file)
+    DynamicJsonBuffer jsonBuffer;
+    JsonArray &arr = jsonBuffer.parseArray(buf.get());
+    if (arr.success())
     {
-      size_t size = file.size();
-      // Allocate a buffer from PSRAM if available
-      char *rawBuf = psramFound() ? (char *)ps_malloc(size) : nullptr;
-      if (!rawBuf) rawBuf = (char *)malloc(size);
-      std::unique_ptr<char[], decltype(&free)> buf(rawBuf, free);
-      file.readBytes(buf.get(), size);
-      DynamicJsonBuffer jsonBuffer;
-      JsonArray &arr = jsonBuffer.parseArray(buf.get());
-      if (arr.success())
-      {
-        stationCount = 0;
-        for (int i = 0; i < (int)arr.size() && i < MAX_STATIONS; i++)
-        {
-          JsonObject &s = arr[i];
-          stations[i].name = s["name"].as<String>();
-          stations[i].url = s["url"].as<String>();
-          stationCount++;
-        }
-        debugMsgSpf("Loaded " + String(stationCount) + " stations");
-        loaded = true;
-      }
-      else
-      {
-        debugMsgSpf("Failed to parse stations json");
-      }
-      file.close();
+      loaded = stationsFromJson(arr);
+      debugMsgSpf("Loaded " + String(stationCount) + " stations");
+    }
+    else
+    {
+      debugMsgSpf("Failed to parse stations json");
     }
   }
-
-  // Seed a default station if none loaded
-  if (!loaded || stationCount == 0)
-  {
-    debugMsgSpf("No stations found - adding default");
-    stations[0].name = "Radio FFH";
-    stations[0].url = "http://mp3.ffh.de/radioffh/hqlivestream.mp3";
-    stationCount = 1;
-    saveStationsToSpiffs();
-    loaded = true;
-  }
-
   return loaded;
 }
 
-// ************************************************************
-// Save stations to SPIFFS
-// ************************************************************
-void SpiffsStorage_::saveStationsToSpiffs()
+void SpiffsStorage_::stationsToJson(JsonArray &arr)
 {
-  debugMsgSpf("Saving stations");
-  DynamicJsonBuffer jsonBuffer;
-  JsonArray &arr = jsonBuffer.createArray();
-
   for (int i = 0; i < stationCount; i++)
   {
     JsonObject &s = arr.createNestedObject();
     s["name"] = stations[i].name;
-    s["url"] = stations[i].url;
+    s["url"] = stations[i].urls[0];
+    if (stations[i].urlCount > 1)
+    {
+      JsonArray &mirrors = s.createNestedArray("mirrors");
+      for (int m = 1; m < stations[i].urlCount; m++)
+      {
+        mirrors.add(stations[i].urls[m]);
+      }
+    }
+    if (stations[i].tierCount > 0)
+    {
+      JsonArray &tiers = s.createNestedArray("tiers");
+      for (int t = 0; t < stations[i].tierCount; t++)
+      {
+        JsonObject &tier = tiers.createNestedObject();
+        tier["kbps"] = stations[i].tierKbps[t];
+        tier["url"] = stations[i].tierUrls[t];
+      }
+    }
   }
+}
 
-  File file = SPIFFS.open("/config/stations.json", "w");
-  if (!file)
+bool SpiffsStorage_::stationsFromJson(JsonArray &arr)
+{
+  stationCount = 0;
+  for (int i = 0; i < (int)arr.size() && i < MAX_STATIONS; i++)
   {
-    debugMsgSpf("Failed to open stations file for writing");
-    file.close();
-    return;
+    JsonObject &s = arr[i];
+    stations[i].name = s["name"].as<String>();
+    stations[i].urls[0] = s["url"].as<String>();
+    stations[i].urlCount = 1;
+    JsonArray &mirrors = s["mirrors"];
+    for (int m = 0; m < (int)mirrors.size() && stations[i].urlCount < MAX_STATION_URLS; m++)
+    {
+      stations[i].urls[stations[i].urlCount++] = mirrors[m].as<String>();
+    }
+    stations[i].tierCount = 0;
+    JsonArray &tiers = s["tiers"];
+    for (int t = 0; t < (int)tiers.size() && t < MAX_STATION_TIERS; t++)
+    {
+      JsonObject &tier = tiers[t];
+      stations[i].tierKbps[t] = tier["kbps"].as<int>();
+      stations[i].tierUrls[t] = tier["url"].as<String>();
+      stations[i].tierCount++;
+    }
+    stationCount++;
   }
-  arr.printTo(file);
-  file.close();
-  debugMsgSpf("Saved " + String(stationCount) + " stations");
+  return stationCount > 0;
 }
 
 // ************************************************************
@@ -263,4 +297,4 @@ SpiffsStorage_ &SpiffsStorage_::getInstance() {
   return instance;
 }
 
-SpiffsStorage_ &spiffsStorage = spiffsStorage.getInstance();
\ No newline at end of file
+SpiffsStorage_ &spiffsStorage = spiffsStorage.getInstance();
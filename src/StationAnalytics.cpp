@@ -0,0 +1,439 @@
+#include "StationAnalytics.h"
+#include <SPIFFS.h>
+#include <stddef.h>
+#include <esp_rom_crc.h>
+#include "DebugManager.h"
+#include "StreamHealth.h"
+
+static_assert(sizeof(analytics_record_t) == 36, "analytics_record_t is part of the stored format");
+
+static uint32_t recordCrc(const analytics_record_t &record) {
+  return esp_rom_crc32_le(0, (const uint8_t *)&record, offsetof(analytics_record_t, crc));
+}
+
+// ************************************************************
+// Load the log. Finish a compaction a reset interrupted, and
+// rewrite a log with a torn or damaged record in it.
+// ************************************************************
+void StationAnalytics_::begin() {
+  memset(_table, 0, sizeof(_table));
+  _fileLock = xSemaphoreCreateMutex();
+  if (SPIFFS.exists(ANALYTICS_LOG_NEW_FILE)) {
+    debugMsgSpf("Station analytics: finishing an interrupted compaction");
+    finishCompaction();
+  }
+  if (SPIFFS.exists(ANALYTICS_LOG_TMP_FILE)) {
+    SPIFFS.remove(ANALYTICS_LOG_TMP_FILE);
+  }
+  replay();
+}
+
+void StationAnalytics_::replay() {
+  File file = SPIFFS.open(ANALYTICS_LOG_FILE, "r");
+  if (!file) {
+    return;
+  }
+  _logBytes = file.size();
+  analytics_record_t records[ANALYTICS_READ_CHUNK];
+  size_t got;
+  while ((got = file.read((uint8_t *)records, sizeof(records))) >= sizeof(analytics_record_t)) {
+    for (size_t i = 0; i < got / sizeof(analytics_record_t); i++) {
+      if (records[i].crc != recordCrc(records[i])) {
+        _badRecords++;
+        continue;
+      }
+      apply(records[i]);
+      _replayed++;
+    }
+  }
+  file.close();
+
+  debugMsgSpff("Station analytics: %u records replayed, %u bad", (unsigned)_replayed, (unsigned)_badRecords);
+  if (_badRecords > 0 || _logBytes % sizeof(analytics_record_t) != 0) {
+    // Appending after a part record would leave every later one out of step
+    compact();
+  }
+}
+
+void StationAnalytics_::apply(const analytics_record_t &record) {
+  if (record.key == 0) {
+    return;
+  }
+  portENTER_CRITICAL(&_mux);
+  int i = slotFor(record.key);
+  if (record.type == ANALYTICS_RECORD_NAME) {
+    memcpy(_table[i].name, record.name, ANALYTICS_NAME_LEN);
+    _table[i].name[ANALYTICS_NAME_LEN] = '\0';
+    _table[i].nameLogged = true;
+  } else if (record.type == ANALYTICS_RECORD_COUNTS) {
+    add(_table[i].total, record.counts);
+  }
+  portEXIT_CRITICAL(&_mux);
+}
+
+// ************************************************************
+// Key of a station: hash of its primary URL
+// ************************************************************
+uint32_t StationAnalytics_::keyFor(const station_t &station) {
+  if (station.urlCount > 0) {
+    return StreamHealth_::hashUrl(station.urls[0]);
+  }
+  if (station.tierCount > 0) {
+    return StreamHealth_::hashUrl(station.tierUrls[0]);
+  }
+  return StreamHealth_::hashUrl(station.name);
+}
+
+// ************************************************************
+// Entry for a key, -1 if none. Call inside the mux.
+// ************************************************************
+int StationAnalytics_::indexOf(uint32_t key) {
+  for (int i = 0; i < ANALYTICS_MAX_STATIONS; i++) {
+    if (_table[i].key == key) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+// ************************************************************
+// Entry for a key, taking a free one or the one with the fewest
+// minutes if it has none. A station that makes way is copied to
+// evicted, if given. Call inside the mux.
+// ************************************************************
+int StationAnalytics_::slotFor(uint32_t key, station_analytics_t *evicted) {
+  int i = indexOf(key);
+  if (i >= 0) {
+    return i;
+  }
+  i = indexOf(0);
+  if (i < 0) {
+    for (int e = 0; e < ANALYTICS_MAX_STATIONS; e++) {
+      if (e != _current && (i < 0 || _table[e].total.minutes < _table[i].total.minutes)) {
+        i = e;
+      }
+    }
+    if (evicted != nullptr) {
+      *evicted = _table[i];
+    }
+  }
+  memset(&_table[i], 0, sizeof(_table[i]));
+  _table[i].key = key;
+  return i;
+}
+
+void StationAnalytics_::add(analytics_counts_t &to, const analytics_counts_t &from) {
+  to.minutes += from.minutes;
+  to.starts += from.starts;
+  to.reconnects += from.reconnects;
+  to.underruns += from.underruns;
+  to.ttfaCount += from.ttfaCount;
+  to.ttfaSumMs += from.ttfaSumMs;
+}
+
+// ************************************************************
+// Counting
+// ************************************************************
+void StationAnalytics_::select(const station_t &station) {
+  uint32_t key = keyFor(station);
+  station_analytics_t evicted;
+  evicted.key = 0;
+  portENTER_CRITICAL(&_mux);
+  _current = slotFor(key, &evicted);
+  station_analytics_t &entry = _table[_current];
+  if (strncmp(entry.name, station.name.c_str(), ANALYTICS_NAME_LEN) != 0) {
+    strlcpy(entry.name, station.name.c_str(), sizeof(entry.name));
+    entry.nameLogged = false;
+  }
+  portEXIT_CRITICAL(&_mux);
+
+  if (evicted.key != 0) {
+    logEvicted(evicted);
+  }
+}
+
+// ************************************************************
+// A station that made way takes what it hadn't logged yet with
+// it, so its totals in the log are complete
+// ************************************************************
+void StationAnalytics_::logEvicted(const station_analytics_t &entry) {
+  static const analytics_counts_t none = {};
+  bool dirty = memcmp(&entry.pending, &none, sizeof(none)) != 0;
+  if (!dirty && entry.nameLogged) {
+    return;
+  }
+  xSemaphoreTake(_fileLock, portMAX_DELAY);
+  File file = SPIFFS.open(ANALYTICS_LOG_FILE, "a");
+  bool written = file && (entry.nameLogged || append(file, entry.key, ANALYTICS_RECORD_NAME, entry.name, ANALYTICS_NAME_LEN)) &&
+                 (!dirty || append(file, entry.key, ANALYTICS_RECORD_COUNTS, &entry.pending, sizeof(entry.pending)));
+  if (!written) {
+    _writeFailures++;
+  }
+  if (file) {
+    _logBytes = file.size();
+    file.close();
+  }
+  xSemaphoreGive(_fileLock);
+}
+
+void StationAnalytics_::noteStart(bool reconnect) {
+  portENTER_CRITICAL(&_mux);
+  if (_current >= 0) {
+    station_analytics_t &entry = _table[_current];
+    if (reconnect) {
+      entry.total.reconnects++;
+      entry.pending.reconnects++;
+    } else {
+      entry.total.starts++;
+      entry.pending.starts++;
+    }
+  }
+  portEXIT_CRITICAL(&_mux);
+}
+
+void StationAnalytics_::noteFirstAudio(uint32_t ms) {
+  portENTER_CRITICAL(&_mux);
+  if (_current >= 0) {
+    station_analytics_t &entry = _table[_current];
+    entry.total.ttfaCount++;
+    entry.total.ttfaSumMs += ms;
+    entry.pending.ttfaCount++;
+    entry.pending.ttfaSumMs += ms;
+  }
+  portEXIT_CRITICAL(&_mux);
+}
+
+void StationAnalytics_::noteUnderrun() {
+  portENTER_CRITICAL(&_mux);
+  if (_current >= 0) {
+    _table[_current].total.underruns++;
+    _table[_current].pending.underruns++;
+  }
+  portEXIT_CRITICAL(&_mux);
+}
+
+void StationAnalytics_::tick(bool playing) {
+  if (playing) {
+    portENTER_CRITICAL(&_mux);
+    if (_current >= 0) {
+      _table[_current].total.minutes++;
+      _table[_current].pending.minutes++;
+    }
+    portEXIT_CRITICAL(&_mux);
+  }
+  portENTER_CRITICAL(&_mux);
+  bool due = ++_sinceFlush >= ANALYTICS_FLUSH_MINUTES;
+  portEXIT_CRITICAL(&_mux);
+  if (due) {
+    flush();
+  }
+}
+
+// ************************************************************
+// One record, CRC added
+// ************************************************************
+bool StationAnalytics_::append(File &file, uint32_t key, AnalyticsRecordType type, const void *data, size_t len) {
+  analytics_record_t record;
+  memset(&record, 0, sizeof(record));
+  record.key = key;
+  record.type = type;
+  memcpy(&record.counts, data, len);
+  record.crc = recordCrc(record);
+  return file.write((const uint8_t *)&record, sizeof(record)) == sizeof(record);
+}
+
+// ************************************************************
+// Append each station's counts since the last flush. The web
+// server flushes too, so the log is only touched under the
+// file lock.
+// ************************************************************
+void StationAnalytics_::flush() {
+  static const analytics_counts_t none = {};
+  if (_fileLock == nullptr) {
+    return;
+  }
+  xSemaphoreTake(_fileLock, portMAX_DELAY);
+  portENTER_CRITICAL(&_mux);
+  _sinceFlush = 0;
+  portEXIT_CRITICAL(&_mux);
+  File file;
+  for (int i = 0; i < ANALYTICS_MAX_STATIONS; i++) {
+    uint32_t key;
+    char name[ANALYTICS_NAME_LEN + 1];
+    bool nameLogged;
+    analytics_counts_t pending;
+
+    // Take the entry's pending counts, then write outside the lock
+    portENTER_CRITICAL(&_mux);
+    key = _table[i].key;
+    pending = _table[i].pending;
+    bool dirty = key != 0 && memcmp(&pending, &none, sizeof(pending)) != 0;
+    if (dirty) {
+      memcpy(name, _table[i].name, sizeof(name));
+      nameLogged = _table[i].nameLogged;
+      _table[i].pending = none;
+      _table[i].nameLogged = true;
+    }
+    portEXIT_CRITICAL(&_mux);
+    if (!dirty) {
+      continue;
+    }
+
+    if (!file) {
+      file = SPIFFS.open(ANALYTICS_LOG_FILE, "a");
+    }
+    bool written = file && (nameLogged || append(file, key, ANALYTICS_RECORD_NAME, name, ANALYTICS_NAME_LEN)) &&
+                   append(file, key, ANALYTICS_RECORD_COUNTS, &pending, sizeof(pending));
+    if (!written) {
+      // Keep them for the next flush
+      _writeFailures++;
+      portENTER_CRITICAL(&_mux);
+      if (_table[i].key == key) {
+        add(_table[i].pending, pending);
+        _table[i].nameLogged = nameLogged;
+      }
+      portEXIT_CRITICAL(&_mux);
+    }
+  }
+  if (file) {
+    _logBytes = file.size();
+    file.close();
+    if (_logBytes > ANALYTICS_LOG_MAX_BYTES) {
+      compact();
+    }
+  }
+  xSemaphoreGive(_fileLock);
+}
+
+// ************************************************************
+// Rewrite the log as each station's name and totals. Call with
+// the file lock held, or from begin().
+// ************************************************************
+void StationAnalytics_::compact() {
+  File file = SPIFFS.open(ANALYTICS_LOG_TMP_FILE, "w");
+  if (!file) {
+    _writeFailures++;
+    return;
+  }
+  // What each entry had pending when it was copied. Counts that arrive after that stay pending.
+  analytics_counts_t taken[ANALYTICS_MAX_STATIONS];
+  uint32_t keys[ANALYTICS_MAX_STATIONS];
+  bool nameLogged[ANALYTICS_MAX_STATIONS];
+  int copied = 0;
+  bool written = true;
+  for (int i = 0; i < ANALYTICS_MAX_STATIONS && written; i++, copied++) {
+    // The totals include what was pending, so take both together
+    portENTER_CRITICAL(&_mux);
+    station_analytics_t entry = _table[i];
+    memset(&_table[i].pending, 0, sizeof(_table[i].pending));
+    _table[i].nameLogged = true;
+    portEXIT_CRITICAL(&_mux);
+    keys[i] = entry.key;
+    taken[i] = entry.pending;
+    nameLogged[i] = entry.nameLogged;
+    if (entry.key == 0) {
+      continue;
+    }
+    written = append(file, entry.key, ANALYTICS_RECORD_NAME, entry.name, ANALYTICS_NAME_LEN) &&
+              append(file, entry.key, ANALYTICS_RECORD_COUNTS, &entry.total, sizeof(entry.total));
+  }
+  file.close();
+  if (!written) {
+    // The old log is still the one in use, so what was taken is pending again
+    _writeFailures++;
+    SPIFFS.remove(ANALYTICS_LOG_TMP_FILE);
+    portENTER_CRITICAL(&_mux);
+    for (int i = 0; i < copied; i++) {
+      if (keys[i] != 0 && _table[i].key == keys[i]) {
+        add(_table[i].pending, taken[i]);
+        _table[i].nameLogged = nameLogged[i];
+      }
+    }
+    portEXIT_CRITICAL(&_mux);
+    return;
+  }
+
+  SPIFFS.rename(ANALYTICS_LOG_TMP_FILE, ANALYTICS_LOG_NEW_FILE);
+  finishCompaction();
+  _compactions++;
+  debugMsgSpff("Station analytics: log compacted to %u bytes", (unsigned)_logBytes);
+}
+
+void StationAnalytics_::finishCompaction() {
+  SPIFFS.remove(ANALYTICS_LOG_FILE);
+  SPIFFS.rename(ANALYTICS_LOG_NEW_FILE, ANALYTICS_LOG_FILE);
+  File file = SPIFFS.open(ANALYTICS_LOG_FILE, "r");
+  _logBytes = file ? file.size() : 0;
+  file.close();
+}
+
+// ************************************************************
+// Queries
+// ************************************************************
+bool StationAnalytics_::find(const String &station, station_analytics_t &entry) {
+  // A key as listed, 8 hex digits, or a name
+  uint32_t key = 0;
+  if (station.length() == 8) {
+    char *end;
+    key = strtoul(station.c_str(), &end, 16);
+    if (*end != '\0') {
+      key = 0;
+    }
+  }
+  bool found = false;
+  portENTER_CRITICAL(&_mux);
+  for (int i = 0; i < ANALYTICS_MAX_STATIONS && !found; i++) {
+    if (_table[i].key != 0 && (_table[i].key == key || strcasecmp(_table[i].name, station.c_str()) == 0)) {
+      entry = _table[i];
+      found = true;
+    }
+  }
+  portEXIT_CRITICAL(&_mux);
+  return found;
+}
+
+int StationAnalytics_::list(station_analytics_t *entries, int max) {
+  int count = 0;
+  for (int i = 0; i < ANALYTICS_MAX_STATIONS && count < max; i++) {
+    portENTER_CRITICAL(&_mux);
+    station_analytics_t entry = _table[i];
+    portEXIT_CRITICAL(&_mux);
+    if (entry.key == 0) {
+      continue;
+    }
+    // Insertion sort, most minutes first
+    int pos = count++;
+    while (pos > 0 && entries[pos - 1].total.minutes < entry.total.minutes) {
+      entries[pos] = entries[pos - 1];
+      pos--;
+    }
+    entries[pos] = entry;
+  }
+  return count;
+}
+
+// ************************************************************
+// For diagnostics
+// ************************************************************
+void StationAnalytics_::writeJson(JsonStreamWriter &json) {
+  json.add("logbytes", _logBytes);
+  json.add("logmax", ANALYTICS_LOG_MAX_BYTES);
+  json.add("flushmins", ANALYTICS_FLUSH_MINUTES);
+  json.add("pendingmins", (unsigned)_sinceFlush);
+  json.add("replayed", _replayed);
+  json.add("badrecords", _badRecords);
+  json.add("compactions", _compactions);
+  json.add("writefailures", _writeFailures);
+  json.add("maxstations", ANALYTICS_MAX_STATIONS);
+  json.add("rambytes", (unsigned)sizeof(_table));
+}
+
+// ************************************************************
+// Library internal singleton wiring
+// ************************************************************
+StationAnalytics_ &StationAnalytics_::getInstance() {
+  static StationAnalytics_ instance;
+  return instance;
+}
+
+StationAnalytics_ &stationAnalytics = stationAnalytics.getInstance();
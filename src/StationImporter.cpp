@@ -0,0 +1,558 @@
+#include "StationImporter.h"
+#include "StationStore.h"
+#include "StreamHealth.h"
+#include "DebugManager.h"
+
+// ************************************************************
+// Claim the importer for a request and read the hashes of the
+// stations already stored
+// ************************************************************
+bool StationImporter_::start(AsyncWebServerRequest *request, ImportFormat format) {
+  if (_active && millis() - _lastFeedAt < IMPORT_STALE_MS) {
+    return false;
+  }
+  if (_active) {
+    debugMsgSpf("Import: giving up a stalled import");
+    finish(_owner);
+  }
+
+  reset();
+  _owner = request;
+  _format = format;
+  _sniffed = format != IMPORT_FORMAT_UNKNOWN;
+  _startedAt = millis();
+  _lastFeedAt = _startedAt;
+  _heapAtStart = ESP.getFreeHeap();
+  _minFreeHeap = _heapAtStart;
+
+  if (!stationStore.isReady()) {
+    _status = "Station store not ready";
+    return false;
+  }
+  if (!loadHashes()) {
+    _status = "Not enough memory";
+    return false;
+  }
+  sampleHeap();
+  _active = true;
+  _status = "Importing";
+  debugMsgSpff("Import: started, %u stations in the store", (unsigned)_hashCount);
+  return true;
+}
+
+void StationImporter_::reset() {
+  _active = false;
+  _format = IMPORT_FORMAT_UNKNOWN;
+  _bytes = 0;
+  _parsed = 0;
+  _added = 0;
+  _duplicates = 0;
+  _invalid = 0;
+  _failed = 0;
+  _elapsedMs = 0;
+  _peakHeapUsed = 0;
+  _hashBytes = 0;
+  _full = false;
+
+  _sniffed = false;
+  _sniffBracket = false;
+  _bufLen = 0;
+  _bufOverflow = false;
+  clearEntry();
+  _plsEntry = -1;
+  _depth = 0;
+  _objectMask = 0;
+  _inString = false;
+  _escape = false;
+  _unicodeLeft = 0;
+  _expectKey = false;
+  _key[0] = '\0';
+  _recordDepth = 0;
+}
+
+void StationImporter_::clearEntry() {
+  _name[0] = '\0';
+  _url[0] = '\0';
+  _urlResolved = false;
+}
+
+// ************************************************************
+// The next piece of the list
+// ************************************************************
+void StationImporter_::feed(AsyncWebServerRequest *request, const uint8_t *data, size_t len) {
+  if (!_active || request != _owner) {
+    return;
+  }
+  _lastFeedAt = millis();
+  _bytes += len;
+  for (size_t i = 0; i < len; i++) {
+    if (_sniffed) {
+      dispatch((char)data[i]);
+    } else {
+      sniff((char)data[i]);
+    }
+  }
+  sampleHeap();
+}
+
+// ************************************************************
+// End of the list - take what's left in the parser
+// ************************************************************
+void StationImporter_::finish(AsyncWebServerRequest *request) {
+  if (!_active || request != _owner) {
+    return;
+  }
+  if (_format == IMPORT_FORMAT_M3U || _format == IMPORT_FORMAT_PLS) {
+    endLine();
+  }
+  if (_format == IMPORT_FORMAT_PLS && _url[0]) {
+    emit(_name, _url);
+  }
+
+  _elapsedMs = millis() - _startedAt;
+  free(_hashes);
+  _hashes = nullptr;
+  _hashCount = 0;
+  _hashCapacity = 0;
+  _active = false;
+  if (_full) {
+    _status = "Station store full";
+  } else if (_parsed == 0) {
+    _status = "No stations found";
+  } else {
+    _status = "Done";
+  }
+  debugMsgSpff("Import: %u bytes of %s, %u stations, %u added, %u duplicates, %u invalid, %u failed, in %ums, peak heap %u",
+               (unsigned)_bytes, formatName(_format), (unsigned)_parsed, (unsigned)_added, (unsigned)_duplicates,
+               (unsigned)_invalid, (unsigned)_failed, (unsigned)_elapsedMs, (unsigned)_peakHeapUsed);
+}
+
+bool StationImporter_::isRunning() {
+  return _active && millis() - _lastFeedAt < IMPORT_STALE_MS;
+}
+
+void StationImporter_::sampleHeap() {
+  uint32_t freeHeap = ESP.getFreeHeap();
+  if (freeHeap < _minFreeHeap) {
+    _minFreeHeap = freeHeap;
+  }
+  if (freeHeap < _heapAtStart && _heapAtStart - freeHeap > _peakHeapUsed) {
+    _peakHeapUsed = _heapAtStart - freeHeap;
+  }
+}
+
+// ************************************************************
+// Duplicate detection
+// ************************************************************
+static int compareHashes(const void *a, const void *b) {
+  uint32_t x = *(const uint32_t *)a;
+  uint32_t y = *(const uint32_t *)b;
+  return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+bool StationImporter_::loadHashes() {
+  _hashCapacity = stationStore.count() + IMPORT_HASH_STEP;
+  _hashes = (uint32_t *)malloc(_hashCapacity * sizeof(uint32_t));
+  if (!_hashes) {
+    _hashCapacity = 0;
+    return false;
+  }
+  _hashBytes = _hashCapacity * sizeof(uint32_t);
+  _hashCount = stationStore.urlHashes(_hashes, _hashCapacity);
+  qsort(_hashes, _hashCount, sizeof(uint32_t), compareHashes);
+  return true;
+}
+
+// Where hash is, or would go
+bool StationImporter_::findHash(uint32_t hash, uint32_t &pos) {
+  uint32_t lo = 0;
+  uint32_t hi = _hashCount;
+  while (lo < hi) {
+    uint32_t mid = lo + (hi - lo) / 2;
+    if (_hashes[mid] < hash) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  pos = lo;
+  return lo < _hashCount && _hashes[lo] == hash;
+}
+
+void StationImporter_::addHash(uint32_t hash, uint32_t pos) {
+  if (_hashCount == _hashCapacity) {
+    uint32_t *grown = (uint32_t *)realloc(_hashes, (_hashCapacity + IMPORT_HASH_STEP) * sizeof(uint32_t));
+    if (!grown) {
+      // Later duplicates of this one get through, nothing worse
+      return;
+    }
+    _hashes = grown;
+    _hashCapacity += IMPORT_HASH_STEP;
+    _hashBytes = _hashCapacity * sizeof(uint32_t);
+  }
+  memmove(_hashes + pos + 1, _hashes + pos, (_hashCount - pos) * sizeof(uint32_t));
+  _hashes[pos] = hash;
+  _hashCount++;
+}
+
+// ************************************************************
+// One parsed station into the store, unless it's already there
+// ************************************************************
+void StationImporter_::emit(const char *name, const char *url) {
+  _parsed++;
+  if ((strncmp(url, "http://", 7) != 0 && strncmp(url, "https://", 8) != 0) || strlen(url) >= IMPORT_URL_MAX) {
+    _invalid++;
+    return;
+  }
+  if (_full) {
+    _failed++;
+    return;
+  }
+
+  station_t station;
+  station.urls[0] = url;
+  station.urlCount = 1;
+  station.tierCount = 0;
+  uint32_t hash = StreamHealth_::hashUrl(station.urls[0]);
+  uint32_t pos;
+  if (findHash(hash, pos)) {
+    _duplicates++;
+    return;
+  }
+  station.name = name;
+  station.name.trim();
+  if (station.name.length() == 0) {
+    station.name = station.urls[0];
+  }
+
+  if (stationStore.add(station) == STATION_ID_NONE) {
+    debugMsgSpff("Import: store full after %u stations", (unsigned)_added);
+    _failed++;
+    _full = true;
+    return;
+  }
+  _added++;
+  addHash(hash, pos);
+  sampleHeap();
+}
+
+// ************************************************************
+// Format detection from the first characters: '#' or a URL is
+// M3U, '{' JSON, '[' followed by a letter PLS ("[playlist]"),
+// '[' followed by anything else a JSON array
+// ************************************************************
+void StationImporter_::sniff(char c) {
+  // Whitespace and a UTF-8 byte order mark
+  if (isspace((uint8_t)c) || (uint8_t)c >= 0x80) {
+    return;
+  }
+  if (_sniffBracket) {
+    _format = isalpha((uint8_t)c) ? IMPORT_FORMAT_PLS : IMPORT_FORMAT_JSON;
+    _sniffed = true;
+    dispatch('[');
+    dispatch(c);
+    return;
+  }
+  if (c == '[') {
+    _sniffBracket = true;
+    return;
+  }
+  _format = c == '{' ? IMPORT_FORMAT_JSON : IMPORT_FORMAT_M3U;
+  _sniffed = true;
+  dispatch(c);
+}
+
+void StationImporter_::dispatch(char c) {
+  if (_format == IMPORT_FORMAT_JSON) {
+    jsonChar(c);
+  } else {
+    lineChar(c);
+  }
+}
+
+// ************************************************************
+// M3U and PLS - a line at a time
+// ************************************************************
+static char *trim(char *s) {
+  while (isspace((uint8_t)*s)) {
+    s++;
+  }
+  char *end = s + strlen(s);
+  while (end > s && isspace((uint8_t)end[-1])) {
+    *--end = '\0';
+  }
+  return s;
+}
+
+void StationImporter_::lineChar(char c) {
+  if (c == '\n' || c == '\r') {
+    endLine();
+  } else if (_bufLen < IMPORT_LINE_MAX - 1) {
+    _buf[_bufLen++] = c;
+  } else {
+    _bufOverflow = true;
+  }
+}
+
+void StationImporter_::endLine() {
+  if (_bufOverflow) {
+    _invalid++;
+  } else if (_bufLen > 0) {
+    _buf[_bufLen] = '\0';
+    char *line = trim(_buf);
+    if (_format == IMPORT_FORMAT_PLS) {
+      plsLine(line);
+    } else {
+      m3uLine(line);
+    }
+  }
+  _bufLen = 0;
+  _bufOverflow = false;
+}
+
+void StationImporter_::m3uLine(char *line) {
+  if (strncmp(line, "#EXTINF:", 8) == 0) {
+    // The title follows the first comma that isn't inside a quoted attribute
+    bool quoted = false;
+    for (char *p = line + 8; *p; p++) {
+      if (*p == '"') {
+        quoted = !quoted;
+      } else if (*p == ',' && !quoted) {
+        strlcpy(_name, trim(p + 1), IMPORT_NAME_MAX);
+        break;
+      }
+    }
+    return;
+  }
+  if (line[0] == '#' || line[0] == '\0') {
+    return;
+  }
+  emit(_name, line);
+  _name[0] = '\0';
+}
+
+void StationImporter_::plsLine(char *line) {
+  char *eq = strchr(line, '=');
+  if (!eq) {
+    return;
+  }
+  *eq = '\0';
+  char *value = trim(eq + 1);
+  bool isFile = strncasecmp(line, "file", 4) == 0 && isdigit((uint8_t)line[4]);
+  bool isTitle = strncasecmp(line, "title", 5) == 0 && isdigit((uint8_t)line[5]);
+  if (!isFile && !isTitle) {
+    return;
+  }
+
+  int entry = atoi(line + (isFile ? 4 : 5));
+  if (entry != _plsEntry) {
+    if (_url[0]) {
+      emit(_name, _url);
+    }
+    clearEntry();
+    _plsEntry = entry;
+  }
+  if (isTitle) {
+    strlcpy(_name, value, IMPORT_NAME_MAX);
+  } else if (strlen(value) < IMPORT_URL_MAX) {
+    strlcpy(_url, value, IMPORT_URL_MAX);
+  } else {
+    // Too long to keep - emit() turns this down as invalid
+    strlcpy(_url, "-", IMPORT_URL_MAX);
+  }
+}
+
+// ************************************************************
+// JSON - a tokenizer that only keeps the string being read and
+// the name and URL of the innermost object that has them
+// ************************************************************
+static bool inObject(uint8_t depth, uint32_t mask) {
+  return depth > 0 && depth <= IMPORT_JSON_DEPTH && ((mask >> (depth - 1)) & 1);
+}
+
+static uint8_t hexValue(char c) {
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  return 0;
+}
+
+void StationImporter_::jsonChar(char c) {
+  if (_inString) {
+    if (_unicodeLeft) {
+      _unicode = (_unicode << 4) | hexValue(c);
+      if (--_unicodeLeft == 0) {
+        if (_unicode < 0x80) {
+          jsonAppend((char)_unicode);
+        } else if (_unicode < 0x800) {
+          jsonAppend((char)(0xC0 | (_unicode >> 6)));
+          jsonAppend((char)(0x80 | (_unicode & 0x3F)));
+        } else if (_unicode >= 0xD800 && _unicode <= 0xDFFF) {
+          // Half of a surrogate pair - not worth joining up for a name
+          jsonAppend('?');
+        } else {
+          jsonAppend((char)(0xE0 | (_unicode >> 12)));
+          jsonAppend((char)(0x80 | ((_unicode >> 6) & 0x3F)));
+          jsonAppend((char)(0x80 | (_unicode & 0x3F)));
+        }
+      }
+    } else if (_escape) {
+      _escape = false;
+      switch (c) {
+        case 'n': jsonAppend('\n'); break;
+        case 't': jsonAppend('\t'); break;
+        case 'r': jsonAppend('\r'); break;
+        case 'b': case 'f': break;
+        case 'u': _unicodeLeft = 4; _unicode = 0; break;
+        default: jsonAppend(c); break;
+      }
+    } else if (c == '\\') {
+      _escape = true;
+    } else if (c == '"') {
+      _inString = false;
+      jsonString();
+    } else {
+      jsonAppend(c);
+    }
+    return;
+  }
+
+  switch (c) {
+    case '"':
+      _inString = true;
+      _bufLen = 0;
+      _bufOverflow = false;
+      break;
+    case '{':
+    case '[':
+      if (_depth < IMPORT_JSON_DEPTH) {
+        if (c == '{') {
+          _objectMask |= 1UL << _depth;
+        } else {
+          _objectMask &= ~(1UL << _depth);
+        }
+      }
+      if (_depth < 255) {
+        _depth++;
+      }
+      _expectKey = c == '{';
+      break;
+    case '}':
+    case ']':
+      if (c == '}' && _recordDepth != 0 && _depth == _recordDepth) {
+        if (_name[0] && _url[0]) {
+          emit(_name, _url);
+        }
+        clearEntry();
+        _recordDepth = 0;
+      }
+      if (_depth > 0) {
+        _depth--;
+      }
+      _expectKey = false;
+      break;
+    case ',':
+      _expectKey = inObject(_depth, _objectMask);
+      break;
+    case ':':
+      _expectKey = false;
+      break;
+    default:
+      // Whitespace, numbers, true, false and null
+      break;
+  }
+}
+
+void StationImporter_::jsonAppend(char c) {
+  if (_bufLen < IMPORT_LINE_MAX - 1) {
+    _buf[_bufLen++] = c;
+  } else {
+    _bufOverflow = true;
+  }
+}
+
+void StationImporter_::jsonString() {
+  _buf[_bufLen] = '\0';
+  if (_expectKey) {
+    strlcpy(_key, _bufLen < IMPORT_KEY_MAX ? _buf : "", IMPORT_KEY_MAX);
+    return;
+  }
+  if (!inObject(_depth, _objectMask) || (_recordDepth != 0 && _depth != _recordDepth)) {
+    return;
+  }
+
+  bool resolved = strcmp(_key, "url_resolved") == 0;
+  if (strcmp(_key, "name") == 0) {
+    strlcpy(_name, _buf, IMPORT_NAME_MAX);
+    _recordDepth = _depth;
+  } else if ((resolved && _bufLen > 0) || (strcmp(_key, "url") == 0 && !_urlResolved)) {
+    // radio-browser.info's url is often a playlist, url_resolved the stream itself
+    if (_bufOverflow || _bufLen >= IMPORT_URL_MAX) {
+      strlcpy(_url, "-", IMPORT_URL_MAX);
+    } else {
+      strlcpy(_url, _buf, IMPORT_URL_MAX);
+    }
+    _urlResolved = resolved;
+    _recordDepth = _depth;
+  }
+}
+
+// ************************************************************
+// Formats
+// ************************************************************
+ImportFormat StationImporter_::formatFor(const String &name) {
+  String lower = name;
+  lower.toLowerCase();
+  if (lower == "m3u" || lower.endsWith(".m3u") || lower.endsWith(".m3u8")) {
+    return IMPORT_FORMAT_M3U;
+  }
+  if (lower == "pls" || lower.endsWith(".pls")) {
+    return IMPORT_FORMAT_PLS;
+  }
+  if (lower == "json" || lower.endsWith(".json")) {
+    return IMPORT_FORMAT_JSON;
+  }
+  return IMPORT_FORMAT_UNKNOWN;
+}
+
+const char *StationImporter_::formatName(ImportFormat format) {
+  switch (format) {
+    case IMPORT_FORMAT_M3U: return "m3u";
+    case IMPORT_FORMAT_PLS: return "pls";
+    case IMPORT_FORMAT_JSON: return "json";
+    default: return "unknown";
+  }
+}
+
+// ************************************************************
+// Status and results. The rate is stations parsed per second,
+// duplicates included; peak heap is the most the import took
+// over what was free when it started.
+// ************************************************************
+void StationImporter_::writeJson(JsonStreamWriter &json) {
+  uint32_t elapsedMs = _active ? millis() - _startedAt : _elapsedMs;
+  json.add("status", _status);
+  json.add("running", _active);
+  json.add("format", formatName(_format));
+  json.add("bytes", _bytes);
+  json.add("stations", _parsed);
+  json.add("added", _added);
+  json.add("duplicates", _duplicates);
+  json.add("invalid", _invalid);
+  json.add("failed", _failed);
+  json.add("ms", elapsedMs);
+  json.key("rate").value(elapsedMs ? _parsed * 1000.0 / elapsedMs : 0.0, 1);
+  json.add("peakheap", _peakHeapUsed);
+  json.add("minfreeheap", _minFreeHeap);
+  json.add("hashbytes", _hashBytes);
+}
+
+// ************************************************************
+// Library internal singleton wiring
+// ************************************************************
+StationImporter_ &StationImporter_::getInstance() {
+  static StationImporter_ instance;
+  return instance;
+}
+
+StationImporter_ &stationImporter = stationImporter.getInstance();
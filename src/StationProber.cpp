@@ -0,0 +1,498 @@
+#include "StationProber.h"
+#include "Globals.h"
+#include "DebugManager.h"
+#include "Metrics.h"
+#include "RadioOutputManager.h"
+#include "StationResolver.h"
+#include "StreamHealth.h"
+#include "AudioFileSourceRadioStream.h"
+#include "AudioFileSourceSplicer.h"
+
+// ************************************************************
+// Start the background task
+// ************************************************************
+void StationProber_::begin() {
+  _lock = xSemaphoreCreateMutex();
+  xTaskCreatePinnedToCore(proberTask, "probe", PROBER_TASK_STACK, this, 1, &_task, 0);
+}
+
+// ************************************************************
+// One probe at a time, when the budget allows
+// ************************************************************
+void StationProber_::proberTask(void *param) {
+  StationProber_ *self = static_cast<StationProber_ *>(param);
+  for (;;) {
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(PROBER_GAP_MS));
+    if (millis() < PROBER_START_DELAY_MS || !WiFi.isConnected() || !self->mayProbe()) {
+      continue;
+    }
+    String url;
+    if (self->pickNext(url) >= 0) {
+      self->probe(url);
+      self->_lastProbeAt = millis();
+    }
+  }
+}
+
+// ************************************************************
+// Nudge the task
+// ************************************************************
+void StationProber_::wake() {
+  if (_task) {
+    xTaskNotifyGive(_task);
+  }
+}
+
+// ************************************************************
+// What the player is doing, once a second
+// ************************************************************
+void StationProber_::notePlayback(bool playing, bool busy, uint32_t bufferedMs) {
+  _playing = playing;
+  _busy = busy;
+  _bufferedMs = bufferedMs;
+}
+
+// ************************************************************
+// Would a probe now get in the way of playback?
+// ************************************************************
+bool StationProber_::mayProbe() {
+  uint32_t now = millis();
+  if (_lastProbeAt != 0 && now - _lastProbeAt < PROBER_GAP_MS) {
+    return false;
+  }
+  if (_busy) {
+    return false;
+  }
+  if (radioOutputManager.isPlaying() && !_playing) {
+    // Playing, but notePlayback() hasn't said so yet - with no buffer reading, wait for one
+    _playing = true;
+    _bufferedMs = 0;
+  }
+  if (!_playing) {
+    return true;
+  }
+  if (_bufferedMs < PROBER_MIN_BUFFER_MS) {
+    return false;
+  }
+  if (_budgetSince == 0 || now - _budgetSince >= 3600000UL) {
+    _budgetSince = now;
+    _budgetUsed = 0;
+  }
+  return _budgetUsed + PROBER_READ_BYTES <= PROBER_PLAYING_BYTES_PER_HOUR;
+}
+
+// ************************************************************
+// Result index for a URL, -1 if there isn't one. Call with
+// the lock.
+// ************************************************************
+int StationProber_::findResult(const String &url) {
+  for (int i = 0; i < PROBER_TABLE_SIZE; i++) {
+    if (_results[i].url.length() > 0 && _results[i].url == url) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+// ************************************************************
+// Take a free slot, or one nobody wants any more. Call with
+// the lock.
+// ************************************************************
+int StationProber_::addResult(const String &url) {
+  int slot = -1;
+  for (int i = 0; i < PROBER_TABLE_SIZE; i++) {
+    if (_results[i].url.length() == 0) {
+      slot = i;
+      break;
+    }
+    if (!_results[i].wanted && slot < 0) {
+      slot = i;
+    }
+  }
+  if (slot >= 0) {
+    probe_result_t &result = _results[slot];
+    result.url = url;
+    result.wanted = true;
+    result.state = PROBE_STATE_UNKNOWN;
+    result.codec = PROBE_CODEC_UNKNOWN;
+    result.status = -1;
+    result.kbps = 0;
+    result.connectMs = 0;
+    result.firstAudioMs = 0;
+    result.bytes = 0;
+    result.probedAt = 0;
+  }
+  return slot;
+}
+
+// ************************************************************
+// Mark a URL as one the station list uses. Call with the lock.
+// ************************************************************
+void StationProber_::want(const String &url) {
+  int idx = findResult(url);
+  if (idx < 0) {
+    idx = addResult(url);
+  }
+  if (idx >= 0) {
+    _results[idx].wanted = true;
+  }
+}
+
+// ************************************************************
+// Line the table up with the station list
+// ************************************************************
+void StationProber_::refresh() {
+  if (!_lock) {
+    return;
+  }
+  xSemaphoreTake(_lock, portMAX_DELAY);
+  for (int i = 0; i < PROBER_TABLE_SIZE; i++) {
+    _results[i].wanted = false;
+  }
+  for (int i = 0; i < stationCount; i++) {
+    for (int u = 0; u < stations[i].urlCount; u++) {
+      want(stations[i].urls[u]);
+    }
+    for (int t = 0; t < stations[i].tierCount; t++) {
+      want(stations[i].tierUrls[t]);
+    }
+  }
+  xSemaphoreGive(_lock);
+  _changed = true;
+  wake();
+}
+
+// ************************************************************
+// The URL never probed, or probed longest ago, if it's due
+// ************************************************************
+int StationProber_::pickNext(String &url) {
+  uint32_t now = millis();
+  int pick = -1;
+  xSemaphoreTake(_lock, portMAX_DELAY);
+  for (int i = 0; i < PROBER_TABLE_SIZE; i++) {
+    const probe_result_t &result = _results[i];
+    if (result.url.length() == 0 || !result.wanted) {
+      continue;
+    }
+    if (result.probedAt != 0 && now - result.probedAt < PROBER_INTERVAL_MS) {
+      continue;
+    }
+    if (pick < 0 || result.probedAt == 0 ||
+        (_results[pick].probedAt != 0 && result.probedAt < _results[pick].probedAt)) {
+      pick = i;
+      if (result.probedAt == 0) {
+        break;
+      }
+    }
+  }
+  if (pick >= 0) {
+    url = _results[pick].url;
+  }
+  xSemaphoreGive(_lock);
+  return pick;
+}
+
+// ************************************************************
+// Open a URL the way the player would, read a few frames and
+// close it again
+// ************************************************************
+void StationProber_::probe(const String &url) {
+  AudioFileSourceRadioStream *stream = new AudioFileSourceRadioStream();
+  stream->setTimeouts(PROBER_CONNECT_TIMEOUT_MS, PROBER_READ_TIMEOUT_MS);
+  String target = url;
+  String finalUrl;
+  IPAddress ip;
+  if (stationResolver.lookup(url, finalUrl, ip, false)) {
+    target = finalUrl;
+    stream->setAddress(ip);
+  }
+
+  uint32_t start = millis();
+  bool opened = stream->open(target.c_str());
+  uint32_t connectMs = millis() - start;
+
+  ProbeCodec codec = PROBE_CODEC_UNKNOWN;
+  uint16_t kbps = 0;
+  uint8_t frames = 0;
+  uint32_t got = 0;
+  uint32_t firstAudioMs = 0;
+  uint8_t *data = nullptr;
+  if (opened) {
+    codec = codecFor(stream->getContentType());
+    kbps = stream->getIcyBitrate();
+    // Only MP3 is worth reading - it's all we decode
+    if (codec == PROBE_CODEC_MP3 || codec == PROBE_CODEC_UNKNOWN) {
+      data = (uint8_t *)malloc(PROBER_READ_BYTES);
+    }
+  }
+  if (data) {
+    while (got < PROBER_READ_BYTES && stream->isOpen()) {
+      uint32_t n = stream->read(data + got, PROBER_READ_BYTES - got);
+      if (n == 0) {
+        break;
+      }
+      got += n;
+      uint16_t frameKbps = 0;
+      frames = countFrames(data, got, frameKbps);
+      if (frames >= PROBER_FRAMES) {
+        firstAudioMs = millis() - start;
+        codec = PROBE_CODEC_MP3;
+        kbps = frameKbps;
+        break;
+      }
+    }
+    free(data);
+  }
+  stream->close();
+  int status = stream->getStatus();
+  delete stream;
+
+  ProbeState state;
+  if (frames >= PROBER_FRAMES) {
+    state = PROBE_STATE_OK;
+  } else if (opened && codec != PROBE_CODEC_MP3 && codec != PROBE_CODEC_UNKNOWN) {
+    state = PROBE_STATE_UNSUPPORTED;
+  } else {
+    state = PROBE_STATE_DEAD;
+  }
+
+  metrics.inc(METRIC_PROBES);
+  if (state == PROBE_STATE_OK) {
+    metrics.observe(METRIC_PROBE_FIRST_AUDIO_MS, firstAudioMs);
+  } else {
+    metrics.inc(METRIC_PROBE_FAILURES);
+  }
+  uint32_t hash = StreamHealth_::hashUrl(url);
+  streamHealth.noteConnect(hash, opened, connectMs);
+  if (state == PROBE_STATE_OK) {
+    streamHealth.noteFirstAudio(hash, firstAudioMs);
+  }
+  if (_playing) {
+    _budgetUsed += got;
+  }
+  debugMsgUtlf("Probed %s: %s, status %d, %s %ukbps, connect %ums, first audio %ums, %u bytes", url.c_str(),
+               stateName(state), status, codecName(codec), (unsigned)kbps, (unsigned)connectMs,
+               (unsigned)firstAudioMs, (unsigned)got);
+
+  // The list may have changed while we were out
+  xSemaphoreTake(_lock, portMAX_DELAY);
+  int idx = findResult(url);
+  if (idx >= 0) {
+    probe_result_t &result = _results[idx];
+    if (result.state != state) {
+      _changed = true;
+    }
+    result.state = state;
+    result.codec = codec;
+    result.status = status;
+    result.kbps = kbps;
+    result.connectMs = opened ? connectMs : 0;
+    result.firstAudioMs = firstAudioMs;
+    result.bytes = got;
+    result.probedAt = millis();
+    if (result.probedAt == 0) {
+      result.probedAt = 1;
+    }
+  }
+  xSemaphoreGive(_lock);
+}
+
+// ************************************************************
+// Codec from a Content-Type, ignoring any parameters
+// ************************************************************
+ProbeCodec StationProber_::codecFor(const String &contentType) {
+  if (contentType.length() == 0 || contentType.startsWith("application/octet-stream")) {
+    return PROBE_CODEC_UNKNOWN;
+  }
+  if (contentType.startsWith("audio/mpeg") || contentType.startsWith("audio/mp3") || contentType.startsWith("audio/x-mpeg")) {
+    return PROBE_CODEC_MP3;
+  }
+  if (contentType.indexOf("aac") >= 0 || contentType.startsWith("audio/mp4")) {
+    return PROBE_CODEC_AAC;
+  }
+  if (contentType.indexOf("ogg") >= 0 || contentType.indexOf("opus") >= 0) {
+    return PROBE_CODEC_OGG;
+  }
+  return PROBE_CODEC_OTHER;
+}
+
+// ************************************************************
+// Longest run of back to back MP3 frames, up to PROBER_FRAMES,
+// from the first header that starts one. kbps is that
+// header's bitrate.
+// ************************************************************
+uint8_t StationProber_::countFrames(const uint8_t *data, uint32_t len, uint16_t &kbps) {
+  uint8_t best = 0;
+  for (uint32_t i = 0; i + 4 <= len; i++) {
+    uint32_t pos = i;
+    uint8_t frames = 0;
+    uint16_t firstKbps = 0;
+    while (pos + 4 <= len && frames < PROBER_FRAMES) {
+      uint32_t header = ((uint32_t)data[pos] << 24) | ((uint32_t)data[pos + 1] << 16) | ((uint32_t)data[pos + 2] << 8) | data[pos + 3];
+      uint16_t frameKbps = 0;
+      uint32_t length = AudioFileSourceSplicer::frameLength(header, &frameKbps);
+      if (length <= 4) {
+        break;
+      }
+      if (frames == 0) {
+        firstKbps = frameKbps;
+      }
+      frames++;
+      pos += length;
+    }
+    if (frames > best) {
+      best = frames;
+      kbps = firstKbps;
+      if (best >= PROBER_FRAMES) {
+        break;
+      }
+    }
+  }
+  return best;
+}
+
+// ************************************************************
+// Index of the station's best result: OK beats unsupported
+// beats dead beats unknown, then the primary URL first. -1 if
+// none of its URLs are in the table.
+// ************************************************************
+int StationProber_::bestResult(int stationIdx) {
+  static const uint8_t RANK[] = {1, 4, 3, 2};   // by ProbeState
+  const station_t &station = stations[stationIdx];
+  int best = -1;
+  for (int u = 0; u < station.urlCount + station.tierCount; u++) {
+    const String &url = (u < station.urlCount) ? station.urls[u] : station.tierUrls[u - station.urlCount];
+    int idx = findResult(url);
+    if (idx >= 0 && (best < 0 || RANK[_results[idx].state] > RANK[_results[best].state])) {
+      best = idx;
+    }
+  }
+  return best;
+}
+
+// ************************************************************
+// What the prober thinks of a station
+// ************************************************************
+ProbeState StationProber_::stationState(int stationIdx) {
+  if (!_lock || stationIdx < 0 || stationIdx >= stationCount) {
+    return PROBE_STATE_UNKNOWN;
+  }
+  xSemaphoreTake(_lock, portMAX_DELAY);
+  int best = bestResult(stationIdx);
+  ProbeState state = (best >= 0) ? _results[best].state : PROBE_STATE_UNKNOWN;
+  xSemaphoreGive(_lock);
+  return state;
+}
+
+// ************************************************************
+// Has anything changed since the last call?
+// ************************************************************
+bool StationProber_::takeChanged() {
+  bool changed = _changed;
+  _changed = false;
+  return changed;
+}
+
+const char *StationProber_::stateName(ProbeState state) {
+  switch (state) {
+    case PROBE_STATE_UNKNOWN:     return "unknown";
+    case PROBE_STATE_OK:          return "ok";
+    case PROBE_STATE_UNSUPPORTED: return "unsupported";
+    case PROBE_STATE_DEAD:        return "dead";
+  }
+  return "?";
+}
+
+const char *StationProber_::codecName(ProbeCodec codec) {
+  switch (codec) {
+    case PROBE_CODEC_UNKNOWN: return "unknown";
+    case PROBE_CODEC_MP3:     return "mp3";
+    case PROBE_CODEC_AAC:     return "aac";
+    case PROBE_CODEC_OGG:     return "ogg";
+    case PROBE_CODEC_OTHER:   return "other";
+  }
+  return "?";
+}
+
+void StationProber_::writeResult(JsonStreamWriter &json, const probe_result_t &result, uint32_t now) {
+  json.beginObject();
+  json.add("url", result.url);
+  json.add("state", stateName(result.state));
+  json.add("codec", codecName(result.codec));
+  json.add("status", (int)result.status);
+  json.add("kbps", (unsigned)result.kbps);
+  json.add("connectms", result.connectMs);
+  json.add("firstaudioms", result.firstAudioMs);
+  json.add("bytes", result.bytes);
+  json.key("age");
+  if (result.probedAt) {
+    json.value((unsigned long)((now - result.probedAt) / 1000));
+  } else {
+    json.nullValue();
+  }
+  json.endObject();
+}
+
+// ************************************************************
+// A station's state and best result, for /api/stations
+// ************************************************************
+void StationProber_::writeStationJson(JsonStreamWriter &json, int stationIdx) {
+  probe_result_t result;
+  bool have = false;
+  if (_lock) {
+    xSemaphoreTake(_lock, portMAX_DELAY);
+    int best = bestResult(stationIdx);
+    if (best >= 0 && _results[best].probedAt != 0) {
+      result = _results[best];
+      have = true;
+    }
+    xSemaphoreGive(_lock);
+  }
+  json.add("status", stateName(have ? result.state : PROBE_STATE_UNKNOWN));
+  json.key("probe");
+  if (have) {
+    writeResult(json, result, millis());
+  } else {
+    json.nullValue();
+  }
+}
+
+// ************************************************************
+// Budget and every result, for /api/probe
+// ************************************************************
+void StationProber_::writeJson(JsonStreamWriter &json) {
+  json.beginObject();
+  json.add("probes", (long)metrics.get(METRIC_PROBES));
+  json.add("failures", (long)metrics.get(METRIC_PROBE_FAILURES));
+  json.add("playing", (bool)_playing);
+  json.add("bufferedms", (uint32_t)_bufferedMs);
+  json.add("budgetused", _budgetUsed);
+  json.add("budget", (uint32_t)PROBER_PLAYING_BYTES_PER_HOUR);
+
+  json.key("results").beginArray();
+  if (_lock) {
+    uint32_t now = millis();
+    for (int i = 0; i < PROBER_TABLE_SIZE; i++) {
+      xSemaphoreTake(_lock, portMAX_DELAY);
+      probe_result_t result = _results[i];
+      xSemaphoreGive(_lock);
+      if (result.url.length() == 0 || !result.wanted) {
+        continue;
+      }
+      writeResult(json, result, now);
+    }
+  }
+  json.endArray();
+
+  json.endObject();
+}
+
+// ************************************************************
+// Library internal singleton wiring
+// ************************************************************
+StationProber_ &StationProber_::getInstance() {
+  static StationProber_ instance;
+  return instance;
+}
+
+StationProber_ &stationProber = stationProber.getInstance();
@@ -0,0 +1,478 @@
+#include "StationResolver.h"
+#include "Globals.h"
+#include "DebugManager.h"
+#include "Metrics.h"
+#include "AudioFileSourceRadioStream.h"
+
+// ************************************************************
+// Start the background task
+// ************************************************************
+void StationResolver_::begin() {
+  _lock = xSemaphoreCreateMutex();
+  xTaskCreatePinnedToCore(resolverTask, "resolve", RESOLVER_TASK_STACK, this, 1, &_task, 0);
+}
+
+// ************************************************************
+// Wait for work; resolve anything stale while WiFi is up
+// ************************************************************
+void StationResolver_::resolverTask(void *param) {
+  StationResolver_ *self = static_cast<StationResolver_ *>(param);
+  for (;;) {
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(RESOLVER_CHECK_MS));
+    if (WiFi.isConnected()) {
+      self->resolveStale();
+    }
+  }
+}
+
+// ************************************************************
+// Nudge the task
+// ************************************************************
+void StationResolver_::wake() {
+  if (_task) {
+    xTaskNotifyGive(_task);
+  }
+}
+
+// ************************************************************
+// Entry index for a URL, -1 if not cached. Call with the lock.
+// ************************************************************
+int StationResolver_::findEntry(const String &url) {
+  for (int i = 0; i < RESOLVER_CACHE_SIZE; i++) {
+    if (_entries[i].url.length() > 0 && _entries[i].url == url) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+// ************************************************************
+// Take a free slot, or the oldest one nobody wants any more.
+// Call with the lock.
+// ************************************************************
+int StationResolver_::addEntry(const String &url) {
+  int slot = -1;
+  for (int i = 0; i < RESOLVER_CACHE_SIZE; i++) {
+    if (_entries[i].url.length() == 0) {
+      slot = i;
+      break;
+    }
+    if (!_entries[i].wanted && (slot < 0 || _entries[i].attemptedAt < _entries[slot].attemptedAt)) {
+      slot = i;
+    }
+  }
+  if (slot >= 0) {
+    resolver_entry_t &entry = _entries[slot];
+    entry.url = url;
+    entry.finalUrl = "";
+    entry.ip = IPAddress();
+    entry.resolvedAt = 0;
+    entry.resolveMs = 0;
+    entry.hops = 0;
+    entry.attemptedAt = 0;
+    entry.valid = false;
+    entry.wanted = true;
+    entry.urgent = false;
+  }
+  return slot;
+}
+
+// ************************************************************
+// Mark a URL as one the station list uses, adding it if it's
+// new. Call with the lock.
+// ************************************************************
+void StationResolver_::want(const String &url) {
+  int idx = findEntry(url);
+  if (idx < 0) {
+    idx = addEntry(url);
+  }
+  if (idx >= 0) {
+    _entries[idx].wanted = true;
+  }
+}
+
+// ************************************************************
+// Line the cache up with the station list
+// ************************************************************
+void StationResolver_::refresh() {
+  if (!_lock) {
+    return;
+  }
+  xSemaphoreTake(_lock, portMAX_DELAY);
+  for (int i = 0; i < RESOLVER_CACHE_SIZE; i++) {
+    _entries[i].wanted = false;
+  }
+  for (int i = 0; i < stationCount; i++) {
+    for (int u = 0; u < stations[i].urlCount; u++) {
+      want(stations[i].urls[u]);
+    }
+    for (int t = 0; t < stations[i].tierCount; t++) {
+      want(stations[i].tierUrls[t]);
+    }
+  }
+  xSemaphoreGive(_lock);
+  wake();
+}
+
+// ************************************************************
+// Look up a URL for playing. A miss queues it for resolving.
+// ************************************************************
+bool StationResolver_::lookup(const String &url, String &finalUrl, IPAddress &ip, bool count) {
+  if (!_lock) {
+    return false;
+  }
+  bool hit = false;
+  uint32_t savedMs = 0;
+  xSemaphoreTake(_lock, portMAX_DELAY);
+  int idx = findEntry(url);
+  if (idx >= 0 && _entries[idx].valid && millis() - _entries[idx].resolvedAt < RESOLVER_TTL_MS) {
+    finalUrl = _entries[idx].finalUrl;
+    ip = _entries[idx].ip;
+    savedMs = _entries[idx].resolveMs;
+    hit = true;
+  } else if (idx < 0) {
+    addEntry(url);
+  }
+  xSemaphoreGive(_lock);
+
+  if (count) {
+    if (hit) {
+      metrics.inc(METRIC_RESOLVER_HITS);
+      metrics.inc(METRIC_RESOLVER_SAVED_MS, savedMs);
+    } else {
+      metrics.inc(METRIC_RESOLVER_MISSES);
+    }
+  }
+  if (!hit) {
+    wake();
+  }
+  return hit;
+}
+
+// ************************************************************
+// Put a URL at the front of the queue
+// ************************************************************
+void StationResolver_::resolveNow(const String &url) {
+  if (!_lock) {
+    return;
+  }
+  xSemaphoreTake(_lock, portMAX_DELAY);
+  int idx = findEntry(url);
+  if (idx < 0) {
+    idx = addEntry(url);
+  }
+  if (idx >= 0) {
+    _entries[idx].urgent = true;
+  }
+  xSemaphoreGive(_lock);
+  wake();
+}
+
+// ************************************************************
+// Has a waiting URL been dealt with (either way)?
+// ************************************************************
+bool StationResolver_::isResolved(const String &url) {
+  if (!_lock) {
+    return true;
+  }
+  xSemaphoreTake(_lock, portMAX_DELAY);
+  int idx = findEntry(url);
+  bool done = (idx < 0) || !_entries[idx].urgent;
+  xSemaphoreGive(_lock);
+  return done;
+}
+
+// ************************************************************
+// Forget where a URL led
+// ************************************************************
+void StationResolver_::invalidate(const String &url) {
+  if (!_lock) {
+    return;
+  }
+  xSemaphoreTake(_lock, portMAX_DELAY);
+  int idx = findEntry(url);
+  if (idx >= 0) {
+    _entries[idx].valid = false;
+    _entries[idx].attemptedAt = 0;
+  }
+  xSemaphoreGive(_lock);
+}
+
+// ************************************************************
+// .pls or .m3u, ignoring any query string
+// ************************************************************
+bool StationResolver_::looksLikePlaylist(const String &url) {
+  String path = url;
+  int query = path.indexOf('?');
+  if (query >= 0) {
+    path = path.substring(0, query);
+  }
+  path.toLowerCase();
+  return path.endsWith(".pls") || path.endsWith(".m3u");
+}
+
+// ************************************************************
+// Work through the entries that need resolving, urgent ones
+// first. The lock is only held to pick an entry and to store
+// the result - never over the network.
+// ************************************************************
+void StationResolver_::resolveStale() {
+  for (;;) {
+    String url;
+    uint32_t now = millis();
+
+    xSemaphoreTake(_lock, portMAX_DELAY);
+    int pick = -1;
+    for (int i = 0; i < RESOLVER_CACHE_SIZE; i++) {
+      resolver_entry_t &entry = _entries[i];
+      if (entry.url.length() == 0 || !(entry.wanted || entry.urgent)) {
+        continue;
+      }
+      bool stale = !entry.valid || now - entry.resolvedAt >= RESOLVER_TTL_MS;
+      bool due = entry.attemptedAt == 0 || now - entry.attemptedAt >= RESOLVER_CHECK_MS;
+      if (entry.urgent || (stale && due)) {
+        pick = i;
+        if (entry.urgent) {
+          break;
+        }
+      }
+    }
+    if (pick >= 0) {
+      url = _entries[pick].url;
+      _entries[pick].attemptedAt = now;
+    }
+    xSemaphoreGive(_lock);
+
+    if (pick < 0) {
+      return;
+    }
+
+    String finalUrl;
+    IPAddress ip;
+    uint8_t hops = 0;
+    uint32_t savedMs = 0;
+    uint32_t start = millis();
+    bool ok = resolveUrl(url, finalUrl, ip, hops, savedMs);
+    metrics.observe(METRIC_RESOLVER_RESOLVE_MS, millis() - start);
+    if (!ok) {
+      metrics.inc(METRIC_RESOLVER_FAILURES);
+    }
+    debugMsgUtlf("Resolved %s -> %s (%s, %u hops, %ums) %s", url.c_str(), finalUrl.c_str(), ip.toString().c_str(),
+                 (unsigned)hops, (unsigned)savedMs, ok ? "ok" : "failed");
+
+    xSemaphoreTake(_lock, portMAX_DELAY);
+    int idx = findEntry(url);
+    if (idx >= 0) {
+      resolver_entry_t &entry = _entries[idx];
+      entry.urgent = false;
+      entry.valid = ok;
+      if (ok) {
+        entry.finalUrl = finalUrl;
+        entry.ip = ip;
+        entry.hops = hops;
+        entry.resolveMs = savedMs;
+        entry.resolvedAt = millis();
+      }
+    }
+    xSemaphoreGive(_lock);
+  }
+}
+
+// ************************************************************
+// Follow url to the stream. savedMs is the part a cache hit
+// avoids: the DNS lookups and every request except the last,
+// which the player makes anyway.
+// ************************************************************
+bool StationResolver_::resolveUrl(const String &url, String &finalUrl, IPAddress &ip, uint8_t &hops, uint32_t &savedMs) {
+  String current = url;
+  hops = 0;
+  savedMs = 0;
+
+  for (;;) {
+    bool secure = current.startsWith("https://");
+    if (!secure && !current.startsWith("http://")) {
+      return false;
+    }
+    int hostStart = secure ? 8 : 7;
+    int hostEnd = hostStart;
+    while (hostEnd < (int)current.length() && current[hostEnd] != '/' && current[hostEnd] != ':' && current[hostEnd] != '?') {
+      hostEnd++;
+    }
+    String host = current.substring(hostStart, hostEnd);
+
+    uint32_t t = millis();
+    if (!WiFi.hostByName(host.c_str(), ip)) {
+      return false;
+    }
+    savedMs += millis() - t;
+
+    if (secure || hops >= RESOLVER_MAX_HOPS) {
+      // We can't look inside TLS here; take it as the stream
+      finalUrl = current;
+      return true;
+    }
+
+    t = millis();
+    WiFiClient client;
+    HTTPClient http;
+    http.setConnectTimeout(RESOLVER_HTTP_TIMEOUT_MS);
+    http.setTimeout(RESOLVER_HTTP_TIMEOUT_MS);
+    http.setFollowRedirects(HTTPC_DISABLE_FOLLOW_REDIRECTS);
+    const char* headers[] = {"Location", "Content-Type"};
+    http.collectHeaders(headers, 2);
+    if (!http.begin(client, current)) {
+      return false;
+    }
+    int code = http.GET();
+
+    if (code == 301 || code == 302 || code == 303 || code == 307 || code == 308) {
+      String location = http.header("Location");
+      http.end();
+      if (location.length() == 0) {
+        return false;
+      }
+      savedMs += millis() - t;
+      // Resolved the same way the player does, so the cached URL is the one it would reach
+      current = AudioFileSourceRadioStream::resolveLocation(current, location);
+      hops++;
+      continue;
+    }
+
+    if (code == 200) {
+      String type = http.header("Content-Type");
+      type.toLowerCase();
+      if (type.indexOf("scpls") >= 0 || type.indexOf("mpegurl") >= 0 || looksLikePlaylist(current)) {
+        String entry;
+        bool found = readPlaylistEntry(http, entry);
+        http.end();
+        if (!found) {
+          return false;
+        }
+        savedMs += millis() - t;
+        current = entry;
+        hops++;
+        continue;
+      }
+    }
+    http.end();
+
+    // Anything else the server is willing to talk about is the stream - including SHOUTcast's
+    // "ICY 200 OK", which HTTPClient reports as "not an HTTP server"
+    if ((code < 0 && code != HTTPC_ERROR_NO_HTTP_SERVER) || code >= 400) {
+      return false;
+    }
+    finalUrl = current;
+    return true;
+  }
+}
+
+// ************************************************************
+// First stream URL in a .pls (FileN=) or .m3u (bare URL) body.
+// Reads at most RESOLVER_PLAYLIST_MAX_BYTES, in case what we
+// were told is a playlist is really the stream.
+// ************************************************************
+bool StationResolver_::readPlaylistEntry(HTTPClient &http, String &entry) {
+  WiFiClient *stream = http.getStreamPtr();
+  String line;
+  uint32_t read = 0;
+  uint32_t start = millis();
+
+  while (read < RESOLVER_PLAYLIST_MAX_BYTES && millis() - start < RESOLVER_HTTP_TIMEOUT_MS) {
+    if (!stream->available()) {
+      if (!stream->connected()) {
+        break;
+      }
+      vTaskDelay(pdMS_TO_TICKS(10));
+      continue;
+    }
+    char c = stream->read();
+    read++;
+    if (c != '\n') {
+      line += c;
+      continue;
+    }
+
+    line.trim();
+    String lower = line;
+    lower.toLowerCase();
+    if (lower.startsWith("file") && line.indexOf('=') > 0) {
+      entry = line.substring(line.indexOf('=') + 1);
+      entry.trim();
+      return entry.length() > 0;
+    }
+    if (lower.startsWith("http://") || lower.startsWith("https://")) {
+      entry = line;
+      return true;
+    }
+    line = "";
+  }
+
+  // A last line without a newline
+  line.trim();
+  if (line.startsWith("http://") || line.startsWith("https://")) {
+    entry = line;
+    return true;
+  }
+  return false;
+}
+
+// ************************************************************
+// Hit rate, time saved and the cache contents
+// ************************************************************
+void StationResolver_::writeJson(JsonStreamWriter &json) {
+  int32_t hits = metrics.get(METRIC_RESOLVER_HITS);
+  int32_t misses = metrics.get(METRIC_RESOLVER_MISSES);
+
+  json.beginObject();
+  json.add("hits", (long)hits);
+  json.add("misses", (long)misses);
+  json.key("hitrate");
+  if (hits + misses > 0) {
+    json.value(100.0 * hits / (hits + misses), 1);
+  } else {
+    json.nullValue();
+  }
+  json.add("savedms", (long)metrics.get(METRIC_RESOLVER_SAVED_MS));
+  json.add("failures", (long)metrics.get(METRIC_RESOLVER_FAILURES));
+
+  json.key("entries").beginArray();
+  if (_lock) {
+    uint32_t now = millis();
+    for (int i = 0; i < RESOLVER_CACHE_SIZE; i++) {
+      xSemaphoreTake(_lock, portMAX_DELAY);
+      resolver_entry_t entry = _entries[i];
+      xSemaphoreGive(_lock);
+      if (entry.url.length() == 0) {
+        continue;
+      }
+      json.beginObject();
+      json.add("url", entry.url);
+      json.add("final", entry.finalUrl);
+      json.add("ip", entry.ip.toString());
+      json.add("valid", entry.valid);
+      json.add("wanted", entry.wanted);
+      json.add("hops", (int)entry.hops);
+      json.add("resolvems", entry.resolveMs);
+      json.key("age");
+      if (entry.resolvedAt) {
+        json.value((unsigned long)((now - entry.resolvedAt) / 1000));
+      } else {
+        json.nullValue();
+      }
+      json.endObject();
+    }
+  }
+  json.endArray();
+
+  json.endObject();
+}
+
+// ************************************************************
+// Library internal singleton wiring
+// ************************************************************
+StationResolver_ &StationResolver_::getInstance() {
+  static StationResolver_ instance;
+  return instance;
+}
+
+StationResolver_ &stationResolver = stationResolver.getInstance();
@@ -0,0 +1,822 @@
+#include "StationStore.h"
+#include <SPIFFS.h>
+#include "Globals.h"
+#include "DebugManager.h"
+#include "StreamHealth.h"
+
+static_assert(sizeof(store_record_t) == 24, "store_record_t is part of the on-flash format");
+static_assert(sizeof(store_index_entry_t) == 16, "store_index_entry_t is part of the on-flash format");
+
+// ************************************************************
+// Open the store, finishing or discarding an interrupted index
+// rebuild. A new store starts with the presets.
+// ************************************************************
+bool StationStore_::begin() {
+  uint32_t start = millis();
+  recover();
+
+  bool fresh = !SPIFFS.exists(STORE_RECORDS_FILE);
+  if (fresh) {
+    SPIFFS.open(STORE_RECORDS_FILE, "w").close();
+    SPIFFS.open(STORE_STRINGS_FILE, "w").close();
+    SPIFFS.open(STORE_INDEX_FILE, "w").close();
+  }
+
+  File records = SPIFFS.open(STORE_RECORDS_FILE, "r");
+  File index = SPIFFS.open(STORE_INDEX_FILE, "r");
+  if (!records || !index) {
+    debugMsgSpf("Station store: can't open files");
+    return false;
+  }
+  _recordCount = records.size() / sizeof(store_record_t);
+  _indexCount = index.size() / sizeof(store_index_entry_t);
+  records.close();
+  index.close();
+  loadTail();
+  loadDeleted();
+
+  _lock = xSemaphoreCreateMutex();
+
+  if (fresh) {
+    for (int i = 0; i < stationCount; i++) {
+      add(stations[i]);
+    }
+  }
+  debugMsgSpff("Station store: %u stations, %u records, %u in the tail, opened in %ums", (unsigned)count(),
+               (unsigned)_recordCount, (unsigned)_tailCount, (unsigned)(millis() - start));
+  return true;
+}
+
+// ************************************************************
+// A rebuilt index that made it to index.new is complete, so
+// put it in place. One still in index.tmp is not.
+// ************************************************************
+void StationStore_::recover() {
+  if (SPIFFS.exists(STORE_INDEX_NEW_FILE)) {
+    debugMsgSpf("Station store: finishing an interrupted index rebuild");
+    finishRebuild();
+  }
+  if (SPIFFS.exists(STORE_INDEX_TMP_FILE)) {
+    SPIFFS.remove(STORE_INDEX_TMP_FILE);
+  }
+}
+
+// ************************************************************
+// Tail entries, sorted. Ranks were taken against the current
+// index.bin when they were added. An entry whose record never
+// made it to records.bin is an add a reset cut short; the file
+// is rewritten without it, so the next add can take its id.
+// ************************************************************
+void StationStore_::loadTail() {
+  _tailCount = 0;
+  File file = SPIFFS.open(STORE_TAIL_FILE, "r");
+  if (!file) {
+    return;
+  }
+  bool dropped = file.size() % sizeof(store_tail_entry_t) != 0;
+  store_tail_entry_t entry;
+  while (file.read((uint8_t *)&entry, sizeof(entry)) == sizeof(entry)) {
+    if (entry.entry.id >= _recordCount) {
+      dropped = true;
+      continue;
+    }
+    if (_tailCount == _tailCapacity && !growTail()) {
+      break;
+    }
+    int t = _tailCount++;
+    while (t > 0 && compare(_tail[t - 1].entry, entry.entry) > 0) {
+      _tail[t] = _tail[t - 1];
+      t--;
+    }
+    _tail[t] = entry;
+  }
+  file.close();
+  if (dropped) {
+    debugMsgSpf("Station store: dropping tail entries of unfinished adds");
+    saveTail();
+  }
+}
+
+// ************************************************************
+// Room for more tail entries: STORE_TAIL_MAX to start with,
+// then STORE_TAIL_STEP at a time up to the limit
+// ************************************************************
+bool StationStore_::growTail() {
+  uint32_t limit = psramFound() ? STORE_TAIL_GROW_MAX : STORE_TAIL_GROW_MAX_SRAM;
+  uint32_t capacity = _tailCapacity == 0 ? STORE_TAIL_MAX : _tailCapacity + STORE_TAIL_STEP;
+  if (capacity > limit) {
+    return false;
+  }
+  size_t bytes = capacity * sizeof(store_tail_entry_t);
+  store_tail_entry_t *grown = (store_tail_entry_t *)(psramFound() ? ps_realloc(_tail, bytes) : realloc(_tail, bytes));
+  if (!grown) {
+    return false;
+  }
+  _tail = grown;
+  _tailCapacity = capacity;
+  return true;
+}
+
+// Back to STORE_TAIL_MAX once a rebuild has emptied it
+void StationStore_::shrinkTail() {
+  if (_tailCapacity <= STORE_TAIL_MAX) {
+    return;
+  }
+  size_t bytes = STORE_TAIL_MAX * sizeof(store_tail_entry_t);
+  store_tail_entry_t *shrunk = (store_tail_entry_t *)(psramFound() ? ps_realloc(_tail, bytes) : realloc(_tail, bytes));
+  if (shrunk) {
+    _tail = shrunk;
+    _tailCapacity = STORE_TAIL_MAX;
+  }
+}
+
+void StationStore_::loadDeleted() {
+  _deletedCount = 0;
+  File file = SPIFFS.open(STORE_DELETED_FILE, "r");
+  if (!file) {
+    return;
+  }
+  uint32_t id;
+  while (_deletedCount < STORE_DELETED_MAX && file.read((uint8_t *)&id, sizeof(id)) == sizeof(id)) {
+    _deleted[_deletedCount++] = id;
+  }
+  file.close();
+}
+
+// ************************************************************
+// Rewrite the tail file from the sorted tail. Call with the
+// lock.
+// ************************************************************
+bool StationStore_::saveTail() {
+  File file = SPIFFS.open(STORE_TAIL_FILE, "w");
+  if (!file) {
+    return false;
+  }
+  size_t bytes = _tailCount * sizeof(store_tail_entry_t);
+  bool ok = file.write((const uint8_t *)_tail, bytes) == bytes;
+  file.close();
+  return ok;
+}
+
+// ************************************************************
+// Lower case letters and digits of a name. Anything past ASCII
+// is kept as it is, so other scripts sort after Latin ones
+// rather than vanishing.
+// ************************************************************
+String StationStore_::fold(const String &name) {
+  String folded;
+  folded.reserve(name.length());
+  for (unsigned int i = 0; i < name.length(); i++) {
+    uint8_t c = (uint8_t)name[i];
+    if (c >= 0x80 || isalnum(c)) {
+      folded += (char)tolower(c);
+    }
+  }
+  return folded;
+}
+
+// ************************************************************
+// The start of the folded name, zero padded
+// ************************************************************
+void StationStore_::makeKey(const String &name, char *key) {
+  String folded = fold(name);
+  memset(key, 0, STORE_KEY_LEN);
+  memcpy(key, folded.c_str(), folded.length() < STORE_KEY_LEN ? folded.length() : STORE_KEY_LEN);
+}
+
+int StationStore_::compare(const store_index_entry_t &a, const store_index_entry_t &b) {
+  int order = memcmp(a.key, b.key, STORE_KEY_LEN);
+  if (order != 0) {
+    return order;
+  }
+  return (a.id < b.id) ? -1 : (a.id > b.id) ? 1 : 0;
+}
+
+// ************************************************************
+// Number of index.bin entries that sort before entry, by
+// binary search on flash
+// ************************************************************
+uint32_t StationStore_::rankInIndex(File &index, const store_index_entry_t &entry, bool &found) {
+  uint32_t lo = 0;
+  uint32_t hi = _indexCount;
+  store_index_entry_t probe;
+  while (lo < hi) {
+    uint32_t mid = lo + (hi - lo) / 2;
+    index.seek(mid * sizeof(store_index_entry_t));
+    if (index.read((uint8_t *)&probe, sizeof(probe)) != sizeof(probe)) {
+      break;
+    }
+    if (compare(probe, entry) < 0) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  found = false;
+  if (lo < _indexCount) {
+    index.seek(lo * sizeof(store_index_entry_t));
+    found = index.read((uint8_t *)&probe, sizeof(probe)) == sizeof(probe) && compare(probe, entry) == 0;
+  }
+  return lo;
+}
+
+// ************************************************************
+// First entry in [lo, hi) whose key starts with prefix or
+// sorts after it - or, for the upper bound, sorts after it
+// ************************************************************
+uint32_t StationStore_::prefixBound(File &index, uint32_t lo, uint32_t hi, const char *prefix, uint8_t len, bool upper) {
+  store_index_entry_t probe;
+  while (lo < hi) {
+    uint32_t mid = lo + (hi - lo) / 2;
+    index.seek(mid * sizeof(store_index_entry_t));
+    if (index.read((uint8_t *)&probe, sizeof(probe)) != sizeof(probe)) {
+      break;
+    }
+    int order = memcmp(probe.key, prefix, len);
+    if (order < 0 || (upper && order == 0)) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+bool StationStore_::isDeleted(uint32_t id) {
+  for (uint8_t i = 0; i < _deletedCount; i++) {
+    if (_deleted[i] == id) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool StationStore_::readRecord(uint32_t id, store_record_t &record) {
+  if (id >= _recordCount) {
+    return false;
+  }
+  File file = SPIFFS.open(STORE_RECORDS_FILE, "r");
+  if (!file) {
+    return false;
+  }
+  file.seek(id * sizeof(store_record_t));
+  bool ok = file.read((uint8_t *)&record, sizeof(record)) == sizeof(record);
+  file.close();
+  return ok;
+}
+
+// ************************************************************
+// Append a station: a tail entry, then its strings and record.
+// The record is what makes the add count - a tail entry without
+// one is dropped at boot, where a record without a tail entry
+// would never be listed.
+// ************************************************************
+uint32_t StationStore_::add(const station_t &station) {
+  if (!_lock || station.name.length() == 0 || station.urlCount == 0) {
+    return STATION_ID_NONE;
+  }
+
+  size_t length = station.name.length() + 1;
+  for (uint8_t u = 0; u < station.urlCount; u++) {
+    length += station.urls[u].length() + 1;
+  }
+  for (uint8_t t = 0; t < station.tierCount; t++) {
+    length += station.tierUrls[t].length() + 1;
+  }
+  if (length > STORE_STRINGS_MAX) {
+    return STATION_ID_NONE;
+  }
+  uint8_t *blob = (uint8_t *)malloc(length);
+  if (!blob) {
+    return STATION_ID_NONE;
+  }
+  size_t pos = 0;
+  memcpy(blob + pos, station.name.c_str(), station.name.length() + 1);
+  pos += station.name.length() + 1;
+  for (uint8_t u = 0; u < station.urlCount; u++) {
+    memcpy(blob + pos, station.urls[u].c_str(), station.urls[u].length() + 1);
+    pos += station.urls[u].length() + 1;
+  }
+  for (uint8_t t = 0; t < station.tierCount; t++) {
+    memcpy(blob + pos, station.tierUrls[t].c_str(), station.tierUrls[t].length() + 1);
+    pos += station.tierUrls[t].length() + 1;
+  }
+
+  uint32_t id = STATION_ID_NONE;
+  xSemaphoreTake(_lock, portMAX_DELAY);
+  // A full tail grows, for maintain() to fold in later; only one that can't is rebuilt here
+  if (_tailCount < _tailCapacity || growTail() || (rebuildIndex() && _tailCapacity > 0)) {
+    store_tail_entry_t entry;
+    makeKey(station.name, entry.entry.key);
+    entry.entry.id = _recordCount;
+    File index = SPIFFS.open(STORE_INDEX_FILE, "r");
+    bool found;
+    entry.rank = index ? rankInIndex(index, entry.entry, found) : 0;
+    index.close();
+    File tail = SPIFFS.open(STORE_TAIL_FILE, "a");
+    bool tailed = tail && tail.write((const uint8_t *)&entry, sizeof(entry)) == sizeof(entry);
+    tail.close();
+
+    store_record_t record;
+    memset(&record, 0, sizeof(record));
+    record.stringsLength = length;
+    record.urlCount = station.urlCount;
+    record.tierCount = station.tierCount;
+    for (uint8_t t = 0; t < station.tierCount; t++) {
+      record.tierKbps[t] = station.tierKbps[t];
+    }
+    record.urlHash = StreamHealth_::hashUrl(station.urls[0]);
+
+    File strings = SPIFFS.open(STORE_STRINGS_FILE, "a");
+    File records = SPIFFS.open(STORE_RECORDS_FILE, "r+");
+    if (tailed && strings && records) {
+      record.stringsOffset = strings.size();
+      // A record torn by a reset is overwritten - its strings are just lost space
+      records.seek(_recordCount * sizeof(store_record_t));
+      if (strings.write(blob, length) == length && records.write((const uint8_t *)&record, sizeof(record)) == sizeof(record)) {
+        id = _recordCount++;
+      }
+    }
+    strings.close();
+    records.close();
+
+    if (id != STATION_ID_NONE) {
+      int t = _tailCount++;
+      while (t > 0 && compare(_tail[t - 1].entry, entry.entry) > 0) {
+        _tail[t] = _tail[t - 1];
+        t--;
+      }
+      _tail[t] = entry;
+    } else {
+      // Take the entry back out, so the next add can have the id
+      saveTail();
+    }
+  }
+  xSemaphoreGive(_lock);
+  free(blob);
+  return id;
+}
+
+// ************************************************************
+// Read a station back
+// ************************************************************
+bool StationStore_::get(uint32_t id, station_t &station) {
+  if (!_lock) {
+    return false;
+  }
+  xSemaphoreTake(_lock, portMAX_DELAY);
+  store_record_t record;
+  bool ok = readRecord(id, record) && !(record.flags & STORE_FLAG_DELETED) && record.stringsLength > 0 &&
+            record.stringsLength <= STORE_STRINGS_MAX;
+  uint8_t *blob = ok ? (uint8_t *)malloc(record.stringsLength) : nullptr;
+  if (blob) {
+    File strings = SPIFFS.open(STORE_STRINGS_FILE, "r");
+    ok = strings && strings.seek(record.stringsOffset) &&
+         strings.read(blob, record.stringsLength) == record.stringsLength;
+    strings.close();
+  } else {
+    ok = false;
+  }
+  xSemaphoreGive(_lock);
+
+  if (ok && blob[record.stringsLength - 1] == '\0') {
+    const char *next = (const char *)blob;
+    const char *end = next + record.stringsLength;
+    station.name = next;
+    next += strlen(next) + 1;
+    station.urlCount = 0;
+    for (uint8_t u = 0; u < record.urlCount && u < MAX_STATION_URLS && next < end; u++) {
+      station.urls[station.urlCount++] = next;
+      next += strlen(next) + 1;
+    }
+    station.tierCount = 0;
+    for (uint8_t t = 0; t < record.tierCount && t < MAX_STATION_TIERS && next < end; t++) {
+      station.tierKbps[t] = record.tierKbps[t];
+      station.tierUrls[station.tierCount++] = next;
+      next += strlen(next) + 1;
+    }
+  } else {
+    ok = false;
+  }
+  free(blob);
+  return ok && station.urlCount > 0;
+}
+
+// ************************************************************
+// Mark a station deleted. It leaves the tail at once, and
+// index.bin at the next rebuild.
+// ************************************************************
+bool StationStore_::remove(uint32_t id) {
+  if (!_lock) {
+    return false;
+  }
+  bool ok = false;
+  xSemaphoreTake(_lock, portMAX_DELAY);
+  store_record_t record;
+  if (readRecord(id, record) && !(record.flags & STORE_FLAG_DELETED) &&
+      (_deletedCount < STORE_DELETED_MAX || rebuildIndex())) {
+    record.flags |= STORE_FLAG_DELETED;
+    File records = SPIFFS.open(STORE_RECORDS_FILE, "r+");
+    if (records) {
+      records.seek(id * sizeof(store_record_t));
+      ok = records.write((const uint8_t *)&record, sizeof(record)) == sizeof(record);
+      records.close();
+    }
+  }
+
+  if (ok) {
+    int inTail = -1;
+    for (uint32_t t = 0; t < _tailCount; t++) {
+      if (_tail[t].entry.id == id) {
+        inTail = t;
+        break;
+      }
+    }
+    if (inTail >= 0) {
+      memmove(&_tail[inTail], &_tail[inTail + 1], (_tailCount - inTail - 1) * sizeof(store_tail_entry_t));
+      _tailCount--;
+      saveTail();
+    } else {
+      _deleted[_deletedCount++] = id;
+      File deleted = SPIFFS.open(STORE_DELETED_FILE, "a");
+      if (deleted) {
+        deleted.write((const uint8_t *)&id, sizeof(id));
+        deleted.close();
+      }
+    }
+  }
+  xSemaphoreGive(_lock);
+  return ok;
+}
+
+// ************************************************************
+// A station's name from open records and strings files, empty
+// if it's deleted. Call with the lock.
+// ************************************************************
+static void readName(File &records, File &strings, uint32_t id, uint32_t recordCount, String &name) {
+  name = "";
+  store_record_t record;
+  if (id >= recordCount || !records.seek(id * sizeof(store_record_t)) ||
+      records.read((uint8_t *)&record, sizeof(record)) != sizeof(record) || (record.flags & STORE_FLAG_DELETED)) {
+    return;
+  }
+  char buf[STORE_NAME_READ + 1];
+  uint16_t want = record.stringsLength < STORE_NAME_READ ? record.stringsLength : STORE_NAME_READ;
+  if (strings.seek(record.stringsOffset) && strings.read((uint8_t *)buf, want) == want) {
+    buf[want] = '\0';
+    name = buf;
+  }
+}
+
+// ************************************************************
+// Names for a list of ids, e.g. a page of search results
+// ************************************************************
+void StationStore_::getNames(const uint32_t *ids, uint8_t count, String *names) {
+  for (uint8_t i = 0; i < count; i++) {
+    names[i] = "";
+  }
+  if (!_lock) {
+    return;
+  }
+  xSemaphoreTake(_lock, portMAX_DELAY);
+  File records = SPIFFS.open(STORE_RECORDS_FILE, "r");
+  File strings = SPIFFS.open(STORE_STRINGS_FILE, "r");
+  if (records && strings) {
+    for (uint8_t i = 0; i < count; i++) {
+      readName(records, strings, ids[i], _recordCount, names[i]);
+    }
+  }
+  records.close();
+  strings.close();
+  xSemaphoreGive(_lock);
+}
+
+// ************************************************************
+// Stations whose folded name starts with the folded query:
+// the index.bin range for the key prefix, narrowed from the
+// last query's range when this one extends it, merged with the
+// tail entries that match. A query longer than a key is
+// checked against the whole name.
+// ************************************************************
+uint8_t StationStore_::search(const String &query, uint32_t *ids, uint8_t max, store_search_t &state, bool &more) {
+  more = false;
+  if (!_lock) {
+    return 0;
+  }
+  String folded = fold(query);
+  uint8_t keyLen = folded.length() < STORE_KEY_LEN ? folded.length() : STORE_KEY_LEN;
+  char key[STORE_KEY_LEN];
+  memset(key, 0, sizeof(key));
+  memcpy(key, folded.c_str(), keyLen);
+  bool checkNames = folded.length() > STORE_KEY_LEN;
+
+  xSemaphoreTake(_lock, portMAX_DELAY);
+  File index = SPIFFS.open(STORE_INDEX_FILE, "r");
+  uint32_t lo = 0;
+  uint32_t hi = index ? _indexCount : 0;
+  if (state.rebuild == _rebuilds && state.keyLen <= keyLen && memcmp(state.key, key, state.keyLen) == 0) {
+    lo = state.lo;
+    hi = state.hi;
+  }
+  if (index && keyLen > 0) {
+    lo = prefixBound(index, lo, hi, key, keyLen, false);
+    hi = prefixBound(index, lo, hi, key, keyLen, true);
+  }
+  memcpy(state.key, key, sizeof(key));
+  state.keyLen = keyLen;
+  state.lo = lo;
+  state.hi = hi;
+  state.rebuild = _rebuilds;
+
+  File records;
+  File strings;
+  if (checkNames) {
+    records = SPIFFS.open(STORE_RECORDS_FILE, "r");
+    strings = SPIFFS.open(STORE_STRINGS_FILE, "r");
+  }
+
+  uint32_t j = 0;
+  while (j < _tailCount && memcmp(_tail[j].entry.key, key, keyLen) < 0) {
+    j++;
+  }
+  store_index_entry_t buf[STORE_READ_CHUNK];
+  uint32_t bufLen = 0;
+  uint32_t bufPos = 0;
+  uint32_t i = lo;
+  if (index) {
+    index.seek(lo * sizeof(store_index_entry_t));
+  }
+  uint8_t got = 0;
+  for (;;) {
+    bool tailMatch = j < _tailCount && memcmp(_tail[j].entry.key, key, keyLen) == 0;
+    uint32_t id;
+    if (tailMatch && (i >= hi || _tail[j].rank <= i)) {
+      id = _tail[j++].entry.id;
+    } else if (i < hi) {
+      if (bufPos == bufLen) {
+        uint32_t want = hi - i < STORE_READ_CHUNK ? hi - i : STORE_READ_CHUNK;
+        bufLen = index.read((uint8_t *)buf, want * sizeof(store_index_entry_t)) / sizeof(store_index_entry_t);
+        bufPos = 0;
+        if (bufLen == 0) {
+          break;
+        }
+      }
+      id = buf[bufPos++].id;
+      i++;
+    } else {
+      break;
+    }
+    if (isDeleted(id)) {
+      continue;
+    }
+    if (checkNames) {
+      String name;
+      readName(records, strings, id, _recordCount, name);
+      if (!fold(name).startsWith(folded)) {
+        continue;
+      }
+    }
+    if (got == max) {
+      more = true;
+      break;
+    }
+    ids[got++] = id;
+  }
+  index.close();
+  records.close();
+  strings.close();
+  xSemaphoreGive(_lock);
+  return got;
+}
+
+uint32_t StationStore_::count() {
+  return _indexCount + _tailCount - _deletedCount;
+}
+
+// ************************************************************
+// The primary URL hash of every station, in id order, reading
+// records.bin through once
+// ************************************************************
+uint32_t StationStore_::urlHashes(uint32_t *hashes, uint32_t max) {
+  if (!_lock) {
+    return 0;
+  }
+  uint32_t got = 0;
+  xSemaphoreTake(_lock, portMAX_DELAY);
+  File records = SPIFFS.open(STORE_RECORDS_FILE, "r");
+  store_record_t buf[STORE_READ_CHUNK];
+  uint32_t id = 0;
+  while (records && id < _recordCount && got < max) {
+    uint32_t want = _recordCount - id < STORE_READ_CHUNK ? _recordCount - id : STORE_READ_CHUNK;
+    uint32_t read = records.read((uint8_t *)buf, want * sizeof(store_record_t)) / sizeof(store_record_t);
+    if (read == 0) {
+      break;
+    }
+    for (uint32_t i = 0; i < read && got < max; i++) {
+      if (!(buf[i].flags & STORE_FLAG_DELETED)) {
+        hashes[got++] = buf[i].urlHash;
+      }
+    }
+    id += read;
+  }
+  records.close();
+  xSemaphoreGive(_lock);
+  return got;
+}
+
+// ************************************************************
+// Merge index.bin and the tail into a new index.bin in one
+// pass, dropping deleted ids. Call with the lock.
+// ************************************************************
+bool StationStore_::rebuildIndex() {
+  uint32_t start = millis();
+  File in = SPIFFS.open(STORE_INDEX_FILE, "r");
+  File out = SPIFFS.open(STORE_INDEX_TMP_FILE, "w");
+  if (!in || !out) {
+    in.close();
+    out.close();
+    return false;
+  }
+
+  store_index_entry_t inBuf[STORE_READ_CHUNK];
+  store_index_entry_t outBuf[STORE_READ_CHUNK];
+  uint32_t inLen = 0;
+  uint32_t inPos = 0;
+  uint8_t outLen = 0;
+  uint32_t i = 0;
+  uint32_t j = 0;
+  bool ok = true;
+  while (ok && (i < _indexCount || j < _tailCount)) {
+    if (i < _indexCount && inPos == inLen) {
+      uint32_t want = _indexCount - i < STORE_READ_CHUNK ? _indexCount - i : STORE_READ_CHUNK;
+      inLen = in.read((uint8_t *)inBuf, want * sizeof(store_index_entry_t)) / sizeof(store_index_entry_t);
+      inPos = 0;
+      if (inLen == 0) {
+        ok = false;
+        break;
+      }
+    }
+    const store_index_entry_t *next;
+    if (j < _tailCount && (i >= _indexCount || _tail[j].rank <= i)) {
+      next = &_tail[j++].entry;
+    } else {
+      next = &inBuf[inPos++];
+      i++;
+    }
+    if (isDeleted(next->id)) {
+      continue;
+    }
+    outBuf[outLen++] = *next;
+    if (outLen == STORE_READ_CHUNK) {
+      ok = out.write((const uint8_t *)outBuf, sizeof(outBuf)) == sizeof(outBuf);
+      outLen = 0;
+    }
+  }
+  if (ok && outLen > 0) {
+    size_t bytes = outLen * sizeof(store_index_entry_t);
+    ok = out.write((const uint8_t *)outBuf, bytes) == bytes;
+  }
+  in.close();
+  out.close();
+
+  if (!ok || !SPIFFS.rename(STORE_INDEX_TMP_FILE, STORE_INDEX_NEW_FILE)) {
+    SPIFFS.remove(STORE_INDEX_TMP_FILE);
+    debugMsgSpf("Station store: index rebuild failed");
+    return false;
+  }
+  finishRebuild();
+  _rebuilds++;
+  debugMsgSpff("Station store: index rebuilt, %u entries in %ums", (unsigned)_indexCount, (unsigned)(millis() - start));
+  return true;
+}
+
+// ************************************************************
+// index.new is complete: the tail and deleted list are in it,
+// so drop them, then swap it in
+// ************************************************************
+void StationStore_::finishRebuild() {
+  SPIFFS.remove(STORE_TAIL_FILE);
+  SPIFFS.remove(STORE_DELETED_FILE);
+  SPIFFS.remove(STORE_INDEX_FILE);
+  SPIFFS.rename(STORE_INDEX_NEW_FILE, STORE_INDEX_FILE);
+  _tailCount = 0;
+  shrinkTail();
+  _deletedCount = 0;
+  File index = SPIFFS.open(STORE_INDEX_FILE, "r");
+  _indexCount = index ? index.size() / sizeof(store_index_entry_t) : 0;
+  index.close();
+}
+
+// ************************************************************
+// A page of ids in name order. The cursor is a position in
+// index.bin and the tail merged: tail entry j sits at its rank
+// plus j.
+// ************************************************************
+uint32_t StationStore_::page(uint32_t cursor, uint32_t *ids, uint8_t max, uint8_t &got) {
+  got = 0;
+  if (!_lock) {
+    return STORE_CURSOR_END;
+  }
+  xSemaphoreTake(_lock, portMAX_DELAY);
+  uint32_t total = _indexCount + _tailCount;
+  uint32_t j = 0;
+  while (j < _tailCount && _tail[j].rank + j < cursor) {
+    j++;
+  }
+  uint32_t i = cursor > j ? cursor - j : 0;
+
+  File index = SPIFFS.open(STORE_INDEX_FILE, "r");
+  store_index_entry_t buf[STORE_READ_CHUNK];
+  uint32_t bufLen = 0;
+  uint32_t bufPos = 0;
+  if (index) {
+    index.seek(i * sizeof(store_index_entry_t));
+  }
+  while (got < max && i + j < total) {
+    uint32_t id;
+    if (j < _tailCount && (i >= _indexCount || _tail[j].rank <= i)) {
+      id = _tail[j++].entry.id;
+    } else {
+      if (bufPos == bufLen) {
+        uint32_t want = _indexCount - i < STORE_READ_CHUNK ? _indexCount - i : STORE_READ_CHUNK;
+        bufLen = index ? index.read((uint8_t *)buf, want * sizeof(store_index_entry_t)) / sizeof(store_index_entry_t) : 0;
+        bufPos = 0;
+        if (bufLen == 0) {
+          break;
+        }
+      }
+      id = buf[bufPos++].id;
+      i++;
+    }
+    if (!isDeleted(id)) {
+      ids[got++] = id;
+    }
+  }
+  index.close();
+  uint32_t next = (i + j < total) ? i + j : STORE_CURSOR_END;
+  xSemaphoreGive(_lock);
+  return next;
+}
+
+// ************************************************************
+// Fold a tail that has grown to STORE_TAIL_MAX into index.bin,
+// here rather than in whichever task did the adds. A failed
+// rebuild (e.g. no room for index.tmp) waits a while before
+// the next try.
+// ************************************************************
+void StationStore_::maintain() {
+  if (!_lock || _tailCount < STORE_TAIL_MAX || (int32_t)(millis() - _maintainAfter) < 0) {
+    return;
+  }
+  xSemaphoreTake(_lock, portMAX_DELAY);
+  if (_tailCount >= STORE_TAIL_MAX && !rebuildIndex()) {
+    _maintainAfter = millis() + STORE_REBUILD_RETRY_MS;
+  }
+  xSemaphoreGive(_lock);
+}
+
+// ************************************************************
+// Sizes, for /api/store
+// ************************************************************
+void StationStore_::writeJson(JsonStreamWriter &json) {
+  uint32_t stringBytes = 0;
+  uint32_t flashBytes = 0;
+  uint32_t rebuilds = 0;
+  if (_lock) {
+    xSemaphoreTake(_lock, portMAX_DELAY);
+    const char *files[] = {STORE_RECORDS_FILE, STORE_STRINGS_FILE, STORE_INDEX_FILE, STORE_TAIL_FILE, STORE_DELETED_FILE};
+    for (const char *path : files) {
+      File file = SPIFFS.open(path, "r");
+      if (file) {
+        flashBytes += file.size();
+        if (path == files[1]) {
+          stringBytes = file.size();
+        }
+        file.close();
+      }
+    }
+    rebuilds = _rebuilds;
+    xSemaphoreGive(_lock);
+  }
+  json.add("ready", isReady());
+  json.add("count", count());
+  json.add("records", _recordCount);
+  json.add("indexed", _indexCount);
+  json.add("tail", (int)_tailCount);
+  json.add("deleted", (int)_deletedCount);
+  json.add("rebuilds", rebuilds);
+  json.add("stringbytes", stringBytes);
+  json.add("flashbytes", flashBytes);
+  json.add("spiffsused", (uint32_t)SPIFFS.usedBytes());
+  json.add("spiffstotal", (uint32_t)SPIFFS.totalBytes());
+}
+
+// ************************************************************
+// Library internal singleton wiring
+// ************************************************************
+StationStore_ &StationStore_::getInstance() {
+  static StationStore_ instance;
+  return instance;
+}
+
+StationStore_ &stationStore = stationStore.getInstance();
@@ -0,0 +1,131 @@
+#include "StreamBench.h"
+#include <AudioFileSourceICYStream.h>
+#include "AudioFileSourceRadioStream.h"
+#include "DebugManager.h"
+
+// ************************************************************
+// Kick off a run
+// ************************************************************
+bool StreamBench_::start(const String &url, uint16_t seconds, BenchClient client) {
+  if (_running) {
+    return false;
+  }
+  _result = bench_result_t();
+  _result.client = client;
+  _result.url = url;
+  _result.seconds = constrain(seconds, 1, BENCH_MAX_SECONDS);
+  _running = true;
+  if (xTaskCreatePinnedToCore(benchTask, "bench", BENCH_TASK_STACK, this, 1, nullptr, 0) != pdPASS) {
+    _running = false;
+    return false;
+  }
+  return true;
+}
+
+void StreamBench_::benchTask(void *param) {
+  static_cast<StreamBench_ *>(param)->run();
+  vTaskDelete(nullptr);
+}
+
+// ************************************************************
+// Read as fast as the stream allows until the time is up
+// ************************************************************
+void StreamBench_::run() {
+  uint8_t *buffer = (uint8_t *)malloc(BENCH_READ_BYTES);
+  if (!buffer) {
+    _running = false;
+    return;
+  }
+
+  uint32_t start = millis();
+  AudioFileSource *source;
+  if (_result.client == BENCH_CLIENT_ICY) {
+    source = new AudioFileSourceICYStream(_result.url.c_str());
+  } else {
+    AudioFileSourceRadioStream *stream = new AudioFileSourceRadioStream();
+    stream->open(_result.url.c_str());
+    _result.redirects = stream->getRedirects();
+    _result.chunked = stream->isChunked();
+    _result.metaInt = stream->getMetaInt();
+    _result.tls = stream->isSecure();
+    _result.handshakeMs = stream->getTls().getHandshakeMs();
+    _result.resumed = stream->getTls().wasResumed();
+    source = stream;
+  }
+  _result.connectMs = millis() - start;
+  _result.opened = source->isOpen();
+
+  start = millis();
+  uint32_t lastData = start;
+  uint32_t deadline = start + _result.seconds * 1000UL;
+  while (source->isOpen() && (int32_t)(millis() - deadline) < 0) {
+    uint32_t got = source->read(buffer, BENCH_READ_BYTES);
+    uint32_t now = millis();
+    if (got == 0) {
+      _result.stalls++;
+      vTaskDelay(1);
+      continue;
+    }
+    if (now - lastData > _result.maxGapMs) {
+      _result.maxGapMs = now - lastData;
+    }
+    lastData = now;
+    _result.bytes += got;
+    _result.elapsedMs = now - start;
+  }
+  _result.elapsedMs = millis() - start;
+  if (_result.tls) {
+    _result.cpuUsPerMbit = static_cast<AudioFileSourceRadioStream *>(source)->getTls().getCpuUsPerMbit();
+  }
+
+  source->close();
+  delete source;
+  free(buffer);
+  debugMsgAudf("Bench %s: %u bytes in %ums", _result.url.c_str(), (unsigned)_result.bytes, (unsigned)_result.elapsedMs);
+  _running = false;
+}
+
+// ************************************************************
+// Where the current or last run got to
+// ************************************************************
+void StreamBench_::writeJson(JsonStreamWriter &json) {
+  json.beginObject();
+  json.add("running", (bool)_running);
+  json.add("client", _result.client == BENCH_CLIENT_ICY ? "icy" : "native");
+  json.add("url", _result.url);
+  json.add("seconds", (unsigned)_result.seconds);
+  json.add("opened", _result.opened);
+  json.add("connectms", _result.connectMs);
+  json.add("bytes", _result.bytes);
+  json.add("elapsedms", _result.elapsedMs);
+  json.key("kbps");
+  if (_result.elapsedMs > 0) {
+    json.value(_result.bytes * 8.0 / _result.elapsedMs, 1);
+  } else {
+    json.nullValue();
+  }
+  json.add("stalls", _result.stalls);
+  json.add("maxgapms", _result.maxGapMs);
+  json.add("redirects", (unsigned)_result.redirects);
+  json.add("chunked", _result.chunked);
+  json.add("metaint", _result.metaInt);
+  json.add("tls", _result.tls);
+  if (_result.tls) {
+    json.add("handshakems", _result.handshakeMs);
+    json.add("resumed", _result.resumed);
+    json.add("cpuuspermbit", _result.cpuUsPerMbit);
+  }
+  json.add("tlshw", StreamTls::hardwareCrypto());
+  json.add("tcpwnd", AudioFileSourceRadioStream::tcpWindow());
+  json.endObject();
+}
+
+// ************************************************************
+// Library internal singleton wiring
+// ************************************************************
+StreamBench_ &StreamBench_::getInstance() {
+  static StreamBench_ instance;
+  return instance;
+}
+
+StreamBench_ &streamBench = streamBench.getInstance();
@@ -0,0 +1,256 @@
+#include "StreamHealth.h"
+#include <Preferences.h>
+#include "Globals.h"
+#include "DebugManager.h"
+
+// NVS location of the table
+static const char* HEALTH_NVS_NAMESPACE = "health";
+static const char* HEALTH_NVS_KEY = "table";
+
+// ************************************************************
+// Smooth a new sample into a value - a quarter weight each
+// ************************************************************
+static uint16_t smooth(uint16_t current, uint32_t sample, bool first) {
+  if (sample > UINT16_MAX) {
+    sample = UINT16_MAX;
+  }
+  return first ? sample : (current * 3 + sample) / 4;
+}
+
+// ************************************************************
+// Load the table. A missing or old-format one starts empty.
+// ************************************************************
+void StreamHealth_::begin() {
+  memset(_table, 0, sizeof(_table));
+  Preferences prefs;
+  if (prefs.begin(HEALTH_NVS_NAMESPACE, true)) {
+    if (prefs.getUChar("version", 0) == HEALTH_TABLE_VERSION && prefs.getBytesLength(HEALTH_NVS_KEY) == sizeof(_table)) {
+      prefs.getBytes(HEALTH_NVS_KEY, _table, sizeof(_table));
+    }
+    prefs.end();
+  }
+  for (int i = 0; i < HEALTH_TABLE_SIZE; i++) {
+    if (_table[i].lastUsed > _useCounter) {
+      _useCounter = _table[i].lastUsed;
+    }
+  }
+}
+
+// ************************************************************
+// FNV-1a of the URL. 0 is kept for free slots.
+// ************************************************************
+uint32_t StreamHealth_::hashUrl(const String &url) {
+  uint32_t hash = 2166136261UL;
+  for (unsigned int i = 0; i < url.length(); i++) {
+    hash ^= (uint8_t)url[i];
+    hash *= 16777619UL;
+  }
+  return hash ? hash : 1;
+}
+
+// ************************************************************
+// Slot for a hash, -1 if none. Call inside the mux.
+// ************************************************************
+int StreamHealth_::find(uint32_t hash) {
+  for (int i = 0; i < HEALTH_TABLE_SIZE; i++) {
+    if (_table[i].urlHash == hash) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+// ************************************************************
+// Slot for a hash, taking a free or the least recently used
+// one if it's new. Call inside the mux.
+// ************************************************************
+int StreamHealth_::findOrAdd(uint32_t hash) {
+  int idx = find(hash);
+  if (idx >= 0) {
+    return idx;
+  }
+  idx = 0;
+  for (int i = 0; i < HEALTH_TABLE_SIZE; i++) {
+    if (_table[i].urlHash == 0) {
+      idx = i;
+      break;
+    }
+    if (_table[i].lastUsed < _table[idx].lastUsed) {
+      idx = i;
+    }
+  }
+  memset(&_table[idx], 0, sizeof(stream_health_t));
+  _table[idx].urlHash = hash;
+  return idx;
+}
+
+// ************************************************************
+// A connect attempt finished
+// ************************************************************
+void StreamHealth_::noteConnect(uint32_t hash, bool ok, uint32_t connectMs) {
+  portENTER_CRITICAL(&_mux);
+  stream_health_t &entry = _table[findOrAdd(hash)];
+  bool first = entry.samples == 0;
+  entry.failRate = smooth(entry.failRate, ok ? 0 : 255, first);
+  if (ok) {
+    entry.connectMs = smooth(entry.connectMs, connectMs, entry.connectMs == 0);
+  }
+  if (entry.samples < UINT8_MAX) {
+    entry.samples++;
+  }
+  entry.lastUsed = ++_useCounter;
+  _dirty = true;
+  portEXIT_CRITICAL(&_mux);
+}
+
+// ************************************************************
+// The first sample of a stream was decoded
+// ************************************************************
+void StreamHealth_::noteFirstAudio(uint32_t hash, uint32_t ms) {
+  portENTER_CRITICAL(&_mux);
+  int idx = find(hash);
+  if (idx >= 0) {
+    _table[idx].firstAudioMs = smooth(_table[idx].firstAudioMs, ms, _table[idx].firstAudioMs == 0);
+    _dirty = true;
+  }
+  portEXIT_CRITICAL(&_mux);
+}
+
+// ************************************************************
+// A stream that connected has ended, by failing or being
+// stopped
+// ************************************************************
+void StreamHealth_::noteEnd(uint32_t hash, uint32_t playedMs, bool failed) {
+  portENTER_CRITICAL(&_mux);
+  int idx = find(hash);
+  if (idx >= 0) {
+    bool dropped = failed && playedMs < HEALTH_DROP_WINDOW_MS;
+    _table[idx].dropRate = smooth(_table[idx].dropRate, dropped ? 255 : 0, false);
+    _dirty = true;
+  }
+  portEXIT_CRITICAL(&_mux);
+}
+
+// ************************************************************
+// 100 less penalties: up to 50 for failed connects, 30 for
+// drops, 15 for a slow connect and 5 for slow first audio
+// ************************************************************
+uint8_t StreamHealth_::scoreOf(const stream_health_t &entry) {
+  if (entry.samples == 0) {
+    return HEALTH_UNKNOWN_SCORE;
+  }
+  uint32_t penalty = entry.failRate * 50 / 255 + entry.dropRate * 30 / 255;
+  penalty += min((uint32_t)entry.connectMs, (uint32_t)7500) / 500;
+  penalty += min((uint32_t)entry.firstAudioMs, (uint32_t)10000) / 2000;
+  return penalty >= 100 ? 0 : 100 - penalty;
+}
+
+uint8_t StreamHealth_::score(uint32_t hash) {
+  portENTER_CRITICAL(&_mux);
+  int idx = find(hash);
+  uint8_t result = idx >= 0 ? scoreOf(_table[idx]) : HEALTH_UNKNOWN_SCORE;
+  portEXIT_CRITICAL(&_mux);
+  return result;
+}
+
+// ************************************************************
+// Order a station's URLs best first (insertion sort - there
+// are at most MAX_STATION_URLS)
+// ************************************************************
+void StreamHealth_::rank(const String *urls, uint8_t count, uint8_t *order) {
+  uint8_t scores[MAX_STATION_URLS];
+  for (uint8_t i = 0; i < count; i++) {
+    scores[i] = score(hashUrl(urls[i]));
+    uint8_t j = i;
+    while (j > 0 && scores[order[j - 1]] < scores[i]) {
+      order[j] = order[j - 1];
+      j--;
+    }
+    order[j] = i;
+  }
+}
+
+// ************************************************************
+// Write the table if anything changed
+// ************************************************************
+void StreamHealth_::saveIfDirty() {
+  if (!_dirty) {
+    return;
+  }
+  stream_health_t *copy = (stream_health_t *)malloc(sizeof(_table));
+  if (!copy) {
+    return;
+  }
+  portENTER_CRITICAL(&_mux);
+  memcpy(copy, _table, sizeof(_table));
+  _dirty = false;
+  portEXIT_CRITICAL(&_mux);
+
+  Preferences prefs;
+  if (prefs.begin(HEALTH_NVS_NAMESPACE, false)) {
+    prefs.putUChar("version", HEALTH_TABLE_VERSION);
+    prefs.putBytes(HEALTH_NVS_KEY, copy, sizeof(_table));
+    prefs.end();
+    debugMsgAud("Saved stream health table");
+  }
+  free(copy);
+}
+
+// ************************************************************
+// One URL's record
+// ************************************************************
+void StreamHealth_::writeUrl(JsonStreamWriter &json, const String &url) {
+  stream_health_t entry;
+  portENTER_CRITICAL(&_mux);
+  int idx = find(hashUrl(url));
+  if (idx >= 0) {
+    entry = _table[idx];
+  } else {
+    memset(&entry, 0, sizeof(entry));
+  }
+  portEXIT_CRITICAL(&_mux);
+
+  json.beginObject();
+  json.add("url", url);
+  json.add("score", (int)scoreOf(entry));
+  json.add("samples", (int)entry.samples);
+  json.add("connectms", (int)entry.connectMs);
+  json.add("firstaudioms", (int)entry.firstAudioMs);
+  json.add("failpct", (int)(entry.failRate * 100 / 255));
+  json.add("droppct", (int)(entry.dropRate * 100 / 255));
+  json.endObject();
+}
+
+// ************************************************************
+// Per station, each URL in its configured order, then each
+// quality tier
+// ************************************************************
+void StreamHealth_::writeJson(JsonStreamWriter &json) {
+  json.beginArray();
+  for (int i = 0; i < stationCount; i++) {
+    json.beginObject();
+    json.add("name", stations[i].name);
+    json.key("urls").beginArray();
+    for (uint8_t u = 0; u < stations[i].urlCount; u++) {
+      writeUrl(json, stations[i].urls[u]);
+    }
+    json.endArray();
+    json.key("tiers").beginArray();
+    for (uint8_t t = 0; t < stations[i].tierCount; t++) {
+      writeUrl(json, stations[i].tierUrls[t]);
+    }
+    json.endArray();
+    json.endObject();
+  }
+  json.endArray();
+}
+
+// ************************************************************
+// Library internal singleton wiring
+// ************************************************************
+StreamHealth_ &StreamHealth_::getInstance() {
+  static StreamHealth_ instance;
+  return instance;
+}
+
+StreamHealth_ &streamHealth = streamHealth.getInstance();
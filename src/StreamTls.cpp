@@ -0,0 +1,267 @@
+#include "StreamTls.h"
+#include <lwip/sockets.h>
+#include <esp_timer.h>
+#include "mbedtls/net_sockets.h"
+#include "mbedtls/ssl_internal.h"
+#include "mbedtls/error.h"
+#include <errno.h>
+#include "DebugManager.h"
+#include "Metrics.h"
+
+// ************************************************************
+// Saved sessions, most recently used kept
+// ************************************************************
+typedef struct {
+  String host;
+  uint16_t port;
+  uint32_t usedAt;
+  bool valid;
+  mbedtls_ssl_session session;
+} tls_cached_session_t;
+
+static tls_cached_session_t sessionCache[TLS_SESSION_CACHE_SIZE];
+
+// The stream and the bench can handshake at the same time
+static SemaphoreHandle_t sessionLock() {
+  static SemaphoreHandle_t lock = xSemaphoreCreateMutex();
+  return lock;
+}
+
+static int findSession(const String &host, uint16_t port) {
+  for (int i = 0; i < TLS_SESSION_CACHE_SIZE; i++) {
+    if (sessionCache[i].valid && sessionCache[i].port == port && sessionCache[i].host == host) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+// ************************************************************
+// Handshake over an open socket
+// ************************************************************
+bool StreamTls::begin(int fd, const String &host, uint16_t port, uint32_t timeoutMs) {
+  end();
+  _fd = fd;
+  _block = true;
+  _resumed = false;
+  _cpuUs = 0;
+  _bytes = 0;
+
+  mbedtls_ssl_init(&_ssl);
+  mbedtls_ssl_config_init(&_conf);
+  mbedtls_entropy_init(&_entropy);
+  mbedtls_ctr_drbg_init(&_drbg);
+  _active = true;
+
+  if (mbedtls_ctr_drbg_seed(&_drbg, mbedtls_entropy_func, &_entropy, (const unsigned char *)host.c_str(), host.length()) != 0 ||
+      mbedtls_ssl_config_defaults(&_conf, MBEDTLS_SSL_IS_CLIENT, MBEDTLS_SSL_TRANSPORT_STREAM, MBEDTLS_SSL_PRESET_DEFAULT) != 0) {
+    end();
+    return false;
+  }
+  mbedtls_ssl_conf_authmode(&_conf, MBEDTLS_SSL_VERIFY_NONE);
+  mbedtls_ssl_conf_rng(&_conf, mbedtls_ctr_drbg_random, &_drbg);
+#if defined(MBEDTLS_SSL_SESSION_TICKETS)
+  mbedtls_ssl_conf_session_tickets(&_conf, MBEDTLS_SSL_SESSION_TICKETS_ENABLED);
+#endif
+  if (mbedtls_ssl_setup(&_ssl, &_conf) != 0 || mbedtls_ssl_set_hostname(&_ssl, host.c_str()) != 0) {
+    end();
+    return false;
+  }
+  mbedtls_ssl_set_bio(&_ssl, this, bioSend, bioRecv, nullptr);
+
+  // Offer the last session with this server
+  xSemaphoreTake(sessionLock(), portMAX_DELAY);
+  int cached = findSession(host, port);
+  if (cached >= 0) {
+    mbedtls_ssl_set_session(&_ssl, &sessionCache[cached].session);
+  }
+  xSemaphoreGive(sessionLock());
+
+  // A step at a time, to see whether the server took the session up. mbedTLS decides that from the
+  // ServerHello and frees the handshake state at the end, so it has to be read on the way. Session
+  // IDs can't tell afterwards: a ticket goes with a random ID, not the one from last time.
+  uint32_t start = millis();
+  while (_ssl.state != MBEDTLS_SSL_HANDSHAKE_OVER) {
+    int ret = mbedtls_ssl_handshake_step(&_ssl);
+    if (_ssl.handshake) {
+      _resumed = _ssl.handshake->resume != 0;
+    }
+    if (ret == 0) {
+      continue;
+    }
+    if ((ret != MBEDTLS_ERR_SSL_WANT_READ && ret != MBEDTLS_ERR_SSL_WANT_WRITE) || millis() - start >= timeoutMs) {
+      char error[64];
+      mbedtls_strerror(ret, error, sizeof(error));
+      debugMsgAudf("TLS handshake with %s failed: -0x%04x %s", host.c_str(), -ret, error);
+      end();
+      return false;
+    }
+  }
+  _handshakeMs = millis() - start;
+
+  metrics.inc(METRIC_TLS_HANDSHAKES);
+  if (_resumed) {
+    metrics.inc(METRIC_TLS_RESUMED);
+  }
+  metrics.observe(METRIC_TLS_HANDSHAKE_MS, _handshakeMs);
+  debugMsgAudf("TLS %s with %s in %ums (%s)", _resumed ? "resumed" : "handshake", host.c_str(), (unsigned)_handshakeMs,
+               mbedtls_ssl_get_ciphersuite(&_ssl));
+
+  // Keep the session (and any new ticket) for next time, replacing the least recently used
+  xSemaphoreTake(sessionLock(), portMAX_DELAY);
+  int slot = findSession(host, port);
+  if (slot < 0) {
+    slot = 0;
+    for (int i = 0; i < TLS_SESSION_CACHE_SIZE; i++) {
+      if (!sessionCache[i].valid) {
+        slot = i;
+        break;
+      }
+      if (sessionCache[i].usedAt < sessionCache[slot].usedAt) {
+        slot = i;
+      }
+    }
+  }
+  tls_cached_session_t &entry = sessionCache[slot];
+  if (entry.valid) {
+    mbedtls_ssl_session_free(&entry.session);
+  }
+  mbedtls_ssl_session_init(&entry.session);
+  entry.valid = mbedtls_ssl_get_session(&_ssl, &entry.session) == 0;
+  entry.host = host;
+  entry.port = port;
+  entry.usedAt = millis();
+  xSemaphoreGive(sessionLock());
+
+  return true;
+}
+
+// ************************************************************
+// Free the connection state. The socket belongs to the caller.
+// ************************************************************
+void StreamTls::end() {
+  if (!_active) {
+    return;
+  }
+  mbedtls_ssl_free(&_ssl);
+  mbedtls_ssl_config_free(&_conf);
+  mbedtls_ctr_drbg_free(&_drbg);
+  mbedtls_entropy_free(&_entropy);
+  _active = false;
+  _fd = -1;
+}
+
+// ************************************************************
+// Decrypt into dst. Counts the CPU time, not the socket wait.
+// ************************************************************
+int StreamTls::read(uint8_t *dst, uint32_t len, bool block) {
+  if (!_active) {
+    return -1;
+  }
+  _block = block;
+  _recvUs = 0;
+  int64_t start = esp_timer_get_time();
+  int n = mbedtls_ssl_read(&_ssl, dst, len);
+  if (n > 0) {
+    int64_t cpu = esp_timer_get_time() - start - _recvUs;
+    if (cpu > 0) {
+      _cpuUs += cpu;
+      metrics.inc(METRIC_TLS_DECRYPT_US, (uint32_t)cpu);
+    }
+    _bytes += n;
+    metrics.inc(METRIC_TLS_BYTES, n);
+    return n;
+  }
+  if (n == MBEDTLS_ERR_SSL_WANT_READ || n == MBEDTLS_ERR_SSL_WANT_WRITE) {
+    return 0;
+  }
+  return -1;
+}
+
+// ************************************************************
+// Encrypt and send all of data
+// ************************************************************
+bool StreamTls::write(const uint8_t *data, uint32_t len) {
+  if (!_active) {
+    return false;
+  }
+  _block = true;
+  uint32_t start = millis();
+  while (len > 0) {
+    int n = mbedtls_ssl_write(&_ssl, data, len);
+    if (n > 0) {
+      data += n;
+      len -= n;
+    } else if ((n != MBEDTLS_ERR_SSL_WANT_READ && n != MBEDTLS_ERR_SSL_WANT_WRITE) || millis() - start >= 5000) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// ************************************************************
+// Plaintext already decrypted, or something on the socket
+// (which may only be part of a record)
+// ************************************************************
+bool StreamTls::dataWaiting() {
+  if (!_active) {
+    return true;
+  }
+  if (mbedtls_ssl_get_bytes_avail(&_ssl) > 0) {
+    return true;
+  }
+  uint8_t c;
+  int n = recv(_fd, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+  return n >= 0 || (errno != EAGAIN && errno != EWOULDBLOCK);
+}
+
+uint32_t StreamTls::getCpuUsPerMbit() {
+  if (_bytes == 0) {
+    return 0;
+  }
+  return (uint32_t)(_cpuUs * 1000000ULL / (_bytes * 8));
+}
+
+// ************************************************************
+// Crypto accelerators compiled into mbedTLS
+// ************************************************************
+String StreamTls::hardwareCrypto() {
+  String hw;
+#ifdef CONFIG_MBEDTLS_HARDWARE_AES
+  hw += "aes,";
+#endif
+#ifdef CONFIG_MBEDTLS_HARDWARE_SHA
+  hw += "sha,";
+#endif
+#ifdef CONFIG_MBEDTLS_HARDWARE_MPI
+  hw += "mpi,";
+#endif
+  if (hw.length() > 0) {
+    hw.remove(hw.length() - 1);
+  }
+  return hw;
+}
+
+// ************************************************************
+// Socket I/O for mbedTLS. Blocking reads wait up to the
+// socket's SO_RCVTIMEO.
+// ************************************************************
+int StreamTls::bioSend(void *ctx, const unsigned char *buf, size_t len) {
+  StreamTls *self = static_cast<StreamTls *>(ctx);
+  int n = send(self->_fd, buf, len, 0);
+  if (n >= 0) {
+    return n;
+  }
+  return (errno == EAGAIN || errno == EWOULDBLOCK) ? MBEDTLS_ERR_SSL_WANT_WRITE : MBEDTLS_ERR_NET_SEND_FAILED;
+}
+
+int StreamTls::bioRecv(void *ctx, unsigned char *buf, size_t len) {
+  StreamTls *self = static_cast<StreamTls *>(ctx);
+  int64_t start = esp_timer_get_time();
+  int n = recv(self->_fd, buf, len, self->_block ? 0 : MSG_DONTWAIT);
+  self->_recvUs += esp_timer_get_time() - start;
+  if (n >= 0) {
+    return n;
+  }
+  return (errno == EAGAIN || errno == EWOULDBLOCK) ? MBEDTLS_ERR_SSL_WANT_READ : MBEDTLS_ERR_NET_RECV_FAILED;
+}
@@ -0,0 +1,178 @@
+#include "TaskProfiler.h"
+#include "DebugManager.h"
+#include "Metrics.h"
+
+// ************************************************************
+// Look up a task in the last sample
+// ************************************************************
+const task_profile_t* TaskProfiler_::findTask(TaskHandle_t handle) {
+  for (uint8_t i = 0; i < _taskCount; i++) {
+    if (_tasks[i].handle == handle) {
+      return &_tasks[i];
+    }
+  }
+  return nullptr;
+}
+
+// ************************************************************
+// Take a snapshot of all tasks and work out what each used
+// since the last one
+// ************************************************************
+void TaskProfiler_::sample() {
+#if configUSE_TRACE_FACILITY
+  // Static so the snapshot doesn't sit on the loop task stack
+  static TaskStatus_t status[PROFILER_MAX_TASKS];
+  static task_profile_t fresh[PROFILER_MAX_TASKS];
+
+  uint32_t totalRunTime = 0;
+  UBaseType_t count = uxTaskGetSystemState(status, PROFILER_MAX_TASKS, &totalRunTime);
+  if (count == 0) {
+    debugMsgUtlf("Task profiler: more than %d tasks, raise PROFILER_MAX_TASKS", PROFILER_MAX_TASKS);
+    return;
+  }
+
+  uint32_t period = totalRunTime - _lastTotalRunTime;
+  bool havePrevious = (_samples > 0) && (period > 0);
+
+  for (UBaseType_t i = 0; i < count; i++) {
+    task_profile_t &t = fresh[i];
+    t.handle = status[i].xHandle;
+    strncpy(t.name, status[i].pcTaskName, sizeof(t.name) - 1);
+    t.name[sizeof(t.name) - 1] = '\0';
+    BaseType_t affinity = xTaskGetAffinity(t.handle);
+    t.core = (affinity == tskNO_AFFINITY) ? -1 : (int8_t)affinity;
+    t.priority = status[i].uxCurrentPriority;
+    t.state = status[i].eCurrentState;
+    t.stackFree = status[i].usStackHighWaterMark;
+    t.runTime = status[i].ulRunTimeCounter;
+    t.cpuPermille = 0;
+
+    const task_profile_t* prev = findTask(t.handle);
+    if (havePrevious && prev) {
+      uint32_t used = t.runTime - prev->runTime;
+      t.cpuPermille = (uint16_t)min((uint64_t)used * 1000 / period, (uint64_t)1000);
+    }
+  }
+
+  int16_t idle[portNUM_PROCESSORS];
+  for (int core = 0; core < portNUM_PROCESSORS; core++) {
+    idle[core] = -1;
+    if (!havePrevious) {
+      continue;
+    }
+    TaskHandle_t idleTask = xTaskGetIdleTaskHandleForCPU(core);
+    for (UBaseType_t i = 0; i < count; i++) {
+      if (fresh[i].handle == idleTask) {
+        idle[core] = fresh[i].cpuPermille;
+      }
+    }
+  }
+
+  portENTER_CRITICAL(&_mux);
+  memcpy(_tasks, fresh, count * sizeof(task_profile_t));
+  _taskCount = count;
+  _samplePeriod = period;
+  for (int core = 0; core < portNUM_PROCESSORS; core++) {
+    _idlePermille[core] = idle[core];
+  }
+  portEXIT_CRITICAL(&_mux);
+
+  _lastTotalRunTime = totalRunTime;
+  _samples++;
+
+  checkThresholds();
+#endif
+}
+
+// ************************************************************
+// Raise the warning counters when the audio task is short of
+// stack or core 1 is nearly saturated
+// ************************************************************
+void TaskProfiler_::checkThresholds() {
+  for (uint8_t i = 0; i < _taskCount; i++) {
+    if (strcmp(_tasks[i].name, PROFILER_AUDIO_TASK_NAME) == 0 && _tasks[i].stackFree < PROFILER_AUDIO_STACK_MIN_BYTES) {
+      metrics.inc(METRIC_AUDIO_STACK_WARNINGS);
+      debugMsgUtlf("Audio task stack margin low: %u bytes", (unsigned)_tasks[i].stackFree);
+    }
+  }
+
+  for (int core = 0; core < portNUM_PROCESSORS; core++) {
+    if (_idlePermille[core] >= 0) {
+      metrics.set(core == 0 ? METRIC_CORE0_IDLE_PERCENT : METRIC_CORE1_IDLE_PERCENT, _idlePermille[core] / 10);
+    }
+  }
+  if (_idlePermille[1] >= 0 && _idlePermille[1] < PROFILER_CORE1_IDLE_MIN_PERMILLE) {
+    metrics.inc(METRIC_CORE1_IDLE_WARNINGS);
+    debugMsgUtlf("Core 1 idle only %d.%d%%", _idlePermille[1] / 10, _idlePermille[1] % 10);
+  }
+}
+
+// ************************************************************
+// Output the last sample. Each task is copied out under the
+// lock, so a sample landing mid-response can't tear a row.
+// ************************************************************
+void TaskProfiler_::writeJson(JsonStreamWriter &json) {
+  json.beginObject();
+#if configGENERATE_RUN_TIME_STATS
+  json.add("runtimestats", true);
+#else
+  json.add("runtimestats", false);
+#endif
+  json.add("samples", _samples);
+  json.add("period", _samplePeriod);
+
+  json.key("cores").beginArray();
+  for (int core = 0; core < portNUM_PROCESSORS; core++) {
+    json.beginObject();
+    json.add("core", core);
+    json.key("idle");
+    if (_idlePermille[core] >= 0) {
+      json.value(_idlePermille[core] / 10.0, 1);
+    } else {
+      json.nullValue();
+    }
+    json.endObject();
+  }
+  json.endArray();
+
+  json.key("tasks").beginArray();
+  for (uint8_t i = 0; ; i++) {
+    task_profile_t t;
+    portENTER_CRITICAL(&_mux);
+    bool more = i < _taskCount;
+    if (more) {
+      t = _tasks[i];
+    }
+    portEXIT_CRITICAL(&_mux);
+    if (!more) {
+      break;
+    }
+
+    json.beginObject();
+    json.add("name", (const char*)t.name);
+    json.add("core", (int)t.core);
+    json.add("priority", (int)t.priority);
+    json.add("state", (int)t.state);
+    json.add("stackfree", (unsigned long)t.stackFree);
+    json.key("cpu").value(t.cpuPermille / 10.0, 1);
+    json.endObject();
+  }
+  json.endArray();
+
+  json.key("warnings").beginObject();
+  json.add("audiostack", (long)metrics.get(METRIC_AUDIO_STACK_WARNINGS));
+  json.add("core1idle", (long)metrics.get(METRIC_CORE1_IDLE_WARNINGS));
+  json.endObject();
+
+  json.endObject();
+}
+
+// ************************************************************
+// Library internal singleton wiring
+// ************************************************************
+TaskProfiler_ &TaskProfiler_::getInstance() {
+  static TaskProfiler_ instance;
+  return instance;
+}
+
+TaskProfiler_ &taskProfiler = taskProfiler.getInstance();
@@ -0,0 +1,232 @@
+#include "Trace.h"
+
+#ifdef FEATURE_TRACE
+
+#include <esp_timer.h>
+
+// ************************************************************
+// Rings are allocated in begin()
+// ************************************************************
+Trace_::Trace_() {
+  for (int i = 0; i < portNUM_PROCESSORS; i++) {
+    _rings[i].events = nullptr;
+    _rings[i].head.store(0, std::memory_order_relaxed);
+    _dumpEnd[i] = 0;
+  }
+}
+
+// ************************************************************
+// Allocate one ring per core, from PSRAM if we have it
+// ************************************************************
+bool Trace_::begin() {
+  if (_recording) {
+    return true;
+  }
+  uint32_t entries = psramFound() ? TRACE_RING_EVENTS : TRACE_RING_EVENTS_SRAM;
+  for (int i = 0; i < portNUM_PROCESSORS; i++) {
+    size_t bytes = entries * sizeof(trace_event_t);
+    _rings[i].events = (trace_event_t*)(psramFound() ? ps_calloc(1, bytes) : calloc(1, bytes));
+    if (!_rings[i].events) {
+      return false;
+    }
+  }
+  _mask = entries - 1;
+  _recording = true;
+  return true;
+}
+
+// ************************************************************
+// Record one event on the calling core's ring. Tasks on the
+// same core can pre-empt each other, so the slot is claimed
+// with an atomic increment; the sequence number is written
+// last so the dump can skip a half written event.
+// ************************************************************
+void Trace_::record(char phase, const char* name) {
+  if (!_recording) {
+    return;
+  }
+  trace_ring_t &ring = _rings[xPortGetCoreID()];
+  uint32_t pos = ring.head.fetch_add(1, std::memory_order_relaxed);
+  trace_event_t &ev = ring.events[pos & _mask];
+
+  ev.seq = 0;
+  ev.ts = esp_timer_get_time();
+  ev.name = name;
+  ev.phase = phase;
+  TaskHandle_t task = xTaskGetCurrentTaskHandle();
+  ev.tid = (uint32_t)(uintptr_t)task;
+  strncpy(ev.task, pcTaskGetTaskName(task), sizeof(ev.task) - 1);
+  ev.task[sizeof(ev.task) - 1] = '\0';
+  std::atomic_thread_fence(std::memory_order_release);
+  ev.seq = pos + 1;
+}
+
+// ************************************************************
+// Freeze the rings and set up the dump cursor
+// ************************************************************
+bool Trace_::startDump() {
+  if (_dumping || !_mask) {
+    return false;
+  }
+  _dumping = true;
+  _recording = false;
+
+  for (int i = 0; i < portNUM_PROCESSORS; i++) {
+    _dumpEnd[i] = _rings[i].head.load(std::memory_order_acquire);
+  }
+  _stage = DUMP_STAGE_HEADER;
+  _dumpCore = 0;
+  _dumpPos = (_dumpEnd[0] > _mask + 1) ? _dumpEnd[0] - (_mask + 1) : 0;
+  _firstEvent = true;
+  _threadCount = 0;
+  _threadIndex = 0;
+  _lineLength = 0;
+  _lineOffset = 0;
+  return true;
+}
+
+// ************************************************************
+// Done (or abandoned) - carry on recording
+// ************************************************************
+void Trace_::endDump() {
+  if (!_dumping) {
+    return;
+  }
+  _stage = DUMP_STAGE_DONE;
+  _recording = true;
+  _dumping = false;
+}
+
+// ************************************************************
+// Remember which task ran on which core, for the thread name
+// metadata at the end of the dump
+// ************************************************************
+void Trace_::noteThread(uint8_t core, const trace_event_t &ev) {
+  for (uint8_t i = 0; i < _threadCount; i++) {
+    if (_threads[i].tid == ev.tid && _threads[i].core == core) {
+      return;
+    }
+  }
+  if (_threadCount < TRACE_MAX_THREADS) {
+    trace_thread_t &t = _threads[_threadCount++];
+    t.tid = ev.tid;
+    t.core = core;
+    strncpy(t.name, ev.task, sizeof(t.name) - 1);
+    t.name[sizeof(t.name) - 1] = '\0';
+  }
+}
+
+// ************************************************************
+// Format the next complete event into the line buffer, moving
+// on to the next core when this one is exhausted
+// ************************************************************
+bool Trace_::nextEventLine() {
+  while (_dumpCore < portNUM_PROCESSORS) {
+    while (_dumpPos < _dumpEnd[_dumpCore]) {
+      uint32_t pos = _dumpPos++;
+      const trace_event_t &ev = _rings[_dumpCore].events[pos & _mask];
+      if (ev.seq != pos + 1) {
+        continue;
+      }
+      noteThread(_dumpCore, ev);
+      int len = snprintf(_line, sizeof(_line), "%s{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%llu,\"pid\":%u,\"tid\":%u%s}",
+                         _firstEvent ? "" : ",\n", ev.name, ev.phase, (unsigned long long)ev.ts,
+                         (unsigned)_dumpCore, (unsigned)ev.tid, ev.phase == 'i' ? ",\"s\":\"t\"" : "");
+      _lineLength = min((size_t)len, sizeof(_line) - 1);
+      _firstEvent = false;
+      return true;
+    }
+    _dumpCore++;
+    if (_dumpCore < portNUM_PROCESSORS) {
+      uint32_t end = _dumpEnd[_dumpCore];
+      _dumpPos = (end > _mask + 1) ? end - (_mask + 1) : 0;
+    }
+  }
+  return false;
+}
+
+// ************************************************************
+// Produce the next piece of JSON. Returns false at the end.
+// ************************************************************
+bool Trace_::nextLine() {
+  int len = 0;
+  _lineOffset = 0;
+  _lineLength = 0;
+  for (;;) {
+    switch (_stage) {
+      case DUMP_STAGE_HEADER:
+        len = snprintf(_line, sizeof(_line), "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+        _stage = DUMP_STAGE_EVENTS;
+        _lineLength = len;
+        return true;
+
+      case DUMP_STAGE_EVENTS:
+        if (nextEventLine()) {
+          return true;
+        }
+        _stage = DUMP_STAGE_THREADS;
+        break;
+
+      case DUMP_STAGE_THREADS:
+        // Name the cores and the tasks seen on them
+        if (_threadIndex < portNUM_PROCESSORS) {
+          len = snprintf(_line, sizeof(_line), "%s{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%u,\"args\":{\"name\":\"Core %u\"}}",
+                         _firstEvent ? "" : ",\n", (unsigned)_threadIndex, (unsigned)_threadIndex);
+        } else if (_threadIndex < portNUM_PROCESSORS + _threadCount) {
+          const trace_thread_t &t = _threads[_threadIndex - portNUM_PROCESSORS];
+          len = snprintf(_line, sizeof(_line), ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%u,\"tid\":%u,\"args\":{\"name\":\"%s\"}}",
+                         (unsigned)t.core, (unsigned)t.tid, t.name);
+        } else {
+          _stage = DUMP_STAGE_FOOTER;
+          break;
+        }
+        _threadIndex++;
+        _firstEvent = false;
+        _lineLength = min((size_t)len, sizeof(_line) - 1);
+        return true;
+
+      case DUMP_STAGE_FOOTER:
+        len = snprintf(_line, sizeof(_line), "\n]}\n");
+        _stage = DUMP_STAGE_DONE;
+        _lineLength = len;
+        return true;
+
+      case DUMP_STAGE_DONE:
+        return false;
+    }
+  }
+}
+
+// ************************************************************
+// Chunked response filler: copy as much JSON as fits
+// ************************************************************
+size_t Trace_::fillDump(uint8_t* buffer, size_t maxLen) {
+  size_t written = 0;
+  while (written < maxLen) {
+    if (_lineOffset >= _lineLength) {
+      if (!nextLine()) {
+        break;
+      }
+    }
+    size_t n = min(maxLen - written, _lineLength - _lineOffset);
+    memcpy(buffer + written, _line + _lineOffset, n);
+    written += n;
+    _lineOffset += n;
+  }
+  if (written == 0) {
+    endDump();
+  }
+  return written;
+}
+
+// ************************************************************
+// Library internal singleton wiring
+// ************************************************************
+Trace_ &Trace_::getInstance() {
+  static Trace_ instance;
+  return instance;
+}
+
+Trace_ &trace = trace.getInstance();
+
+#endif
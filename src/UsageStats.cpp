@@ -0,0 +1,105 @@
+#include "UsageStats.h"
+#include <stddef.h>
+#include <esp_attr.h>
+#include <esp_rom_crc.h>
+#include "ConfigStore.h"
+#include "DebugManager.h"
+
+// Not cleared at boot - only a power cut loses it, and the CRC tells
+static RTC_NOINIT_ATTR stats_rtc_t rtcStats;
+
+static uint32_t rtcCrc(const stats_rtc_t &block) {
+  return esp_rom_crc32_le(0, (const uint8_t *)&block, offsetof(stats_rtc_t, crc));
+}
+
+// ************************************************************
+// Take over counters that didn't make it to flash before a
+// reset
+// ************************************************************
+void UsageStats_::begin() {
+  _lock = xSemaphoreCreateMutex();
+  if (rtcStats.magic == STATS_RTC_MAGIC && rtcStats.crc == rtcCrc(rtcStats) && rtcStats.uptimeMins > cs->uptimeMins) {
+    _recoveredMins = rtcStats.uptimeMins - cs->uptimeMins;
+    debugMsgSpff("Usage stats: recovered %u minutes from RTC memory", (unsigned)_recoveredMins);
+    cs->uptimeMins = rtcStats.uptimeMins;
+    cs->playtimeMins = rtcStats.playtimeMins;
+    commit();
+  } else {
+    toRtc();
+  }
+}
+
+// ************************************************************
+// Count a minute
+// ************************************************************
+void UsageStats_::tick(bool playing) {
+  xSemaphoreTake(_lock, portMAX_DELAY);
+  cs->uptimeMins++;
+  if (playing) {
+    cs->playtimeMins++;
+  }
+  toRtc();
+  bool due = ++_sinceCommit >= STATS_COMMIT_MINUTES;
+  xSemaphoreGive(_lock);
+
+  if (due) {
+    commit();
+  }
+}
+
+// ************************************************************
+// The web server commits too. The stats record alternates
+// between two slots, so only one save may be picking the slot
+// and sequence number at a time.
+// ************************************************************
+bool UsageStats_::commit() {
+  xSemaphoreTake(_lock, portMAX_DELAY);
+  toRtc();
+  bool saved = configStore.saveStats();
+  if (saved) {
+    _commits++;
+    _sinceCommit = 0;
+  } else {
+    _commitFailures++;
+    // Try again next minute
+    _sinceCommit = STATS_COMMIT_MINUTES - 1;
+  }
+  xSemaphoreGive(_lock);
+  return saved;
+}
+
+void UsageStats_::sync() {
+  xSemaphoreTake(_lock, portMAX_DELAY);
+  toRtc();
+  xSemaphoreGive(_lock);
+}
+
+void UsageStats_::toRtc() {
+  rtcStats.magic = STATS_RTC_MAGIC;
+  rtcStats.uptimeMins = cs->uptimeMins;
+  rtcStats.playtimeMins = cs->playtimeMins;
+  rtcStats.crc = rtcCrc(rtcStats);
+}
+
+// ************************************************************
+// For diagnostics
+// ************************************************************
+void UsageStats_::writeJson(JsonStreamWriter &json) {
+  json.add("uptimemins", (unsigned long)cs->uptimeMins);
+  json.add("playtimemins", (unsigned long)cs->playtimeMins);
+  json.add("commitmins", STATS_COMMIT_MINUTES);
+  json.add("pendingmins", (unsigned)_sinceCommit);
+  json.add("commits", _commits);
+  json.add("commitfailures", _commitFailures);
+  json.add("recoveredmins", _recoveredMins);
+}
+
+// ************************************************************
+// Library internal singleton wiring
+// ************************************************************
+UsageStats_ &UsageStats_::getInstance() {
+  static UsageStats_ instance;
+  return instance;
+}
+
+UsageStats_ &usageStats = usageStats.getInstance();
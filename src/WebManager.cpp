@@ -1,6 +1,71 @@
 #include "WebManager.h"
 #include <ArduinoOTA.h>
 #include <Update.h>
+#include "WebAssets.h"
+#include "Metrics.h"
+#include "Trace.h"
+
+// ************************************************************
+// Find an embedded web asset by URL path
+// ************************************************************
+static const WebAsset* findWebAsset(const char* path) {
+  for (size_t i = 0; i < webAssetCount; i++) {
+    if (strcmp(webAssets[i].path, path) == 0) {
+      return &webAssets[i];
+    }
+  }
+  return nullptr;
+}
+
+// ************************************************************
+// Send an embedded asset gzipped straight from flash, or a 304
+// if the browser already holds this version
+// ************************************************************
+static void sendWebAsset(AsyncWebServerRequest *request, const WebAsset* asset) {
+  if (request->hasHeader("If-None-Match") &&
+      request->getHeader("If-None-Match")->value() == asset->etag) {
+    AsyncWebServerResponse *resp = request->beginResponse(304);
+    resp->addHeader("ETag", asset->etag);
+    resp->addHeader("Cache-Control", WEB_ASSET_CACHE_CONTROL);
+    request->send(resp);
+    return;
+  }
+
+  AsyncWebServerResponse *resp = request->beginResponse(200, asset->mimeType, asset->data, asset->length);
+  resp->addHeader("Content-Encoding", "gzip");
+  resp->addHeader("ETag", asset->etag);
+  resp->addHeader("Cache-Control", WEB_ASSET_CACHE_CONTROL);
+  resp->addHeader("Vary", "Accept-Encoding");
+  request->send(resp);
+}
+
+// ************************************************************
+// Map a URL onto an embedded asset
+// ************************************************************
+static void serveWebAsset(AsyncWebServerRequest *request, const char* assetPath) {
+  const WebAsset* asset = findWebAsset(assetPath);
+  if (asset) {
+    sendWebAsset(request, asset);
+  } else {
+    request->send(404, "text/plain", "The content you are looking for was not found.");
+  }
+}
+
+// ************************************************************
+// Count every request, whichever handler takes it. Middleware
+// survives server.reset(), so only add it once.
+// ************************************************************
+void WebManager_::addRequestMetrics() {
+  if (_requestMetricsAdded) {
+    return;
+  }
+  server.addMiddleware([](AsyncWebServerRequest *request, ArMiddlewareNext next) {
+    metrics.inc(METRIC_HTTP_REQUESTS);
+    TRACE_SCOPE("http.request");
+    next();
+  });
+  _requestMetricsAdded = true;
+}
 
 // ************************************************************
 // Open up the normal page handlers
@@ -8,19 +73,46 @@
 void WebManager_::begin() {
   debugMsgWbm("Setting up server endpoints");
   server.reset();
-  server.serveStatic("/", SPIFFS, "/web/").setDefaultFile("index.html");
+  addRequestMetrics();
+
+  // Pages are embedded gzipped in flash - no SPIFFS access while streaming
+  server.on("/", HTTP_GET, [](AsyncWebServerRequest *request) {
+    serveWebAsset(request, "/index.html");
+  });
+  for (size_t i = 0; i < webAssetCount; i++) {
+    const WebAsset* asset = &webAssets[i];
+    server.on(asset->path, HTTP_GET, [asset](AsyncWebServerRequest *request) {
+      sendWebAsset(request, asset);
+    });
+  }
 
   // Summary and diagnostics
   server.on("/api/getSummary", HTTP_GET, getSummaryDataHandler);
   server.on("/api/getDiags", HTTP_GET, getDiagsDataHandler);
+  server.on("/metrics", HTTP_GET, getMetricsHandler);
+  server.on("/api/tasks", HTTP_GET, getTasksHandler);
+  server.on("/api/loop", HTTP_GET, getLoopHandler);
+  server.on("/api/link", HTTP_GET, getLinkHandler);
+  server.on("/api/resolver", HTTP_GET, getResolverHandler);
+  server.on("/api/health", HTTP_GET, getStreamHealthHandler);
+  server.on("/api/abr", HTTP_GET, getAbrHandler);
+  server.on("/api/silence", HTTP_GET, getSilenceHandler);
+  server.on("/api/probe", HTTP_GET, getProbeHandler);
+  server.on("/api/bench/stream", HTTP_POST, postStreamBenchHandler);
+  server.on("/api/bench/stream", HTTP_GET, getStreamBenchHandler);
+  server.on("/api/logs", HTTP_GET, getLogsHandler);
+  server.on("/api/logs", HTTP_POST, postLogLevelHandler);
 
  // Configure options
   server.on("/api/getConfig", HTTP_GET, getConfigDataHandler);
   server.on("/api/postConfig", HTTP_POST, postConfigDataHandler);
+  server.on("/api/settings", HTTP_GET, getSettingsHandler);
+  server.on("/api/settings", HTTP_POST, postSettingsHandler);
 
   // wifi credentials
   server.on("/api/postWiFiCredentials", HTTP_POST, postWiFiCredentialsHandler);
   server.on("/api/credentials", HTTP_GET, getCredentialsHandler);
+  server.on("/api/credentials/delete", HTTP_POST, deleteWiFiCredentialHandler);
 
   // Utilities
   server.on("/utils/resetwifi", HTTP_GET, resetWifiHandler);
@@ -36,10 +128,13 @@ void WebManager_::begin() {
         request->redirect("/utility.html");;
     });
   server.on("/utils/restart", HTTP_GET, restartHandler);
+#ifdef FEATURE_TRACE
+  server.on("/utils/trace", HTTP_GET, getTraceHandler);
+#endif
 
   // OTA web update
   server.on("/update", HTTP_GET, [](AsyncWebServerRequest *request) {
-    request->send(SPIFFS, "/web/update.html", "text/html");
+    serveWebAsset(request, "/update.html");
   });
   server.on("/update", HTTP_POST,
     [](AsyncWebServerRequest *request) {
@@ -48,8 +143,7 @@ void WebManager_::begin() {
       resp->addHeader("Connection", "close");
       request->send(resp);
       if (ok) {
-        delay(100);
-        ESP.restart();
+        scheduleRestart(100);
       }
     },
     [](AsyncWebServerRequest *request, String filename, size_t index, uint8_t *data, size_t len, bool final) {
@@ -80,8 +174,7 @@ void WebManager_::begin() {
       resp->addHeader("Connection", "close");
       request->send(resp);
       if (ok) {
-        delay(100);
-        ESP.restart();
+        scheduleRestart(100);
       }
     },
     [](AsyncWebServerRequest *request, String filename, size_t index, uint8_t *data, size_t len, bool final) {
@@ -105,10 +198,20 @@ void WebManager_::begin() {
   );
 
   // Radio web interface
-  server.on("/radio", HTTP_GET, radioPageHandler);
+  server.on("/radio", HTTP_GET, [](AsyncWebServerRequest *request) {
+    serveWebAsset(request, "/radio.html");
+  });
+  server.on("/api/stations/search", HTTP_GET, getStationSearchHandler);
   server.on("/api/stations/delete", HTTP_POST, deleteStationHandler);
   server.on("/api/stations", HTTP_GET, getStationsHandler);
   server.on("/api/stations", HTTP_POST, postStationHandler);
+  server.on("/api/store/import", HTTP_POST, postImportHandler, postImportUploadHandler, postImportBodyHandler);
+  server.on("/api/store/import", HTTP_GET, getImportHandler);
+  server.on("/api/stats", HTTP_GET, getStationStatsHandler);
+  server.on("/api/store/delete", HTTP_POST, postStoreDeleteHandler);
+  server.on("/api/store/preset", HTTP_POST, postStorePresetHandler);
+  server.on("/api/store", HTTP_GET, getStoreHandler);
+  server.on("/api/store", HTTP_POST, postStoreHandler);
   server.on("/api/status", HTTP_GET, getStatusHandler);
   server.on("/api/play", HTTP_POST, postPlayHandler);
   server.on("/api/stop", HTTP_POST, postStopHandler);
@@ -150,6 +253,7 @@ public:
 void WebManager_::beginPortal() {
   debugMsgWbm("Setting up server endpoints for Portal");
   server.reset();
+  addRequestMetrics();
 
   // serve the captive page
   server.addHandler(new CaptiveRequestHandler()).setFilter(ON_AP_FILTER);
@@ -157,6 +261,7 @@ void WebManager_::beginPortal() {
   // wifi credentials
   server.on("/api/postWiFiCredentials", HTTP_POST, postWiFiCredentialsHandler);
   server.on("/api/credentials", HTTP_GET, getCredentialsHandler);
+  server.on("/api/credentials/delete", HTTP_POST, deleteWiFiCredentialHandler);
   server.on("/api/getWiFiNetworks", HTTP_GET, getWiFiNetworksHandler);
 
   // Utilities
@@ -1,5 +1,43 @@
 #include "WiFiManager.h"
 #include "RadioMenuConfiguration.h"
+#include "Metrics.h"
+#include "Trace.h"
+#include "Scheduler.h"
+#include "LoopProfiler.h"
+#include <Preferences.h>
+#include "RadioOutputManager.h"
+#include "LinkMonitor.h"
+#include "StationResolver.h"
+
+// NVS location of the fast connect cache
+static const char* WIFI_NVS_NAMESPACE = "wifi";
+static const char* WIFI_NVS_FAST_KEY = "fast";
+
+// A failed roam and the way back have to fit in the audio a roam waits for
+static_assert(WIFI_ROAM_CONNECT_TIMEOUT_MS + WIFI_ROAM_RETURN_MS <= WIFI_ROAM_MIN_BUFFER_MS, "roam buffer too small");
+
+// Must match the WiFiState order
+static const char* const WIFI_STATE_NAMES[] = {
+  "idle", "scanning", "connecting", "connected", "portal"
+};
+
+// ************************************************************
+// Scheduler trampolines for the steps of each sequence
+// ************************************************************
+static void wifiBeginJob() { wifiManager.beginStep(); }
+static void wifiScanJob() { wifiManager.scanStep(); }
+static void wifiPortalJob() { wifiManager.portalStep(); }
+static void wifiWpsJob() { wifiManager.wpsStep(); }
+static void wifiSmartConfigJob() { wifiManager.smartConfigStep(); }
+static void wifiTimeoutJob() { wifiManager.checkTimeouts(); }
+static void wifiSelectJob() { wifiManager.selectStep(); }
+static void wifiRoamCheckJob() { wifiManager.roamCheck(); }
+static void wifiDnsJob() {
+  LoopStepTimer step(LOOP_STEP_DNS);
+  wifiManager.manageDNSInOpenAP();
+}
+static void wifiRoamJob() { wifiManager.roamStep(); }
+static void wifiEventJob() { wifiManager.runEvents(); }
 
 // ************************************************************
 // Utility: Set up WPS
@@ -32,16 +70,15 @@ void WiFiEvent(WiFiEvent_t event, arduino_event_info_t info)
     debugMsgWfm("IP Address: " + WiFi.localIP().toString());
     debugMsgWfm("MAC Address: " + WiFi.macAddress());
     debugMsgWfm("Host name: " + String(WiFi.getHostname()));
-    wifiManager.saveWiFiCredentials(WiFi.SSID(), WiFi.psk());
-    wifiManager.startWiFiServices();
-    menuSystem.showFlashMessage(("Connected to\n" + WiFi.SSID()).c_str());
+    metrics.inc(METRIC_WIFI_CONNECTS);
+    wifiManager.postEvent(event);
     break;
   case ARDUINO_EVENT_WIFI_STA_DISCONNECTED:
     debugMsgWfm("Disconnected from station");
-    if (doAutoReconnect) {
-      debugMsgWfm("autoreconnect on, trying reconnect");
-      WiFi.reconnect();
-    }
+    metrics.inc(METRIC_WIFI_DISCONNECTS);
+    TRACE_INSTANT("wifi.disconnected");
+    linkMonitor.noteEvent(LINK_EVENT_WIFI_DISCONNECT);
+    wifiManager.postEvent(event);
     break;
   case ARDUINO_EVENT_WPS_ER_SUCCESS:
     debugMsgWfm("WPS Successfull, connecting...");
@@ -65,7 +102,7 @@ void WiFiEvent(WiFiEvent_t event, arduino_event_info_t info)
     break;
   case ARDUINO_EVENT_WIFI_SCAN_DONE:
     debugMsgWfm("Scan complete");
-    wifiManager.processScanResults();
+    wifiManager.postEvent(event);
     break;
   case ARDUINO_EVENT_WIFI_READY:
     debugMsgWfm("WiFi ready");
@@ -90,6 +127,7 @@ void WiFiEvent(WiFiEvent_t event, arduino_event_info_t info)
 // Set up the WiFi for normal use
 // ************************************************************
 void WiFiManager_::setUpWiFi() {
+  _events = xQueueCreate(WIFI_EVENT_QUEUE_LEN, sizeof(WiFiEvent_t));
   WiFi.onEvent(WiFiEvent);
 
   String mac = String(WiFi.macAddress());
@@ -98,6 +136,268 @@ void WiFiManager_::setUpWiFi() {
 
   debugMsgWfm("Unique hostname: " + uniqHostname);
   WiFi.setHostname(uniqHostname.c_str());
+
+  loadFastCache();
+
+  scheduler.every("wifi", 1000, wifiTimeoutJob, SCHEDULER_PRIORITY_LOW);
+  scheduler.every("roam", WIFI_ROAM_CHECK_MS, wifiRoamCheckJob, SCHEDULER_PRIORITY_LOW);
+}
+
+// ************************************************************
+// Read the last good connection from NVS
+// ************************************************************
+void WiFiManager_::loadFastCache() {
+  Preferences prefs;
+  _fastCacheValid = false;
+  if (prefs.begin(WIFI_NVS_NAMESPACE, true)) {
+    size_t got = prefs.getBytes(WIFI_NVS_FAST_KEY, &_fastCache, sizeof(_fastCache));
+    _fastCacheValid = (got == sizeof(_fastCache) && _fastCache.version == WIFI_FAST_CACHE_VERSION && _fastCache.channel > 0);
+    prefs.end();
+  }
+  if (_fastCacheValid) {
+    debugMsgWfmf("Fast connect cache: %s ch %d %02x:%02x:%02x:%02x:%02x:%02x", _fastCache.ssid, _fastCache.channel,
+                 _fastCache.bssid[0], _fastCache.bssid[1], _fastCache.bssid[2],
+                 _fastCache.bssid[3], _fastCache.bssid[4], _fastCache.bssid[5]);
+  }
+}
+
+// ************************************************************
+// Remember the connection we just made. Only writes to flash
+// when something changed.
+// ************************************************************
+void WiFiManager_::updateFastCache() {
+  wifi_fast_cache_t fresh;
+  memset(&fresh, 0, sizeof(fresh));
+  fresh.version = WIFI_FAST_CACHE_VERSION;
+  fresh.channel = WiFi.channel();
+  uint8_t* bssid = WiFi.BSSID();
+  if (bssid == nullptr || fresh.channel == 0) {
+    return;
+  }
+  memcpy(fresh.bssid, bssid, sizeof(fresh.bssid));
+  strncpy(fresh.ssid, WiFi.SSID().c_str(), sizeof(fresh.ssid) - 1);
+  fresh.ip = WiFi.localIP();
+  fresh.gateway = WiFi.gatewayIP();
+  fresh.subnet = WiFi.subnetMask();
+  fresh.dns1 = WiFi.dnsIP(0);
+  fresh.dns2 = WiFi.dnsIP(1);
+
+  if (_fastCacheValid && memcmp(&fresh, &_fastCache, sizeof(fresh)) == 0) {
+    return;
+  }
+
+  Preferences prefs;
+  if (prefs.begin(WIFI_NVS_NAMESPACE, false)) {
+    prefs.putBytes(WIFI_NVS_FAST_KEY, &fresh, sizeof(fresh));
+    prefs.end();
+    _fastCache = fresh;
+    _fastCacheValid = true;
+    debugMsgWfm("Updated fast connect cache");
+  }
+}
+
+// ************************************************************
+// Forget the last connection
+// ************************************************************
+void WiFiManager_::clearFastCache() {
+  Preferences prefs;
+  if (prefs.begin(WIFI_NVS_NAMESPACE, false)) {
+    prefs.remove(WIFI_NVS_FAST_KEY);
+    prefs.end();
+  }
+  _fastCacheValid = false;
+}
+
+// ************************************************************
+// The cached BSSID/channel didn't work: drop the cache for this
+// attempt and connect the slow way
+// ************************************************************
+void WiFiManager_::fallBackToFullConnect() {
+  debugMsgWfm("Fast connect failed, falling back to full scan");
+  metrics.inc(METRIC_WIFI_FAST_FALLBACKS);
+  _fastAttempt = false;
+  _fastCacheValid = false;
+  scheduleStep("wifi.begin", WIFI_SETTLE_MS, wifiBeginJob);
+  WiFi.disconnect();
+}
+
+// ************************************************************
+// State handling
+// ************************************************************
+void WiFiManager_::setState(WiFiState state) {
+  if (state != _state) {
+    debugMsgWfm(String("State ") + WIFI_STATE_NAMES[_state] + " -> " + WIFI_STATE_NAMES[state]);
+    _state = state;
+  }
+}
+
+const char* WiFiManager_::getStateName() {
+  return WIFI_STATE_NAMES[_state];
+}
+
+// ************************************************************
+// Events that move the connect sequences on are handed to the
+// main loop, in order, so the steps and their state are only
+// ever touched from there
+// ************************************************************
+void WiFiManager_::postEvent(WiFiEvent_t event) {
+  bool idle = uxQueueMessagesWaiting(_events) == 0;
+  if (xQueueSend(_events, &event, 0) != pdTRUE) {
+    debugMsgWfm("WiFi event queue full, event dropped");
+    return;
+  }
+  // A job that is already going to run picks this one up too
+  if (idle) {
+    scheduler.after("wifi.event", 0, wifiEventJob, SCHEDULER_PRIORITY_HIGH);
+  }
+}
+
+void WiFiManager_::runEvents() {
+  WiFiEvent_t event;
+  while (xQueueReceive(_events, &event, 0) == pdTRUE) {
+    switch (event) {
+    case ARDUINO_EVENT_WIFI_STA_GOT_IP:
+      onGotIP();
+      saveWiFiCredentials(WiFi.SSID(), WiFi.psk());
+      startWiFiServices();
+      menuSystem.showFlashMessage(("Connected to\n" + WiFi.SSID()).c_str());
+      break;
+    case ARDUINO_EVENT_WIFI_STA_DISCONNECTED:
+      onDisconnected();
+      break;
+    case ARDUINO_EVENT_WIFI_SCAN_DONE:
+      if (!onScanDone()) {
+        processScanResults();
+      }
+      break;
+    default:
+      break;
+    }
+  }
+}
+
+// ************************************************************
+// Queue the next step of a sequence, replacing any step that
+// hasn't run yet. Main loop only.
+// ************************************************************
+void WiFiManager_::scheduleStep(const char* name, uint32_t delayMs, SchedulerJob fn) {
+  scheduler.cancel(_stepJob);
+  _stepJob = scheduler.after(name, delayMs, fn);
+}
+
+// ************************************************************
+// Got an IP: the connect is done
+// ************************************************************
+void WiFiManager_::onGotIP() {
+  if (_state == WIFI_STATE_CONNECTING) {
+    metrics.observe(METRIC_WIFI_CONNECT_MS, millis() - _connectStartMillis);
+  }
+  if (_fastAttempt) {
+    metrics.inc(METRIC_WIFI_FAST_CONNECTS);
+    _fastAttempt = false;
+  }
+  if (!_bootConnectRecorded) {
+    _bootConnectRecorded = true;
+    metrics.set(METRIC_BOOT_WIFI_MS, millis());
+    debugMsgWfmf("Boot to WiFi connected: %lums", millis());
+  }
+  _waitingForUser = false;
+  _roamInProgress = false;
+  _roamConnecting = false;
+  setState(WIFI_STATE_CONNECTED);
+  updateFastCache();
+  stationResolver.wake();
+}
+
+// ************************************************************
+// Lost the station. With autoreconnect on, go straight back to
+// connecting, otherwise sit idle.
+// ************************************************************
+void WiFiManager_::onDisconnected() {
+  if (_roamInProgress) {
+    // Leaving the old AP - expected. The next one means the new AP turned us down.
+    _roamInProgress = false;
+    _roamConnecting = true;
+    return;
+  }
+  if (_roamConnecting) {
+    roamFailed("rejected");
+    return;
+  }
+  if (_fastAttempt && _stepJob < 0) {
+    // Typically "no AP found" - the AP has moved channel or we're somewhere else
+    fallBackToFullConnect();
+    return;
+  }
+  if (_state == WIFI_STATE_PORTAL || _state == WIFI_STATE_SCANNING || _stepJob >= 0) {
+    // Expected while scanning, serving the portal or between the steps of a sequence
+    return;
+  }
+  if (doAutoReconnect) {
+    debugMsgWfm("autoreconnect on, trying reconnect");
+    if (_state != WIFI_STATE_CONNECTING) {
+      _connectStartMillis = millis();
+    }
+    setState(WIFI_STATE_CONNECTING);
+    WiFi.reconnect();
+  } else if (_state == WIFI_STATE_CONNECTED) {
+    setState(WIFI_STATE_IDLE);
+  }
+}
+
+// ************************************************************
+// A scan finished, go back to what we were doing. Scans we
+// started to pick or roam between APs are handed to the main
+// loop; returns true for those.
+// ************************************************************
+bool WiFiManager_::onScanDone() {
+  if (_roamScan || _selectScan) {
+    metrics.observe(METRIC_WIFI_SCAN_MS, millis() - _scanStartMillis);
+    if (_roamScan) {
+      _roamScan = false;
+      scheduleStep("wifi.roam", 0, wifiRoamJob);
+    } else {
+      _selectScan = false;
+      scheduleStep("wifi.select", 0, wifiSelectJob);
+    }
+    return true;
+  }
+  if (_state == WIFI_STATE_SCANNING) {
+    metrics.observe(METRIC_WIFI_SCAN_MS, millis() - _scanStartMillis);
+    setState(_stateBeforeScan);
+  }
+  return false;
+}
+
+// ************************************************************
+// Once a second: give up on connects and scans that have been
+// going too long
+// ************************************************************
+void WiFiManager_::checkTimeouts() {
+  // Any events left when the scheduler had no room for the job
+  runEvents();
+
+  unsigned long now = millis();
+  if ((_roamInProgress || _roamConnecting) && now - _connectStartMillis > WIFI_ROAM_CONNECT_TIMEOUT_MS) {
+    roamFailed("timed out");
+  } else if (_state == WIFI_STATE_CONNECTING && _fastAttempt && _stepJob < 0 && now - _connectStartMillis > WIFI_FAST_CONNECT_TIMEOUT_MS) {
+    fallBackToFullConnect();
+  } else if (_state == WIFI_STATE_CONNECTING && !_waitingForUser && now - _connectStartMillis > WIFI_CONNECT_TIMEOUT_MS) {
+    debugMsgWfm("Connect timed out");
+    metrics.inc(METRIC_WIFI_CONNECT_FAILURES);
+    if (doAutoReconnect) {
+      _connectStartMillis = now;
+      WiFi.reconnect();
+    } else {
+      setState(WIFI_STATE_IDLE);
+      menuSystem.showFlashMessage("Connect failed");
+    }
+  } else if (_state == WIFI_STATE_SCANNING && now - _scanStartMillis > WIFI_SCAN_TIMEOUT_MS) {
+    debugMsgWfm("Scan timed out");
+    _selectScan = false;
+    WiFi.scanDelete();
+    setState(_stateBeforeScan);
+  }
 }
 
 // ************************************************************
@@ -108,10 +408,24 @@ void WiFiManager_::startScanWiFiNetworks() {
   menuSystem.showFlashMessage("Scanning...");
   WiFi.onEvent(WiFiEvent, ARDUINO_EVENT_SC_SCAN_DONE);
 
+  // Set the state first so the disconnect event doesn't trigger a reconnect
+  if (_state != WIFI_STATE_SCANNING) {
+    _stateBeforeScan = (_state == WIFI_STATE_PORTAL) ? WIFI_STATE_PORTAL : WIFI_STATE_IDLE;
+  }
+  _scanStartMillis = millis();
+  setState(WIFI_STATE_SCANNING);
+
   WiFi.mode(WIFI_AP_STA);
   WiFi.disconnect();
-  delay(500);
+  scheduleStep("wifi.scan", WIFI_SETTLE_MS, wifiScanJob);
+}
 
+// ************************************************************
+// Scan step: the radio has settled after the disconnect
+// ************************************************************
+void WiFiManager_::scanStep() {
+  _stepJob = -1;
+  _scanStartMillis = millis();
   WiFi.scanNetworks(true);
 }
 
@@ -180,9 +494,18 @@ String WiFiManager_::getLastScanResultSSID(int index) {
 // ************************************************************
 void WiFiManager_::startSmartConfig() {
   menuSystem.showFlashMessage("SmartConfig started");
+  _connectStartMillis = millis();
+  _waitingForUser = true;
+  setState(WIFI_STATE_CONNECTING);
+  scheduleStep("wifi.smartconfig", WIFI_SETTLE_MS, wifiSmartConfigJob);
   WiFi.disconnect();
-  delay(500);
+}
 
+// ************************************************************
+// SmartConfig step: the radio has settled after the disconnect
+// ************************************************************
+void WiFiManager_::smartConfigStep() {
+  _stepJob = -1;
   WiFi.mode(WIFI_AP_STA);
   WiFi.beginSmartConfig();
 }
@@ -210,49 +533,71 @@ bool WiFiManager_::connectWithWPS() {
     debugMsgWfm("Press the WPS button on your router now.");
     menuSystem.showFlashMessage("Press WPS button");
 
+    _connectStartMillis = millis();
+    _waitingForUser = true;
+    setState(WIFI_STATE_CONNECTING);
     WiFi.mode(WIFI_STA);
-    delay(1000);
-      
-    wpsInitConfig();
-
-    esp_err_t retCodeEnable = esp_wifi_wps_enable(&wps_config);
-    debugMsgWfm("WPS Enable Result: " + String(retCodeEnable));
-
-    esp_err_t retCodeStart = esp_wifi_wps_start(0);
-    debugMsgWfm("WPS Start Result: " + String(retCodeStart));
-
-    return (retCodeEnable == 0 && retCodeStart == 0);
+    scheduleStep("wifi.wps", WIFI_WPS_SETTLE_MS, wifiWpsJob);
+    return true;
   } else {
     debugMsgWfm("Already connected, won't do WPS");
     return false;
   }
 }
 
+// ************************************************************
+// WPS step: station mode is up, start WPS. The result arrives
+// as a WPS event.
+// ************************************************************
+void WiFiManager_::wpsStep() {
+  _stepJob = -1;
+  wpsInitConfig();
+
+  esp_err_t retCodeEnable = esp_wifi_wps_enable(&wps_config);
+  debugMsgWfm("WPS Enable Result: " + String(retCodeEnable));
+
+  esp_err_t retCodeStart = esp_wifi_wps_start(0);
+  debugMsgWfm("WPS Start Result: " + String(retCodeStart));
+
+  if (retCodeEnable != 0 || retCodeStart != 0) {
+    menuSystem.showFlashMessage("WPS failed to start");
+    _waitingForUser = false;
+    setState(WIFI_STATE_IDLE);
+  }
+}
+
 // ************************************************************
 // Start up AP mode
 // ************************************************************
 void WiFiManager_::openAccessPortal() {
   // Captive portal
   if (WiFi.status() != WL_CONNECTED) {
-    startScanWiFiNetworks();
-
     debugMsgWfm("");
     debugMsgWfm("Portal mode");
+    scheduleStep("wifi.portal", WIFI_SETTLE_MS, wifiPortalJob);
     WiFi.disconnect();
-    delay(100);
     WiFi.mode(WIFI_AP_STA);
-    delay(100);
-    debugMsgWfm("Setting soft-AP configuration ... ");
-    WiFi.softAP(uniqHostname.c_str());
-    delay(100);
-    debugMsgWfm("Soft-AP IP address: " + WiFi.softAPIP().toString());
-    menuSystem.showFlashMessage(("Portal: " + WiFi.softAPIP().toString()).c_str());
-    _isOpenAP = true;
   } else {
     menuSystem.showFlashMessage(("Already on " + WiFi.SSID()).c_str());
   }
 }
 
+// ************************************************************
+// Portal step: bring up the soft AP, then scan so the portal
+// has a network list to offer
+// ************************************************************
+void WiFiManager_::portalStep() {
+  _stepJob = -1;
+  debugMsgWfm("Setting soft-AP configuration ... ");
+  WiFi.softAP(uniqHostname.c_str());
+  debugMsgWfm("Soft-AP IP address: " + WiFi.softAPIP().toString());
+  menuSystem.showFlashMessage(("Portal: " + WiFi.softAPIP().toString()).c_str());
+  _isOpenAP = true;
+  setState(WIFI_STATE_PORTAL);
+
+  startScanWiFiNetworks();
+}
+
 // ************************************************************
 // Start up mDNS
 // ************************************************************
@@ -267,7 +612,8 @@ void WiFiManager_::startMDNS() {
 }
 
 // ************************************************************
-// Start up DNS for captive portal capture
+// Start up DNS for captive portal capture, and the job that
+// polls it - the main loop only wakes for it while it runs
 // ************************************************************
 void WiFiManager_::startDNSD() {
   dnsServer.reset(new DNSServer());
@@ -276,14 +622,22 @@ void WiFiManager_::startDNSD() {
   dnsServer->setErrorReplyCode(DNSReplyCode::NoError);
   debugMsgWfm("dns server started with ip: " + WiFi.softAPIP().toString());
   dnsServer->start(DNS_PORT, F("*"), WiFi.softAPIP());
+
+  if (_dnsJob < 0) {
+    _dnsJob = scheduler.every("dns", WIFI_DNS_POLL_MS, wifiDnsJob);
+  }
 }
 
 // ************************************************************
 // Stop DNS for captive portal capture
 // ************************************************************
 void WiFiManager_::stopDNSD() {
-  dnsServer->stop();
-  dnsServer.reset();
+  scheduler.cancel(_dnsJob);
+  _dnsJob = -1;
+  if (dnsServer) {
+    dnsServer->stop();
+    dnsServer.reset();
+  }
 }
 
 // ************************************************************
@@ -291,7 +645,7 @@ void WiFiManager_::stopDNSD() {
 // Captive Portal mode
 // ************************************************************
 void WiFiManager_::manageDNSInOpenAP() {
-  if (_isOpenAP) {
+  if (_isOpenAP && dnsServer) {
     dnsServer->processNextRequest();
   }
 }
@@ -333,36 +687,306 @@ void WiFiManager_::startWiFiServicesPortal() {
 // Startup th WiFi using the credentials we have
 // ************************************************************
 void WiFiManager_::wifiBeginWithCredentials() {
+  _connectStartMillis = millis();
+  _waitingForUser = false;
+  setState(WIFI_STATE_CONNECTING);
+  scheduleStep("wifi.begin", WIFI_SETTLE_MS, wifiBeginJob);
   WiFi.disconnect();
-  delay(1000);
+}
+
+// ************************************************************
+// Connect step: the radio has settled after the disconnect.
+// GOT_IP or the timeout check finishes the connect.
+// ************************************************************
+void WiFiManager_::beginStep() {
+  _stepJob = -1;
+  _roamInProgress = false;
+  _roamConnecting = false;
   WiFi.mode(WIFI_MODE_STA);
-  delay(1000);
-  WiFi.begin(cc->WiFiSSID.c_str(), cc->WiFiPassword.c_str());
+
+  const wifi_credential_t* cached = _fastCacheValid ? findCredential(_fastCache.ssid) : nullptr;
+  _fastAttempt = (cached != nullptr);
+  if (_fastAttempt) {
+    // Straight to the AP we used last time - no scan
+    debugMsgWfmf("Fast connect to %s on channel %d", _fastCache.ssid, _fastCache.channel);
+#ifdef WIFI_FAST_REUSE_IP
+    WiFi.config(IPAddress(_fastCache.ip), IPAddress(_fastCache.gateway), IPAddress(_fastCache.subnet),
+                IPAddress(_fastCache.dns1), IPAddress(_fastCache.dns2));
+#endif
+    WiFi.begin(cached->ssid.c_str(), cached->password.c_str(), _fastCache.channel, _fastCache.bssid);
+    return;
+  }
+
+  // Back to DHCP in case a fast connect set a static config
+  WiFi.config(INADDR_NONE, INADDR_NONE, INADDR_NONE);
+  if (cc->wifiCredentialCount > 1) {
+    // Several networks known - see which are in range first
+    _selectScan = true;
+    _scanStartMillis = millis();
+    WiFi.scanNetworks(true);
+  } else {
+    WiFi.begin(cc->WiFiSSID.c_str(), cc->WiFiPassword.c_str());
+  }
+}
+
+// ************************************************************
+// Select step: connect to the highest priority known network
+// in range, strongest AP first. If none are visible, try the
+// last one anyway - it may be hidden.
+// ************************************************************
+void WiFiManager_::selectStep() {
+  _stepJob = -1;
+  int best = -1;
+  const wifi_credential_t* bestCred = nullptr;
+  int n = WiFi.scanComplete();
+  for (int i = 0; i < n; i++) {
+    const wifi_credential_t* cred = findCredential(WiFi.SSID(i));
+    if (cred == nullptr) {
+      continue;
+    }
+    if (bestCred == nullptr || cred->priority > bestCred->priority ||
+        (cred->priority == bestCred->priority && WiFi.RSSI(i) > WiFi.RSSI(best))) {
+      best = i;
+      bestCred = cred;
+    }
+  }
+
+  if (bestCred) {
+    debugMsgWfmf("Selected %s (priority %d, %d dBm, ch %d)", bestCred->ssid.c_str(), bestCred->priority,
+                 (int)WiFi.RSSI(best), (int)WiFi.channel(best));
+    WiFi.begin(bestCred->ssid.c_str(), bestCred->password.c_str(), WiFi.channel(best), WiFi.BSSID(best));
+  } else {
+    debugMsgWfm("No known network in range, trying " + cc->WiFiSSID);
+    WiFi.begin(cc->WiFiSSID.c_str(), cc->WiFiPassword.c_str());
+  }
+  WiFi.scanDelete();
+}
+
+// ************************************************************
+// The best scan result for an SSID, skipping one BSSID. -1 if
+// there's nothing.
+// ************************************************************
+int WiFiManager_::findBestScanResult(const char* ssid, const uint8_t* excludeBssid) {
+  int best = -1;
+  int n = WiFi.scanComplete();
+  for (int i = 0; i < n; i++) {
+    if (WiFi.SSID(i) != ssid) {
+      continue;
+    }
+    if (excludeBssid && memcmp(WiFi.BSSID(i), excludeBssid, 6) == 0) {
+      continue;
+    }
+    if (best < 0 || WiFi.RSSI(i) > WiFi.RSSI(best)) {
+      best = i;
+    }
+  }
+  return best;
+}
+
+// ************************************************************
+// A scan or a handover stalls the stream for a moment - only
+// do it when the buffer can cover that
+// ************************************************************
+bool WiFiManager_::roamBufferOk() {
+  return !radioOutputManager.isPlaying() || radioOutputManager.getBufferedMs() >= WIFI_ROAM_MIN_BUFFER_MS;
+}
+
+// ************************************************************
+// Every WIFI_ROAM_CHECK_MS: if the link is weak, passively scan
+// for a better AP of the same network. The current channel is
+// scanned first (short, stays mostly on channel); if that finds
+// nothing the next scan covers all channels.
+// ************************************************************
+void WiFiManager_::roamCheck() {
+  if (_state != WIFI_STATE_CONNECTED || _roamScan || _stepJob >= 0) {
+    return;
+  }
+  if (_lastRoamMillis != 0 && millis() - _lastRoamMillis < WIFI_ROAM_HOLDOFF_MS) {
+    return;
+  }
+  int rssi = WiFi.RSSI();
+  if (rssi > WIFI_ROAM_RSSI_THRESHOLD) {
+    _roamAllChannels = false;
+    return;
+  }
+  if (!roamBufferOk()) {
+    metrics.inc(METRIC_WIFI_ROAMS_DEFERRED);
+    return;
+  }
+
+  debugMsgWfmf("Weak link (%d dBm), scanning %s", rssi, _roamAllChannels ? "all channels" : "current channel");
+  metrics.inc(METRIC_WIFI_ROAM_SCANS);
+  _roamScan = true;
+  _scanStartMillis = millis();
+  String ssid = WiFi.SSID();
+  if (WiFi.scanNetworks(true, false, true, WIFI_ROAM_SCAN_MS_PER_CHAN,
+                        _roamAllChannels ? 0 : WiFi.channel(), ssid.c_str()) == WIFI_SCAN_FAILED) {
+    _roamScan = false;
+  }
+}
+
+// ************************************************************
+// Roam step: move to the strongest other AP if it clears the
+// hysteresis margin
+// ************************************************************
+void WiFiManager_::roamStep() {
+  _stepJob = -1;
+  if (_state != WIFI_STATE_CONNECTED) {
+    WiFi.scanDelete();
+    return;
+  }
+
+  String ssid = WiFi.SSID();
+  int rssi = WiFi.RSSI();
+  int best = findBestScanResult(ssid.c_str(), WiFi.BSSID());
+  if (best < 0 || WiFi.RSSI(best) < rssi + WIFI_ROAM_HYSTERESIS_DB) {
+    debugMsgWfmf("No better AP (%d dBm now, best %d dBm)", rssi, best < 0 ? -127 : (int)WiFi.RSSI(best));
+    _roamAllChannels = !_roamAllChannels;
+    WiFi.scanDelete();
+    return;
+  }
+  _roamAllChannels = false;
+
+  const wifi_credential_t* cred = findCredential(ssid);
+  if (cred == nullptr || !roamBufferOk()) {
+    if (cred) {
+      metrics.inc(METRIC_WIFI_ROAMS_DEFERRED);
+    }
+    WiFi.scanDelete();
+    return;
+  }
+
+  debugMsgWfmf("Roaming from %d dBm to %d dBm on ch %d", rssi, (int)WiFi.RSSI(best), (int)WiFi.channel(best));
+  TRACE_INSTANT("wifi.roam");
+  metrics.inc(METRIC_WIFI_ROAMS);
+  _lastRoamMillis = millis();
+  _roamInProgress = true;
+  _fastAttempt = false;
+  _connectStartMillis = millis();
+  setState(WIFI_STATE_CONNECTING);
+  WiFi.begin(cred->ssid.c_str(), cred->password.c_str(), WiFi.channel(best), WiFi.BSSID(best));
+  WiFi.scanDelete();
+}
+
+// ************************************************************
+// The new AP didn't take us: go back to the old one, which is
+// still in the fast connect cache
+// ************************************************************
+void WiFiManager_::roamFailed(const char* why) {
+  debugMsgWfmf("Roam %s, back to the last AP", why);
+  metrics.inc(METRIC_WIFI_CONNECT_FAILURES);
+  _roamInProgress = false;
+  _roamConnecting = false;
+  wifiBeginWithCredentials();
 }
 
 // ************************************************************
 // Save the credentials to SPIFFS if they are valid
 // ************************************************************
-void WiFiManager_::saveWiFiCredentials(String newWiFiSSID, String newWiFiPassword) {
-  if ((cc->WiFiSSID != newWiFiSSID || 
-      cc->WiFiPassword != newWiFiPassword) && 
-      newWiFiSSID.length() > 0 &&
-      newWiFiPassword.length() > 0) {
-    debugMsgWfm("Updating stored WiFi credentials");
+void WiFiManager_::saveWiFiCredentials(String newWiFiSSID, String newWiFiPassword, int priority) {
+  if (newWiFiSSID.length() == 0 || newWiFiPassword.length() == 0) {
+    debugMsgWfm("No changes to WiFi credentials saved");
+    return;
+  }
+
+  bool changed = upsertCredential(newWiFiSSID, newWiFiPassword, priority);
+  if (cc->WiFiSSID != newWiFiSSID || cc->WiFiPassword != newWiFiPassword) {
     cc->WiFiSSID = newWiFiSSID;
     cc->WiFiPassword = newWiFiPassword;
     cc->WifiOnAtStart = true;
-    spiffsStorage.saveConfigToSpiffs();
+    changed = true;
+  }
+
+  if (changed) {
+    debugMsgWfm("Updating stored WiFi credentials");
+    configStore.saveConfig();
     debugMsgWfm("Saved WiFi credentials");
   } else {
     debugMsgWfm("No changes to WiFi credentials saved");
   }
 }
 
+// ************************************************************
+// Add or update a network in the list. A negative priority
+// keeps the existing one. When the list is full the lowest
+// priority entry makes way. Returns true if anything changed.
+// ************************************************************
+bool WiFiManager_::upsertCredential(const String &ssid, const String &password, int priority) {
+  for (uint8_t i = 0; i < cc->wifiCredentialCount; i++) {
+    wifi_credential_t &cred = cc->wifiCredentials[i];
+    if (cred.ssid == ssid) {
+      bool changed = false;
+      if (cred.password != password) {
+        cred.password = password;
+        changed = true;
+      }
+      if (priority >= 0 && cred.priority != priority) {
+        cred.priority = priority;
+        changed = true;
+      }
+      return changed;
+    }
+  }
+
+  uint8_t slot = cc->wifiCredentialCount;
+  if (slot >= MAX_WIFI_CREDENTIALS) {
+    slot = 0;
+    for (uint8_t i = 1; i < MAX_WIFI_CREDENTIALS; i++) {
+      if (cc->wifiCredentials[i].priority <= cc->wifiCredentials[slot].priority) {
+        slot = i;
+      }
+    }
+    debugMsgWfm("Network list full, replacing " + cc->wifiCredentials[slot].ssid);
+  } else {
+    cc->wifiCredentialCount++;
+  }
+  cc->wifiCredentials[slot].ssid = ssid;
+  cc->wifiCredentials[slot].password = password;
+  cc->wifiCredentials[slot].priority = (priority >= 0) ? priority : WIFI_DEFAULT_PRIORITY;
+  return true;
+}
+
+// ************************************************************
+// Forget one network
+// ************************************************************
+bool WiFiManager_::removeWiFiCredential(const String &ssid) {
+  for (uint8_t i = 0; i < cc->wifiCredentialCount; i++) {
+    if (cc->wifiCredentials[i].ssid == ssid) {
+      for (uint8_t j = i; j + 1 < cc->wifiCredentialCount; j++) {
+        cc->wifiCredentials[j] = cc->wifiCredentials[j + 1];
+      }
+      cc->wifiCredentialCount--;
+      if (cc->WiFiSSID == ssid) {
+        cc->WiFiSSID = cc->wifiCredentialCount > 0 ? cc->wifiCredentials[0].ssid : "";
+        cc->WiFiPassword = cc->wifiCredentialCount > 0 ? cc->wifiCredentials[0].password : "";
+      }
+      configStore.saveConfig();
+      return true;
+    }
+  }
+  return false;
+}
+
+// ************************************************************
+// Look up a remembered network
+// ************************************************************
+const wifi_credential_t* WiFiManager_::findCredential(const String &ssid) {
+  for (uint8_t i = 0; i < cc->wifiCredentialCount; i++) {
+    if (cc->wifiCredentials[i].ssid == ssid) {
+      return &cc->wifiCredentials[i];
+    }
+  }
+  return nullptr;
+}
+
 // ************************************************************
 // Undock from the WiFi mothership
 // ************************************************************
 void WiFiManager_::disconnectWiFi() {
+  scheduler.cancel(_stepJob);
+  _stepJob = -1;
+  _waitingForUser = false;
+  setState(WIFI_STATE_IDLE);
   WiFi.disconnect();
 }
 
@@ -372,8 +996,10 @@ void WiFiManager_::disconnectWiFi() {
 void WiFiManager_::resetWiFiCredentials() {
   cc->WiFiSSID = "";
   cc->WiFiPassword = "";
+  cc->wifiCredentialCount = 0;
   cc->WifiOnAtStart = false;
-  spiffsStorage.saveConfigToSpiffs();
+  configStore.saveConfig();
+  clearFastCache();
 }
 
 // ************************************************************
@@ -9,13 +9,28 @@
 #include "utilities.h"
 #include "BluetoothManager.h"
 #include "RadioMenuConfiguration.h"
+#include "Trace.h"
+#include "TaskProfiler.h"
+#include "LoopProfiler.h"
+#include "Scheduler.h"
+#include "LinkMonitor.h"
+#include "StationResolver.h"
+#include "StreamHealth.h"
+#include "SilenceDetector.h"
+#include "StationProber.h"
+#include "StationStore.h"
+#include "StationImporter.h"
+#include "Metrics.h"
+#include "UsageStats.h"
+#include "StationAnalytics.h"
 
 // ************************************************************
 // Set up the unit
 // ************************************************************
 void setup() {
   Serial.begin(SERIAL_BAUD_RATE);
-  
+  debugManager.begin();
+
   #ifdef DEBUG
   // Debug for 10 minutes
   debugManager.setDebugAutoOff(600);
@@ -34,6 +49,14 @@ void setup() {
     debugMsgInr("WARNING: No PSRAM detected");
   }
 
+  #ifdef FEATURE_TRACE
+  if (!trace.begin()) {
+    debugMsgInr("WARNING: Could not allocate trace buffers");
+  }
+  #endif
+
+  linkMonitor.begin();
+
   // -------------------------------------------------------------------------
 
   debugMsgInr("Start up SPIFFS");
@@ -44,26 +67,56 @@ void setup() {
     return;
   }
 
-  bool statsLoaded = spiffsStorage.getStatsFromSpiffs();
+  // Config, stats and stations from NVS - the first boot after an update migrates the JSON files
+  uint32_t storageStart = millis();
+  bool statsLoaded = configStore.loadStats();
 
   if (!statsLoaded) {
-    debugMsgInr("SPIFFS storage: read stats failed");
-    spiffsStorage.saveStatsToSpiffs();
+    debugMsgInr("Config store: read stats failed");
+    configStore.saveStats();
   }
+  // Minutes counted since the last save, if that was a crash rather than a power cut
+  usageStats.begin();
 
-  bool configloaded = spiffsStorage.getConfigFromSpiffs();
+  bool configloaded = configStore.loadConfig();
 
   if (configloaded) {
-    debugMsgInr("SPIFFS storage: Loaded");
+    debugMsgInr("Config store: Loaded");
   } else {
-    debugMsgInr("SPIFFS storage: read config failed - do factory reset");
+    debugMsgInr("Config store: read config failed - do factory reset");
     resetOptions();
-    spiffsStorage.saveConfigToSpiffs();
+    configStore.saveConfig();
   }
+  silenceDetector.configure(cc->silenceThresholdDb, cc->silenceSeconds, cc->stallSeconds, cc->silenceAction);
 
   // Load station list
-  spiffsStorage.getStationsFromSpiffs();
+  if (!configStore.loadStations()) {
+    debugMsgInr("No stations found - adding default");
+    stations[0].name = "Radio FFH";
+    stations[0].urls[0] = "http://mp3.ffh.de/radioffh/hqlivestream.mp3";
+    stations[0].urlCount = 1;
+    stationCount = 1;
+    configStore.saveStations();
+  }
   debugMsgInr("Loaded " + String(stationCount) + " stations");
+  metrics.set(METRIC_BOOT_STORAGE_MS, millis() - storageStart);
+
+  // The station directory - a new one starts with the presets
+  stationStore.begin();
+
+  // Resolves the station URLs in the background once WiFi is up
+  stationResolver.begin();
+  stationResolver.refresh();
+
+  // What we know about each station URL, to pick between mirrors
+  streamHealth.begin();
+
+  // What has been listened to, per station
+  stationAnalytics.begin();
+
+  // Checks each station URL in the background, when playback can spare it
+  stationProber.begin();
+  stationProber.refresh();
 
   // -------------------------------------------------------------------------
 
@@ -138,110 +191,98 @@ void setup() {
 
   // -------------------------------------------------------------------------
 
+  // -------------------------------------------------------------------------
+
+  scheduleJobs();
+
+  // -------------------------------------------------------------------------
+
+  metrics.set(METRIC_BOOT_READY_MS, millis());
   debugMsgInr("Startup done");
 }
 
 
 // ************************************************************
-// Main loop
+// Main loop: run whatever the scheduler has due, then sleep
+// until the next deadline. The exception is when the decoder
+// had to fall back to running inline in this task - then we
+// keep turning over as fast as we can.
 // ************************************************************
 void loop() {
-
-
   nowMillis = millis();
 
-  if (lastSecondStartMillis > nowMillis) {
-    // rollover
-    lastSecondStartMillis = 0;
-  }
-
-  // -------------------------------------------------------------------------------
-
-  performOncePerLoopProcessing();
-
-  if (lastSecond != second()) {
-    lastSecond = second();
-    performOncePerSecondProcessing();
-
-    if ((second() == 0) && (!triggeredThisSec)) {
-      if ((minute() == 0)) {
-        if (hour() == 0) {
-          performOncePerDayProcessing();
-        }
-        performOncePerHourProcessing();
-      }
-      performOncePerMinuteProcessing();
-    }
+  loopProfiler.beginIteration();
+  uint32_t waitMs;
+  {
+    TRACE_SCOPE("loop");
+    waitMs = scheduler.runDue(nowMillis);
 
-    // Make sure we don't call multiple times
-    triggeredThisSec = true;
-    if ((second() > 0) && triggeredThisSec) {
-      triggeredThisSec = false;
+    if (radioOutputManager.isInlineMode()) {
+      LoopStepTimer step(LOOP_STEP_AUDIO);
+      radioOutputManager.audioOncePerLoop();
+      waitMs = 0;
     }
   }
-}
-
-
+  loopProfiler.endIteration(radioOutputManager.isInlineMode());
 
+  scheduler.sleep(waitMs);
+}
 
 // ************************************************************
-// Called every 10mS or so
+// Register the periodic work with the scheduler
 // ************************************************************
-void performOncePerLoopProcessing() {
-  
-  // -------------------------------------------------------------------------------
-  // Audio loop must run as frequently as possible to avoid choppy playback
-  radioOutputManager.audioOncePerLoop();
+void scheduleJobs() {
+  scheduler.begin();
 
-  // -------------------------------------------------------------------------------
+  // Stream clean up and reconnects - the decoder itself runs in its own task
+  scheduler.every("audio", 20, audioJob, SCHEDULER_PRIORITY_HIGH);
+
+  // OLED I2C is slow and starves the audio decoder - ~20fps is plenty for UI
+  #ifdef FEATURE_MENU
+  scheduler.every("menu", 50, menuJob);
+  #endif
 
   // OTA polling - every 500ms is more than responsive enough
-  static unsigned long lastOTACheck = 0;
-  if (nowMillis - lastOTACheck >= 500) {
-    lastOTACheck = nowMillis;
-    webManager.handleOTA();
-  }
+  scheduler.every("ota", 500, otaJob, SCHEDULER_PRIORITY_LOW);
 
-  // -------------------------------------------------------------------------------
+  scheduler.every("led", 1000, ledJob, SCHEDULER_PRIORITY_LOW);
 
-  wifiManager.manageDNSInOpenAP();
+  scheduler.every("second", 1000UL, performOncePerSecondProcessing);
+  scheduler.every("minute", 60UL * 1000, performOncePerMinuteProcessing, SCHEDULER_PRIORITY_LOW);
+  scheduler.every("hour", 60UL * 60 * 1000, performOncePerHourProcessing, SCHEDULER_PRIORITY_LOW);
+  scheduler.every("day", 24UL * 60 * 60 * 1000, performOncePerDayProcessing, SCHEDULER_PRIORITY_LOW);
+}
 
-  // -------------------------------------------------------------------------------
+// ************************************************************
+// Audio housekeeping
+// ************************************************************
+void audioJob() {
+  LoopStepTimer step(LOOP_STEP_AUDIO);
+  radioOutputManager.audioOncePerLoop();
+}
 
-  // Throttle menu/display updates - OLED I2C is slow and starves the audio decoder
+// ************************************************************
+// Menu input and display refresh
+// ************************************************************
+void menuJob() {
   #ifdef FEATURE_MENU
-  static unsigned long lastMenuUpdate = 0;
-  if (nowMillis - lastMenuUpdate >= 50) {  // ~20fps is plenty for UI
-    lastMenuUpdate = nowMillis;
-    menuOncePerLoop();
-  }
+  LoopStepTimer step(LOOP_STEP_MENU);
+  menuOncePerLoop();
   #endif
-
-  // -------------------------------------------------------------------------------
-
-  // Calculate the intra second millis
-  secsDeltaAbs = (nowMillis - lastSecondStartMillis);
-  if (secsDeltaAbs > 1000) {secsDeltaAbs = 1000;}
-  if (secsDeltaAbs < 0) {secsDeltaAbs = 0;}
-  upOrDown = (second() % 2) == 0;
-  
-  if (upOrDown) {
-    secsDelta = secsDeltaAbs;
-  } else {
-    secsDelta = 1000 - secsDeltaAbs;
-  }
 }
 
 // ************************************************************
-// Called once per second. Trigger all the things that do
-// Not need processing continuously multiple times per second
+// OTA polling
 // ************************************************************
-void performOncePerSecondProcessing() {
-  lastSecondStartMillis = nowMillis;
+void otaJob() {
+  LoopStepTimer step(LOOP_STEP_OTA);
+  webManager.handleOTA();
+}
 
-  // -------------------------------------------------------------------------------
-  
-  // Maintain the LED next to the controller
+// ************************************************************
+// Maintain the LED next to the controller
+// ************************************************************
+void ledJob() {
   if (WiFi.status() == WL_CONNECTED) {
     setLedFlashType(0);
 
@@ -251,6 +292,14 @@ void performOncePerSecondProcessing() {
   } else {
     setLedFlashType(1);
   }
+}
+
+// ************************************************************
+// Called once per second. Trigger all the things that do
+// Not need processing continuously multiple times per second
+// ************************************************************
+void performOncePerSecondProcessing() {
+  LoopStepTimer step(LOOP_STEP_PERIODIC);
 
   // -------------------------------------------------------------------------------
 
@@ -265,6 +314,21 @@ void performOncePerSecondProcessing() {
 
   // -------------------------------------------------------------------------------
 
+  // Decoder rate, dead air, quality tiers and the prober's view of playback
+  radioOutputManager.audioOncePerSecond();
+
+  // Fold the station directory's tail into its index, once an import has finished adding to it
+  if (!stationImporter.isRunning()) {
+    stationStore.maintain();
+  }
+
+  // -------------------------------------------------------------------------------
+
+  taskProfiler.sample();
+  linkMonitor.sample();
+
+  // -------------------------------------------------------------------------------
+
   feedWatchdog();
 }
 
@@ -272,15 +336,20 @@ void performOncePerSecondProcessing() {
 // Called once per minute
 // ************************************************************
 void performOncePerMinuteProcessing() {
+  LoopStepTimer step(LOOP_STEP_PERIODIC);
   debugMsgInr("---> OncePerMinuteProcessing");
   // Usage stats
-  cs->uptimeMins++;
+  usageStats.tick(radioOutputManager.isPlaying());
+  stationAnalytics.tick(radioOutputManager.isPlaying());
+
+  streamHealth.saveIfDirty();
 }
 
 // ************************************************************
 // Called once per hour
 // ************************************************************
 void performOncePerHourProcessing() {
+  LoopStepTimer step(LOOP_STEP_PERIODIC);
   debugMsgInr("---> OncePerHourProcessing");
 }
 
@@ -288,7 +357,6 @@ void performOncePerHourProcessing() {
 // Called once per day
 // ************************************************************
 void performOncePerDayProcessing() {
+  LoopStepTimer step(LOOP_STEP_PERIODIC);
   debugMsgInr("---> OncePerDayProcessing");
-
-  spiffsStorage.saveStatsToSpiffs();
 }
\ No newline at end of file
@@ -1,5 +1,23 @@
 #include "utilities.h"
 #include "RadioOutputManager.h"
+#include "JsonStreamWriter.h"
+#include "Metrics.h"
+#include "Trace.h"
+#include "TaskProfiler.h"
+#include "LoopProfiler.h"
+#include "Scheduler.h"
+#include "LinkMonitor.h"
+#include "StationResolver.h"
+#include "StreamBench.h"
+#include "StreamHealth.h"
+#include "BitrateController.h"
+#include "SilenceDetector.h"
+#include "StationProber.h"
+#include "StationStore.h"
+#include "StationImporter.h"
+#include "UsageStats.h"
+#include "StationAnalytics.h"
+#include <esp_wifi.h>
 
 // --------------------------------------------------------------------------------------------------------
 // ----------------------------------------  Utility functions  -------------------------------------------
@@ -23,33 +41,29 @@ String timeToReadableStringFromTm(tm timeToFormat) {
 // ************************************************************
 // Format a duration into an output string
 // ************************************************************
-String secsToReadableString (long secsValue) {
+void formatDuration(char* buf, size_t size, long secsValue) {
   long upDays = secsValue / 86400;
-  long upHours = (secsValue - (upDays * 86400)) / 3600;
-  long upMins = (secsValue - (upDays * 86400) - (upHours * 3600)) / 60;
-  secsValue = secsValue - (upDays * 86400) - (upHours * 3600) - (upMins * 60);
-  String uptimeString = "";
-  if (upDays > 0) {
-    uptimeString += upDays; 
-    uptimeString += " d ";
+  long upHours = (secsValue % 86400) / 3600;
+  long upMins = (secsValue % 3600) / 60;
+  long upSecs = secsValue % 60;
+
+  size_t used = 0;
+  buf[0] = '\0';
+  if (upDays > 0 && used < size) {
+    used += snprintf(buf + used, size - used, "%ld d ", upDays);
   }
-  if (upHours > 0) {
-    uptimeString += upHours;
-    uptimeString += " h "; 
+  if (upHours > 0 && used < size) {
+    used += snprintf(buf + used, size - used, "%ld h ", upHours);
   }
-  if (upMins > 0) {
-    uptimeString += upMins; 
-    uptimeString += " m ";
+  if (upMins > 0 && used < size) {
+    used += snprintf(buf + used, size - used, "%ld m ", upMins);
   }
-  if (secsValue > 0) {
-    uptimeString += secsValue; 
-    uptimeString += " s";
+  if (upSecs > 0 && used < size) {
+    used += snprintf(buf + used, size - used, "%ld s", upSecs);
   }
-  if (uptimeString == "") {
-    uptimeString = "0 s";
+  if (buf[0] == '\0') {
+    snprintf(buf, size, "0 s");
   }
-
-  return uptimeString;
 }
 
 // ************************************************************
@@ -57,9 +71,14 @@ String secsToReadableString (long secsValue) {
 // ************************************************************
 void resetOptions() {
   cc->WifiOnAtStart = true;
+  cc->silenceAction = SILENCE_DEFAULT_ACTION;
+  cc->silenceThresholdDb = SILENCE_DEFAULT_THRESHOLD_DB;
+  cc->silenceSeconds = SILENCE_DEFAULT_SECONDS;
+  cc->stallSeconds = STALL_DEFAULT_SECONDS;
   cc->WiFiSSID = "";
   cc->WiFiPassword = "";
-  spiffsStorage.saveConfigToSpiffs();
+  cc->wifiCredentialCount = 0;
+  configStore.saveConfig();
 }
 
 // ************************************************************
@@ -156,7 +175,8 @@ void cssHandler(AsyncWebServerRequest *request) {
 void saveStatsHandler(AsyncWebServerRequest *request) {
   debugMsgUtl("Got save stats request");
 
-  spiffsStorage.saveStatsToSpiffs();
+  usageStats.commit();
+  stationAnalytics.flush();
   
   request->send(200, "text/json", "{\"status\": \"Stats saved\"}");
 }
@@ -168,19 +188,31 @@ void getSummaryDataHandler(AsyncWebServerRequest *request) {
   debugMsgUtl("Got api summary GET request");
   
   AsyncResponseStream *response = request->beginResponseStream("application/json");
-  DynamicJsonBuffer jsonBuffer;
-  JsonObject &root = jsonBuffer.createObject();  
+  JsonStreamWriter json(*response);
+  json.beginObject();
 
-  root["ip"] = WiFi.localIP().toString();
-  root["mac"] = WiFi.macAddress();
-  root["ssid"] = WiFi.SSID();
-  String clockUrl = "http://" + String(WiFi.getHostname()) + ".local";
-  clockUrl.toLowerCase();
-  root["clockurl"] = clockUrl;
-  root["version"] = SOFTWARE_VERSION;
+  char text[48];
+  IPAddress ip = WiFi.localIP();
+  snprintf(text, sizeof(text), "%u.%u.%u.%u", ip[0], ip[1], ip[2], ip[3]);
+  json.add("ip", text);
 
-  root.printTo(*response);
+  uint8_t mac[6];
+  WiFi.macAddress(mac);
+  snprintf(text, sizeof(text), "%02X:%02X:%02X:%02X:%02X:%02X", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+  json.add("mac", text);
+
+  wifi_ap_record_t apInfo;
+  json.add("ssid", (esp_wifi_sta_get_ap_info(&apInfo) == ESP_OK) ? (const char*)apInfo.ssid : "");
+
+  snprintf(text, sizeof(text), "http://%s.local", WiFi.getHostname());
+  for (char* c = text; *c; c++) {
+    *c = tolower(*c);
+  }
+  json.add("clockurl", text);
+  json.add("version", SOFTWARE_VERSION);
 
+  json.endObject();
+  json.flush();
   request->send(response);
 }
 
@@ -191,12 +223,15 @@ void getConfigDataHandler(AsyncWebServerRequest *request) {
   debugMsgUtl("Got api config GET request");
   
   AsyncResponseStream *response = request->beginResponseStream("application/json");
-  DynamicJsonBuffer jsonBuffer;
-  JsonObject &root = jsonBuffer.createObject();
-
-  root["WifiOnAtStart"] = cc->WifiOnAtStart;
-
-  root.printTo(*response);
+  JsonStreamWriter json(*response);
+  json.beginObject();
+  json.add("WifiOnAtStart", cc->WifiOnAtStart);
+  json.add("SilenceAction", cc->silenceAction);
+  json.add("SilenceThresholdDb", cc->silenceThresholdDb);
+  json.add("SilenceSeconds", cc->silenceSeconds);
+  json.add("StallSeconds", cc->stallSeconds);
+  json.endObject();
+  json.flush();
   request->send(response);
 }
 
@@ -288,10 +323,15 @@ void postConfigDataHandler(AsyncWebServerRequest *request) {
     // ------------------------------------------------------------
 
     compareAndUpdateBool  (json, "WifiOnAtStart",&cc->WifiOnAtStart);
+    compareAndUpdateInt   (json, "SilenceAction",&cc->silenceAction);
+    compareAndUpdateInt   (json, "SilenceThresholdDb",&cc->silenceThresholdDb);
+    compareAndUpdateInt   (json, "SilenceSeconds",&cc->silenceSeconds);
+    compareAndUpdateInt   (json, "StallSeconds",&cc->stallSeconds);
+    silenceDetector.configure(cc->silenceThresholdDb, cc->silenceSeconds, cc->stallSeconds, cc->silenceAction);
 
     // ------------------------------------------------------------
 
-    spiffsStorage.saveConfigToSpiffs();
+    configStore.saveConfig();
     debugMsgUtl("Saved new config");
   } else {
     debugMsgUtl("Json parse failure: " + String(request->arg("body")));
@@ -301,6 +341,67 @@ void postConfigDataHandler(AsyncWebServerRequest *request) {
   getConfigDataHandler(request);
 }
 
+// ************************************************************
+// GET /api/settings - config, stats and stations as JSON, for
+// backup. WiFi passwords are left out.
+// ************************************************************
+void getSettingsHandler(AsyncWebServerRequest *request) {
+  DynamicJsonBuffer jsonBuffer;
+  JsonObject &root = jsonBuffer.createObject();
+  JsonObject &config = root.createNestedObject("config");
+  spiffsStorage.configToJson(config, false);
+  JsonObject &stats = root.createNestedObject("stats");
+  spiffsStorage.statsToJson(stats);
+  JsonArray &list = root.createNestedArray("stations");
+  spiffsStorage.stationsToJson(list);
+
+  AsyncResponseStream *response = request->beginResponseStream("application/json");
+  response->addHeader("Content-Disposition", "attachment; filename=\"settings.json\"");
+  root.printTo(*response);
+  request->send(response);
+}
+
+// ************************************************************
+// POST /api/settings - restore a backup. Each of config, stats
+// and stations is only replaced if it is in the body.
+// ************************************************************
+void postSettingsHandler(AsyncWebServerRequest *request) {
+  debugMsgUtl("Got api settings POST request");
+
+  DynamicJsonBuffer jsonBuffer;
+  JsonObject &root = jsonBuffer.parseObject(request->arg("body"));
+  if (!root.success()) {
+    request->send(200, "application/json", "{\"status\":\"Invalid JSON\"}");
+    return;
+  }
+
+  bool saved = true;
+  JsonObject &config = root["config"];
+  if (config.success()) {
+    spiffsStorage.configFromJson(config);
+    silenceDetector.configure(cc->silenceThresholdDb, cc->silenceSeconds, cc->stallSeconds, cc->silenceAction);
+    saved &= configStore.saveConfig();
+  }
+  JsonObject &stats = root["stats"];
+  if (stats.success()) {
+    spiffsStorage.statsFromJson(stats);
+    saved &= usageStats.commit();
+  }
+  JsonArray &list = root["stations"];
+  if (list.success() && list.size() > 0) {
+    spiffsStorage.stationsFromJson(list);
+    saved &= configStore.saveStations();
+    stationResolver.refresh();
+    stationProber.refresh();
+  }
+
+  if (saved) {
+    request->send(200, "application/json", "{\"status\":\"Settings restored\"}");
+  } else {
+    request->send(200, "application/json", "{\"status\":\"Settings applied but not saved\"}");
+  }
+}
+
 // ************************************************************
 // Diags page
 // ************************************************************
@@ -308,43 +409,59 @@ void getDiagsDataHandler(AsyncWebServerRequest *request) {
   debugMsgUtl("Got api diagnostics GET request");
   
   AsyncResponseStream *response = request->beginResponseStream("application/json");
-  DynamicJsonBuffer jsonBuffer;
-  JsonObject &root = jsonBuffer.createObject();  
+  JsonStreamWriter json(*response);
+  json.beginObject();
+
+  char text[64];
 
-  const char compile_date[] = __DATE__ " " __TIME__;
   // Total ontime for the life of the clock
-  root["uptime"] = secsToReadableString(cs->uptimeMins * 60);
+  formatDuration(text, sizeof(text), cs->uptimeMins * 60);
+  json.add("uptime", text);
 
   // Total time the tubes have been on for
-  root["ontime"] = secsToReadableString(cs->playtimeMins * 60);
-
-  root["heap"] = ESP.getFreeHeap();
-  root["freesketch"] = ESP.getFreeSketchSpace();
-  root["sketchsize"] = ESP.getSketchSize();
-  root["flashsize"] = ESP.getFlashChipSize();
-  root["compiledate"] = String(compile_date);
-  root["cpufreq"] = ESP.getCpuFreqMHz();
-  root["sdkversion"] = ESP.getSdkVersion();
-  root["sketchmd5"] = ESP.getSketchMD5();
+  formatDuration(text, sizeof(text), cs->playtimeMins * 60);
+  json.add("ontime", text);
+
+  json.add("heap", ESP.getFreeHeap());
+  json.add("maxallocheap", ESP.getMaxAllocHeap());
+  json.add("freesketch", ESP.getFreeSketchSpace());
+  json.add("sketchsize", ESP.getSketchSize());
+  json.add("flashsize", ESP.getFlashChipSize());
+  json.add("compiledate", __DATE__ " " __TIME__);
+  json.add("cpufreq", ESP.getCpuFreqMHz());
+  json.add("sdkversion", ESP.getSdkVersion());
+  json.add("sketchmd5", ESP.getSketchMD5());
 
   // Time since last reboot
-  root["runtime"] = secsToReadableString(nowMillis/1000);
-  root["cyclecount"] = ESP.getCycleCount();
-  root["psramsize"] = ESP.getPsramSize();
-  root["freepsram"] = ESP.getFreePsram();
-  root["minfreepsram"] = ESP.getMinFreePsram();
-  root["minfreeheap"] = ESP.getMinFreeHeap();
-  root["resetreason"] = String(rtc_get_reset_reason(0)) + "/" + String(rtc_get_reset_reason(1));
+  formatDuration(text, sizeof(text), nowMillis / 1000);
+  json.add("runtime", text);
+  json.add("cyclecount", ESP.getCycleCount());
+  json.add("psramsize", ESP.getPsramSize());
+  json.add("freepsram", ESP.getFreePsram());
+  json.add("minfreepsram", ESP.getMinFreePsram());
+  json.add("minfreeheap", ESP.getMinFreeHeap());
+  json.key("resetreason").valuef("%d/%d", rtc_get_reset_reason(0), rtc_get_reset_reason(1));
+  json.add("wifistate", wifiManager.getStateName());
+  json.add("bootwifims", (long)metrics.get(METRIC_BOOT_WIFI_MS));
+  json.add("bootaudioms", (long)metrics.get(METRIC_BOOT_FIRST_AUDIO_MS));
+  json.add("bootstoragems", (long)metrics.get(METRIC_BOOT_STORAGE_MS));
+  json.add("bootreadyms", (long)metrics.get(METRIC_BOOT_READY_MS));
+  json.key("configstore").beginObject();
+  configStore.writeJson(json);
+  json.endObject();
+  json.key("usagestats").beginObject();
+  usageStats.writeJson(json);
+  json.endObject();
 
   debugMsgUtl("Start partition recovery");
-  String partitionStr = "Name,type,subtype,offset,length;";
+  json.key("partitions").beginString();
+  json.stringPart("Name,type,subtype,offset,length;");
   esp_partition_iterator_t iter = esp_partition_find(ESP_PARTITION_TYPE_APP, ESP_PARTITION_SUBTYPE_ANY, NULL);
   while (iter != nullptr)
   {
     const esp_partition_t *partition = esp_partition_get(iter);
-    char buffer[60];
-    sprintf(buffer, "%s,app,%d,0x%x,0x%x,(%d);", partition->label, partition->subtype, partition->address, partition->size, partition->size);
-    partitionStr = partitionStr + String(buffer);
+    snprintf(text, sizeof(text), "%s,app,%d,0x%x,0x%x,(%d);", partition->label, partition->subtype, partition->address, partition->size, partition->size);
+    json.stringPart(text);
     iter = esp_partition_next(iter);
   }
   
@@ -353,40 +470,223 @@ void getDiagsDataHandler(AsyncWebServerRequest *request) {
   while (iter != nullptr)
   {
     const esp_partition_t *partition = esp_partition_get(iter);
-    char buffer[60];
-    sprintf(buffer, "%s,data,%d,0x%x,0x%x,(%d);", partition->label, partition->subtype, partition->address, partition->size, partition->size);
-    partitionStr = partitionStr + String(buffer);
+    snprintf(text, sizeof(text), "%s,data,%d,0x%x,0x%x,(%d);", partition->label, partition->subtype, partition->address, partition->size, partition->size);
+    json.stringPart(text);
     iter = esp_partition_next(iter);
   }
   
   esp_partition_iterator_release(iter);
+  json.endString();
   debugMsgUtl("End partition recovery");
   
-  #ifdef DIGIT_DIAGNOSTICS
-  root["diagsMode"] = cc->diagsMode;
-  #endif
-
-  String featureString = "";
+  json.key("features").beginString();
   #ifdef DEBUG
-  featureString += "DEB ";
+  json.stringPart("DEB ");
   #endif
 
   #ifdef OLED_SSD1306
-  featureString += "SSD1306 ";
+  json.stringPart("SSD1306 ");
   #endif
 
   #ifdef OLED_SH1106
-  featureString += "SH1106 ";
+  json.stringPart("SH1106 ");
   #endif
+  json.endString();
+
+  json.endObject();
+  json.flush();
+  request->send(response);
+}
 
-  root["features"] = featureString;
+// ************************************************************
+// Prometheus scrape
+// ************************************************************
+void getMetricsHandler(AsyncWebServerRequest *request) {
+  AsyncResponseStream *response = request->beginResponseStream("text/plain; version=0.0.4");
+  if (metrics.writePrometheus(*response)) {
+    request->send(response);
+  } else {
+    delete response;
+    request->send(429, "text/plain", "Scrape interval too short");
+  }
+}
 
-  root["partitions"] = partitionStr;
+// ************************************************************
+// Per task CPU and stack use from the last profiler sample
+// ************************************************************
+void getTasksHandler(AsyncWebServerRequest *request) {
+  AsyncResponseStream *response = request->beginResponseStream("application/json");
+  JsonStreamWriter json(*response);
+  taskProfiler.writeJson(json);
+  json.flush();
+  request->send(response);
+}
 
-  root.printTo(*response);
+// ************************************************************
+// Main loop step timings and slow iterations
+// ************************************************************
+void getLoopHandler(AsyncWebServerRequest *request) {
+  AsyncResponseStream *response = request->beginResponseStream("application/json");
+  JsonStreamWriter json(*response);
+  loopProfiler.writeJson(json);
+  json.flush();
+  request->send(response);
+}
+
+// ************************************************************
+// Link quality history and the events it was captured for.
+// ?history=N sets how many seconds of history (default 60).
+// ************************************************************
+void getLinkHandler(AsyncWebServerRequest *request) {
+  uint16_t historySeconds = 60;
+  if (request->hasArg("history")) {
+    historySeconds = constrain(request->arg("history").toInt(), 0, LINK_HISTORY_SECONDS);
+  }
+  AsyncResponseStream *response = request->beginResponseStream("application/json");
+  JsonStreamWriter json(*response);
+  linkMonitor.writeJson(json, historySeconds);
+  json.flush();
+  request->send(response);
+}
+
+// ************************************************************
+// Resolver cache: hit rate, time saved and entries
+// ************************************************************
+void getResolverHandler(AsyncWebServerRequest *request) {
+  AsyncResponseStream *response = request->beginResponseStream("application/json");
+  JsonStreamWriter json(*response);
+  stationResolver.writeJson(json);
+  json.flush();
+  request->send(response);
+}
+
+// ************************************************************
+// Health record and score of every station URL
+// ************************************************************
+void getStreamHealthHandler(AsyncWebServerRequest *request) {
+  AsyncResponseStream *response = request->beginResponseStream("application/json");
+  JsonStreamWriter json(*response);
+  streamHealth.writeJson(json);
+  json.flush();
   request->send(response);
 }
 
+// ************************************************************
+// Dead air detector: thresholds, current level and events
+// ************************************************************
+void getSilenceHandler(AsyncWebServerRequest *request) {
+  AsyncResponseStream *response = request->beginResponseStream("application/json");
+  JsonStreamWriter json(*response);
+  silenceDetector.writeJson(json);
+  json.flush();
+  request->send(response);
+}
+
+// ************************************************************
+// Station prober: budget and the last result for every URL
+// ************************************************************
+void getProbeHandler(AsyncWebServerRequest *request) {
+  AsyncResponseStream *response = request->beginResponseStream("application/json");
+  JsonStreamWriter json(*response);
+  stationProber.writeJson(json);
+  json.flush();
+  request->send(response);
+}
+
+// ************************************************************
+// Adaptive bitrate: tiers, estimates and recent switches
+// ************************************************************
+void getAbrHandler(AsyncWebServerRequest *request) {
+  AsyncResponseStream *response = request->beginResponseStream("application/json");
+  JsonStreamWriter json(*response);
+  bitrateController.writeJson(json);
+  json.flush();
+  request->send(response);
+}
+
+// ************************************************************
+// Start a stream throughput run: url, seconds, client
+// (native | icy)
+// ************************************************************
+void postStreamBenchHandler(AsyncWebServerRequest *request) {
+  if (!request->hasArg("url")) {
+    request->send(400, "application/json", "{\"status\":\"URL required\"}");
+    return;
+  }
+  uint16_t seconds = request->hasArg("seconds") ? request->arg("seconds").toInt() : 10;
+  BenchClient client = (request->hasArg("client") && request->arg("client") == "icy") ? BENCH_CLIENT_ICY : BENCH_CLIENT_NATIVE;
+  if (!streamBench.start(request->arg("url"), seconds, client)) {
+    request->send(409, "application/json", "{\"status\":\"Bench already running\"}");
+    return;
+  }
+  request->send(200, "application/json", "{\"status\":\"Started\"}");
+}
+
+// ************************************************************
+// Progress or result of the last stream throughput run
+// ************************************************************
+void getStreamBenchHandler(AsyncWebServerRequest *request) {
+  AsyncResponseStream *response = request->beginResponseStream("application/json");
+  JsonStreamWriter json(*response);
+  streamBench.writeJson(json);
+  json.flush();
+  request->send(response);
+}
+
+#ifdef FEATURE_TRACE
+// ************************************************************
+// Dump the trace rings as Chrome Trace Event JSON. Streamed in
+// chunks - the dump is far too big to build in the heap.
+// ************************************************************
+void getTraceHandler(AsyncWebServerRequest *request) {
+  if (!trace.startDump()) {
+    request->send(409, "text/plain", "Trace dump already running");
+    return;
+  }
+  AsyncWebServerResponse *response = request->beginChunkedResponse("application/json", [](uint8_t *buffer, size_t maxLen, size_t index) -> size_t {
+    return trace.fillDump(buffer, maxLen);
+  });
+  response->addHeader("Content-Disposition", "attachment; filename=\"trace.json\"");
+  request->onDisconnect([]() {
+    trace.endDump();
+  });
+  request->send(response);
+}
+#endif
+
+// ************************************************************
+// Tail of the log, as written to the serial port
+// ************************************************************
+void getLogsHandler(AsyncWebServerRequest *request) {
+  AsyncResponseStream *response = request->beginResponseStream("text/plain");
+  debugManager.writeHistory(*response);
+  uint32_t dropped = debugManager.getDroppedCount();
+  if (dropped > 0) {
+    response->printf("-- %u messages dropped (log ring full)\n", (unsigned)dropped);
+  }
+  request->send(response);
+}
+
+// ************************************************************
+// Set the runtime level of one module: module=AUD&level=0..2
+// ************************************************************
+void postLogLevelHandler(AsyncWebServerRequest *request) {
+  LogModule module;
+  if (!request->hasArg("module") || !debugManager.moduleFromName(request->arg("module").c_str(), module)) {
+    request->send(400, "application/json", "{\"status\":\"Unknown module\"}");
+    return;
+  }
+  if (!request->hasArg("level")) {
+    request->send(400, "application/json", "{\"status\":\"Level required\"}");
+    return;
+  }
+  int level = request->arg("level").toInt();
+  if (level < LOG_LEVEL_OFF) level = LOG_LEVEL_OFF;
+  if (level > LOG_LEVEL_TRACE) level = LOG_LEVEL_TRACE;
+  debugManager.setModuleLevel(module, (LogLevel)level);
+  request->send(200, "application/json", "{\"status\":\"OK\"}");
+}
+
 // ************************************************************
 // WiFi
 // ************************************************************
@@ -397,12 +697,43 @@ void getCredentialsHandler(AsyncWebServerRequest *request) {
 //  dumpArgs(request);
 //  #endif
 
-  if (WiFi.isConnected()) {
-    AsyncWebServerResponse* response = request->beginResponse(200, "text/json", "{\"connected\": \"true\", \"SSID\": \"" + WiFi.SSID() + "\"}");
-    request->send(response);        
+  AsyncResponseStream *response = request->beginResponseStream("text/json");
+  JsonStreamWriter json(*response);
+  json.beginObject();
+  wifi_ap_record_t apInfo;
+  if (WiFi.isConnected() && esp_wifi_sta_get_ap_info(&apInfo) == ESP_OK) {
+    json.add("connected", "true");
+    json.add("SSID", (const char*)apInfo.ssid);
   } else {
-    AsyncWebServerResponse* response = request->beginResponse(200, "text/json", "{\"connected\": \"false\"}");
-    request->send(response);        
+    json.add("connected", "false");
+  }
+
+  // Remembered networks - no passwords
+  json.key("networks").beginArray();
+  for (uint8_t i = 0; i < cc->wifiCredentialCount; i++) {
+    json.beginObject();
+    json.add("ssid", cc->wifiCredentials[i].ssid.c_str());
+    json.add("priority", (int)cc->wifiCredentials[i].priority);
+    json.endObject();
+  }
+  json.endArray();
+  json.endObject();
+  json.flush();
+  request->send(response);
+}
+
+// ************************************************************
+// Forget a remembered network
+// ************************************************************
+void deleteWiFiCredentialHandler(AsyncWebServerRequest *request) {
+  if (!request->hasArg("SSID")) {
+    request->send(200, "application/json", "{\"status\":\"SSID required\"}");
+    return;
+  }
+  if (wifiManager.removeWiFiCredential(request->arg("SSID"))) {
+    request->send(200, "application/json", "{\"status\":\"Network deleted\"}");
+  } else {
+    request->send(200, "application/json", "{\"status\":\"Unknown network\"}");
   }
 }
 
@@ -418,6 +749,7 @@ void postWiFiCredentialsHandler(AsyncWebServerRequest *request) {
 
   String newSSID = "";
   String newPassword = "";
+  int priority = -1;
 
   if (request->hasArg("SSID")) {
     newSSID = request->arg("SSID");
@@ -425,42 +757,61 @@ void postWiFiCredentialsHandler(AsyncWebServerRequest *request) {
   if (request->hasArg("password")) {
     newPassword = request->arg("password");
   }
+  if (request->hasArg("priority")) {
+    priority = constrain(request->arg("priority").toInt(), 0, 255);
+  }
 
+  AsyncResponseStream *response = request->beginResponseStream("text/json");
+  JsonStreamWriter json(*response);
+  json.beginObject();
   if (newSSID.length() > 0 && newPassword.length() > 0) {
     debugMsgUtl("Setting new WiFi credentials - " + newSSID + ":" + newPassword);
 
-    wifiManager.saveWiFiCredentials(newSSID, newPassword);
+    wifiManager.saveWiFiCredentials(newSSID, newPassword, priority);
 
-    AsyncWebServerResponse* response = request->beginResponse(200, "text/json", "{\"status\": \"Saved " + newSSID + "\"}");
-    request->send(response);
+    json.key("status").beginString().stringPart("Saved ").stringPart(newSSID.c_str()).endString();
   } else {
-    AsyncWebServerResponse* response = request->beginResponse(200, "text/json", "{\"status\": \"No changes saved\"}");
-    request->send(response);
+    json.add("status", "No changes saved");
   }
+  json.endObject();
+  json.flush();
+  request->send(response);
 
-  // Autorestart
-  delay(1000);
-
-  ESP.restart();
+  // Autorestart once the response has gone out
+  scheduleRestart(1000);
 }
 
 // ************************************************************
 // Return a list of WiFi Networks
 // ************************************************************
+static void startScanJob() {
+  wifiManager.startScanWiFiNetworks();
+}
+
 void getWiFiNetworksHandler(AsyncWebServerRequest *request) {
   debugMsgUtl("Got api wifi networks request");
   
-  if (WiFi.isConnected()) {
-    AsyncWebServerResponse* response = request->beginResponse(200, "text/json", "{\"connected\": \"true\", \"SSID\": \"" + WiFi.SSID() + "\"}");
-    request->send(response);        
+  AsyncResponseStream *response = request->beginResponseStream("text/json");
+  JsonStreamWriter json(*response);
+  json.beginObject();
+  wifi_ap_record_t apInfo;
+  if (WiFi.isConnected() && esp_wifi_sta_get_ap_info(&apInfo) == ESP_OK) {
+    json.add("connected", "true");
+    json.add("SSID", (const char*)apInfo.ssid);
+    json.endObject();
+    json.flush();
+    request->send(response);
     debugMsgUtl("Scan aborted because we are already connected");
   } else {
-    AsyncWebServerResponse* response = request->beginResponse(200, "text/json", "{\"connected\": \"false\", \"SSIDs\": \"" + lastWiFiScan + "\"}");
-    request->send(response);        
+    json.add("connected", "false");
+    json.add("SSIDs", lastWiFiScan);
+    json.endObject();
+    json.flush();
+    request->send(response);
     debugMsgUtl("Scan done");
 
-    // trigger a new scan
-    wifiManager.startScanWiFiNetworks();
+    // trigger a new scan, from the main loop like the rest of the WiFi steps
+    scheduler.after("wifi.webscan", 0, startScanJob);
   }
 }
 
@@ -474,10 +825,10 @@ void restartHandler(AsyncWebServerRequest *request) {
   request->send(response);
 
   // preserve the uptime over restarts, especially after OTA
-  spiffsStorage.saveStatsToSpiffs();
+  usageStats.commit();
+  stationAnalytics.flush();
 
-  delay(1000);
-  ESP.restart();
+  scheduleRestart(1000);
 }
 
 // ************************************************************
@@ -506,6 +857,19 @@ void resetAll() {
   resetWiFi();
 }
 
+// ************************************************************
+// Restart after a delay without blocking the caller, so web
+// responses and flash messages can get out first
+// ************************************************************
+static void restartJob() {
+  ESP.restart();
+}
+
+void scheduleRestart(uint32_t delayMs) {
+  debugMsgUtl("Restart in " + String(delayMs) + "ms");
+  scheduler.after("restart", delayMs, restartJob, SCHEDULER_PRIORITY_HIGH);
+}
+
 // ************************************************************
 // Utilities
 // ************************************************************
@@ -598,96 +962,26 @@ void feedWatchdog() {
 //**********************************************************************************
 //**********************************************************************************
 
-static const char RADIO_PAGE[] PROGMEM = R"rawliteral(
-<!DOCTYPE html><html><head>
-<meta name="viewport" content="width=device-width,initial-scale=1">
-<title>Internet Radio</title>
-<style>
-*{box-sizing:border-box;margin:0;padding:0}
-body{font-family:system-ui,sans-serif;background:#1a1a2e;color:#e0e0e0;padding:16px;max-width:600px;margin:0 auto}
-h1{color:#0f3460;background:#e0e0e0;padding:12px;border-radius:8px;text-align:center;margin-bottom:16px;font-size:1.3em}
-.card{background:#16213e;border-radius:8px;padding:16px;margin-bottom:12px}
-.card h2{font-size:1em;color:#a0a0a0;margin-bottom:8px}
-.now{font-size:1.1em;color:#00d4ff;min-height:1.4em}
-.station{display:flex;align-items:center;padding:8px 0;border-bottom:1px solid #1a1a2e}
-.station:last-child{border:none}
-.station .name{flex:1;font-weight:bold}
-.station .url{flex:2;font-size:0.8em;color:#888;overflow:hidden;text-overflow:ellipsis;white-space:nowrap;padding:0 8px}
-button{background:#0f3460;color:#fff;border:none;border-radius:4px;padding:6px 12px;cursor:pointer;font-size:0.85em}
-button:hover{background:#1a5276}
-button.stop{background:#922}
-button.stop:hover{background:#b33}
-button.del{background:#555;font-size:0.75em}
-button.del:hover{background:#922}
-input[type=text]{width:100%;padding:8px;border-radius:4px;border:1px solid #333;background:#0f1a30;color:#e0e0e0;margin-bottom:8px;font-size:0.9em}
-input[type=range]{width:100%;margin:8px 0;accent-color:#00d4ff}
-.row{display:flex;gap:8px;align-items:center}
-.vol-val{min-width:32px;text-align:right;color:#00d4ff}
-#msg{color:#0a4;font-size:0.85em;min-height:1.2em;margin-top:4px}
-.notif{position:fixed;top:0;left:0;right:0;padding:12px;text-align:center;font-size:0.95em;z-index:99;transition:opacity 0.5s}
-.notif.err{background:#922;color:#fff}
-.notif.ok{background:#0a4;color:#fff}
-</style></head><body>
-<div id="notif" class="notif" style="display:none"></div>
-<h1>Internet Radio</h1>
-<div class="card"><h2>Now Playing</h2>
-<div class="now" id="np">--</div>
-<div style="margin-top:8px" id="ctrl">
-<button onclick="doPlay(-1)">Play</button>
-<button class="stop" onclick="doStop()">Stop</button>
-</div></div>
-<div class="card"><h2>Volume</h2>
-<div class="row"><input type="range" id="vol" min="0" max="100" value="10"
-oninput="document.getElementById('vv').textContent=this.value"
-onchange="setVol(this.value)"><span class="vol-val" id="vv">10</span></div></div>
-<div class="card"><h2>Stations</h2>
-<div id="sl">Loading...</div></div>
-<div class="card"><h2>Add Station</h2>
-<input type="text" id="sn" placeholder="Station name">
-<input type="text" id="su" placeholder="Stream URL (http://...)">
-<button onclick="addStation()">Add</button>
-<div id="msg"></div></div>
-<script>
-function notify(msg,type){var e=document.getElementById('notif');e.textContent=msg;e.className='notif '+(type||'err');e.style.display='block';e.style.opacity='1';setTimeout(function(){e.style.opacity='0';setTimeout(function(){e.style.display='none'},500)},4000)}
-function api(u,m,b){return fetch(u,{method:m||'GET',headers:b?{'Content-Type':'application/x-www-form-urlencoded'}:{},body:b}).then(r=>r.json())}
-function refresh(){
-api('/api/status').then(d=>{
-document.getElementById('np').textContent=d.playing?(d.station+' - '+d.url):'Stopped';
-document.getElementById('vol').value=d.volume;
-document.getElementById('vv').textContent=d.volume;
-});
-api('/api/stations').then(d=>{
-let h='';
-d.forEach((s,i)=>{
-h+='<div class="station"><span class="name">'+s.name+'</span><span class="url">'+s.url+'</span><button onclick="doPlay('+i+')">Play</button> <button class="del" onclick="delStation('+i+')">Del</button></div>';
-});
-document.getElementById('sl').innerHTML=h||'No stations';
-});
-}
-function doPlay(i){api('/api/play','POST','index='+i).then(refresh)}
-function doStop(){api('/api/stop','POST','x=1').then(refresh)}
-function setVol(v){api('/api/volume','POST','volume='+v)}
-function addStation(){
-let n=document.getElementById('sn').value,u=document.getElementById('su').value;
-if(!n||!u){document.getElementById('msg').textContent='Name and URL required';return}
-if(!u.startsWith('http://')){notify('Only http:// streams are supported. https:// will not work.','err');return}
-api('/api/stations','POST','name='+encodeURIComponent(n)+'&url='+encodeURIComponent(u)).then(d=>{
-document.getElementById('msg').textContent=d.status||'Added';
-document.getElementById('sn').value='';document.getElementById('su').value='';refresh();
-});
-}
-function delStation(i){api('/api/stations/delete','POST','index='+i).then(d=>{
-document.getElementById('msg').textContent=d.status||'Deleted';refresh();
-})}
-refresh();
-</script></body></html>
-)rawliteral";
-
-// ************************************************************
-// Serve the radio web page
-// ************************************************************
-void radioPageHandler(AsyncWebServerRequest *request) {
-  request->send(200, "text/html", RADIO_PAGE);
+// ************************************************************
+// A station's name, URLs and tiers, as members of the object
+// being written
+// ************************************************************
+static void writeStationFields(JsonStreamWriter &json, const station_t &station) {
+  json.add("name", station.name);
+  json.add("url", station.urls[0]);
+  json.key("mirrors").beginArray();
+  for (int m = 1; m < station.urlCount; m++) {
+    json.value(station.urls[m]);
+  }
+  json.endArray();
+  json.key("tiers").beginArray();
+  for (int t = 0; t < station.tierCount; t++) {
+    json.beginObject();
+    json.add("kbps", (unsigned)station.tierKbps[t]);
+    json.add("url", station.tierUrls[t]);
+    json.endObject();
+  }
+  json.endArray();
 }
 
 // ************************************************************
@@ -695,21 +989,89 @@ void radioPageHandler(AsyncWebServerRequest *request) {
 // ************************************************************
 void getStationsHandler(AsyncWebServerRequest *request) {
   AsyncResponseStream *response = request->beginResponseStream("application/json");
-  DynamicJsonBuffer jsonBuffer;
-  JsonArray &arr = jsonBuffer.createArray();
+  JsonStreamWriter json(*response);
+  json.beginArray();
 
   for (int i = 0; i < stationCount; i++) {
-    JsonObject &s = arr.createNestedObject();
-    s["name"] = stations[i].name;
-    s["url"] = stations[i].url;
+    json.beginObject();
+    writeStationFields(json, stations[i]);
+    stationProber.writeStationJson(json, i);
+    json.endObject();
   }
 
-  arr.printTo(*response);
+  json.endArray();
+  json.flush();
   request->send(response);
 }
 
 // ************************************************************
-// POST /api/stations - add a station
+// Take the first whitespace separated word off a list
+// ************************************************************
+static String takeWord(String &list) {
+  list.replace('\n', ' ');
+  list.replace('\r', ' ');
+  list.replace('\t', ' ');
+  list.trim();
+  int end = list.indexOf(' ');
+  String word = end < 0 ? list : list.substring(0, end);
+  list = end < 0 ? "" : list.substring(end + 1);
+  list.trim();
+  return word;
+}
+
+static bool isStreamUrl(const String &url) {
+  return url.startsWith("http://") || url.startsWith("https://");
+}
+
+// ************************************************************
+// A station from the name, url, mirrors and tiers args.
+// mirrors is an optional whitespace separated list of fallback
+// URLs, tiers one of kbps=url quality variants.
+// ************************************************************
+static bool stationFromArgs(AsyncWebServerRequest *request, station_t &station) {
+  String name = request->hasArg("name") ? request->arg("name") : "";
+  String url = request->hasArg("url") ? request->arg("url") : "";
+
+  if (name.length() == 0 || url.length() == 0) {
+    return false;
+  }
+
+  station.name = name;
+  station.urls[0] = url;
+  station.urlCount = 1;
+  String mirrors = request->hasArg("mirrors") ? request->arg("mirrors") : "";
+  while (mirrors.length() > 0 && station.urlCount < MAX_STATION_URLS) {
+    String mirror = takeWord(mirrors);
+    if (isStreamUrl(mirror)) {
+      station.urls[station.urlCount++] = mirror;
+    }
+  }
+
+  // Tiers are kept lowest bitrate first
+  station.tierCount = 0;
+  String tiers = request->hasArg("tiers") ? request->arg("tiers") : "";
+  while (tiers.length() > 0 && station.tierCount < MAX_STATION_TIERS) {
+    String tier = takeWord(tiers);
+    int eq = tier.indexOf('=');
+    uint16_t kbps = eq > 0 ? tier.substring(0, eq).toInt() : 0;
+    String tierUrl = eq > 0 ? tier.substring(eq + 1) : "";
+    if (kbps == 0 || !isStreamUrl(tierUrl)) {
+      continue;
+    }
+    int t = station.tierCount++;
+    while (t > 0 && station.tierKbps[t - 1] > kbps) {
+      station.tierKbps[t] = station.tierKbps[t - 1];
+      station.tierUrls[t] = station.tierUrls[t - 1];
+      t--;
+    }
+    station.tierKbps[t] = kbps;
+    station.tierUrls[t] = tierUrl;
+  }
+  return true;
+}
+
+// ************************************************************
+// POST /api/stations - add a preset
 // ************************************************************
 void postStationHandler(AsyncWebServerRequest *request) {
   if (stationCount >= MAX_STATIONS) {
@@ -717,19 +1079,17 @@ void postStationHandler(AsyncWebServerRequest *request) {
     return;
   }
 
-  String name = request->hasArg("name") ? request->arg("name") : "";
-  String url = request->hasArg("url") ? request->arg("url") : "";
-
-  if (name.length() == 0 || url.length() == 0) {
+  station_t station;
+  if (!stationFromArgs(request, station)) {
     request->send(200, "application/json", "{\"status\":\"Name and URL required\"}");
     return;
   }
-
-  stations[stationCount].name = name;
-  stations[stationCount].url = url;
+  stations[stationCount] = station;
   stationCount++;
 
-  spiffsStorage.saveStationsToSpiffs();
+  configStore.saveStations();
+  stationResolver.refresh();
+  stationProber.refresh();
   request->send(200, "application/json", "{\"status\":\"Station added\"}");
 }
 
@@ -754,45 +1114,381 @@ void deleteStationHandler(AsyncWebServerRequest *request) {
   }
   stationCount--;
   stations[stationCount].name = "";
-  stations[stationCount].url = "";
+  for (int m = 0; m < MAX_STATION_URLS; m++) {
+    stations[stationCount].urls[m] = "";
+  }
+  stations[stationCount].urlCount = 0;
+  for (int t = 0; t < MAX_STATION_TIERS; t++) {
+    stations[stationCount].tierUrls[t] = "";
+  }
+  stations[stationCount].tierCount = 0;
+
+  configStore.saveStations();
+  stationResolver.refresh();
+  stationProber.refresh();
+  request->send(200, "application/json", "{\"status\":\"Station deleted\"}");
+}
+
+// ************************************************************
+// GET /api/store - the station directory a page at a time, in
+// name order, or one station with ?id=
+// ************************************************************
+void getStoreHandler(AsyncWebServerRequest *request) {
+  station_t station;
+  if (request->hasArg("id")) {
+    uint32_t id = strtoul(request->arg("id").c_str(), nullptr, 10);
+    if (!stationStore.get(id, station)) {
+      request->send(200, "application/json", "{\"status\":\"Not found\"}");
+      return;
+    }
+    AsyncResponseStream *response = request->beginResponseStream("application/json");
+    JsonStreamWriter json(*response);
+    json.beginObject();
+    json.add("id", id);
+    writeStationFields(json, station);
+    json.endObject();
+    json.flush();
+    request->send(response);
+    return;
+  }
+
+  uint32_t cursor = request->hasArg("cursor") ? strtoul(request->arg("cursor").c_str(), nullptr, 10) : 0;
+  int count = request->hasArg("count") ? request->arg("count").toInt() : 20;
+  if (count < 1) count = 1;
+  if (count > STORE_PAGE_MAX) count = STORE_PAGE_MAX;
+  uint32_t ids[STORE_PAGE_MAX];
+  uint8_t got = 0;
+  uint32_t next = stationStore.page(cursor, ids, count, got);
+
+  AsyncResponseStream *response = request->beginResponseStream("application/json");
+  JsonStreamWriter json(*response);
+  json.beginObject();
+  stationStore.writeJson(json);
+  json.key("next");
+  if (next == STORE_CURSOR_END) {
+    json.nullValue();
+  } else {
+    json.value(next);
+  }
+  json.key("stations").beginArray();
+  for (uint8_t i = 0; i < got; i++) {
+    if (stationStore.get(ids[i], station)) {
+      json.beginObject();
+      json.add("id", ids[i]);
+      writeStationFields(json, station);
+      json.endObject();
+    }
+  }
+  json.endArray();
+  json.endObject();
+  json.flush();
+  request->send(response);
+}
 
-  spiffsStorage.saveStationsToSpiffs();
+// ************************************************************
+// GET /api/stations/search?q= - directory stations whose name
+// starts with q, ignoring case, spaces and punctuation
+// ************************************************************
+void getStationSearchHandler(AsyncWebServerRequest *request) {
+  String query = request->hasArg("q") ? request->arg("q") : "";
+  int count = request->hasArg("count") ? request->arg("count").toInt() : 20;
+  if (count < 1) count = 1;
+  if (count > STORE_PAGE_MAX) count = STORE_PAGE_MAX;
+
+  // Each request stands alone, so there's no earlier range to narrow
+  store_search_t state;
+  uint32_t ids[STORE_PAGE_MAX];
+  String names[STORE_PAGE_MAX];
+  bool more = false;
+  uint32_t started = micros();
+  uint8_t got = stationStore.search(query, ids, count, state, more);
+  uint32_t searchUs = micros() - started;
+  stationStore.getNames(ids, got, names);
+
+  AsyncResponseStream *response = request->beginResponseStream("application/json");
+  JsonStreamWriter json(*response);
+  json.beginObject();
+  json.add("q", query);
+  json.add("us", searchUs);
+  json.add("more", more);
+  json.key("results").beginArray();
+  for (uint8_t i = 0; i < got; i++) {
+    json.beginObject();
+    json.add("id", ids[i]);
+    json.add("name", names[i]);
+    json.endObject();
+  }
+  json.endArray();
+  json.endObject();
+  json.flush();
+  request->send(response);
+}
+
+// ************************************************************
+// POST /api/store - add a station to the directory
+// ************************************************************
+void postStoreHandler(AsyncWebServerRequest *request) {
+  station_t station;
+  if (!stationFromArgs(request, station)) {
+    request->send(200, "application/json", "{\"status\":\"Name and URL required\"}");
+    return;
+  }
+  uint32_t id = stationStore.add(station);
+  if (id == STATION_ID_NONE) {
+    request->send(200, "application/json", "{\"status\":\"Station store failed\"}");
+    return;
+  }
+  request->send(200, "application/json", "{\"status\":\"Station added\",\"id\":" + String(id) + "}");
+}
+
+// ************************************************************
+// POST /api/store/delete - delete a directory station by id
+// ************************************************************
+void postStoreDeleteHandler(AsyncWebServerRequest *request) {
+  uint32_t id = request->hasArg("id") ? strtoul(request->arg("id").c_str(), nullptr, 10) : STATION_ID_NONE;
+  if (!stationStore.remove(id)) {
+    request->send(200, "application/json", "{\"status\":\"Not found\"}");
+    return;
+  }
   request->send(200, "application/json", "{\"status\":\"Station deleted\"}");
 }
 
+// ************************************************************
+// POST /api/store/preset - copy a directory station into the
+// presets
+// ************************************************************
+void postStorePresetHandler(AsyncWebServerRequest *request) {
+  if (stationCount >= MAX_STATIONS) {
+    request->send(200, "application/json", "{\"status\":\"Station list full\"}");
+    return;
+  }
+  uint32_t id = request->hasArg("id") ? strtoul(request->arg("id").c_str(), nullptr, 10) : STATION_ID_NONE;
+  station_t station;
+  if (!stationStore.get(id, station)) {
+    request->send(200, "application/json", "{\"status\":\"Not found\"}");
+    return;
+  }
+  stations[stationCount] = station;
+  stationCount++;
+
+  configStore.saveStations();
+  stationResolver.refresh();
+  stationProber.refresh();
+  request->send(200, "application/json", "{\"status\":\"Station added\"}");
+}
+
+// ************************************************************
+// POST /api/store/import - a station list, either as the raw
+// body (any Content-Type but form-urlencoded) or as a file
+// upload. Parsed and stored as it arrives; the response is sent
+// once the whole list is in.
+// ************************************************************
+static ImportFormat importFormat(AsyncWebServerRequest *request, const String &filename) {
+  if (request->hasArg("format")) {
+    return StationImporter_::formatFor(request->arg("format"));
+  }
+  return StationImporter_::formatFor(filename);
+}
+
+void postImportUploadHandler(AsyncWebServerRequest *request, String filename, size_t index, uint8_t *data, size_t len, bool final) {
+  if (index == 0) {
+    stationImporter.start(request, importFormat(request, filename));
+  }
+  stationImporter.feed(request, data, len);
+  if (final) {
+    stationImporter.finish(request);
+  }
+}
+
+void postImportBodyHandler(AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total) {
+  if (index == 0) {
+    stationImporter.start(request, importFormat(request, ""));
+  }
+  stationImporter.feed(request, data, len);
+  if (index + len >= total) {
+    stationImporter.finish(request);
+  }
+}
+
+void postImportHandler(AsyncWebServerRequest *request) {
+  if (!stationImporter.isOwner(request)) {
+    if (stationImporter.isRunning()) {
+      request->send(409, "application/json", "{\"status\":\"Import already running\"}");
+    } else {
+      request->send(200, "application/json", "{\"status\":\"No station list sent\"}");
+    }
+    return;
+  }
+  stationImporter.finish(request);
+
+  AsyncResponseStream *response = request->beginResponseStream("application/json");
+  JsonStreamWriter json(*response);
+  json.beginObject();
+  stationImporter.writeJson(json);
+  json.add("count", stationStore.count());
+  json.endObject();
+  json.flush();
+  request->send(response);
+}
+
+// ************************************************************
+// GET /api/store/import - progress of the running import, or
+// the results of the last one
+// ************************************************************
+void getImportHandler(AsyncWebServerRequest *request) {
+  AsyncResponseStream *response = request->beginResponseStream("application/json");
+  JsonStreamWriter json(*response);
+  json.beginObject();
+  stationImporter.writeJson(json);
+  json.add("count", stationStore.count());
+  json.endObject();
+  json.flush();
+  request->send(response);
+}
+
+// ************************************************************
+// Station stats, one per CSV line or JSON object
+// ************************************************************
+static void writeStationStatsCsv(AsyncResponseStream *response, const station_analytics_t &entry) {
+  response->printf("%08x,\"", (unsigned)entry.key);
+  for (const char *c = entry.name; *c; c++) {
+    if (*c == '"') {
+      response->print('"');
+    }
+    response->print(*c);
+  }
+  response->printf("\",%u,%u,%u,%u,", (unsigned)entry.total.minutes, (unsigned)entry.total.starts,
+                   (unsigned)entry.total.reconnects, (unsigned)entry.total.underruns);
+  if (entry.total.ttfaCount > 0) {
+    response->printf("%u", (unsigned)(entry.total.ttfaSumMs / entry.total.ttfaCount));
+  }
+  response->print("\n");
+}
+
+static void writeStationStatsJson(JsonStreamWriter &json, const station_analytics_t &entry) {
+  json.key("station").valuef("%08x", (unsigned)entry.key);
+  json.add("name", entry.name);
+  json.add("minutes", entry.total.minutes);
+  json.add("starts", entry.total.starts);
+  json.add("reconnects", entry.total.reconnects);
+  json.add("underruns", entry.total.underruns);
+  if (entry.total.ttfaCount > 0) {
+    json.add("ttfams", entry.total.ttfaSumMs / entry.total.ttfaCount);
+  } else {
+    json.key("ttfams").nullValue();
+  }
+}
+
+// ************************************************************
+// GET /api/stats - listening per station, most minutes first,
+// or one station with ?station= (key or name); ?format=csv for
+// a CSV download
+// ************************************************************
+void getStationStatsHandler(AsyncWebServerRequest *request) {
+  bool csv = request->arg("format") == "csv";
+  station_analytics_t *entries;
+  int count;
+  if (request->hasArg("station")) {
+    entries = (station_analytics_t *)malloc(sizeof(station_analytics_t));
+    if (!entries) {
+      request->send(503, "application/json", "{\"status\":\"Out of memory\"}");
+      return;
+    }
+    count = stationAnalytics.find(request->arg("station"), entries[0]) ? 1 : 0;
+    if (count == 0) {
+      free(entries);
+      request->send(404, "application/json", "{\"status\":\"Unknown station\"}");
+      return;
+    }
+  } else {
+    entries = (station_analytics_t *)malloc(sizeof(station_analytics_t) * ANALYTICS_MAX_STATIONS);
+    if (!entries) {
+      request->send(503, "application/json", "{\"status\":\"Out of memory\"}");
+      return;
+    }
+    count = stationAnalytics.list(entries, ANALYTICS_MAX_STATIONS);
+  }
+
+  if (csv) {
+    AsyncResponseStream *response = request->beginResponseStream("text/csv");
+    response->addHeader("Content-Disposition", "attachment; filename=\"stats.csv\"");
+    response->print("station,name,minutes,starts,reconnects,underruns,mean_ttfa_ms\n");
+    for (int i = 0; i < count; i++) {
+      writeStationStatsCsv(response, entries[i]);
+    }
+    free(entries);
+    request->send(response);
+    return;
+  }
+
+  AsyncResponseStream *response = request->beginResponseStream("application/json");
+  JsonStreamWriter json(*response);
+  json.beginObject();
+  if (request->hasArg("station")) {
+    writeStationStatsJson(json, entries[0]);
+  } else {
+    stationAnalytics.writeJson(json);
+    json.key("stations").beginArray();
+    for (int i = 0; i < count; i++) {
+      json.beginObject();
+      writeStationStatsJson(json, entries[i]);
+      json.endObject();
+    }
+    json.endArray();
+  }
+  json.endObject();
+  json.flush();
+  free(entries);
+  request->send(response);
+}
+
 // ************************************************************
 // GET /api/status - return current playback status
 // ************************************************************
 void getStatusHandler(AsyncWebServerRequest *request) {
   AsyncResponseStream *response = request->beginResponseStream("application/json");
-  DynamicJsonBuffer jsonBuffer;
-  JsonObject &root = jsonBuffer.createObject();
+  JsonStreamWriter json(*response);
+  json.beginObject();
 
-  root["playing"] = radioOutputManager.isPlaying();
-  root["volume"] = volume;
-  root["mode"] = radioOutputManager.isBluetoothMode() ? "bluetooth" : "radio";
+  json.add("playing", radioOutputManager.isPlaying());
+  json.add("volume", volume);
+  json.add("mode", radioOutputManager.isBluetoothMode() ? "bluetooth" : "radio");
 
-  root["station"] = radioOutputManager.getStationName();
-  root["url"] = radioOutputManager.getUrl();
+  json.add("station", radioOutputManager.getStationName());
+  json.add("url", radioOutputManager.getUrl());
+  json.add("urlindex", (int)radioOutputManager.getUrlIndex());
+  json.add("kbps", (unsigned)radioOutputManager.getStreamKbps());
 
-  root.printTo(*response);
+  json.endObject();
+  json.flush();
   request->send(response);
 }
 
 // ************************************************************
-// POST /api/play - play a station by index
+// POST /api/play - play a preset by index, or a directory
+// station by id
 // ************************************************************
 void postPlayHandler(AsyncWebServerRequest *request) {
   int idx = request->hasArg("index") ? request->arg("index").toInt() : -1;
 
-  if (idx >= 0 && idx < stationCount) {
+  if (request->hasArg("id")) {
+    // A directory station
+    station_t station;
+    if (stationStore.get(strtoul(request->arg("id").c_str(), nullptr, 10), station)) {
+      float gain = (volume / 100.0f) * MAX_GAIN;
+      radioOutputManager.startRadioStream(station, gain);
+      request->send(200, "application/json", "{\"status\":\"Playing\"}");
+    } else {
+      request->send(200, "application/json", "{\"status\":\"Not found\"}");
+    }
+  } else if (idx >= 0 && idx < stationCount) {
     float gain = (volume / 100.0f) * MAX_GAIN;
-    radioOutputManager.startRadioStream(stations[idx].url, stations[idx].name, gain);
+    radioOutputManager.startRadioStream(stations[idx], gain);
     request->send(200, "application/json", "{\"status\":\"Playing\"}");
   } else if (stationCount > 0) {
     // Play first station if no valid index
     float gain = (volume / 100.0f) * MAX_GAIN;
-    radioOutputManager.startRadioStream(stations[0].url, stations[0].name, gain);
+    radioOutputManager.startRadioStream(stations[0], gain);
     request->send(200, "application/json", "{\"status\":\"Playing\"}");
   } else {
     request->send(200, "application/json", "{\"status\":\"No stations\"}");
@@ -0,0 +1,24 @@
+#pragma once
+
+// ----------------------------------------------------------------------------------------------------
+// Just enough of Arduino and FreeRTOS to build Scheduler.cpp on the host. millis() is a clock the
+// test moves by hand.
+// ----------------------------------------------------------------------------------------------------
+
+#include <stdint.h>
+#include <stddef.h>
+
+extern uint32_t fakeMillis;
+inline uint32_t millis() { return fakeMillis; }
+
+typedef int portMUX_TYPE;
+#define portMUX_INITIALIZER_UNLOCKED 0
+#define portENTER_CRITICAL(mux) ((void)(mux))
+#define portEXIT_CRITICAL(mux) ((void)(mux))
+
+typedef void *TaskHandle_t;
+#define pdTRUE 1
+#define pdMS_TO_TICKS(ms) (ms)
+inline TaskHandle_t xTaskGetCurrentTaskHandle() { return (TaskHandle_t)1; }
+inline void xTaskNotifyGive(TaskHandle_t) {}
+inline uint32_t ulTaskNotifyTake(int, uint32_t) { return 0; }
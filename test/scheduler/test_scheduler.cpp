@@ -0,0 +1,211 @@
+#include <stdio.h>
+#include <string.h>
+#include "Scheduler.h"
+
+// ************************************************************
+// Host test for Scheduler_: priority order among jobs due at
+// the same time, periodic jobs staying on their grid, and
+// skipping runs a job fell behind on
+// ************************************************************
+
+uint32_t fakeMillis = 0;
+
+static int failures = 0;
+
+#define CHECK(cond)                                                   \
+  do {                                                                \
+    if (!(cond)) {                                                    \
+      printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+      failures++;                                                     \
+    }                                                                 \
+  } while (0)
+
+// Which jobs ran, in order
+static char ranOrder[16];
+static uint8_t ranCount = 0;
+static uint32_t ranAt[64];
+static uint8_t ranAtCount = 0;
+
+static void note(char c) {
+  if (ranCount < sizeof(ranOrder) - 1) {
+    ranOrder[ranCount++] = c;
+    ranOrder[ranCount] = '\0';
+  }
+}
+
+static void jobLow() { note('L'); }
+static void jobNormal() { note('N'); }
+static void jobHigh() { note('H'); }
+static void jobEarly() { note('E'); }
+static void jobTick() {
+  if (ranAtCount < sizeof(ranAt) / sizeof(ranAt[0])) {
+    ranAt[ranAtCount++] = millis();
+  }
+}
+static void jobSlow() {
+  // Takes 30ms, so anything else due runs late
+  fakeMillis += 30;
+}
+
+static void resetRuns() {
+  ranOrder[0] = '\0';
+  ranCount = 0;
+  ranAtCount = 0;
+}
+
+// ************************************************************
+// Jobs due at the same time run highest priority first; equal
+// priorities go by deadline
+// ************************************************************
+static void testPriorityOrder() {
+  fakeMillis = 1000;
+  resetRuns();
+  int8_t low = scheduler.every("low", 100, jobLow, SCHEDULER_PRIORITY_LOW);
+  int8_t normal = scheduler.every("normal", 100, jobNormal);
+  int8_t high = scheduler.every("high", 100, jobHigh, SCHEDULER_PRIORITY_HIGH);
+  int8_t early = scheduler.every("early", 100, jobEarly, SCHEDULER_PRIORITY_NORMAL, 90);
+
+  fakeMillis = 1100;
+  scheduler.runDue(millis());
+  CHECK(strcmp(ranOrder, "HENL") == 0);
+
+  // Each job runs once per runDue(), however late
+  resetRuns();
+  fakeMillis = 1205;
+  scheduler.runDue(millis());
+  CHECK(ranCount == 4);
+  CHECK(ranOrder[0] == 'H');
+  CHECK(ranOrder[3] == 'L');
+
+  scheduler.cancel(low);
+  scheduler.cancel(normal);
+  scheduler.cancel(high);
+  scheduler.cancel(early);
+}
+
+// ************************************************************
+// Late runs don't push the next deadline back
+// ************************************************************
+static void testNoDrift() {
+  fakeMillis = 5000;
+  resetRuns();
+  int8_t tick = scheduler.every("tick", 100, jobTick);
+
+  // Run each one a different amount late, up to most of a period
+  const uint32_t lateness[] = {0, 7, 40, 99, 3, 65, 12, 80};
+  uint32_t due = 5100;
+  for (uint8_t i = 0; i < 8; i++) {
+    fakeMillis = due + lateness[i];
+    uint32_t wait = scheduler.runDue(millis());
+    due += 100;
+    CHECK(wait == due - fakeMillis);
+  }
+  CHECK(ranAtCount == 8);
+  for (uint8_t i = 0; i < ranAtCount; i++) {
+    CHECK(ranAt[i] == 5100 + i * 100 + lateness[i]);
+  }
+
+  // Early calls don't run it
+  fakeMillis = due - 1;
+  scheduler.runDue(millis());
+  CHECK(ranAtCount == 8);
+
+  scheduler.cancel(tick);
+}
+
+// ************************************************************
+// A job more than a period behind skips the runs it missed and
+// comes back on its grid
+// ************************************************************
+static void testSkipsMissedRuns() {
+  fakeMillis = 10000;
+  resetRuns();
+  int8_t tick = scheduler.every("tick", 100, jobTick);
+
+  fakeMillis = 10350;
+  uint32_t wait = scheduler.runDue(millis());
+  CHECK(ranAtCount == 1);
+  CHECK(wait == 50);
+
+  fakeMillis = 10400;
+  scheduler.runDue(millis());
+  CHECK(ranAtCount == 2);
+
+  scheduler.cancel(tick);
+}
+
+// ************************************************************
+// A slow job makes the ones after it late, not off their grid
+// ************************************************************
+static void testSlowNeighbour() {
+  fakeMillis = 20000;
+  resetRuns();
+  int8_t slow = scheduler.every("slow", 100, jobSlow, SCHEDULER_PRIORITY_HIGH);
+  int8_t tick = scheduler.every("tick", 50, jobTick);
+
+  for (uint8_t i = 0; i < 10; i++) {
+    uint32_t wait = scheduler.runDue(millis());
+    fakeMillis += wait;
+  }
+  CHECK(ranAtCount >= 4);
+  for (uint8_t i = 1; i < ranAtCount; i++) {
+    // Each run belongs to its own 50ms slot
+    CHECK((ranAt[i] - 20000) / 50 > (ranAt[i - 1] - 20000) / 50);
+  }
+
+  scheduler.cancel(slow);
+  scheduler.cancel(tick);
+}
+
+// ************************************************************
+// Deadlines compare across millis() wrapping
+// ************************************************************
+static void testWrap() {
+  fakeMillis = 0xFFFFFF00UL;
+  resetRuns();
+  int8_t tick = scheduler.every("tick", 100, jobTick);
+
+  for (uint8_t i = 1; i <= 5; i++) {
+    fakeMillis = 0xFFFFFF00UL + i * 100 + 5;
+    scheduler.runDue(millis());
+  }
+  CHECK(ranAtCount == 5);
+
+  scheduler.cancel(tick);
+}
+
+// ************************************************************
+// after() runs once, cancel() stops a job before it runs
+// ************************************************************
+static void testOneShotAndCancel() {
+  fakeMillis = 30000;
+  resetRuns();
+  scheduler.after("once", 10, jobTick);
+  int8_t cancelled = scheduler.after("cancelled", 10, jobLow);
+  scheduler.cancel(cancelled);
+
+  fakeMillis = 30010;
+  scheduler.runDue(millis());
+  fakeMillis = 30500;
+  uint32_t wait = scheduler.runDue(millis());
+  CHECK(ranAtCount == 1);
+  CHECK(ranCount == 0);
+  CHECK(wait == SCHEDULER_MAX_SLEEP_MS);
+}
+
+int main() {
+  scheduler.begin();
+  testPriorityOrder();
+  testNoDrift();
+  testSkipsMissedRuns();
+  testSlowNeighbour();
+  testWrap();
+  testOneShotAndCancel();
+
+  if (failures) {
+    printf("scheduler: %d check(s) failed\n", failures);
+    return 1;
+  }
+  printf("scheduler: all checks passed\n");
+  return 0;
+}